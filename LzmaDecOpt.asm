@@ -610,7 +610,7 @@ PARAM_limit     equ REG_PARAM_1
 PARAM_bufLimit  equ REG_PARAM_2
 
 ; MY_ALIGN_64
-MY_PROC LzmaDec_DecodeReal, 3
+MY_PROC LzmaDec_DecodeReal_3, 3
 MY_PUSH_PRESERVED_REGS
 
         lea     r0, [RSP - (SIZEOF CLzmaDec_Asm_Loc)]
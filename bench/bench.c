@@ -18,15 +18,176 @@ extern size_t g_total;
 #define MB *(1 <<20)
 #define GB *(1U<<30)
 
+#ifndef MIN
+#  define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
 static U32 g_nbSeconds = 10;
+static U32 g_compareDecoders = 0;
+static U32 g_format = 0;        /* 0 : text, 1 : CSV, 2 : JSON */
+static U32 g_highMode = 0;      /* 0 : normal levels, 1 : high levels, 2 : both */
+static U32 g_threadScaling = 0; /* benchmark 1..n threads if nonzero */
+static size_t g_streamBuf = 0;  /* buffer size for the streaming benchmark, or 0 to skip it */
+
+/* Parameters from the command line, applied to each context after the compression level */
+#define MAX_PARAMS 32
+static struct {
+    FL2_cParameter param;
+    unsigned value;
+} g_params[MAX_PARAMS];
+static unsigned g_nbParams = 0;
+
+typedef struct {
+    int level;
+    unsigned high;
+    unsigned threads;
+    size_t srcSize;
+    size_t cSize;
+    double cSpeed;   /* MB/s */
+    double dSpeed;
+    double csSpeed;  /* streaming, or 0 if not measured */
+    double dsSpeed;
+} BMK_result;
 
-static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t srcSize, char* compressedBuffer, size_t maxCompressedSize,
-    char* resultBuffer)
+/* Returns the duration of one timing loop, or 0 on error */
+static U64 timeDecompression(FL2_DCtx* dctx, char* resultBuffer, size_t srcSize, const char* compressedBuffer, size_t cSize, U64* fastestD)
 {
+    U64 clockLoop = g_nbSeconds ? TIMELOOP_MICROSEC : 1;
+    U32 nbLoops = 0;
+    UTIL_time_t const clockStart = UTIL_getTime();
+    do {
+        size_t const regenSize = FL2_decompressDCtx(dctx,
+            resultBuffer, srcSize,
+            compressedBuffer, cSize);
+        if (FL2_isError(regenSize)) {
+            printf("FL2_decompressDCtx() failed on size %u : %s  \r\n",
+                (unsigned)cSize, FL2_getErrorName(regenSize));
+            return 0;
+        }
+        nbLoops++;
+    } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
+    {   U64 const loopDuration = UTIL_clockSpanMicro(clockStart);
+        if (loopDuration < *fastestD*nbLoops)
+            *fastestD = loopDuration / nbLoops;
+        return loopDuration + !loopDuration;
+    }
+}
 
-//    RDG_genBuffer(compressedBuffer, maxCompressedSize, 0.10, 0.50, 1);
+/* Compresses src through a FL2_CStream, passing at most bufSize bytes in and out per call */
+static size_t streamCompress(FL2_CStream* fcs, char* dst, size_t dstCapacity, const char* src, size_t srcSize, size_t bufSize)
+{
+    FL2_inBuffer in = { src, 0, 0 };
+    FL2_outBuffer out = { dst, 0, 0 };
+    size_t res = FL2_initCStream(fcs, 0);
+    if (FL2_isError(res))
+        return res;
+    while (in.pos < srcSize) {
+        in.size = MIN(srcSize, in.pos + bufSize);
+        out.size = MIN(dstCapacity, out.pos + bufSize);
+        res = FL2_compressStream(fcs, &out, &in);
+        if (FL2_isError(res))
+            return res;
+    }
+    do {
+        out.size = MIN(dstCapacity, out.pos + bufSize);
+        res = FL2_endStream(fcs, &out);
+        if (FL2_isError(res))
+            return res;
+    } while (res != 0 && out.pos < dstCapacity);
+    return out.pos;
+}
 
+/* Decompresses src through a FL2_DStream, passing at most bufSize bytes in and out per call */
+static size_t streamDecompress(FL2_DStream* fds, char* dst, size_t dstCapacity, const char* src, size_t srcSize, size_t bufSize)
+{
+    FL2_inBuffer in = { src, 0, 0 };
+    FL2_outBuffer out = { dst, 0, 0 };
+    size_t res = FL2_initDStream(fds);
+    if (FL2_isError(res))
+        return res;
+    do {
+        size_t const inPos = in.pos;
+        size_t const outPos = out.pos;
+        in.size = MIN(srcSize, in.pos + bufSize);
+        out.size = MIN(dstCapacity, out.pos + bufSize);
+        res = FL2_decompressStream(fds, &out, &in);
+        if (FL2_isError(res))
+            return res;
+        if (res != 0 && in.pos == inPos && out.pos == outPos && (in.pos == srcSize || out.pos == dstCapacity))
+            return (size_t)-1; /* truncated or oversized */
+    } while (res != 0);
+    return out.pos;
+}
+
+/* Times the streaming paths with g_streamBuf sized buffers and stores the speeds in result */
+static int benchStreams(FL2_CStream* fcs, FL2_DStream* fds, const char* srcBuffer, size_t srcSize, char* compressedBuffer, size_t maxCompressedSize,
+    char* resultBuffer, BMK_result* result)
+{
+    U64 const clockLoop = g_nbSeconds ? TIMELOOP_MICROSEC : 1;
+    U64 const maxTime = (g_nbSeconds * TIMELOOP_MICROSEC) + 1;
     U64 fastestC = (U64)(-1LL), fastestD = (U64)(-1LL);
+    U64 totalTime = 0;
+    size_t cSize = 0;
+
+    while (totalTime < maxTime) {
+        UTIL_time_t clockStart;
+        U32 nbLoops = 0;
+        UTIL_sleepMilli(1);
+        UTIL_waitForNextTick();
+        clockStart = UTIL_getTime();
+        do {
+            cSize = streamCompress(fcs, compressedBuffer, maxCompressedSize, srcBuffer, srcSize, g_streamBuf);
+            if (FL2_isError(cSize)) {
+                printf("FL2_compressStream() error : %s  \r\n", FL2_getErrorName(cSize));
+                return 1;
+            }
+            nbLoops++;
+        } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
+        {   U64 const loopDuration = UTIL_clockSpanMicro(clockStart);
+            if (loopDuration < fastestC*nbLoops)
+                fastestC = loopDuration / nbLoops;
+            totalTime += loopDuration;
+        }
+    }
+    totalTime = 0;
+    while (totalTime < maxTime) {
+        UTIL_time_t clockStart;
+        U32 nbLoops = 0;
+        memset(resultBuffer, 0xD6, srcSize);
+        UTIL_sleepMilli(1);
+        UTIL_waitForNextTick();
+        clockStart = UTIL_getTime();
+        do {
+            size_t const dSize = streamDecompress(fds, resultBuffer, srcSize, compressedBuffer, cSize, g_streamBuf);
+            if (FL2_isError(dSize) || dSize != srcSize) {
+                printf("FL2_decompressStream() error on cSize %u : %s  \r\n", (unsigned)cSize,
+                    FL2_isError(dSize) ? FL2_getErrorName(dSize) : "wrong size");
+                return 1;
+            }
+            nbLoops++;
+        } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
+        {   U64 const loopDuration = UTIL_clockSpanMicro(clockStart);
+            if (loopDuration < fastestD*nbLoops)
+                fastestD = loopDuration / nbLoops;
+            totalTime += loopDuration;
+        }
+        if (memcmp(resultBuffer, srcBuffer, srcSize) != 0) {
+            printf("Stream corruption on dSize %u cSize %u\r\n", (unsigned)srcSize, (unsigned)cSize);
+            return 1;
+        }
+    }
+    result->csSpeed = (double)srcSize / (fastestC + !fastestC);
+    result->dsSpeed = (double)srcSize / (fastestD + !fastestD);
+    return 0;
+}
+
+static int benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t srcSize, char* compressedBuffer, size_t maxCompressedSize,
+    char* resultBuffer, BMK_result* result)
+{
+
+//    RDG_genBuffer(compressedBuffer, maxCompressedSize, 0.10, 0.50, 1);
+
+    U64 fastestC = (U64)(-1LL), fastestD = (U64)(-1LL), fastestDC = (U64)(-1LL);
     UTIL_time_t coolTime;
     U64 const maxTime = (g_nbSeconds * TIMELOOP_MICROSEC) + 1;
     U64 totalCTime = 0, totalDTime = 0;
@@ -36,15 +197,18 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
     U32 markNb = 0;
 
     coolTime = UTIL_getTime();
-    printf( "\r%79s\r", "");
+    if (g_format == 0)
+        printf( "\r%79s\r", "");
     size_t cSize = 0;
     while (!cCompleted || !dCompleted) {
 
         /* overheat protection */
         if (UTIL_clockSpanMicro(coolTime) > ACTIVEPERIOD_MICROSEC) {
-            printf( "\rcooling down ...    \r");
+            if (g_format == 0)
+                printf( "\rcooling down ...    \r");
             UTIL_sleep(COOLPERIOD_SEC);
-            printf("\r                    \r");
+            if (g_format == 0)
+                printf("\r                    \r");
             coolTime = UTIL_getTime();
         }
 
@@ -63,7 +227,7 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
                 cSize = FL2_compressCCtx(fcs, compressedBuffer, maxCompressedSize, srcBuffer, srcSize, 0);
                 if (FL2_isError(cSize)) {
                     printf("FL2_compressCCtx() error : %s  \r\n", FL2_getErrorName(cSize));
-                    return;
+                    return 1;
                 }
                 nbLoops++;
             } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
@@ -86,44 +250,91 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
         UTIL_waitForNextTick();
 
         if (!dCompleted) {
-            U64 clockLoop = g_nbSeconds ? TIMELOOP_MICROSEC : 1;
-            U32 nbLoops = 0;
-            UTIL_time_t const clockStart = UTIL_getTime();
-            do {
-                size_t const regenSize = FL2_decompressDCtx(dctx,
-                    resultBuffer, srcSize,
-                    compressedBuffer, cSize);
-                if (FL2_isError(regenSize)) {
-                    printf("FL2_decompressDCtx() failed on size %u : %s  \r\n",
-                        (unsigned)cSize, FL2_getErrorName(regenSize));
-                    return;
-                }
-                nbLoops++;
-            } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
-        {   U64 const loopDuration = UTIL_clockSpanMicro(clockStart);
-            if (loopDuration < fastestD*nbLoops)
-                fastestD = loopDuration / nbLoops;
+            U64 loopDuration = timeDecompression(dctx, resultBuffer, srcSize, compressedBuffer, cSize, &fastestD);
+            if (loopDuration == 0)
+                return 1;
             totalDTime += loopDuration;
             dCompleted = (totalDTime >= maxTime);
-        }
             if (memcmp(resultBuffer, srcBuffer, srcSize) != 0)
                 printf("Corruption on dSize %u cSize %u\r\n", (unsigned)srcSize, (unsigned)cSize);
+            if (g_compareDecoders) {
+                /* same data through the C decode loop */
+                FL2_setDecoderAsm(0);
+                memset(resultBuffer, 0xD6, srcSize);
+                loopDuration = timeDecompression(dctx, resultBuffer, srcSize, compressedBuffer, cSize, &fastestDC);
+                FL2_setDecoderAsm(1);
+                if (loopDuration == 0)
+                    return 1;
+                if (memcmp(resultBuffer, srcBuffer, srcSize) != 0)
+                    printf("Corruption in C decoder on dSize %u cSize %u\r\n", (unsigned)srcSize, (unsigned)cSize);
+            }
         }
 
 #endif
+        if (g_format != 0)
+            continue;
         double ratio = (double)srcSize / (double)cSize;
         markNb = (markNb + 1) % NB_MARKS;
         {   int const ratioAccuracy = (ratio < 10.) ? 3 : 2;
         double const compressionSpeed = (double)srcSize / fastestC;
         int const cSpeedAccuracy = 2;// (compressionSpeed < 10.) ? 2 : 1;
         double const decompressionSpeed = (double)srcSize / fastestD;
-        printf("%2s-%-17.17s :%10u ->%10u (%5.*f),%6.*f MB/s ,%6.1f MB/s\r",
-            marks[markNb], "", (U32)srcSize, (U32)cSize,
-            ratioAccuracy, ratio,
-            cSpeedAccuracy, compressionSpeed,
-            decompressionSpeed);
+        if (g_compareDecoders)
+            printf("%2s-%-17.17s :%10u ->%10u (%5.*f),%6.*f MB/s ,%6.1f MB/s asm ,%6.1f MB/s C\r",
+                marks[markNb], "", (U32)srcSize, (U32)cSize,
+                ratioAccuracy, ratio,
+                cSpeedAccuracy, compressionSpeed,
+                decompressionSpeed, (double)srcSize / fastestDC);
+        else
+            printf("%2s-%-17.17s :%10u ->%10u (%5.*f),%6.*f MB/s ,%6.1f MB/s\r",
+                marks[markNb], "", (U32)srcSize, (U32)cSize,
+                ratioAccuracy, ratio,
+                cSpeedAccuracy, compressionSpeed,
+                decompressionSpeed);
         }
     }
+    result->srcSize = srcSize;
+    result->cSize = cSize;
+    result->cSpeed = (double)srcSize / fastestC;
+    result->dSpeed = (double)srcSize / fastestD;
+    return 0;
+}
+
+/* Writes one result. Speedup and efficiency are relative to the first thread count benchmarked. */
+static void printResult(const char* name, const BMK_result* result, const BMK_result* base, int first)
+{
+    double const speedup = result->cSpeed / base->cSpeed;
+    double const efficiency = speedup * base->threads / result->threads;
+    double const dSpeedup = result->dSpeed / base->dSpeed;
+    double const ratio = (double)result->srcSize / (double)result->cSize;
+
+    if (g_format == 1) {
+        if (first)
+            printf("name,level,high,threads,srcSize,cSize,ratio,cSpeed,dSpeed,csSpeed,dsSpeed,speedup,efficiency,dSpeedup\n");
+        printf("%s,%d,%u,%u,%u,%u,%.4f,%.2f,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f\n",
+            name, result->level, result->high, result->threads, (U32)result->srcSize, (U32)result->cSize, ratio,
+            result->cSpeed, result->dSpeed, result->csSpeed, result->dsSpeed, speedup, efficiency, dSpeedup);
+    }
+    else if (g_format == 2) {
+        printf("%s\n  { \"name\": \"%s\", \"version\": \"%s\", \"level\": %d, \"high\": %u, \"threads\": %u, "
+            "\"srcSize\": %u, \"cSize\": %u, \"ratio\": %.4f, \"cSpeed\": %.2f, \"dSpeed\": %.2f, "
+            "\"csSpeed\": %.2f, \"dsSpeed\": %.2f, \"speedup\": %.3f, \"efficiency\": %.3f, \"dSpeedup\": %.3f }",
+            first ? "[" : ",", name, FL2_versionString(), result->level, result->high, result->threads,
+            (U32)result->srcSize, (U32)result->cSize, ratio, result->cSpeed, result->dSpeed,
+            result->csSpeed, result->dsSpeed, speedup, efficiency, dSpeedup);
+    }
+    else {
+        printf("\r%79s\r", "");
+        printf("%2d%s T%-3u:%10u ->%10u (%5.3f),%6.2f MB/s ,%6.1f MB/s",
+            result->level, result->high ? "x" : " ", result->threads, (U32)result->srcSize, (U32)result->cSize,
+            ratio, result->cSpeed, result->dSpeed);
+        if (result->csSpeed > 0)
+            printf(" | stream%6.2f MB/s ,%6.1f MB/s", result->csSpeed, result->dsSpeed);
+        if (g_threadScaling)
+            printf(" | x%5.2f, %3.0f%%", speedup, efficiency * 100.);
+        printf("\r\n");
+    }
+    fflush(stdout);
 }
 
 #define kHash3Bits 14
@@ -144,16 +355,31 @@ int hash_test(void)
     return 1;
 }
 
-static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
+static unsigned g_level = 0;     /* 0 : library default */
+static unsigned g_threads = 1;
+static size_t g_genSize = 0;     /* generated corpus size, or 0 to read a file */
+static int g_tune = 0;           /* find the parameter sets on the speed/ratio front instead of benchmarking */
+static unsigned g_tuneTarget = 0;/* MB/s for which to select a tuned set, or 0 */
+
+static void addParam(FL2_cParameter param, unsigned value)
 {
-    for (int i = 2; i < argc; ++i) {
-        if (argv[i][0] == '-' && argv[i][1] >= '0' && argv[i][1] <= '9')
-            FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, atoi(argv[i] + 1));
+    if (g_nbParams < MAX_PARAMS) {
+        g_params[g_nbParams].param = param;
+        g_params[g_nbParams].value = value;
+        ++g_nbParams;
     }
+}
+
+static int parse_params(int argc, char** argv)
+{
     int end_level = 0;
-    for (int i = 2; i < argc; ++i) {
+    for (int i = 1; i < argc; ++i) {
         if (argv[i][0] != '-')
             continue;
+        if (argv[i][1] >= '0' && argv[i][1] <= '9') {
+            g_level = atoi(argv[i] + 1);
+            continue;
+        }
         char param[4];
         int j = 1;
         for (; j < 4 && argv[i][j] && (argv[i][j] < '0' || argv[i][j] > '9'); ++j) {
@@ -164,62 +390,200 @@ static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
         if (strcmp(param, "t") == 0) {
             g_nbSeconds = value;
         }
+        else if (strcmp(param, "T") == 0) {
+            g_threads = value;
+        }
+        else if (strcmp(param, "S") == 0) {
+            /* thread scaling from 1 to value */
+            g_threadScaling = value;
+        }
+        else if (strcmp(param, "sb") == 0) {
+            /* streaming buffer size in kB */
+            g_streamBuf = (size_t)value KB;
+        }
+        else if (strcmp(param, "g") == 0) {
+            /* generated corpus size in MB */
+            g_genSize = (size_t)value MB;
+        }
+        else if (strcmp(param, "tu") == 0) {
+            g_tune = 1;
+            g_tuneTarget = value;
+        }
+        else if (strcmp(param, "fm") == 0) {
+            /* 0: text, 1: CSV, 2: JSON */
+            g_format = MIN(value, 2);
+        }
         else if(strcmp(param, "d") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_dictionaryLog, value);
+            addParam(FL2_p_dictionaryLog, value);
         }
         else if (strcmp(param, "o") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_overlapFraction, value);
+            addParam(FL2_p_overlapFraction, value);
         }
         else if (strcmp(param, "ds") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_chainLog, value);
+            addParam(FL2_p_chainLog, value);
         }
         else if (strcmp(param, "mc") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_searchLog, value);
+            addParam(FL2_p_searchLog, value);
         }
         else if (strcmp(param, "sd") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_searchDepth, value);
+            addParam(FL2_p_searchDepth, value);
         }
         else if (strcmp(param, "fb") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_fastLength, value);
+            addParam(FL2_p_fastLength, value);
         }
         else if (strcmp(param, "q") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_divideAndConquer, value);
+            addParam(FL2_p_divideAndConquer, value);
         }
         else if (strcmp(param, "b") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_bufferLog, value);
+            addParam(FL2_p_bufferLog, value);
         }
         else if (strcmp(param, "a") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_strategy, value);
+            addParam(FL2_p_strategy, value);
         }
         else if (strcmp(param, "h") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_doXXHash, value);
+            addParam(FL2_p_doXXHash, value);
         }
         else if (strcmp(param, "x") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_highCompression, value);
+            /* 0: normal levels, 1: high levels, 2: both */
+            g_highMode = MIN(value, 2);
         }
         else if (strcmp(param, "s") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_blockSizeLog, value);
+            addParam(FL2_p_blockSizeLog, value);
+        }
+        else if (strcmp(param, "ip") == 0) {
+            addParam(FL2_p_incrementalPrices, value);
+        }
+        else if (strcmp(param, "at") == 0) {
+            addParam(FL2_p_adaptiveThroughput, value);
+        }
+        else if (strcmp(param, "rf") == 0) {
+            addParam(FL2_p_randomFilter, value);
+        }
+        else if (strcmp(param, "da") == 0) {
+            /* 0: C decode loop, 1: asm decode loop, 2: compare both */
+            g_compareDecoders = (value == 2 && FL2_setDecoderAsm(1));
+            if (value < 2 && FL2_setDecoderAsm(value) != (int)value)
+                printf("Asm decode loop not available\r\n");
         }
         else if (strcmp(param, "e") == 0) {
             end_level = value;
         }
 #ifdef RMF_REFERENCE
         else if (strcmp(param, "r") == 0) {
-            FL2_CCtx_setParameter(fcs, FL2_p_useReferenceMF, value);
+            addParam(FL2_p_useReferenceMF, value);
         }
 #endif
     }
     return end_level;
 }
 
+/* Fills buffer with segments of differing compressibility, like a mixed corpus such as Silesia */
+static void genCorpus(char* buffer, size_t size)
+{
+    static const double probas[][2] = {
+        { 0.70, 0.20 },  /* source code */
+        { 0.50, 0.02 },  /* text */
+        { 0.90, 0.50 },  /* structured records */
+        { 0.30, 0.70 },  /* binary */
+        { 0.05, 0.00 },  /* poorly compressible */
+    };
+    size_t const nbSegments = sizeof(probas) / sizeof(probas[0]);
+    size_t const segSize = size / nbSegments + 1;
+    for (size_t u = 0, pos = 0; pos < size; ++u, pos += segSize) {
+        size_t const s = u % nbSegments;
+        RDG_genBuffer(buffer + pos, MIN(segSize, size - pos), probas[s][0], probas[s][1], (unsigned)u + 1);
+    }
+}
+
+/* Sets the level and mode, then the parameters from the command line, which override the level */
+static int setCCtxParams(FL2_CCtx* cctx, FL2_CStream* fcs, int level, unsigned high)
+{
+    if (cctx != NULL) {
+        FL2_CCtx_setParameter(cctx, FL2_p_highCompression, high);
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    }
+    if (fcs != NULL) {
+        FL2_CStream_setParameter(fcs, FL2_p_highCompression, high);
+        FL2_CStream_setParameter(fcs, FL2_p_compressionLevel, level);
+    }
+    for (unsigned u = 0; u < g_nbParams; ++u) {
+        if (cctx != NULL && FL2_isError(FL2_CCtx_setParameter(cctx, g_params[u].param, g_params[u].value)))
+            return 1;
+        if (fcs != NULL && FL2_isError(FL2_CStream_setParameter(fcs, g_params[u].param, g_params[u].value)))
+            return 1;
+    }
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    printf("usage : %s [file] [-#] [args]\r\n", name);
+    printf(" -#    : compression level (default: library default)\r\n");
+    printf(" -e#   : benchmark levels up to #, from 1 if no level is given\r\n");
+    printf(" -x#   : 0: normal levels, 1: high levels, 2: both\r\n");
+    printf(" -T#   : threads (default: 1)\r\n");
+    printf(" -S#   : thread scaling, benchmark 1..# threads\r\n");
+    printf(" -sb#  : also benchmark FL2_CStream / FL2_DStream with # kB buffers\r\n");
+    printf(" -g#   : benchmark a generated # MB mixed corpus instead of a file\r\n");
+    printf(" -fm#  : output format, 0: text, 1: CSV, 2: JSON\r\n");
+    printf(" -t#   : seconds per test (default: 10)\r\n");
+    printf(" -da#  : 0: C decode loop, 1: asm decode loop, 2: compare both\r\n");
+    printf(" -tu#  : tune parameters on the input, and select a set for # MB/s if nonzero\r\n");
+}
+
+/* Prints the parameter sets on the front, and the best compressing one at least g_tuneTarget MB/s.
+ * The dictionary size and other parameters are taken from the level and command line. */
+static int tune(const char* name, const char* src, size_t size)
+{
+    FL2_CCtx* const cctx = FL2_createCCtxMt(g_threads);
+    FL2_tuneResult* const results = malloc(256 * sizeof(FL2_tuneResult));
+    size_t selected = (size_t)-1;
+    size_t count;
+    int ret = (cctx == NULL || results == NULL || setCCtxParams(cctx, NULL, g_level ? (int)g_level : 0, g_highMode == 1));
+    if (!ret) {
+        count = FL2_CCtx_tune(cctx, src, size, results, 256);
+        ret = FL2_isError(count);
+        if (ret)
+            printf("Error: %s\r\n", FL2_getErrorName(count));
+    }
+    if (!ret) {
+        count = MIN(count, 256);
+        printf("%s : %u bytes, %u threads, %u sets\r\n", name, (unsigned)size, g_threads, (unsigned)count);
+        for (size_t u = 0; u < count; ++u)
+            if (g_tuneTarget && (double)results[u].srcSize / results[u].time >= g_tuneTarget)
+                selected = u;
+        for (size_t u = 0; u < count; ++u) {
+            char text[FL2_PARAMETERS_STRING_MAX];
+            FL2_parametersToString(text, sizeof(text), &results[u].params);
+            printf("%c %8.2f MB/s  %6.3f  %s\r\n", (u == selected) ? '*' : ' ',
+                (double)results[u].srcSize / results[u].time,
+                (double)results[u].srcSize / results[u].cSize, text);
+        }
+        if (g_tuneTarget && selected == (size_t)-1)
+            printf("No set reaches %u MB/s\r\n", g_tuneTarget);
+    }
+    free(results);
+    FL2_freeCCtx(cctx);
+    return ret;
+}
+
 int FL2LIB_CALL main(int argc, char** argv)
 {
-    if (argc < 2)
+    const char* fileName = NULL;
+    for (int i = 1; i < argc && fileName == NULL; ++i) {
+        if (argv[i][0] != '-')
+            fileName = argv[i];
+    }
+    int end_level = parse_params(argc, argv);
+    if (fileName == NULL && g_genSize == 0) {
+        usage(argv[0]);
         return 1;
+    }
     size_t size;
     char* src;
-    if (1) {
-        FILE* f = fopen(argv[1], "rb");
+    char name[64];
+    if (fileName != NULL) {
+        FILE* f = fopen(fileName, "rb");
         if (f == NULL)
             return 1;
         fseek(f, 0, 2);
@@ -227,40 +591,94 @@ int FL2LIB_CALL main(int argc, char** argv)
         if (size > 3UL << 29) size = 3UL << 29;
         fseek(f, 0, 0);
         src = malloc(size);
+        if (src == NULL)
+            return 1;
         size = fread(src, 1, size, f);
         fclose(f);
+        {   const char* base = fileName;
+            for (const char* c = fileName; *c; ++c)
+                if (*c == '/' || *c == '\\')
+                    base = c + 1;
+            snprintf(name, sizeof(name), "%s", base);
+        }
     }
     else {
-        size = 1UL << 30;
+        size = g_genSize;
         src = malloc(size);
-        RDG_genBuffer(src, size, 0.6, 0.02, 1);
+        if (src == NULL)
+            return 1;
+        genCorpus(src, size);
+        snprintf(name, sizeof(name), "gen%uMB", (unsigned)(size >> 20));
     }
-    unsigned threads = 1;
-    for (int i = 2; i < argc; ++i) {
-        if (argv[i][0] == '-' && argv[i][1] == 'T')
-        threads = atoi(argv[i] + 2);
+    if (g_tune) {
+        int const ret = tune(name, src, size);
+        free(src);
+        return ret;
     }
-    FL2_CCtx* fcs = FL2_createCCtxMt(threads);
-    FL2_DCtx* dctx = FL2_createDCtx();
-    if (fcs == NULL || dctx == NULL)
-        return 1;
-    int end_level = parse_params(fcs, argc, argv);
-    int level = (int)FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, 0);
     size_t maxCompressedSize = FL2_compressBound(size);
     char* compressedBuffer = malloc(maxCompressedSize);
     char* resultBuffer = malloc(size);
-    if (!end_level)
-        end_level = level;
-    else if (end_level > FL2_maxCLevel())
-        end_level = FL2_maxCLevel();
-    for (; level <= end_level; ++level) {
-        benchmark(fcs, dctx, src, size, compressedBuffer, maxCompressedSize, resultBuffer);
-        FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, level + 1);
-        printf("%u\r\n", level);
-        g_nbSeconds += 5;
+    if (compressedBuffer == NULL || resultBuffer == NULL)
+        return 1;
+
+    unsigned const firstThreads = g_threadScaling ? 1 : g_threads;
+    unsigned const lastThreads = g_threadScaling ? g_threadScaling : g_threads;
+    unsigned const firstHigh = (g_highMode == 1);
+    unsigned const lastHigh = (g_highMode != 0);
+    int first = 1;
+    int ret = 0;
+    for (unsigned high = firstHigh; high <= lastHigh && !ret; ++high) {
+        int const maxLevel = high ? FL2_maxHighCLevel() : FL2_maxCLevel();
+        int level = g_level ? (int)g_level : (end_level ? 1 : 0);
+        int last;
+        if (level == 0) {
+            /* library default */
+            FL2_CCtx* const cctx = FL2_createCCtx();
+            if (cctx == NULL)
+                return 1;
+            level = (int)FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 0);
+            FL2_freeCCtx(cctx);
+        }
+        level = MIN(level, maxLevel);
+        last = end_level ? MIN(end_level, maxLevel) : level;
+        for (; level <= last && !ret; ++level) {
+            BMK_result base;
+            memset(&base, 0, sizeof(base));
+            for (unsigned threads = firstThreads; threads <= lastThreads && !ret; ++threads) {
+                BMK_result result;
+                FL2_CCtx* const fcs = FL2_createCCtxMt(threads);
+                FL2_DCtx* const dctx = FL2_createDCtxMt(threads);
+                memset(&result, 0, sizeof(result));
+                result.level = level;
+                result.high = high;
+                result.threads = threads;
+                ret = (fcs == NULL || dctx == NULL || setCCtxParams(fcs, NULL, level, high));
+                if (!ret)
+                    ret = benchmark(fcs, dctx, src, size, compressedBuffer, maxCompressedSize, resultBuffer, &result);
+                FL2_freeCCtx(fcs);
+                FL2_freeDCtx(dctx);
+                if (!ret && g_streamBuf) {
+                    FL2_CStream* const cstream = FL2_createCStreamMt(threads);
+                    FL2_DStream* const dstream = FL2_createDStreamMt(threads);
+                    ret = (cstream == NULL || dstream == NULL || setCCtxParams(NULL, cstream, level, high));
+                    if (!ret)
+                        ret = benchStreams(cstream, dstream, src, size, compressedBuffer, maxCompressedSize, resultBuffer, &result);
+                    FL2_freeCStream(cstream);
+                    FL2_freeDStream(dstream);
+                }
+                if (ret)
+                    break;
+                if (threads == firstThreads)
+                    base = result;
+                printResult(name, &result, &base, first);
+                first = 0;
+            }
+        }
     }
+    if (g_format == 2 && !first)
+        printf("\n]\n");
+    free(resultBuffer);
     free(compressedBuffer);
     free(src);
-    return 0;
+    return ret;
 }
-
@@ -0,0 +1,347 @@
+// micro.c : times the matchfinder, encoder and decoder kernels in isolation.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../fast-lzma2.h"
+#include "../fl2_compress_internal.h"
+#include "../radix_mf.h"
+#include "../lzma2_enc.h"
+#include "../lzma2_dec.h"
+#include "../tests/datagen.h"
+#include "../mem.h"
+#include "../util.h"
+
+#if defined(__linux__)
+#  include <unistd.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <linux/perf_event.h>
+#  define MB_PERF_EVENTS
+#endif
+
+#define TIMELOOP_MICROSEC 1*1000000ULL /* 1 second */
+
+#define KB *(1 <<10)
+#define MB *(1 <<20)
+
+#ifndef MIN
+#  define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#  define MAX(a,b) ((a) > (b) ? (a) : (b))
+#endif
+
+static U32 g_nbSeconds = 3;
+
+/*-*************************************
+*  Hardware counters
+***************************************/
+
+#define MB_NB_COUNTERS 3
+
+static const char* const g_counterNames[MB_NB_COUNTERS] = { "cycles/B", "instr/B", "misses/kB" };
+
+typedef struct {
+    int fd[MB_NB_COUNTERS];  /* -1 if not available */
+    U64 total[MB_NB_COUNTERS];
+    U64 bytes;               /* bytes processed while the counters ran */
+    U64 fastest;             /* microseconds */
+    U64 fastestBytes;
+} MB_kernel;
+
+static void MB_openCounters(MB_kernel* const kernel)
+{
+#ifdef MB_PERF_EVENTS
+    static const U64 configs[MB_NB_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[u];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        kernel->fd[u] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u)
+        kernel->fd[u] = -1;
+#endif
+}
+
+static void MB_closeCounters(MB_kernel* const kernel)
+{
+#ifdef MB_PERF_EVENTS
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u)
+        if (kernel->fd[u] >= 0)
+            close(kernel->fd[u]);
+#else
+    (void)kernel;
+#endif
+}
+
+static void MB_initKernel(MB_kernel* const kernel)
+{
+    memset(kernel, 0, sizeof(*kernel));
+    kernel->fastest = (U64)-1;
+    MB_openCounters(kernel);
+}
+
+static UTIL_time_t MB_start(MB_kernel* const kernel)
+{
+#ifdef MB_PERF_EVENTS
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u) {
+        if (kernel->fd[u] >= 0) {
+            ioctl(kernel->fd[u], PERF_EVENT_IOC_RESET, 0);
+            ioctl(kernel->fd[u], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    (void)kernel;
+#endif
+    return UTIL_getTime();
+}
+
+static void MB_stop(MB_kernel* const kernel, UTIL_time_t const start, size_t const bytes)
+{
+    U64 const span = UTIL_clockSpanMicro(start);
+#ifdef MB_PERF_EVENTS
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u) {
+        U64 count;
+        if (kernel->fd[u] < 0)
+            continue;
+        ioctl(kernel->fd[u], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(kernel->fd[u], &count, sizeof(count)) == sizeof(count))
+            kernel->total[u] += count;
+    }
+#endif
+    kernel->bytes += bytes;
+    /* compare time per byte, since the kernels may process different amounts */
+    if (span * kernel->fastestBytes < kernel->fastest * bytes || kernel->fastest == (U64)-1) {
+        kernel->fastest = span;
+        kernel->fastestBytes = bytes;
+    }
+}
+
+static void MB_print(const char* const name, const MB_kernel* const kernel)
+{
+    double const bytes = (double)(kernel->bytes + !kernel->bytes);
+    printf("%-8s: %7.3f ns/B", name, kernel->fastestBytes ? (double)kernel->fastest * 1000. / kernel->fastestBytes : 0.);
+    for (unsigned u = 0; u < MB_NB_COUNTERS; ++u) {
+        double const scale = (u == 2) ? 1024. : 1.;
+        if (kernel->fd[u] >= 0)
+            printf(", %8.3f %s", (double)kernel->total[u] * scale / bytes, g_counterNames[u]);
+        else
+            printf(", %8s %s", "n/a", g_counterNames[u]);
+    }
+    printf("\r\n");
+}
+
+/*-*************************************
+*  Kernels
+***************************************/
+
+/* Runs RMF_initTable + RMF_buildTable and FL2_lzma2Encode on the block until the time is up,
+ * then FLzma2Dec_DecodeToDic on the result */
+static int benchKernels(const FL2_CCtx_params* const params, const BYTE* const src, size_t const srcSize)
+{
+    FL2_customMem const mem = { NULL, NULL, NULL };
+    FL2_dataBlock const block = { src, 0, srcSize };
+    size_t const dstCapacity = FL2_compressBound(srcSize);
+    BYTE* const dst = malloc(dstCapacity);
+    BYTE* const decoded = malloc(srcSize);
+    FL2_matchTable* const tbl = RMF_createMatchTable(&params->rParams, srcSize, 1, mem);
+    FL2_lzmaEncoderCtx* const enc = FL2_lzma2Create();
+    CLzma2Dec dec;
+    MB_kernel init, build, encode, decode;
+    U64 totalTime = 0;
+    size_t cSize = 0;
+    int ret = 1;
+
+    LzmaDec_Construct(&dec);
+    MB_initKernel(&init);
+    MB_initKernel(&build);
+    MB_initKernel(&encode);
+    MB_initKernel(&decode);
+    if (dst == NULL || decoded == NULL || tbl == NULL || enc == NULL
+        || FL2_lzma2HashAlloc(enc, &params->cParams) != 0) {
+        printf("Allocation error\r\n");
+        goto _cleanup;
+    }
+
+    printf("%u bytes, %s table, dict log %u, depth %u, strategy %u\r\n", (U32)srcSize,
+        tbl->isStruct ? "structured" : tbl->isCompact ? "compact" : "bitpack",
+        params->rParams.dictionary_log, params->rParams.depth, (U32)params->cParams.strategy);
+
+    while (totalTime < g_nbSeconds * TIMELOOP_MICROSEC + 1) {
+        UTIL_time_t const loopStart = UTIL_getTime();
+        UTIL_time_t start;
+        size_t init_done;
+
+        RMF_filterRandom(tbl, src, 0, srcSize, 0);
+        start = MB_start(&init);
+        init_done = RMF_initTable(tbl, src, 0, srcSize);
+        MB_stop(&init, start, srcSize);
+
+        start = MB_start(&build);
+        RMF_buildTable(tbl, 0, 0, block, NULL, NULL, 0, init_done);
+        MB_stop(&build, start, srcSize);
+
+        start = MB_start(&encode);
+        cSize = FL2_lzma2Encode(enc, tbl, block, &params->cParams, dst, dstCapacity - 1, NULL, NULL, 0, 0);
+        MB_stop(&encode, start, srcSize);
+        if (FL2_isError(cSize)) {
+            printf("FL2_lzma2Encode() error : %s\r\n", FL2_getErrorName(cSize));
+            goto _cleanup;
+        }
+        totalTime += UTIL_clockSpanMicro(loopStart);
+    }
+    dst[cSize++] = LZMA2_END_MARKER;
+
+    for (totalTime = 0; totalTime < g_nbSeconds * TIMELOOP_MICROSEC + 1; ) {
+        UTIL_time_t start;
+        size_t srcLen = cSize;
+        size_t res;
+
+        res = FLzma2Dec_Init(&dec, FL2_getDictSizeProp(srcSize), decoded, srcSize);
+        if (FL2_isError(res))
+            goto _cleanup;
+        start = MB_start(&decode);
+        res = FLzma2Dec_DecodeToDic(&dec, srcSize, dst, &srcLen, LZMA_FINISH_END);
+        MB_stop(&decode, start, srcSize);
+        totalTime += UTIL_clockSpanMicro(start);
+        if (FL2_isError(res) || res != LZMA_STATUS_FINISHED_WITH_MARK || memcmp(decoded, src, srcSize) != 0) {
+            printf("Decoding error\r\n");
+            goto _cleanup;
+        }
+    }
+
+    printf("%u -> %u bytes\r\n", (U32)srcSize, (U32)cSize);
+    MB_print("init", &init);
+    MB_print("build", &build);
+    MB_print("encode", &encode);
+    MB_print("decode", &decode);
+    ret = 0;
+
+_cleanup:
+    MB_closeCounters(&init);
+    MB_closeCounters(&build);
+    MB_closeCounters(&encode);
+    MB_closeCounters(&decode);
+    FLzmaDec_Free(&dec);
+    FL2_lzma2Free(enc);
+    RMF_freeMatchTable(tbl);
+    free(decoded);
+    free(dst);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    printf("usage : %s [file] [-#] [args]\r\n", name);
+    printf(" -#    : compression level (default: library default)\r\n");
+    printf(" -x    : high compression levels\r\n");
+    printf(" -m#   : match table 0: level default, 1: bitpack, 2: compact, 3: structured\r\n");
+    printf(" -s#   : ultra secondary matcher 0: hash chain, 1: hash rows\r\n");
+    printf(" -g#   : use a generated # MB buffer instead of a file\r\n");
+    printf(" -t#   : seconds per kernel (default: 3)\r\n");
+    printf(" -da#  : 0: C decode loop, 1: asm decode loop\r\n");
+}
+
+int FL2LIB_CALL main(int argc, char** argv)
+{
+    const char* fileName = NULL;
+    unsigned level = 0;
+    unsigned high = 0;
+    unsigned tableMode = 0;
+    unsigned secondMatcher = 0;
+    size_t genSize = 0;
+    size_t size;
+    BYTE* src;
+    FL2_CCtx* cctx;
+    int ret;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* const arg = argv[i];
+        if (arg[0] != '-')
+            fileName = arg;
+        else if (arg[1] >= '0' && arg[1] <= '9')
+            level = atoi(arg + 1);
+        else if (arg[1] == 'x')
+            high = 1;
+        else if (arg[1] == 'm')
+            tableMode = atoi(arg + 2);
+        else if (arg[1] == 's')
+            secondMatcher = atoi(arg + 2);
+        else if (arg[1] == 'g')
+            genSize = (size_t)atoi(arg + 2) MB;
+        else if (arg[1] == 't')
+            g_nbSeconds = atoi(arg + 2);
+        else if (arg[1] == 'd' && arg[2] == 'a') {
+            if (FL2_setDecoderAsm(atoi(arg + 3)) != atoi(arg + 3))
+                printf("Asm decode loop not available\r\n");
+        }
+    }
+    if (fileName == NULL && genSize == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* parameters of the level, read from a context */
+    cctx = FL2_createCCtx();
+    if (cctx == NULL)
+        return 1;
+    FL2_CCtx_setParameter(cctx, FL2_p_highCompression, high);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    FL2_CCtx_setParameter(cctx, FL2_p_secondMatcher, secondMatcher);
+    if (tableMode == 1) {
+        cctx->params.rParams.depth = MIN(cctx->params.rParams.depth, BITPACK_MAX_LENGTH);
+        cctx->params.rParams.dictionary_log = MIN(cctx->params.rParams.dictionary_log, RADIX_LINK_BITS);
+    }
+    else if (tableMode == 2) {
+        cctx->params.rParams.depth = MAX(cctx->params.rParams.depth, BITPACK_MAX_LENGTH + 1);
+        cctx->params.rParams.dictionary_log = MIN(cctx->params.rParams.dictionary_log, COMPACT_LINK_BITS);
+    }
+    else if (tableMode == 3) {
+        cctx->params.rParams.depth = MAX(cctx->params.rParams.depth, BITPACK_MAX_LENGTH + 1);
+        cctx->params.rParams.dictionary_log = MAX(cctx->params.rParams.dictionary_log, COMPACT_LINK_BITS + 1);
+    }
+
+    if (fileName != NULL) {
+        FILE* const f = fopen(fileName, "rb");
+        if (f == NULL)
+            return 1;
+        fseek(f, 0, 2);
+        size = ftell(f);
+        fclose(f);
+    }
+    else {
+        size = genSize;
+    }
+    /* one block, since the kernels run on one dictionary */
+    size = MIN(size, (size_t)1 << cctx->params.rParams.dictionary_log);
+    src = malloc(size);
+    if (src == NULL)
+        return 1;
+    if (fileName != NULL) {
+        FILE* const f = fopen(fileName, "rb");
+        if (f == NULL)
+            return 1;
+        size = fread(src, 1, size, f);
+        fclose(f);
+    }
+    else {
+        RDG_genBuffer(src, size, 0.5, 0.2, 1);
+    }
+
+    ret = benchKernels(&cctx->params, src, size);
+
+    FL2_freeCCtx(cctx);
+    free(src);
+    return ret;
+}
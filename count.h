@@ -3,6 +3,22 @@
 
 #include "mem.h"
 
+/* Vector compare for ZSTD_countLong(). SSE2 and NEON are part of the x86-64 and AArch64
+ * base instruction sets, so no runtime detection is needed. AVX2 requires -mavx2 or /arch:AVX2. */
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define COUNT_VECTOR_AVX2
+#  define COUNT_VECTOR_SIZE 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define COUNT_VECTOR_SSE2
+#  define COUNT_VECTOR_SIZE 16
+#elif ((defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)) && !defined(__ARM_BIG_ENDIAN)
+#  include <arm_neon.h>
+#  define COUNT_VECTOR_NEON
+#  define COUNT_VECTOR_SIZE 16
+#endif
+
 #if defined (__cplusplus)
 extern "C" {
 #endif
@@ -108,6 +124,69 @@ MEM_STATIC size_t ZSTD_count(const BYTE* pIn, const BYTE* pMatch, const BYTE* co
     return (size_t)(pIn - pStart);
 }
 
+#ifdef COUNT_VECTOR_SIZE
+
+/* Returns the number of equal bytes at the start of two vectors, or COUNT_VECTOR_SIZE */
+MEM_STATIC unsigned ZSTD_vectorCommonBytes(const BYTE* pIn, const BYTE* pMatch)
+{
+#  if defined(COUNT_VECTOR_AVX2) || defined(COUNT_VECTOR_SSE2)
+#    ifdef COUNT_VECTOR_AVX2
+    __m256i const eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pIn), _mm256_loadu_si256((const __m256i*)pMatch));
+    U32 const diff = ~(U32)_mm256_movemask_epi8(eq);
+#    else
+    __m128i const eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)pIn), _mm_loadu_si128((const __m128i*)pMatch));
+    U32 const diff = ~(U32)_mm_movemask_epi8(eq) & 0xFFFF;
+#    endif
+    if (diff == 0)
+        return COUNT_VECTOR_SIZE;
+#    if defined(_MSC_VER)
+    {   unsigned long r;
+        _BitScanForward(&r, diff);
+        return (unsigned)r;
+    }
+#    else
+    return (unsigned)__builtin_ctz(diff);
+#    endif
+#  else /* NEON : narrow the byte mask to 4 bits per byte */
+    uint8x16_t const eq = vceqq_u8(vld1q_u8(pIn), vld1q_u8(pMatch));
+    U64 const diff = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    if (diff == 0)
+        return COUNT_VECTOR_SIZE;
+#    if defined(_MSC_VER)
+    {   unsigned long r;
+        _BitScanForward64(&r, diff);
+        return (unsigned)(r >> 2);
+    }
+#    else
+    return (unsigned)(__builtin_ctzll(diff) >> 2);
+#    endif
+#  endif
+}
+
+#endif /* COUNT_VECTOR_SIZE */
+
+/* ZSTD_countLong() :
+ * Same result as ZSTD_count(), for matches which are expected to be long, such as the
+ * extension of a match beyond the length stored in the match table. Compares a vector
+ * at a time where available. */
+MEM_STATIC size_t ZSTD_countLong(const BYTE* pIn, const BYTE* pMatch, const BYTE* const pInLimit)
+{
+#ifdef COUNT_VECTOR_SIZE
+    const BYTE* const pStart = pIn;
+
+    while (pInLimit - pIn >= COUNT_VECTOR_SIZE) {
+        unsigned const common = ZSTD_vectorCommonBytes(pIn, pMatch);
+        if (common < COUNT_VECTOR_SIZE)
+            return (size_t)(pIn - pStart) + common;
+        pIn += COUNT_VECTOR_SIZE;
+        pMatch += COUNT_VECTOR_SIZE;
+    }
+    return (size_t)(pIn - pStart) + ZSTD_count(pIn, pMatch, pInLimit);
+#else
+    return ZSTD_count(pIn, pMatch, pInLimit);
+#endif
+}
+
 #if defined (__cplusplus)
 }
 #endif
@@ -96,6 +96,14 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressMt(void* dst, size_t dstCapacity,
 FL2LIB_API size_t FL2LIB_CALL FL2_decompress(void* dst, size_t dstCapacity,
     const void* src, size_t compressedSize);
 
+/*! FL2_decompressMt() :
+ *  Same as FL2_decompress(), using up to `nbThreads` threads. Specify nbThreads = 0 to use all cores.
+ *  A stream can be split between threads at each dictionary reset, so the number of threads
+ *  used depends on the FL2_p_blockSizeLog setting used for compression. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressMt(void* dst, size_t dstCapacity,
+    const void* src, size_t compressedSize,
+    unsigned nbThreads);
+
 /*! FL2_findDecompressedSize()
  *  `src` should point to the start of a LZMA2 encoded stream.
  *  `srcSize` must be at least as large as the LZMA2 stream including end marker.
@@ -113,7 +121,12 @@ FL2LIB_API size_t FL2LIB_CALL FL2_findDecompressedSize(const void *src, size_t s
 
 
 /*======  Helper functions  ======*/
-#define FL2_COMPRESSBOUND(srcSize)   ((srcSize) + (((srcSize) + 0xFFF) / 0x1000) * 3 + 6)  /* this formula calculates the maximum size of data stored in uncompressed chunks */
+#define FL2_COMPRESSBOUND(srcSize)   ((srcSize) + (((srcSize) + 0xFFF) / 0x1000) * 3 + 10)  /* this formula calculates the maximum size of data stored in uncompressed chunks, with an XXH64 hash */
+/* maximum size of a .xz stream (FL2_p_xzFormat) with the dictionaryLog used : each block adds at most 64 bytes */
+#define FL2_XZ_COMPRESSBOUND(srcSize, dictionaryLog)   (FL2_COMPRESSBOUND(srcSize) + (((srcSize) >> (dictionaryLog)) + 1) * 64 + 48)
+/* maximum size of a frame with a seek table (FL2_p_seekTable) if no block but the last is smaller than 2 ^ blockLog bytes :
+ * 16 bytes for each block and the end entry, and an 8-byte footer. Flushes and FL2_p_contentBlockLog can cut smaller blocks. */
+#define FL2_SEEK_COMPRESSBOUND(srcSize, blockLog)   (FL2_COMPRESSBOUND(srcSize) + (((srcSize) >> (blockLog)) + 2) * 16 + 8)
 FL2LIB_API size_t      FL2LIB_CALL FL2_compressBound(size_t srcSize); /*!< maximum compressed size in worst case scenario */
 FL2LIB_API unsigned    FL2LIB_CALL FL2_isError(size_t code);          /*!< tells if a `size_t` function result is an error code */
 FL2LIB_API const char* FL2LIB_CALL FL2_getErrorName(size_t code);     /*!< provides readable string from an error code */
@@ -143,6 +156,61 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* ctx,
     const void* src, size_t srcSize,
     int compressionLevel);
 
+/*! FL2_CCtx_loadDictionary() :
+ *  Loads a preset dictionary which primes the window of each following FL2_compressCCtx() call.
+ *  Matches can reference the dictionary content, but it is not part of the output. This improves
+ *  compression of small inputs which share content with the dictionary, such as records using the
+ *  same schema. The dictionary is copied into the context and is not used by the streaming or
+ *  caller-managed block functions. At most the last half of the dictionary size is used.
+ *  The same dictionary must be loaded with FL2_DCtx_loadDictionary() to decompress the output.
+ *  Passing NULL or dictSize 0 unloads the dictionary.
+ *  @return : 0, or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_loadDictionary(FL2_CCtx* ctx, const void* dict, size_t dictSize);
+
+/*! FL2_CCtx_getRandomFilterStats() :
+ *  Reports the number of bytes tested by the FL2_p_randomFilter detector in the current or
+ *  most recent frame, and how many of those were classified as random and stored.
+ *  Either pointer may be NULL. */
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getRandomFilterStats(const FL2_CCtx* ctx, unsigned long long* bytesTested, unsigned long long* bytesRandom);
+
+/*! FL2_compressStats :
+ *  Instrumentation of the current or most recent frame. Times are wall clock microseconds and
+ *  are only measured if FL2_p_collectStats is set. Encoder counters include chunks which were
+ *  encoded and then stored because they did not compress. */
+typedef struct {
+    unsigned long long blocks;           /* match table builds */
+    unsigned long long initTime;         /* match table initialization, including the random filter */
+    unsigned long long buildTime;        /* match table build phases */
+    unsigned long long encodeTime;       /* encoding phases, or pipelined build and encode phases */
+    unsigned long long idleTime;         /* time threads taking part in a phase spent waiting for the others */
+    unsigned long long bytesCompressed;  /* input bytes written in compressed chunks */
+    unsigned long long bytesStored;      /* input bytes written in uncompressed chunks */
+    unsigned long long repeatBytes;      /* input bytes in runs of repeated bytes or byte pairs,
+                                          * which were given matches without a table search */
+    unsigned long long matchCount;       /* matches encoded. matchBytes / matchCount is the average length */
+    unsigned long long matchBytes;
+    unsigned long long repMatchCount;    /* repeat distance matches encoded, including single bytes */
+    unsigned long long repMatchBytes;
+} FL2_compressStats;
+
+/*! FL2_threadStats :
+ *  Times of one thread of a context, in wall clock microseconds, measured if FL2_p_collectStats is set.
+ *  Thread 0 is the calling thread. Compute-bound work means busy time is close to CPU time. */
+typedef struct {
+    unsigned long long buildTime;        /* building the match table */
+    unsigned long long encodeTime;       /* encoding its slices of each block */
+    unsigned long long idleTime;         /* waiting for other threads at the end of phases it took part in */
+} FL2_threadStats;
+
+/*! FL2_CCtx_getStats() :
+ *  Reports the instrumentation of the current or most recent frame. */
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getStats(const FL2_CCtx* ctx, FL2_compressStats* stats);
+
+/*! FL2_CCtx_getThreadStats() :
+ *  Reports the times of thread `thread`, which must be less than FL2_CCtx_nbThreads().
+ *  @return : 0, or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getThreadStats(const FL2_CCtx* ctx, unsigned thread, FL2_threadStats* stats);
+
 /************************************************
 *  Caller-managed data buffer and overlap section
 ************************************************/
@@ -176,7 +244,7 @@ FL2LIB_API void FL2LIB_CALL FL2_beginFrame(FL2_CCtx* const cctx);
  *  the beginning of the output. Obtain it by calling FL2_dictSizeProp() before
  *  compressing the first block or after the last. No hash will be written, but
  *  the caller can calculate it using the interface in xxhash.h, write it at the end,
- *  and set bit 7 in the property byte. */
+ *  and set bit 7 in the property byte, and bit 6 if it is an XXH64 value. */
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtxBlock(FL2_CCtx* ctx,
     void* dst, size_t dstCapacity,
     const FL2_blockBuffer *block,
@@ -184,7 +252,9 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtxBlock(FL2_CCtx* ctx,
 
 /*! FL2_endFrame() :
  *  Write the end marker to terminate the LZMA2 stream.
- *  Must be called after compressing with FL2_compressCCtxBlock() */
+ *  Must be called after compressing with FL2_compressCCtxBlock()
+ *  If FL2_p_seekTable is set the seek table follows the end marker, so no hash can
+ *  be appended by the caller. */
 FL2LIB_API size_t FL2LIB_CALL FL2_endFrame(FL2_CCtx* ctx,
     void* dst, size_t dstCapacity);
 
@@ -218,16 +288,106 @@ FL2LIB_API unsigned char FL2LIB_CALL FL2_dictSizeProp(FL2_CCtx* ctx);
  *  and re-use it for each successive compression operation.
  *  This will make the workload friendlier for the system's memory.
  *  Use one context per thread for parallel execution. */
-typedef struct CLzma2Dec_s FL2_DCtx;
+typedef struct FL2_DCtx_s FL2_DCtx;
 FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtx(void);
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtxMt(unsigned nbThreads);
 FL2LIB_API size_t    FL2LIB_CALL FL2_freeDCtx(FL2_DCtx* dctx);
 
+FL2LIB_API unsigned FL2LIB_CALL FL2_DCtx_nbThreads(const FL2_DCtx* ctx);
+
+/*! FL2_DCtx_setMemoryLimit() :
+ *  Refuse frames which need a dictionary buffer larger than `limit` bytes, where the context
+ *  allocates one (FL2_decompressDCtx_toFn() and range decoding). Such frames fail with
+ *  FL2_error_memoryLimit_exceeded. 0 = no limit (default). */
+FL2LIB_API void FL2LIB_CALL FL2_DCtx_setMemoryLimit(FL2_DCtx* ctx, size_t limit);
+
 /*! FL2_decompressDCtx() :
  *  Same as FL2_decompress(), requires an allocated FL2_DCtx (see FL2_createDCtx()) */
 FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* ctx,
     void* dst, size_t dstCapacity,
     const void* src, size_t srcSize);
 
+/*! FL2_decompressDCtx_toFn() :
+ *  Decompresses a complete frame without a destination buffer. The data is decoded into a ring
+ *  dictionary of the frame's dictionary size, which the context keeps for reuse, and written
+ *  to `writeFn` straight from the dictionary. A preset dictionary loaded with
+ *  FL2_DCtx_loadDictionary() is used. Decoding uses a single thread.
+ *  @return : the total decompressed size, or an error code (which can be tested using FL2_isError()).
+ *            If `writeFn` returns nonzero the error is FL2_error_write_failed. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx_toFn(FL2_DCtx* ctx,
+    const void* src, size_t srcSize,
+    FL2_writerFn writeFn, void* opaque);
+
+/*! FL2_decompressRange() :
+ *  Decompress `uLen` bytes starting at uncompressed position `uOffset` from a complete
+ *  frame which was compressed with FL2_p_seekTable set. Only the blocks covering the
+ *  range are decoded. The hash cannot be checked on a partial decode.
+ *  @return : the number of bytes written into `dst`, which is less than `uLen` only if
+ *            the range extends past the end of the data,
+ *            or an error code, which is FL2_error_seekTable_missing if the frame has no table. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRange(FL2_DCtx* ctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long uOffset, size_t uLen);
+
+/*! FL2_DCtx_loadDictionary() :
+ *  Loads the preset dictionary used to compress the frames which FL2_decompressDCtx() and
+ *  FL2_decompressRange() will decode. The dictionary is copied into the context. Decoding a frame
+ *  with a dictionary uses a single thread. Passing NULL or dictSize 0 unloads the dictionary.
+ *  @return : 0, or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_DCtx_loadDictionary(FL2_DCtx* ctx, const void* dict, size_t dictSize);
+
+/*! FL2_setDecoderAsm() :
+ *  Selects the x86-64 assembly decode loop (enable != 0), which is the default in builds that
+ *  include it, or the portable C loop. The setting is global and must not be changed while any
+ *  decompression is in progress.
+ *  @return : 1 if the assembly loop is in use, 0 if the library was built without it or it was disabled. */
+FL2LIB_API int FL2LIB_CALL FL2_setDecoderAsm(int enable);
+
+/*= Context pools
+ *  A pool hands out contexts for many small operations on any number of threads. Released contexts
+ *  keep their match tables, encoders and buffers, and all contexts of a pool share one set of
+ *  nbThreads - 1 worker threads. The pools are thread-safe unless the library is compiled with
+ *  FL2_SINGLETHREAD.
+ *  FL2_CCtxPool_acquire() prefers an idle context last used at compressionLevel whose match table
+ *  fits srcSizeHint (0 if unknown), and creates one if none are idle. All parameters are reset
+ *  to the defaults for compressionLevel (0 for the default level), and acquired contexts have no
+ *  dictionary loaded.
+ *  Every acquired context must be released to its pool before the pool is freed.
+ *  Contexts from a pool must not be freed with FL2_freeCCtx() or FL2_freeDCtx(). */
+typedef struct FL2_CCtxPool_s FL2_CCtxPool;
+FL2LIB_API FL2_CCtxPool* FL2LIB_CALL FL2_createCCtxPool(unsigned nbThreads);
+FL2LIB_API void FL2LIB_CALL FL2_freeCCtxPool(FL2_CCtxPool* pool);
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_CCtxPool_acquire(FL2_CCtxPool* pool, int compressionLevel, size_t srcSizeHint);
+FL2LIB_API void FL2LIB_CALL FL2_CCtxPool_release(FL2_CCtxPool* pool, FL2_CCtx* cctx);
+
+typedef struct FL2_DCtxPool_s FL2_DCtxPool;
+FL2LIB_API FL2_DCtxPool* FL2LIB_CALL FL2_createDCtxPool(unsigned nbThreads);
+FL2LIB_API void FL2LIB_CALL FL2_freeDCtxPool(FL2_DCtxPool* pool);
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_DCtxPool_acquire(FL2_DCtxPool* pool);
+FL2LIB_API void FL2LIB_CALL FL2_DCtxPool_release(FL2_DCtxPool* pool, FL2_DCtx* dctx);
+
+/*= Shared thread pools
+ *  A thread pool holds nbThreads - 1 worker threads which any number of contexts can share, so
+ *  many concurrent compressions don't each start their own threads. A context created with
+ *  FL2_createCCtxWithPool() or FL2_createDCtxWithPool() uses nbThreads jobs like one created with
+ *  nbThreads: the calling thread runs one and the rest are queued for the pool. Jobs of all
+ *  contexts run in the order they were queued, and each context waits only for its own jobs.
+ *  A context must be used by one thread at a time, and all contexts must be freed before the pool.
+ *  FL2_createThreadPool_advanced() sets the CPU affinity and priority of the workers, so they can
+ *  be kept off latency-critical cores. Both are applied on Linux and Windows and ignored elsewhere. */
+typedef struct FL2_threadPool_s FL2_threadPool;
+typedef struct {
+    unsigned long long affinityMask; /* bit n allows the workers to run on CPU n. 0 = no restriction */
+    int priority;       /* 0 = inherit. 1 to 19 = nice value of the workers on Linux. On Windows 1 to 9
+                         * run them below normal priority, and 10 or more at the lowest priority. */
+} FL2_threadPoolParams;
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads);
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool_advanced(unsigned nbThreads, const FL2_threadPoolParams* params);
+FL2LIB_API void FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool);
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxWithPool(FL2_threadPool* pool);
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtxWithPool(FL2_threadPool* pool);
+
 /****************************
 *  Streaming
 ****************************/
@@ -244,6 +404,27 @@ typedef struct FL2_outBuffer_s {
     size_t pos;         /**< position where writing stopped. Will be updated. Necessarily 0 <= pos <= size */
 } FL2_outBuffer;
 
+/*= Batch compression
+ *  FL2_compressBatch() compresses each `srcs[i]` from `pos` to `size` into its own frame
+ *  at `dsts[i].pos`, and advances `dsts[i].pos` by the frame size. Buffers too small to
+ *  give every thread of the context a share are compressed whole on the context's threads
+ *  at the same time, each by a single-threaded context with its own encoder and match table.
+ *  Larger buffers are compressed one at a time using all threads, while the small ones are
+ *  being compressed. The worker contexts are created on first use and kept by the context.
+ *  They use its parameters and any loaded dictionary. FL2_p_memoryLimit covers the whole
+ *  batch : it is divided equally between the workers, or if there are also large buffers,
+ *  half goes to the context and the other half is divided between the workers.
+ *  FL2_decompressBatch() decompresses the frame in each `srcs[i]` to `dsts[i]` in the same
+ *  way. Frames the multithreaded decoder can split are decoded one at a time with all threads.
+ *  @return : the total size written, or the error of the first buffer which failed.
+ *            The other buffers are still processed, and `dsts[i].pos` is unchanged for each
+ *            buffer which failed. */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressBatch(FL2_CCtx* ctx,
+    const FL2_inBuffer* srcs, FL2_outBuffer* dsts, size_t count);
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressBatch(FL2_DCtx* ctx,
+    const FL2_inBuffer* srcs, FL2_outBuffer* dsts, size_t count);
+
 
 
 /*-***********************************************************************
@@ -251,6 +432,17 @@ typedef struct FL2_outBuffer_s {
  *
  *  A FL2_CStream object is required to track streaming operation.
  *  Use FL2_createCStream() and FL2_freeCStream() to create/release resources.
+ *  FL2_createCStreamMt() creates a stream which compresses each block using up to
+ *  `nbThreads` threads. Setting FL2_p_pipelineDepth additionally overlaps the match-finding
+ *  for one block with encoding of the previous one.
+ *
+ *  FL2_createCStreamAsync() creates a stream which never compresses on the caller's thread.
+ *  FL2_compressStream() only copies input and writes finished output, and a full block is
+ *  compressed by a background thread while input is read into a second buffer. When the
+ *  stream cannot accept more input it returns 0 with `input.pos < input.size`.
+ *  FL2_flushStream() and FL2_endStream() also return without waiting, and return >0 while
+ *  a block is being compressed. Use FL2_waitStream() to wait for the background thread,
+ *  or poll it with a timeout of 0. FL2_p_pipelineDepth is not used in this mode.
  *  FL2_CStream objects can be reused multiple times on consecutive compression operations.
  *  It is recommended to re-use FL2_CStream in situations where many streaming operations will be achieved consecutively,
  *  since it will play nicer with system's memory, by re-using already allocated memory.
@@ -288,14 +480,33 @@ typedef struct FL2_CStream_s FL2_CStream;
 
 /*===== FL2_CStream management functions =====*/
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream(void);
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamMt(unsigned nbThreads);
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamAsync(unsigned nbThreads);
 FL2LIB_API size_t FL2LIB_CALL FL2_freeCStream(FL2_CStream* fcs);
 
 /*===== Streaming compression functions =====*/
 FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionLevel);
 FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer* output, FL2_inBuffer* input);
+
+/*! FL2_compressStreamRef() :
+ *  Use the caller's buffer, e.g. a memory-mapped file, as the entire input of the frame
+ *  instead of copying data into the stream. The match finder and encoders read it in place.
+ *  Must be called after FL2_initCStream() and before any other input. The buffer must remain
+ *  valid and unchanged until FL2_endStream() returns 0. Compression takes place in
+ *  FL2_flushStream() and FL2_endStream(), and FL2_compressStream() cannot be used in the same
+ *  frame. Not supported by asynchronous streams.
+ *  @return : 0, or an error code, which can be tested using FL2_isError(). */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressStreamRef(FL2_CStream* fcs, const void* base, size_t size);
 FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer* output);
 FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer* output);
 
+/*! FL2_waitStream() :
+ *  Wait at most `timeout` milliseconds for the background compression of an asynchronous
+ *  stream. A timeout of 0 only polls, and (unsigned)-1 waits until compression is done.
+ *  @return : 1 if still compressing, 0 if the stream can make progress,
+ *            or an error code from the compression. Always 0 for other streams. */
+FL2LIB_API size_t FL2LIB_CALL FL2_waitStream(FL2_CStream* fcs, unsigned timeout);
+
 
 /*-***************************************************************************
  *  Streaming decompression - HowTo
@@ -303,6 +514,10 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer* out
  *  A FL2_DStream object is required to track streaming operations.
  *  Use FL2_createDStream() and FL2_freeDStream() to create/release resources.
  *  FL2_DStream objects can be re-used multiple times.
+ *  FL2_createDStreamMt() creates a stream which decodes segments between dictionary resets
+ *  in parallel. Up to nbThreads decoded segments are buffered internally. Segments larger than
+ *  4 times the dictionary size, which are not produced with the default FL2_p_blockSizeLog,
+ *  are decoded on a single thread.
  *
  *  Use FL2_initDStream() to start a new decompression operation.
  *   @return : recommended first input size
@@ -324,8 +539,19 @@ typedef struct FL2_DStream_s FL2_DStream;
 
 /*===== FL2_DStream management functions =====*/
 FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStream(void);
+FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads);
 FL2LIB_API size_t FL2LIB_CALL FL2_freeDStream(FL2_DStream* fds);
 
+/*! FL2_DStream_setMemoryLimit() :
+ *  Refuse frames with a dictionary larger than `limit` bytes, failing with
+ *  FL2_error_memoryLimit_exceeded. 0 = no limit (default). Applies from the next frame.
+ *  The limit is checked against the frame header before anything is allocated. The dictionary
+ *  buffer itself starts small and grows only as far as the frame's content needs, and is kept
+ *  for following frames which can use it. A multithreaded stream buffers the input and output
+ *  of each segment it decodes concurrently, so it decodes fewer segments at once under a limit,
+ *  and decodes on a single thread if the limit does not allow two. */
+FL2LIB_API void FL2LIB_CALL FL2_DStream_setMemoryLimit(FL2_DStream* fds, size_t limit);
+
 /*===== Streaming decompression functions =====*/
 FL2LIB_API size_t FL2LIB_CALL FL2_initDStream(FL2_DStream* fds);
 FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuffer* output, FL2_inBuffer* input);
@@ -364,6 +590,15 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 #define FL2_LP_MAX 4
 #define FL2_PB_MIN 0
 #define FL2_PB_MAX 4
+#define FL2_PIPELINE_DEPTH_MIN 0
+#define FL2_PIPELINE_DEPTH_MAX 1
+#define FL2_CONTENT_BLOCK_LOG_MIN 16
+#define FL2_CONTENT_BLOCK_LOG_MAX 30
+#define FL2_SECOND_MATCHER_MIN 0
+#define FL2_SECOND_MATCHER_MAX 1
+#define FL2_FLUSH_WINDOW_LOG_MIN 12
+#define FL2_XZ_FORMAT_MIN 0
+#define FL2_XZ_FORMAT_MAX 2
 
 typedef enum {
     /* compression parameters */
@@ -382,7 +617,9 @@ typedef enum {
                              * as n / 16 of the block size (dictionary size). Larger values are slower.
                              * Values above 2 mostly yield only a small improvement in compression. */
     FL2_p_blockSizeLog,     /* Block size for multithreaded decompression. A dictionary reset will occur
-                               after each 2 ^ blockSizeLog bytes of input. */
+                             * after each 2 ^ blockSizeLog bytes of input. Each block can be decoded
+                             * by a separate thread (see FL2_decompressMt()). Default is dictionaryLog + 2.
+                             * 0 means no resets. */
     FL2_p_bufferLog,        /* Buffering speeds up the matchfinder. Buffer size is 
                              * 2 ^ (dictionaryLog - bufferLog). Lower number = slower, better compression,
                              * higher memory usage. */
@@ -408,18 +645,89 @@ typedef enum {
     FL2_p_divideAndConquer, /* Split long chains of 2-byte matches into shorter chains with a small overlap
                              * during further processing. Allows buffering of all chains at length 2.
                              * Faster, less compression. Generally a good tradeoff. Enabled by default. */
-    FL2_p_strategy,         /* 1 = fast; 2 = optimize, 3 = ultra (hybrid mode).
+    FL2_p_strategy,         /* 0 = fast; 1 = optimize, 2 = ultra (hybrid mode).
                              * The higher the value of the selected strategy, the more complex it is,
                              * resulting in stronger and slower compression.
-                             * Special: value 0 means "do not change strategy". */
+                             * 3 = adaptive: each chunk is encoded fast, optimized or stored depending
+                             * on its match statistics. See FL2_p_adaptiveThroughput. */
 #ifndef NO_XXHASH
-    FL2_p_doXXHash,         /* Calculate a 32-bit xxhash value from the input data and store it 
+    FL2_p_doXXHash,         /* Calculate an xxhash value from the input data and store it
                              * after the stream terminator. The value will be checked on decompression.
-                             * 0 = do not calculate; 1 = calculate (default) */
+                             * It is calculated while other threads build the match table.
+                             * 0 = do not calculate; 1 = XXH32 (default); 2 = XXH64, which is faster
+                             * on 64-bit CPUs and sets bit 6 in the property byte */
 #endif
     FL2_p_omitProperties,   /* Omit the property byte at the start of the stream. For use within 7-zip */
                             /* or other containers which store the property byte elsewhere. */
                             /* Cannot be decoded by this library. */
+    FL2_p_seekTable,        /* Append a table of dictionary reset positions to the frame, after the hash,
+                             * for random access with FL2_decompressRange(). Each entry uses 16 bytes
+                             * and there is one per block (see FL2_p_blockSizeLog and
+                             * FL2_p_contentBlockLog), plus 24 bytes.
+                             * Not written if FL2_p_omitProperties is set. 0 = off (default) */
+    FL2_p_pipelineDepth,    /* Streaming only. 1 = build the match table for the next block while the
+                             * previous block is encoded. Uses memory for a second match table and input
+                             * buffer, and output is delayed by one block. 0 = off (default) */
+    FL2_p_incrementalPrices,/* Only useful for strategies >= opt. 1 = after each optimal parse step, re-price
+                             * only the length, distance and align tables changed by the symbols just
+                             * encoded, instead of rebuilding all tables on a fixed schedule.
+                             * Prices stay current, usually for slightly better compression. 0 = off (default) */
+    FL2_p_adaptiveThroughput,/* Adaptive strategy only. Encoder speed target in MB/s per thread. Chunks
+                             * which would benefit from the optimal parser fall back to the fast encoder
+                             * when the estimated encoding time exceeds the target. The estimate uses
+                             * nominal speeds, not a clock, so output does not depend on machine load.
+                             * 0 = no target (default) */
+    FL2_p_randomFilter,     /* Test each 64 KB window of a block for incompressible data, such as already
+                             * compressed media, before building the match table. Windows classified as
+                             * random are left out of the table and stored. Saves match finder time on
+                             * mixed data, but matches to a repeated copy of random data are lost.
+                             * See FL2_CCtx_getRandomFilterStats(). 0 = off (default) */
+    FL2_p_contentBlockLog,  /* Streaming only. Cut blocks where a rolling hash of the input matches, about
+                             * every 2 ^ contentBlockLog bytes, instead of when the input buffer is full.
+                             * Each block begins with a dictionary reset, so identical regions in different
+                             * streams compress to identical data after the first cut, which helps
+                             * deduplication. Blocks are also seek table entries and can be decoded in
+                             * parallel. Costs some compression. Not supported with FL2_p_pipelineDepth,
+                             * FL2_createCStreamAsync() or FL2_compressStreamRef(). 0 = off (default) */
+    FL2_p_collectStats,     /* Time each phase of compression on each thread, for FL2_CCtx_getStats().
+                             * Costs a clock read per thread per phase. Counters are always kept unless
+                             * the library is built with FL2_NO_STATS. 0 = off (default) */
+    FL2_p_memoryLimit,      /* Memory budget in MiB for the match table, encoders and stream buffers of a
+                             * frame. When each frame begins, the thread count used, chainLog, searchDepth
+                             * and dictionaryLog are reduced until FL2_estimateCStreamSize_usingCCtx() or
+                             * FL2_estimateCCtxSize_usingCCtx() fits. Reduced parameters stay in effect until
+                             * they or the level are set again. If the minimum settings do not fit, compression
+                             * fails with FL2_error_memoryLimit_exceeded. 0 = no limit (default) */
+    FL2_p_memoryPriority,   /* How FL2_p_memoryLimit is met. 0 = ratio: use fewer threads first, and reduce
+                             * the dictionary last (default). 1 = speed: reduce the dictionary and search
+                             * settings first, and use fewer threads last. */
+    FL2_p_longWindowLog,    /* One-shot compression only (FL2_compressCCtx() without a dictionary). Find matches
+                             * up to 2 ^ longWindowLog bytes back with a sparse rolling-hash index of the source,
+                             * in addition to the match table, which covers only dictionaryLog. Catches long
+                             * repeats at large distances for a fraction of the memory of a larger dictionary:
+                             * the index takes 2 ^ (longWindowLog - 3) bytes. The frame's dictionary size is
+                             * raised to cover the longest distance used, which sets the memory needed for
+                             * streaming decompression. 0 = off (default), or FL2_DICTLOG_MIN to FL2_DICTLOG_MAX. */
+    FL2_p_secondMatcher,    /* Match finder used by the ultra strategy for short matches at near distances, in
+                             * addition to the match table. 0 = hash chain of 2 ^ chainLog positions, walked
+                             * up to 2 ^ searchLog steps (default). 1 = rows of 16 recent positions per hash,
+                             * with 8-bit tags compared all at once; the same number of entries in about the
+                             * same memory. Faster than the chain with slightly different output. */
+    FL2_p_flushWindowLog,   /* Streaming only. Blocks compressed by FL2_flushStream() or FL2_endStream() keep
+                             * only the last 2 ^ flushWindowLog bytes of earlier input as their dictionary
+                             * prefix, so the match table is built over that window plus the new data instead
+                             * of the whole input buffer. Bounds the time of frequent small flushes, at the
+                             * cost of matches further back. Not used with FL2_p_pipelineDepth.
+                             * 0 = off (default), or FL2_FLUSH_WINDOW_LOG_MIN to FL2_DICTLOG_MAX. */
+    FL2_p_xzFormat,         /* Write a .xz stream instead of the fast-lzma2 frame, from FL2_compressCCtx() or a
+                             * CStream. Each dictionary-sized section of the input, or each content-defined
+                             * block, is an independent .xz block with its sizes in the block header, so xz
+                             * and liblzma can decode the blocks in parallel. No overlap is kept between
+                             * blocks, which costs some compression at the boundaries. doXXHash,
+                             * omitProperties and seekTable are not used. Not supported with a preset
+                             * dictionary, FL2_p_pipelineDepth, FL2_createCStreamAsync() or
+                             * FL2_compressStreamRef(). Size destination buffers with FL2_XZ_COMPRESSBOUND().
+                             * 0 = off (default), 1 = .xz with a CRC32 check, 2 = .xz with a CRC64 check. */
 #ifdef RMF_REFERENCE
     FL2_p_useReferenceMF    /* Use the reference matchfinder for development purposes. SLOW. */
 #endif
@@ -432,6 +740,84 @@ typedef enum {
  *            or an error code (which can be tested with FL2_isError()). */
 FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParameter param, unsigned value);
 FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameter(FL2_CStream* fcs, FL2_cParameter param, unsigned value);
+FL2LIB_API void FL2LIB_CALL FL2_CStream_getRandomFilterStats(const FL2_CStream* fcs, unsigned long long* bytesTested, unsigned long long* bytesRandom);
+FL2LIB_API void FL2LIB_CALL FL2_CStream_getStats(const FL2_CStream* fcs, FL2_compressStats* stats);
+
+/***************************************
+*  Parameter sets
+***************************************/
+
+/*! FL2_compressionParameters :
+ *  The parameters selected by a compression level, in the order of the level tables. The fields
+ *  take the values of FL2_p_dictionaryLog, FL2_p_overlapFraction, FL2_p_chainLog, FL2_p_searchLog,
+ *  FL2_p_searchDepth, FL2_p_fastLength, FL2_p_divideAndConquer, FL2_p_bufferLog and FL2_p_strategy. */
+typedef struct {
+    unsigned dictionaryLog;    /* largest match distance : larger == more compression, more memory needed during decompression; >= 27 == more memory, slower */
+    unsigned overlapFraction;  /* overlap between consecutive blocks in 1/16 units: larger == more compression, slower */
+    unsigned chainLog;         /* fully searched segment : larger == more compression, slower, more memory; hybrid mode only (ultra) */
+    unsigned searchLog;        /* nb of searches : larger == more compression, slower; hybrid mode only (ultra) */
+    unsigned searchDepth;      /* maximum depth for resolving string matches : larger == more compression, slower; >= 64 == more memory, slower */
+    unsigned fastLength;       /* acceptable match size for parser, not less than searchDepth : larger == more compression, slower; fast bytes parameter from 7-zip */
+    unsigned divideAndConquer; /* split long chains of 2-byte matches into shorter chains with a small overlap : faster, somewhat less compression; enabled by default */
+    unsigned bufferLog;        /* buffer size for processing match chains is (dictionaryLog - bufferLog) : when divideAndConquer enabled, affects compression; */
+                               /* when divideAndConquer disabled, affects speed in a hardware-dependent manner */
+    unsigned strategy;         /* encoder strategy : 0 = fast, 1 = optimized, 2 = ultra (hybrid), 3 = adaptive */
+} FL2_compressionParameters;
+
+/*! FL2_getLevelParameters() :
+ *  Gets the parameters of a level from the default table, or the high compression table if
+ *  `highCompression` is nonzero.
+ *  @return : 0, or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_getLevelParameters(int compressionLevel, int highCompression, FL2_compressionParameters* params);
+
+/*! FL2_CCtx_setParameters() :
+ *  Sets all parameters of a set, as setting a compression level does. lc, lp and pb return to their
+ *  defaults and FL2_p_blockSizeLog follows the dictionary size. Nothing is changed if any
+ *  parameter is out of bounds.
+ *  @return : 0, or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameters(FL2_CCtx* cctx, const FL2_compressionParameters* params);
+FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameters(FL2_CStream* fcs, const FL2_compressionParameters* params);
+
+/*! FL2_CCtx_getParameters() :
+ *  Gets the current values of the parameters of a set. */
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getParameters(const FL2_CCtx* cctx, FL2_compressionParameters* params);
+
+/*! FL2_parametersToString(), FL2_parametersFromString() :
+ *  A parameter set as text, for storing a tuned set and loading it at startup. The fields are
+ *  written as decimal numbers separated by commas, in the order of the structure, for example
+ *  "24,2,9,0,42,48,1,8,2". FL2_parametersToString() writes at most FL2_PARAMETERS_STRING_MAX
+ *  bytes including the terminating null, and returns the length of the string, or an error code
+ *  if a value is out of bounds or dstCapacity is too small.
+ *  FL2_parametersFromString() fails with FL2_error_parameter_outOfBound if the text is not nine
+ *  numbers or a value is out of bounds. */
+#define FL2_PARAMETERS_STRING_MAX 64
+
+FL2LIB_API size_t FL2LIB_CALL FL2_parametersToString(char* dst, size_t dstCapacity, const FL2_compressionParameters* params);
+FL2LIB_API size_t FL2LIB_CALL FL2_parametersFromString(FL2_compressionParameters* params, const char* src);
+
+/*! FL2_tuneResult :
+ *  A parameter set measured by FL2_CCtx_tune(). */
+typedef struct {
+    FL2_compressionParameters params;
+    size_t srcSize;                 /* sample size */
+    size_t cSize;                   /* compressed size of the sample */
+    unsigned long long time;        /* fastest time to compress the sample, in microseconds */
+} FL2_tuneResult;
+
+/*! FL2_CCtx_tune() :
+ *  Times FL2_compressCCtx() on a sample of the caller's data with candidate parameter sets, and
+ *  finds those on the Pareto front of speed and compressed size for this host. Candidates are the
+ *  sets of all levels of both tables, with the context's dictionaryLog, and variations of
+ *  bufferLog, searchDepth, overlapFraction and divideAndConquer around each set on the front.
+ *  The context's threads and other parameters are used, and all parameters are restored after.
+ *  overlapFraction only has an effect if the sample is larger than the dictionary.
+ *  The front is written to `results` fastest first, each set compressing better than the one
+ *  before it. For a speed target, use the last set at least that fast; for a ratio target, the
+ *  first set small enough.
+ *  @return : the number of sets on the front, which can be more than `maxResults` written,
+ *            or an error code (which can be tested using FL2_isError()). */
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_tune(FL2_CCtx* cctx, const void* sample, size_t sampleSize,
+    FL2_tuneResult* results, size_t maxResults);
 
 /***************************************
 *  Context memory usage
@@ -442,13 +828,43 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameter(FL2_CStream* fcs, FL2_cPa
 *  FL2_estimateCCtxSize() will provide a budget large enough for any compression level up to selected one.
 *  To use FL2_estimateCCtxSize_usingCCtx, set the compression level and any other settings for the context,
 *  then call the function. Some allocation occurs when the context is created, but the large memory buffers
-*  used for string matching are allocated only when compression begins. */
+*  used for string matching are allocated only when compression begins.
+*  Inputs of FL2_SMALL_INPUT_MAX bytes or less are matched with a compact binary tree match finder instead of
+*  the radix match finder, which avoids its fixed setup cost. FL2_estimateCCtxSize_bySize() gives the memory
+*  usage for a known source size, including this case. */
+
+#define FL2_SMALL_INPUT_MAX ((size_t)1 << 12)
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize(int compressionLevel, unsigned nbThreads); /*!< memory usage determined by level */
+FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_bySize(int compressionLevel, size_t srcSize, unsigned nbThreads); /*!< memory usage determined by level and source size */
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx* cctx);           /*!< memory usage determined by settings */
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsigned nbThreads);
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCCtx(const FL2_CStream* fcs);
 
+/***************************************
+*  Custom memory allocation
+***************************************/
+
+/*! FL2_customMem :
+ *  Allocation functions for a compression context, its match tables and the input buffers of
+ *  a stream, which are the largest allocations made. Both functions must be set, or both NULL
+ *  to use malloc() and free(). */
+typedef void* (*FL2_allocFunction) (void* opaque, size_t size);
+typedef void  (*FL2_freeFunction) (void* opaque, void* address);
+typedef struct { FL2_allocFunction customAlloc; FL2_freeFunction customFree; void* opaque; } FL2_customMem;
+
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtx_advanced(unsigned nbThreads, FL2_customMem customMem);
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream_advanced(unsigned nbThreads, FL2_customMem customMem);
+
+/*! FL2_largePageAlloc(), FL2_largePageFree() :
+ *  Built-in allocator for use as { FL2_largePageAlloc, FL2_largePageFree, NULL }, which
+ *  reduces TLB misses in the match finder for large dictionaries. Allocations of 2 MiB or more
+ *  use huge pages on Linux (reserved pages through MAP_HUGETLB if available, otherwise
+ *  transparent huge pages through madvise()), and large pages on Windows if the process has
+ *  SeLockMemoryPrivilege. Ordinary pages are used if these are unavailable. */
+FL2LIB_API void* FL2LIB_CALL FL2_largePageAlloc(void* opaque, size_t size);
+FL2LIB_API void FL2LIB_CALL FL2_largePageFree(void* opaque, void* address);
+
 #endif  /* FAST_LZMA2_H */
 
 #if defined (__cplusplus)
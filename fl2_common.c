@@ -19,6 +19,13 @@
 #include "fast-lzma2.h"
 #include "fl2_error_private.h"
 #include "fl2_internal.h"
+#include "util.h"        /* UTIL_countPhysicalCores */
+#include "fl2_pool.h"
+#if defined(_WIN32)
+#  include <windows.h>   /* VirtualAlloc */
+#elif defined(__linux__)
+#  include <sys/mman.h>  /* mmap, madvise */
+#endif
 
 
 /*-****************************************
@@ -59,3 +66,150 @@ FL2LIB_API const char* FL2LIB_CALL FL2_getErrorString(FL2_ErrorCode code) { retu
 int g_debuglog_enable = 1;
 #endif
 
+
+
+unsigned FL2_checkNbThreads(unsigned nbThreads)
+{
+#ifndef FL2_SINGLETHREAD
+    if (!nbThreads) {
+        nbThreads = UTIL_countPhysicalCores();
+        nbThreads += !nbThreads;
+    }
+    if (nbThreads > FL2_MAXTHREADS) {
+        nbThreads = FL2_MAXTHREADS;
+    }
+#else
+    nbThreads = 1;
+#endif
+    return nbThreads;
+}
+
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads)
+{
+    return FL2_createThreadPool_advanced(nbThreads, NULL);
+}
+
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool_advanced(unsigned nbThreads, const FL2_threadPoolParams* params)
+{
+    FL2_threadPool* const pool = malloc(sizeof(FL2_threadPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->nbThreads = FL2_checkNbThreads(nbThreads);
+    pool->factory = NULL;
+
+    DEBUGLOG(3, "FL2_createThreadPool : %u threads", pool->nbThreads);
+
+#ifndef FL2_SINGLETHREAD
+    if (pool->nbThreads > 1) {
+        pool->factory = (params != NULL)
+            ? FL2POOL_create_advanced(pool->nbThreads - 1, params->affinityMask, params->priority)
+            : FL2POOL_create(pool->nbThreads - 1);
+        if (pool->factory == NULL) {
+            free(pool);
+            return NULL;
+        }
+    }
+#else
+    (void)params;
+#endif
+    return pool;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool)
+{
+    if (pool == NULL)
+        return;
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(pool->factory);
+#endif
+    free(pool);
+}
+
+/*-****************************************
+*  Memory allocation
+******************************************/
+void* FL2_malloc(size_t size, FL2_customMem customMem)
+{
+    if (customMem.customAlloc)
+        return customMem.customAlloc(customMem.opaque, size);
+    return malloc(size);
+}
+
+void FL2_free(void* ptr, FL2_customMem customMem)
+{
+    if (ptr != NULL) {
+        if (customMem.customFree)
+            customMem.customFree(customMem.opaque, ptr);
+        else
+            free(ptr);
+    }
+}
+
+#define FL2_LARGE_PAGE_MIN ((size_t)1 << 21)
+#define FL2_LARGE_PAGE_HEADER 64U /* holds the mapped size and keeps cache line alignment */
+
+FL2LIB_API void* FL2LIB_CALL FL2_largePageAlloc(void* opaque, size_t size)
+{
+    size_t const total = size + FL2_LARGE_PAGE_HEADER;
+    size_t mapped = 0;
+    BYTE* ptr = NULL;
+
+    (void)opaque;
+    if (size >= FL2_LARGE_PAGE_MIN) {
+#if defined(_WIN32)
+        SIZE_T const page = GetLargePageMinimum();
+        if (page != 0) {
+            mapped = (total + page - 1) & ~(page - 1);
+            ptr = VirtualAlloc(NULL, mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+        if (ptr == NULL) {
+            mapped = total;
+            ptr = VirtualAlloc(NULL, mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+#elif defined(__linux__) && defined(MAP_ANONYMOUS)
+        mapped = (total + FL2_LARGE_PAGE_MIN - 1) & ~(FL2_LARGE_PAGE_MIN - 1);
+#  ifdef MAP_HUGETLB
+        ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+            ptr = NULL;
+#  endif
+        if (ptr == NULL) {
+            ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED)
+                ptr = NULL;
+#  ifdef MADV_HUGEPAGE
+            else
+                madvise(ptr, mapped, MADV_HUGEPAGE);
+#  endif
+        }
+#endif
+    }
+    if (ptr == NULL) {
+        mapped = 0;
+        ptr = malloc(total);
+        if (ptr == NULL)
+            return NULL;
+    }
+    *(size_t*)ptr = mapped;
+    return ptr + FL2_LARGE_PAGE_HEADER;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_largePageFree(void* opaque, void* address)
+{
+    BYTE* ptr;
+
+    (void)opaque;
+    if (address == NULL)
+        return;
+    ptr = (BYTE*)address - FL2_LARGE_PAGE_HEADER;
+    if (*(size_t*)ptr == 0) {
+        free(ptr);
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#elif defined(__linux__) && defined(MAP_ANONYMOUS)
+    munmap(ptr, *(size_t*)ptr);
+#endif
+}
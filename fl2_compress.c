@@ -9,6 +9,7 @@
 * You may select, at your option, one of the above-listed licenses.
 */
 
+#include <stdio.h>      /* snprintf */
 #include <string.h>
 #include "fast-lzma2.h"
 #include "fl2_internal.h"
@@ -22,6 +23,7 @@
 #include "lzma2_enc.h"
 
 #define MIN_BYTES_PER_THREAD 0x10000
+#define SLICE_COST_SAMPLE (MIN_BYTES_PER_THREAD / 4) /* bytes of each unit used for the cost estimate */
 
 #define ALIGNMENT_MASK (~(size_t)15)
 
@@ -93,9 +95,8 @@ void FL2_fillParameters(FL2_CCtx* const cctx, const FL2_compressionParameters* c
     cParams->pb = 2;
     cParams->fast_length = params->fastLength;
     cParams->match_cycles = 1U << params->searchLog;
-    cParams->strategy = params->strategy;
+    cParams->strategy = (FL2_strategy)params->strategy;
     cParams->second_dict_bits = params->chainLog;
-    cParams->random_filter = 0;
     rParams->dictionary_log = MIN(params->dictionaryLog, FL2_DICTLOG_MAX); /* allow for reduced dict in 32-bit version */
     rParams->match_buffer_log = params->bufferLog;
     rParams->overlap_fraction = params->overlapFraction;
@@ -111,50 +112,103 @@ FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtx(void)
 
 FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxMt(unsigned nbThreads)
 {
-    FL2_CCtx* cctx;
+    FL2_customMem const defaultMem = { NULL, NULL, NULL };
+    return FL2_createCCtx_advanced(nbThreads, defaultMem);
+}
 
-#ifndef FL2_SINGLETHREAD
-    if (!nbThreads) {
-        nbThreads = UTIL_countPhysicalCores();
-        nbThreads += !nbThreads;
-    }
-    if (nbThreads > FL2_MAXTHREADS) {
-        nbThreads = FL2_MAXTHREADS;
-    }
-#else
-    nbThreads = 1;
+/* FL2_initParameters() :
+ * Sets all parameters to their defaults. */
+static void FL2_initParameters(FL2_CCtx* const cctx)
+{
+    cctx->params.highCompression = 0;
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, FL2_CLEVEL_DEFAULT);
+#ifndef NO_XXHASH
+    cctx->params.doXXH = 1;
+#endif
+    cctx->params.omitProp = 0;
+    cctx->params.seekTable = 0;
+    cctx->params.pipelineDepth = 0;
+    cctx->params.contentBlockLog = 0;
+    cctx->params.collectStats = 0;
+    cctx->params.memoryLimit = 0;
+    cctx->params.memoryPriority = 0;
+    cctx->params.longWindowLog = 0;
+    cctx->params.flushWindowLog = 0;
+    cctx->params.xzFormat = 0;
+    cctx->params.cParams.incremental_prices = 0;
+    cctx->params.cParams.adaptive_throughput = 0;
+    cctx->params.cParams.random_filter = 0;
+    cctx->params.cParams.second_matcher = FL2_SECOND_MATCHER_CHAIN;
+
+#ifdef RMF_REFERENCE
+    cctx->params.rParams.use_ref_mf = 0;
 #endif
+}
+
+/* FL2_createCCtx_internal() :
+ * Creates a context which runs its jobs on the threads of sharedPool if not NULL. */
+static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, FL2_customMem const customMem, FL2POOL_ctx* const sharedPool)
+{
+    FL2_CCtx* cctx;
+
+    if ((customMem.customAlloc == NULL) != (customMem.customFree == NULL))
+        return NULL;
+
+    nbThreads = FL2_checkNbThreads(nbThreads);
 
     DEBUGLOG(3, "FL2_createCCtxMt : %u threads", nbThreads);
 
-    cctx = malloc(sizeof(FL2_CCtx) + (nbThreads - 1) * sizeof(FL2_job));
+    cctx = FL2_malloc(sizeof(FL2_CCtx) + (nbThreads - 1) * sizeof(FL2_job), customMem);
     if (cctx == NULL)
         return NULL;
 
+    cctx->customMem = customMem;
+
     cctx->jobCount = nbThreads;
+    cctx->threadLimit = nbThreads;
     for (unsigned u = 0; u < nbThreads; ++u) {
         cctx->jobs[u].enc = NULL;
     }
 
-    cctx->params.highCompression = 0;
-    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, FL2_CLEVEL_DEFAULT);
-#ifndef NO_XXHASH
-    cctx->params.doXXH = 1;
-#endif
-    cctx->params.omitProp = 0;
-
-#ifdef RMF_REFERENCE
-    cctx->params.rParams.use_ref_mf = 0;
-#endif
+    FL2_initParameters(cctx);
 
+    cctx->poolNext = NULL;
     cctx->matchTable = NULL;
+    cctx->pipeTable = NULL;
+    cctx->encThreads = 0;
+    cctx->pipeThreads = 0;
+    cctx->seek_table = NULL;
+    cctx->seek_size = 0;
+    cctx->seek_cap = 0;
+    cctx->xz_check = 0;
+    cctx->xz_head_size = 0;
+    cctx->xz_tail_size = 0;
+    FL2_xzIndexInit(&cctx->xz_index);
+    cctx->dict_buf = NULL;
+    cctx->dict_size = 0;
+    cctx->dict_cap = 0;
+    cctx->in_total = 0;
+    cctx->out_total = 0;
+    cctx->filter_total = 0;
+    cctx->filter_random = 0;
+    cctx->ldm = NULL;
+    cctx->ldm_active = 0;
+    cctx->slice_cost = NULL;
+    cctx->slice_cost_cap = 0;
+    cctx->batch = NULL;
+#ifndef NO_XXHASH
+    FL2_hashInit(&cctx->hash);
+#endif
 
 #ifndef FL2_SINGLETHREAD
-    cctx->factory = FL2POOL_create(nbThreads - 1);
+    cctx->factory = (sharedPool != NULL) ? FL2POOL_createView(sharedPool) : FL2POOL_create(nbThreads - 1);
+    cctx->batch_pool = NULL;
     if (nbThreads > 1 && cctx->factory == NULL) {
         FL2_freeCCtx(cctx);
         return NULL;
     }
+#else
+    (void)sharedPool;
 #endif
 
     for (unsigned u = 0; u < nbThreads; ++u) {
@@ -164,13 +218,27 @@ FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxMt(unsigned nbThreads)
             return NULL;
         }
         cctx->jobs[u].cctx = cctx;
+        cctx->jobs[u].busy = 0;
+        memset(&cctx->jobs[u].stats, 0, sizeof(cctx->jobs[u].stats));
     }
+    memset(&cctx->stats, 0, sizeof(cctx->stats));
     cctx->dictMax = 0;
     cctx->block_total = 0;
 
     return cctx;
 }
 
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtx_advanced(unsigned nbThreads, FL2_customMem customMem)
+{
+    return FL2_createCCtx_internal(nbThreads, customMem, NULL);
+}
+
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxWithPool(FL2_threadPool* pool)
+{
+    FL2_customMem const defaultMem = { NULL, NULL, NULL };
+    return FL2_createCCtx_internal(pool->nbThreads, defaultMem, pool->factory);
+}
+
 FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
 {
     if (cctx == NULL) 
@@ -183,11 +251,26 @@ FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
     }
 
 #ifndef FL2_SINGLETHREAD
+    FL2POOL_free(cctx->batch_pool);
     FL2POOL_free(cctx->factory);
 #endif
 
     RMF_freeMatchTable(cctx->matchTable);
-    free(cctx);
+    RMF_freeMatchTable(cctx->pipeTable);
+    free(cctx->seek_table);
+    FL2_xzIndexFree(&cctx->xz_index);
+    FL2_free(cctx->dict_buf, cctx->customMem);
+    FL2_free(cctx->slice_cost, cctx->customMem);
+    FL2_ldmFree(cctx->ldm);
+    if (cctx->batch != NULL) {
+        for (unsigned u = 0; u < cctx->jobCount; ++u)
+            FL2_freeCCtx(cctx->batch[u].cctx);
+        FL2_free(cctx->batch, cctx->customMem);
+    }
+#ifndef NO_XXHASH
+    FL2_hashFree(&cctx->hash);
+#endif
+    FL2_free(cctx, cctx->customMem);
 }
 
 FL2LIB_API unsigned FL2LIB_CALL FL2_CCtx_nbThreads(const FL2_CCtx* cctx)
@@ -195,34 +278,488 @@ FL2LIB_API unsigned FL2LIB_CALL FL2_CCtx_nbThreads(const FL2_CCtx* cctx)
     return cctx->jobCount;
 }
 
+struct FL2_CCtxPool_s {
+    ZSTD_pthread_mutex_t mutex;
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_ctx* factory;   /* worker threads shared by all contexts */
+#endif
+    FL2_CCtx* idle;         /* most recently released first */
+    unsigned nbThreads;
+};
+
+FL2LIB_API FL2_CCtxPool* FL2LIB_CALL FL2_createCCtxPool(unsigned nbThreads)
+{
+    FL2_CCtxPool* const pool = malloc(sizeof(FL2_CCtxPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->nbThreads = FL2_checkNbThreads(nbThreads);
+    pool->idle = NULL;
+
+    DEBUGLOG(3, "FL2_createCCtxPool : %u threads", pool->nbThreads);
+
+#ifndef FL2_SINGLETHREAD
+    pool->factory = FL2POOL_create(pool->nbThreads - 1);
+    if (pool->nbThreads > 1 && pool->factory == NULL) {
+        free(pool);
+        return NULL;
+    }
+#endif
+    if (ZSTD_pthread_mutex_init(&pool->mutex, NULL)) {
+#ifndef FL2_SINGLETHREAD
+        FL2POOL_free(pool->factory);
+#endif
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_freeCCtxPool(FL2_CCtxPool* pool)
+{
+    if (pool == NULL)
+        return;
+
+    DEBUGLOG(3, "FL2_freeCCtxPool");
+
+    while (pool->idle != NULL) {
+        FL2_CCtx* const cctx = pool->idle;
+        pool->idle = cctx->poolNext;
+        FL2_freeCCtx(cctx);
+    }
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(pool->factory);
+#endif
+    ZSTD_pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_CCtxPool_acquire(FL2_CCtxPool* pool, int compressionLevel, size_t srcSizeHint)
+{
+    unsigned const level = (compressionLevel > 0) ? (unsigned)compressionLevel : FL2_CLEVEL_DEFAULT;
+    FL2_CCtx* cctx = NULL;
+
+    ZSTD_pthread_mutex_lock(&pool->mutex);
+    {   /* Prefer a context last used at this level with a table large enough for srcSizeHint,
+         * then any context last used at this level, then the most recent one */
+        FL2_CCtx** best = NULL;
+        for (FL2_CCtx** link = &pool->idle; *link != NULL; link = &(*link)->poolNext) {
+            FL2_CCtx* const c = *link;
+            if (c->params.compressionLevel != level || c->params.highCompression)
+                continue;
+            if (c->matchTable != NULL && RMF_compatibleParameters(c->matchTable, &c->params.rParams, srcSizeHint)) {
+                best = link;
+                break;
+            }
+            if (best == NULL)
+                best = link;
+        }
+        if (best == NULL && pool->idle != NULL)
+            best = &pool->idle;
+        if (best != NULL) {
+            cctx = *best;
+            *best = cctx->poolNext;
+        }
+    }
+    ZSTD_pthread_mutex_unlock(&pool->mutex);
+
+    if (cctx == NULL) {
+        FL2_customMem const defaultMem = { NULL, NULL, NULL };
+#ifndef FL2_SINGLETHREAD
+        cctx = FL2_createCCtx_internal(pool->nbThreads, defaultMem, pool->factory);
+#else
+        cctx = FL2_createCCtx_internal(pool->nbThreads, defaultMem, NULL);
+#endif
+        if (cctx == NULL)
+            return NULL;
+    }
+    cctx->poolNext = NULL;
+    cctx->dict_size = 0;
+    FL2_initParameters(cctx);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    return cctx;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CCtxPool_release(FL2_CCtxPool* pool, FL2_CCtx* cctx)
+{
+    if (cctx == NULL)
+        return;
+
+    ZSTD_pthread_mutex_lock(&pool->mutex);
+    cctx->poolNext = pool->idle;
+    pool->idle = cctx;
+    ZSTD_pthread_mutex_unlock(&pool->mutex);
+}
+
+/* FL2_statsClock() :
+ * Reads the clock if FL2_p_collectStats is set. */
+static UTIL_time_t FL2_statsClock(const FL2_CCtx* const cctx)
+{
+    UTIL_time_t time = UTIL_TIME_INITIALIZER;
+#ifndef FL2_NO_STATS
+    if (cctx->params.collectStats)
+        time = UTIL_getTime();
+#else
+    (void)cctx;
+#endif
+    return time;
+}
+
+/* FL2_statsSpan() :
+ * Returns the microseconds since `start` if FL2_p_collectStats is set, otherwise 0. */
+static U64 FL2_statsSpan(const FL2_CCtx* const cctx, UTIL_time_t const start)
+{
+#ifndef FL2_NO_STATS
+    if (cctx->params.collectStats)
+        return UTIL_clockSpanMicro(start);
+#else
+    (void)cctx;
+    (void)start;
+#endif
+    return 0;
+}
+
+/* FL2_jobWorked() :
+ * Adds the work which began at `start` to the busy time of the job and to *total. */
+static void FL2_jobWorked(FL2_job* const job, UTIL_time_t const start, unsigned long long* const total)
+{
+    U64 const span = FL2_statsSpan(job->cctx, start);
+    job->busy += span;
+    *total += span;
+}
+
+/* FL2_endPhase() :
+ * Adds the phase which began at `start` to *total, and the part of it each of the first
+ * nbJobs jobs spent waiting for the others to its idle time. */
+static void FL2_endPhase(FL2_CCtx* const cctx, UTIL_time_t const start, unsigned long long* const total, size_t const nbJobs)
+{
+    U64 const span = FL2_statsSpan(cctx, start);
+
+    *total += span;
+    for (size_t u = 0; u < nbJobs; ++u) {
+        U64 const idle = span - MIN(span, cctx->jobs[u].busy);
+        cctx->jobs[u].stats.idleTime += idle;
+        cctx->stats.idleTime += idle;
+        cctx->jobs[u].busy = 0;
+    }
+}
+
 /* FL2_buildRadixTable() : FL2POOL_function type */
 static void FL2_buildRadixTable(void* const jobDescription, size_t n)
 {
-    const FL2_job* const job = (FL2_job*)jobDescription;
+    FL2_job* const job = (FL2_job*)jobDescription;
     FL2_CCtx* const cctx = job->cctx;
+    UTIL_time_t const start = FL2_statsClock(cctx);
 
     RMF_buildTable(cctx->matchTable, n, 1, cctx->curBlock, NULL, NULL, 0, 0);
+    FL2_jobWorked(job, start, &job->stats.buildTime);
+}
+
+#ifndef FL2_SINGLETHREAD
+/* FL2_initRadixTable() : FL2POOL_function type */
+static void FL2_initRadixTable(void* const jobDescription, size_t n)
+{
+    const FL2_job* const job = (FL2_job*)jobDescription;
+    FL2_CCtx* const cctx = job->cctx;
+
+    RMF_initTableJob(cctx->initTable, n, cctx->initThreads, cctx->initBlock.data, cctx->initBlock.start, cctx->initBlock.end);
 }
+#endif
 
 /* FL2_compressRadixChunk() : FL2POOL_function type */
 static void FL2_compressRadixChunk(void* const jobDescription, size_t n)
 {
-    const FL2_job* const job = (FL2_job*)jobDescription;
+    FL2_job* const job = (FL2_job*)jobDescription;
     FL2_CCtx* const cctx = job->cctx;
+    UTIL_time_t const start = FL2_statsClock(cctx);
 
-    cctx->jobs[n].cSize = FL2_lzma2Encode(cctx->jobs[n].enc, cctx->matchTable, job->block, &cctx->params.cParams, NULL, NULL, 0, 0);
+    cctx->jobs[n].cSize = FL2_lzma2Encode(cctx->jobs[n].enc, cctx->matchTable, job->block, &cctx->params.cParams, job->dst, job->dstCapacity, NULL, NULL, 0, 0);
+    FL2_jobWorked(job, start, &job->stats.encodeTime);
 }
 
 static int FL2_initEncoders(FL2_CCtx* const cctx)
 {
-    for(unsigned u = 0; u < cctx->jobCount; ++u) {
+    for(unsigned u = 0; u < cctx->threadLimit; ++u) {
         if (FL2_lzma2HashAlloc(cctx->jobs[u].enc, &cctx->params.cParams) != 0)
             return 1;
     }
     return 0;
 }
 
-static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, FL2_progressFn progress, void* opaque)
+static size_t FL2_writeSeekEntry(FL2_CCtx* const cctx, U64 const uPos, U64 const cPos)
+{
+    /* always leave room for the footer */
+    if (cctx->seek_size + FL2_SEEK_ENTRY_SIZE + FL2_SEEK_FOOTER_SIZE > cctx->seek_cap) {
+        size_t const cap = cctx->seek_cap ? cctx->seek_cap * 2 : FL2_SEEK_ENTRY_SIZE * 64;
+        BYTE* const table = realloc(cctx->seek_table, cap);
+        if (table == NULL)
+            return FL2_ERROR(memory_allocation);
+        cctx->seek_table = table;
+        cctx->seek_cap = cap;
+    }
+    MEM_writeLE64(cctx->seek_table + cctx->seek_size, uPos);
+    MEM_writeLE64(cctx->seek_table + cctx->seek_size + 8, cPos);
+    cctx->seek_size += FL2_SEEK_ENTRY_SIZE;
+    return 0;
+}
+
+/* FL2_recordSeekPoint() :
+ * Adds a seek table entry if the block just encoded began with a dictionary reset
+ * or is the first of the frame, which may be primed with a preset dictionary,
+ * and advances the frame totals. */
+static size_t FL2_recordSeekPoint(FL2_CCtx* const cctx, size_t const nbThreads)
+{
+    if (cctx->curBlock.start == 0 || cctx->in_total == 0)
+        CHECK_F(FL2_writeSeekEntry(cctx, cctx->in_total, cctx->out_total));
+
+    cctx->in_total += cctx->curBlock.end - cctx->curBlock.start;
+    for (size_t u = 0; u < nbThreads; ++u) {
+        if (FL2_isError(cctx->jobs[u].cSize))
+            return cctx->jobs[u].cSize;
+        cctx->out_total += cctx->jobs[u].cSize;
+    }
+    return 0;
+}
+
+/* FL2_finishSeekTable() :
+ * Adds the end entry and footer. Returns the table size. */
+static size_t FL2_finishSeekTable(FL2_CCtx* const cctx)
+{
+    CHECK_F(FL2_writeSeekEntry(cctx, cctx->in_total, cctx->out_total));
+    MEM_writeLE32(cctx->seek_table + cctx->seek_size, (U32)(cctx->seek_size / FL2_SEEK_ENTRY_SIZE));
+    MEM_writeLE32(cctx->seek_table + cctx->seek_size + 4, FL2_SEEK_TABLE_MAGIC);
+    cctx->seek_size += FL2_SEEK_FOOTER_SIZE;
+    return cctx->seek_size;
+}
+
+/* FL2_initMatchTable() :
+ * Creates or reuses *tbl for the block and initializes it to length 2.
+ * Returns the amount of initialization done, or an error code. */
+static size_t FL2_initMatchTable(FL2_CCtx* const cctx, FL2_matchTable** const tbl, FL2_dataBlock const block)
+{
+    /* Free unsuitable match table before reallocating anything else */
+    if (*tbl && (!RMF_compatibleParameters(*tbl, &cctx->params.rParams, block.end)
+        || RMF_threadCount(*tbl) > cctx->threadLimit)) {
+        RMF_freeMatchTable(*tbl);
+        *tbl = NULL;
+    }
+
+    if(FL2_initEncoders(cctx) != 0) /* Create hash objects together, leaving the (large) match table last */
+        return FL2_ERROR(memory_allocation);
+
+    if (!*tbl) {
+        *tbl = RMF_createMatchTable(&cctx->params.rParams, block.end, cctx->threadLimit, cctx->customMem);
+        if (*tbl == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+    else {
+        DEBUGLOG(5, "Have compatible match table");
+        RMF_applyParameters(*tbl, &cctx->params.rParams, block.end);
+    }
+
+    /* update largest dict size used */
+    cctx->dictMax = MAX(cctx->dictMax, block.end);
+
+    if (cctx->params.cParams.random_filter) {
+        cctx->filter_total += block.end - block.start;
+        cctx->filter_random += RMF_filterRandom(*tbl, block.data, block.start, block.end, 1);
+    }
+    else {
+        RMF_filterRandom(*tbl, block.data, block.start, block.end, 0);
+    }
+
+    /* initialize to length 2 */
+#ifndef FL2_SINGLETHREAD
+    cctx->initThreads = RMF_initThreadCount(*tbl, block.end);
+    if (cctx->initThreads > 1) {
+        cctx->initTable = *tbl;
+        cctx->initBlock = block;
+        for (size_t u = 1; u < cctx->initThreads; ++u) {
+            FL2POOL_add(cctx->factory, FL2_initRadixTable, &cctx->jobs[u], u);
+        }
+        RMF_initTableJob(*tbl, 0, cctx->initThreads, block.data, block.start, block.end);
+        FL2POOL_waitAll(cctx->factory);
+        return RMF_initTableMerge(*tbl, cctx->initThreads);
+    }
+#endif
+    return RMF_initTable(*tbl, block.data, block.start, block.end);
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_balanceSlices() :
+ * Moves the slice boundaries to MIN_BYTES_PER_THREAD units of curBlock so each job gets an
+ * equal share of the estimated encoding cost, taken from a sample of each unit in the built
+ * match table. Incompressible data is cheap to encode and text is expensive, so equal byte
+ * ranges leave threads idle. Keeps the equal slices if the cost buffer cannot be allocated. */
+static void FL2_balanceSlices(FL2_CCtx* const cctx, const FL2_matchTable* const tbl, size_t const nbThreads)
+{
+    size_t const start = cctx->curBlock.start;
+    size_t const end = cctx->curBlock.end;
+    size_t const nbUnits = (end - start + MIN_BYTES_PER_THREAD - 1) / MIN_BYTES_PER_THREAD;
+    U64 total = 0;
+    U64 sum = 0;
+    size_t slice = 1;
+
+    if (nbUnits > cctx->slice_cost_cap) {
+        FL2_free(cctx->slice_cost, cctx->customMem);
+        cctx->slice_cost = FL2_malloc(nbUnits * sizeof(U32), cctx->customMem);
+        cctx->slice_cost_cap = (cctx->slice_cost != NULL) ? nbUnits : 0;
+        if (cctx->slice_cost == NULL)
+            return;
+    }
+    for (size_t i = 0; i < nbUnits; ++i) {
+        size_t const unit_start = start + i * MIN_BYTES_PER_THREAD;
+        cctx->slice_cost[i] = (U32)FL2_lzma2EstimateCost(tbl, cctx->curBlock, unit_start,
+            MIN(unit_start + SLICE_COST_SAMPLE, end), cctx->params.cParams.strategy);
+        total += cctx->slice_cost[i];
+    }
+    /* Cut after the unit which brings the running cost to the next share of the total, */
+    /* leaving at least one unit for each remaining slice */
+    for (size_t i = 0; slice < nbThreads; ++i) {
+        sum += cctx->slice_cost[i];
+        if (sum * nbThreads >= total * slice || nbUnits - i - 1 == nbThreads - slice) {
+            size_t const boundary = start + (i + 1) * MIN_BYTES_PER_THREAD;
+            cctx->jobs[slice - 1].block.end = boundary;
+            cctx->jobs[slice].block.start = boundary;
+            ++slice;
+        }
+    }
+    DEBUGLOG(5, "FL2_balanceSlices : %u units, total cost %u", (U32)nbUnits, (U32)total);
+}
+
+#endif
+
+/* FL2_sliceCurBlock() :
+ * Divides curBlock between the encoder jobs. The match table must be built.
+ * Returns the number of slices. */
+static size_t FL2_sliceCurBlock(FL2_CCtx* const cctx, const FL2_matchTable* const tbl)
+{
+    size_t const encodeSize = cctx->curBlock.end - cctx->curBlock.start;
+#ifndef FL2_SINGLETHREAD
+    size_t nbThreads = MIN(cctx->threadLimit, encodeSize / MIN_BYTES_PER_THREAD);
+    nbThreads += !nbThreads;
+#else
+    size_t const nbThreads = 1;
+#endif
+    size_t sliceStart = cctx->curBlock.start;
+    size_t const sliceSize = encodeSize / nbThreads;
+
+    cctx->jobs[0].block.data = cctx->curBlock.data;
+    cctx->jobs[0].block.start = sliceStart;
+    cctx->jobs[0].block.end = sliceStart + sliceSize;
+    cctx->jobs[0].dst = NULL;
+    cctx->jobs[0].dstCapacity = 0;
+
+    for (size_t u = 1; u < nbThreads; ++u) {
+        sliceStart += sliceSize;
+        cctx->jobs[u].block.data = cctx->curBlock.data;
+        cctx->jobs[u].block.start = sliceStart;
+        cctx->jobs[u].block.end = sliceStart + sliceSize;
+        cctx->jobs[u].dst = NULL;
+        cctx->jobs[u].dstCapacity = 0;
+    }
+    cctx->jobs[nbThreads - 1].block.end = cctx->curBlock.end;
+
+#ifndef FL2_SINGLETHREAD
+    if (nbThreads > 1)
+        FL2_balanceSlices(cctx, tbl, nbThreads);
+#else
+    (void)tbl;
+#endif
+    return nbThreads;
+}
+
+/* FL2_assignDirectOutput() :
+ * Gives each slice a region of dst large enough for its worst-case output so the
+ * encoders can write there instead of staging in the match table. Slices keep
+ * the match table if dst cannot hold the sum of the bounds. */
+static void FL2_assignDirectOutput(FL2_CCtx* const cctx, size_t const nbThreads, BYTE* dst, size_t dstCapacity)
+{
+    size_t total = 0;
+
+    for (size_t u = 0; u < nbThreads; ++u)
+        total += FL2_COMPRESSBOUND(cctx->jobs[u].block.end - cctx->jobs[u].block.start);
+    if (total > dstCapacity)
+        return;
+
+    for (size_t u = 0; u < nbThreads; ++u) {
+        size_t const bound = FL2_COMPRESSBOUND(cctx->jobs[u].block.end - cctx->jobs[u].block.start);
+        cctx->jobs[u].dst = dst;
+        cctx->jobs[u].dstCapacity = bound;
+        dst += bound;
+    }
+}
+
+/* FL2_hashBlock() :
+ * Adds the new data of `block` to the frame checksum, if one is being calculated, or
+ * calculates the check of the .xz block.
+ * The hashes and CRCs are serial, so this runs on one thread alongside the matchfinder. */
+static void FL2_hashBlock(FL2_CCtx* const cctx, FL2_dataBlock const block)
+{
+    if (cctx->xz_check != 0) {
+        cctx->xz_check_value = FL2_xzCheck(cctx->xz_check, block.data + block.start, block.end - block.start);
+        return;
+    }
+#ifndef NO_XXHASH
+    FL2_hashUpdate(&cctx->hash, block.data + block.start, block.end - block.start);
+#else
+    (void)block;
+#endif
+}
+
+/* FL2_endXzBlock() :
+ * Sets the header and tail of the .xz block holding the LZMA2 data of curBlock,
+ * which begins with a dictionary reset, and adds the block to the index. */
+static size_t FL2_endXzBlock(FL2_CCtx* const cctx, size_t const nbThreads)
+{
+    U64 const uSize = cctx->curBlock.end - cctx->curBlock.start;
+    U64 cSize = 1; /* end marker */
+
+    for (size_t u = 0; u < nbThreads; ++u) {
+        if (FL2_isError(cctx->jobs[u].cSize))
+            return cctx->jobs[u].cSize;
+        cSize += cctx->jobs[u].cSize;
+    }
+    cctx->xz_head_size = FL2_xzBlockHeaderSize(uSize);
+    FL2_xzWriteBlockHeader(cctx->xz_head, cctx->xz_head_size, cSize, uSize, FL2_getDictSizeProp(cctx->curBlock.end));
+    cctx->xz_tail_size = FL2_xzWriteBlockTail(cctx->xz_tail, cSize, cctx->xz_check, cctx->xz_check_value);
+
+    DEBUGLOG(5, "FL2_endXzBlock : %u bytes => %u", (U32)uSize, (U32)cSize);
+
+    return FL2_xzIndexAdd(&cctx->xz_index, cctx->xz_head_size + cSize + FL2_xzCheckSize(cctx->xz_check), uSize);
+}
+
+/* FL2_findLongMatches() :
+ * Runs the long-distance matcher over the new data of curBlock if FL2_compressCCtx() enabled it.
+ * Returns the number of matches or an error code. */
+static size_t FL2_findLongMatches(FL2_CCtx* const cctx)
+{
+    size_t count;
+
+    if (!cctx->ldm_active)
+        return 0;
+    count = FL2_ldmFindMatches(cctx->ldm, cctx->curBlock);
+    if (!FL2_isError(count) && count != 0)
+        cctx->dictMax = MAX(cctx->dictMax, (size_t)FL2_ldmMaxDist(cctx->ldm) + 1);
+    return count;
+}
+
+/* FL2_setLongMatches() :
+ * Passes the long matches of curBlock to the encoders, or clears them. Windows the random
+ * filter excluded are encoded where a long match covers them. */
+static void FL2_setLongMatches(FL2_CCtx* const cctx, size_t const count)
+{
+    const FL2_longMatch* const matches = (count != 0) ? FL2_ldmMatches(cctx->ldm) : NULL;
+    U32 const max_dist = (count != 0) ? FL2_ldmMaxDist(cctx->ldm) : 0;
+
+    for (size_t n = 0; n < count; ++n)
+        RMF_unmarkRandom(cctx->matchTable, matches[n].pos, matches[n].pos + matches[n].length);
+    for (unsigned u = 0; u < cctx->jobCount; ++u)
+        FL2_lzma2SetLongMatches(cctx->jobs[u].enc, matches, count, max_dist);
+}
+
+static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, BYTE* const dst, size_t const dstCapacity, FL2_progressFn progress, void* opaque)
 {
     size_t const encodeSize = (cctx->curBlock.end - cctx->curBlock.start);
     size_t init_done;
@@ -232,18 +769,18 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, FL2_progressFn progress
     int err = 0;
 #ifndef FL2_SINGLETHREAD
     size_t mfThreads = cctx->curBlock.end / RMF_MIN_BYTES_PER_THREAD;
-    size_t nbThreads = MIN(cctx->jobCount, encodeSize / MIN_BYTES_PER_THREAD);
-    nbThreads += !nbThreads;
 #else
     size_t mfThreads = 1;
-    size_t nbThreads = 1;
 #endif
+    size_t nbThreads;
+    size_t longCount;
+    UTIL_time_t phase = FL2_statsClock(cctx);
 
     if (rmf_weight >= 20) {
         rmf_weight = depth_weight * (rmf_weight - 10) + (rmf_weight - 19) * 12;
         if (cctx->params.cParams.strategy == 0)
             enc_weight = 20;
-        else if (cctx->params.cParams.strategy == 1)
+        else if (cctx->params.cParams.strategy == 1 || cctx->params.cParams.strategy == FL2_adaptive)
             enc_weight = 50;
         else
             enc_weight = 60 + cctx->params.cParams.second_dict_bits + ZSTD_highbit32(cctx->params.cParams.fast_length) * 3U;
@@ -255,63 +792,40 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, FL2_progressFn progress
         enc_weight = 8;
     }
 
-    DEBUGLOG(5, "FL2_compressCurBlock : %u threads, %u start, %u bytes", (U32)nbThreads, (U32)cctx->curBlock.start, (U32)encodeSize);
-
-    /* Free unsuitable match table before reallocating anything else */
-    if (cctx->matchTable && !RMF_compatibleParameters(cctx->matchTable, &cctx->params.rParams, cctx->curBlock.end)) {
-        RMF_freeMatchTable(cctx->matchTable);
-        cctx->matchTable = NULL;
-    }
-
-    if(FL2_initEncoders(cctx) != 0) /* Create hash objects together, leaving the (large) match table last */
-        return FL2_ERROR(memory_allocation);
-
-    if (!cctx->matchTable) {
-        cctx->matchTable = RMF_createMatchTable(&cctx->params.rParams, cctx->curBlock.end, cctx->jobCount);
-        if (cctx->matchTable == NULL)
-            return FL2_ERROR(memory_allocation);
-    }
-    else {
-        DEBUGLOG(5, "Have compatible match table");
-        RMF_applyParameters(cctx->matchTable, &cctx->params.rParams, cctx->curBlock.end);
-    }
-
-    {   size_t sliceStart = cctx->curBlock.start;
-        size_t sliceSize = encodeSize / nbThreads;
-        cctx->jobs[0].block.data = cctx->curBlock.data;
-        cctx->jobs[0].block.start = sliceStart;
-        cctx->jobs[0].block.end = sliceStart + sliceSize;
+    DEBUGLOG(5, "FL2_compressCurBlock : %u start, %u bytes", (U32)cctx->curBlock.start, (U32)encodeSize);
 
-        for (size_t u = 1; u < nbThreads; ++u) {
-            sliceStart += sliceSize;
-            cctx->jobs[u].block.data = cctx->curBlock.data;
-            cctx->jobs[u].block.start = sliceStart;
-            cctx->jobs[u].block.end = sliceStart + sliceSize;
-        }
-        cctx->jobs[nbThreads - 1].block.end = cctx->curBlock.end;
-    }
-
-    /* update largest dict size used */
-    cctx->dictMax = MAX(cctx->dictMax, cctx->curBlock.end);
+    init_done = FL2_initMatchTable(cctx, &cctx->matchTable, cctx->curBlock);
+    if (FL2_isError(init_done))
+        return init_done;
+    cctx->stats.initTime += FL2_statsSpan(cctx, phase);
+    FL2_STATS_ADD(cctx->stats.blocks, 1);
+    FL2_STATS_ADD(cctx->stats.repeatBytes, init_done);
 
-    /* initialize to length 2 */
-    init_done = RMF_initTable(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end);
+    phase = FL2_statsClock(cctx);
 
 #ifndef FL2_SINGLETHREAD
     mfThreads = MIN(RMF_threadCount(cctx->matchTable), mfThreads);
     for (size_t u = 1; u < mfThreads; ++u) {
-		FL2POOL_add(cctx->factory, FL2_buildRadixTable, &cctx->jobs[u], u);
+        FL2POOL_add(cctx->factory, FL2_buildRadixTable, &cctx->jobs[u], u);
     }
 #endif
+    /* the matchfinder threads share the work dynamically, so this thread joins them late */
+    FL2_hashBlock(cctx, cctx->curBlock);
+    longCount = FL2_findLongMatches(cctx);
 
     err = RMF_buildTable(cctx->matchTable, 0, mfThreads > 1, cctx->curBlock, progress, opaque, rmf_weight, init_done);
+    FL2_jobWorked(&cctx->jobs[0], phase, &cctx->jobs[0].stats.buildTime);
 
 #ifndef FL2_SINGLETHREAD
 
     FL2POOL_waitAll(cctx->factory);
+    FL2_endPhase(cctx, phase, &cctx->stats.buildTime, mfThreads);
 
     if (err)
         return FL2_ERROR(canceled);
+    CHECK_F(longCount);
+    if (cctx->ldm_active)
+        FL2_setLongMatches(cctx, longCount);
 
 #ifdef RMF_CHECK_INTEGRITY
     err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
@@ -319,34 +833,282 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, FL2_progressFn progress
         return FL2_ERROR(internal);
 #endif
 
+    nbThreads = FL2_sliceCurBlock(cctx, cctx->matchTable);
+    if (dst != NULL)
+        FL2_assignDirectOutput(cctx, nbThreads, dst, dstCapacity);
+
+    phase = FL2_statsClock(cctx);
     for (size_t u = 1; u < nbThreads; ++u) {
-		FL2POOL_add(cctx->factory, FL2_compressRadixChunk, &cctx->jobs[u], u);
+        FL2POOL_add(cctx->factory, FL2_compressRadixChunk, &cctx->jobs[u], u);
     }
 
-    cctx->jobs[0].cSize = FL2_lzma2Encode(cctx->jobs[0].enc, cctx->matchTable, cctx->jobs[0].block, &cctx->params.cParams, progress, opaque, (rmf_weight * encodeSize) >> 4, enc_weight * (U32)nbThreads);
+    {   UTIL_time_t const start = FL2_statsClock(cctx);
+        cctx->jobs[0].cSize = FL2_lzma2Encode(cctx->jobs[0].enc, cctx->matchTable, cctx->jobs[0].block, &cctx->params.cParams, cctx->jobs[0].dst, cctx->jobs[0].dstCapacity, progress, opaque, (rmf_weight * encodeSize) >> 4, enc_weight * (U32)nbThreads);
+        FL2_jobWorked(&cctx->jobs[0], start, &cctx->jobs[0].stats.encodeTime);
+    }
     FL2POOL_waitAll(cctx->factory);
+    FL2_endPhase(cctx, phase, &cctx->stats.encodeTime, nbThreads);
 
 #else /* FL2_SINGLETHREAD */
 
+    FL2_endPhase(cctx, phase, &cctx->stats.buildTime, 1);
     if (err)
         return FL2_ERROR(canceled);
+    CHECK_F(longCount);
+    if (cctx->ldm_active)
+        FL2_setLongMatches(cctx, longCount);
 
 #ifdef RMF_CHECK_INTEGRITY
     err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
     if (err)
         return FL2_ERROR(internal);
 #endif
-    cctx->jobs[0].cSize = FL2_lzma2Encode(cctx->jobs[0].enc, cctx->matchTable, cctx->jobs[0].block, &cctx->params.cParams, progress, opaque, (rmf_weight * encodeSize) >> 4, enc_weight);
+    nbThreads = FL2_sliceCurBlock(cctx, cctx->matchTable);
+    if (dst != NULL)
+        FL2_assignDirectOutput(cctx, nbThreads, dst, dstCapacity);
+
+    phase = FL2_statsClock(cctx);
+    cctx->jobs[0].cSize = FL2_lzma2Encode(cctx->jobs[0].enc, cctx->matchTable, cctx->jobs[0].block, &cctx->params.cParams, cctx->jobs[0].dst, cctx->jobs[0].dstCapacity, progress, opaque, (rmf_weight * encodeSize) >> 4, enc_weight);
+    FL2_jobWorked(&cctx->jobs[0], phase, &cctx->jobs[0].stats.encodeTime);
+    FL2_endPhase(cctx, phase, &cctx->stats.encodeTime, 1);
 
 #endif
 
+    if (cctx->xz_check != 0) {
+        CHECK_F(FL2_endXzBlock(cctx, nbThreads));
+    }
+    else if (cctx->params.seekTable && !cctx->params.omitProp) {
+        CHECK_F(FL2_recordSeekPoint(cctx, nbThreads));
+    }
+
     return nbThreads;
 }
 
+/* FL2_pipelineJob() : FL2POOL_function type
+ * Encodes a slice of curBlock, then helps to build the match table for pipeBlock.
+ * Job 0 adds pipeBlock to the frame checksum first.
+ * The matchfinder threads take lists from a shared index, so any thread finishing
+ * its slice early keeps working. */
+static void FL2_pipelineJob(void* const jobDescription, size_t n)
+{
+    FL2_job* const job = (FL2_job*)jobDescription;
+    FL2_CCtx* const cctx = job->cctx;
+
+    UTIL_time_t start = FL2_statsClock(cctx);
+
+    if (n < cctx->encThreads) {
+        job->cSize = FL2_lzma2Encode(job->enc, cctx->matchTable, job->block, &cctx->params.cParams, NULL, 0, NULL, NULL, 0, 0);
+        FL2_jobWorked(job, start, &job->stats.encodeTime);
+        start = FL2_statsClock(cctx);
+    }
+    if (n == 0 && cctx->pipeThreads)
+        FL2_hashBlock(cctx, cctx->pipeBlock);
+    if (n < cctx->pipeThreads) {
+        RMF_buildTable(cctx->pipeTable, n, cctx->pipeThreads > 1, cctx->pipeBlock, NULL, NULL, 0, 0);
+        FL2_jobWorked(job, start, &job->stats.buildTime);
+    }
+}
+
+/* FL2_compressPipelined() :
+ * Encodes curBlock, whose table in matchTable is already built, if `encode` is set,
+ * and builds pipeTable for pipeBlock if `build` is set, in a single parallel phase.
+ * Returns the number of encoded slices. */
+static size_t FL2_compressPipelined(FL2_CCtx* const cctx, int const encode, int const build)
+{
+    size_t nbJobs;
+    UTIL_time_t phase;
+
+    cctx->encThreads = encode ? FL2_sliceCurBlock(cctx, cctx->matchTable) : 0;
+    cctx->pipeThreads = 0;
+
+    if (build) {
+        size_t init_done;
+
+        phase = FL2_statsClock(cctx);
+        init_done = FL2_initMatchTable(cctx, &cctx->pipeTable, cctx->pipeBlock);
+        if (FL2_isError(init_done))
+            return init_done;
+        cctx->stats.initTime += FL2_statsSpan(cctx, phase);
+        FL2_STATS_ADD(cctx->stats.blocks, 1);
+        FL2_STATS_ADD(cctx->stats.repeatBytes, init_done);
+#ifndef FL2_SINGLETHREAD
+        cctx->pipeThreads = MIN(RMF_threadCount(cctx->pipeTable), cctx->pipeBlock.end / RMF_MIN_BYTES_PER_THREAD);
+        cctx->pipeThreads += !cctx->pipeThreads;
+#else
+        cctx->pipeThreads = 1;
+#endif
+    }
+    nbJobs = MAX(cctx->encThreads, cctx->pipeThreads);
+
+    DEBUGLOG(5, "FL2_compressPipelined : %u encoders, %u matchfinders", (U32)cctx->encThreads, (U32)cctx->pipeThreads);
+
+    phase = FL2_statsClock(cctx);
+#ifndef FL2_SINGLETHREAD
+    for (size_t u = 1; u < nbJobs; ++u) {
+        FL2POOL_add(cctx->factory, FL2_pipelineJob, &cctx->jobs[u], u);
+    }
+#endif
+    if (nbJobs)
+        FL2_pipelineJob(&cctx->jobs[0], 0);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->factory);
+#endif
+    FL2_endPhase(cctx, phase, encode ? &cctx->stats.encodeTime : &cctx->stats.buildTime, nbJobs);
+
+#ifdef RMF_CHECK_INTEGRITY
+    if (build && RMF_integrityCheck(cctx->pipeTable, cctx->pipeBlock.data, cctx->pipeBlock.start, cctx->pipeBlock.end, cctx->params.rParams.depth))
+        return FL2_ERROR(internal);
+#endif
+
+    if (encode && cctx->params.seekTable && !cctx->params.omitProp)
+        CHECK_F(FL2_recordSeekPoint(cctx, cctx->encThreads));
+
+    return cctx->encThreads;
+}
+
 FL2LIB_API void FL2LIB_CALL FL2_beginFrame(FL2_CCtx* const cctx)
 {
     cctx->dictMax = 0;
     cctx->block_total = 0;
+    cctx->seek_size = 0;
+    cctx->xz_check = 0;
+    cctx->xz_head_size = 0;
+    cctx->xz_tail_size = 0;
+    FL2_xzIndexReset(&cctx->xz_index);
+    cctx->in_total = 0;
+    cctx->out_total = 0;
+    cctx->filter_total = 0;
+    cctx->filter_random = 0;
+    memset(&cctx->stats, 0, sizeof(cctx->stats));
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        memset(&cctx->jobs[u].stats, 0, sizeof(cctx->jobs[u].stats));
+        cctx->jobs[u].busy = 0;
+        FL2_lzma2ResetStats(cctx->jobs[u].enc);
+    }
+#ifndef NO_XXHASH
+    cctx->hash.type = FL2_HASH_NONE;
+#endif
+}
+
+/* FL2_beginHash() :
+ * Starts the frame checksum if one is configured. Blocks are added to it as they are compressed,
+ * and the property byte and the end of the frame follow its type. A .xz stream has a check of
+ * each block in place of the checksum. */
+static size_t FL2_beginHash(FL2_CCtx* const cctx)
+{
+    cctx->xz_check = FL2_xzCheckId(cctx->params.xzFormat);
+#ifndef NO_XXHASH
+    if (FL2_hashReset(&cctx->hash, (cctx->params.omitProp || cctx->xz_check) ? FL2_HASH_NONE : cctx->params.doXXH))
+        return FL2_ERROR(memory_allocation);
+#endif
+    return 0;
+}
+
+/* FL2_useLongMatcher() :
+ * The long-distance matcher is used in one-shot compression if its window is larger than
+ * the dictionary and the source doesn't fit in one block. */
+static int FL2_useLongMatcher(const FL2_CCtx* const cctx, size_t const srcSize)
+{
+    return cctx->params.longWindowLog > cctx->params.rParams.dictionary_log
+        && srcSize > ((size_t)1 << cctx->params.rParams.dictionary_log)
+        && cctx->dict_size == 0
+        && cctx->xz_check == 0;
+}
+
+/* FL2_frameMemoryUsage() :
+ * Memory needed for a frame using the current parameters and threadLimit, with `buffers`
+ * dictionary-sized input buffers, and the dictionary reduced to fit srcSize if it is known. */
+static size_t FL2_frameMemoryUsage(const FL2_CCtx* const cctx, size_t const srcSize, unsigned const buffers)
+{
+    const RMF_parameters* const rParams = &cctx->params.rParams;
+    unsigned dictLog = rParams->dictionary_log;
+    size_t size;
+
+    if (srcSize != 0 && srcSize < ((size_t)1 << dictLog))
+        dictLog = MAX(ZSTD_highbit32((U32)srcSize) + 1, FL2_DICTLOG_MIN);
+    size = RMF_memoryUsage(dictLog, rParams->match_buffer_log, rParams->depth, cctx->threadLimit)
+        + FL2_lzma2MemoryUsage(cctx->params.cParams.second_dict_bits, cctx->params.cParams.strategy, cctx->threadLimit)
+        + ((size_t)buffers << dictLog);
+    if (cctx->params.pipelineDepth && buffers)
+        size += RMF_memoryUsage(dictLog, rParams->match_buffer_log, rParams->depth, cctx->threadLimit);
+    if (!buffers && FL2_useLongMatcher(cctx, srcSize))
+        size += FL2_ldmMemoryUsage(cctx->params.longWindowLog);
+    return size;
+}
+
+/* FL2_reduceForMemory() :
+ * Takes one step down in the order of FL2_p_memoryPriority. Returns 0 if nothing can be reduced. */
+static int FL2_reduceForMemory(FL2_CCtx* const cctx)
+{
+    RMF_parameters* const rParams = &cctx->params.rParams;
+    FL2_lzma2Parameters* const cParams = &cctx->params.cParams;
+    int const reduceThreads = cctx->threadLimit > 1;
+    /* the hash chains are only allocated by the ultra strategy */
+    int const reduceChain = cParams->strategy == FL2_ultra && cParams->second_dict_bits > FL2_CHAINLOG_MIN;
+    /* the structured table takes 5 bytes per position instead of 4. Deep searches in dictionaries
+     * of 16 MiB or less use the compact table, which is already 4 bytes. */
+    int const reduceDepth = rParams->depth > BITPACK_MAX_LENGTH
+        && rParams->dictionary_log > COMPACT_LINK_BITS && rParams->dictionary_log <= RADIX_LINK_BITS;
+    int const reduceDict = rParams->dictionary_log > FL2_DICTLOG_MIN;
+
+    if (cctx->params.memoryPriority == 0 && reduceThreads) {
+        --cctx->threadLimit;
+    }
+    else if (reduceChain) {
+        --cParams->second_dict_bits;
+    }
+    else if (reduceDepth) {
+        rParams->depth = BITPACK_MAX_LENGTH;
+    }
+    else if (reduceDict) {
+        --rParams->dictionary_log;
+    }
+    else if (reduceThreads) {
+        --cctx->threadLimit;
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+/* FL2_fitMemoryLimit() :
+ * Reduces the parameters until a frame of srcSize bytes (0 if unknown) with `buffers`
+ * input buffers fits in FL2_p_memoryLimit. */
+static size_t FL2_fitMemoryLimit(FL2_CCtx* const cctx, size_t const srcSize, unsigned const buffers)
+{
+    U64 const limit = (U64)cctx->params.memoryLimit << 20;
+
+    cctx->threadLimit = cctx->jobCount;
+    if (limit == 0)
+        return 0;
+    while (FL2_frameMemoryUsage(cctx, srcSize, buffers) > limit) {
+        if (!FL2_reduceForMemory(cctx))
+            return FL2_ERROR(memoryLimit_exceeded);
+    }
+    DEBUGLOG(4, "FL2_fitMemoryLimit : %u threads, dict log %u, depth %u, chain log %u", cctx->threadLimit,
+        cctx->params.rParams.dictionary_log, cctx->params.rParams.depth, cctx->params.cParams.second_dict_bits);
+    return 0;
+}
+
+/* FL2_advanceBlock() :
+ * Moves curBlock to the next window of the source after compression, retaining
+ * the overlap section or periodically resetting the dictionary.
+ * `remaining` is the amount of source data not yet compressed. */
+static void FL2_advanceBlock(FL2_CCtx* const cctx, size_t const remaining)
+{
+    size_t const block_overlap = FL2_blockOverlap(cctx);
+
+    cctx->block_total += cctx->curBlock.end - cctx->curBlock.start;
+    if (cctx->params.rParams.block_size_log && cctx->block_total + MIN(cctx->curBlock.end - block_overlap, remaining) > ((U64)1 << cctx->params.rParams.block_size_log)) {
+        /* periodically reset the dictionary for mt decompression */
+        cctx->curBlock.start = 0;
+        cctx->block_total = 0;
+    }
+    else {
+        cctx->curBlock.start = block_overlap;
+    }
+    cctx->curBlock.data += cctx->curBlock.end - cctx->curBlock.start;
 }
 
 static size_t FL2_compressBlock(FL2_CCtx* const cctx,
@@ -358,7 +1120,6 @@ static size_t FL2_compressBlock(FL2_CCtx* const cctx,
     BYTE* dstBuf = dst;
     size_t outSize = 0;
     size_t const dictionary_size = (size_t)1 << cctx->params.rParams.dictionary_log;
-    size_t const block_overlap = OVERLAP_FROM_DICT_LOG(cctx->params.rParams.dictionary_log, cctx->params.rParams.overlap_fraction);
 
     if (srcStart >= srcEnd)
         return 0;
@@ -367,13 +1128,30 @@ static size_t FL2_compressBlock(FL2_CCtx* const cctx,
 
     while (srcStart < srcEnd) {
         size_t nbThreads;
+        size_t headSize;
 
         cctx->curBlock.end = cctx->curBlock.start + MIN(srcEnd - srcStart, dictionary_size - cctx->curBlock.start);
 
-        nbThreads = FL2_compressCurBlock(cctx, progress, opaque);
+        /* direct output leaves room for the .xz block header, which is written when the size is known */
+        headSize = (cctx->xz_check != 0) ? FL2_xzBlockHeaderSize(cctx->curBlock.end - cctx->curBlock.start) : 0;
+        if (writeFn == NULL && dstCapacity < headSize)
+            return FL2_ERROR(dstSize_tooSmall);
+
+        nbThreads = FL2_compressCurBlock(cctx, (writeFn == NULL) ? dstBuf + headSize : NULL, dstCapacity - headSize, progress, opaque);
         if (FL2_isError(nbThreads))
             return nbThreads;
 
+        if (writeFn != NULL && headSize != 0) {
+            if (writeFn(cctx->xz_head, headSize, opaque))
+                return FL2_ERROR(write_failed);
+            outSize += headSize;
+        }
+        else if (headSize != 0) {
+            memcpy(dstBuf, cctx->xz_head, headSize);
+            dstBuf += headSize;
+            dstCapacity -= headSize;
+        }
+
         for (size_t u = 0; u < nbThreads; ++u) {
             const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start);
 
@@ -390,36 +1168,211 @@ static size_t FL2_compressBlock(FL2_CCtx* const cctx,
                     return FL2_ERROR(write_failed);
                 outSize += cctx->jobs[u].cSize;
             }
+            else if (cctx->jobs[u].dst != NULL) {
+                /* compact the direct output of each slice */
+                if (cctx->jobs[u].dst != dstBuf)
+                    memmove(dstBuf, cctx->jobs[u].dst, cctx->jobs[u].cSize);
+                dstBuf += cctx->jobs[u].cSize;
+                dstCapacity -= cctx->jobs[u].cSize;
+            }
             else {
                 memcpy(dstBuf, outBuf, cctx->jobs[u].cSize);
                 dstBuf += cctx->jobs[u].cSize;
                 dstCapacity -= cctx->jobs[u].cSize;
             }
         }
-        srcStart += cctx->curBlock.end - cctx->curBlock.start;
-        cctx->block_total += cctx->curBlock.end - cctx->curBlock.start;
-        if (cctx->params.rParams.block_size_log && cctx->block_total + MIN(cctx->curBlock.end - block_overlap, srcEnd - srcStart) > ((U64)1 << cctx->params.rParams.block_size_log)) {
-            /* periodically reset the dictionary for mt decompression */
-            cctx->curBlock.start = 0;
-            cctx->block_total = 0;
-        }
-        else {
-            cctx->curBlock.start = block_overlap;
+        if (cctx->xz_check != 0) {
+            if (writeFn != NULL) {
+                if (writeFn(cctx->xz_tail, cctx->xz_tail_size, opaque))
+                    return FL2_ERROR(write_failed);
+                outSize += cctx->xz_tail_size;
+            }
+            else {
+                if (dstCapacity < cctx->xz_tail_size)
+                    return FL2_ERROR(dstSize_tooSmall);
+                memcpy(dstBuf, cctx->xz_tail, cctx->xz_tail_size);
+                dstBuf += cctx->xz_tail_size;
+                dstCapacity -= cctx->xz_tail_size;
+            }
         }
-        cctx->curBlock.data += cctx->curBlock.end - cctx->curBlock.start;
+        srcStart += cctx->curBlock.end - cctx->curBlock.start;
+        FL2_advanceBlock(cctx, srcEnd - srcStart);
     }
     return (writeFn != NULL) ? outSize : dstBuf - (const BYTE*)dst;
 }
 
+/* FL2_reserveDictBuffer() :
+ * Ensures dict_buf can hold `size` bytes, retaining the dictionary. */
+static size_t FL2_reserveDictBuffer(FL2_CCtx* const cctx, size_t const size)
+{
+    if (size > cctx->dict_cap) {
+        BYTE* const buf = FL2_malloc(size, cctx->customMem);
+        if (buf == NULL)
+            return FL2_ERROR(memory_allocation);
+        if (cctx->dict_size)
+            memcpy(buf, cctx->dict_buf, cctx->dict_size);
+        FL2_free(cctx->dict_buf, cctx->customMem);
+        cctx->dict_buf = buf;
+        cctx->dict_cap = size;
+    }
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_loadDictionary(FL2_CCtx* cctx, const void* dict, size_t dictSize)
+{
+    DEBUGLOG(4, "FL2_CCtx_loadDictionary : %u bytes", (U32)dictSize);
+
+    cctx->dict_size = 0;
+    if (dict == NULL || dictSize == 0)
+        return 0;
+    if (dictSize > ((size_t)1 << FL2_DICTLOG_MAX))
+        return FL2_ERROR(parameter_outOfBound);
+    CHECK_F(FL2_reserveDictBuffer(cctx, dictSize));
+    memcpy(cctx->dict_buf, dict, dictSize);
+    cctx->dict_size = dictSize;
+    return 0;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getRandomFilterStats(const FL2_CCtx* cctx, unsigned long long* bytesTested, unsigned long long* bytesRandom)
+{
+    if (bytesTested != NULL)
+        *bytesTested = cctx->filter_total;
+    if (bytesRandom != NULL)
+        *bytesRandom = cctx->filter_random;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getStats(const FL2_CCtx* cctx, FL2_compressStats* stats)
+{
+    *stats = cctx->stats;
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        const FL2_lzma2Stats* const enc = FL2_lzma2GetStats(cctx->jobs[u].enc);
+        stats->bytesCompressed += enc->compressed_bytes;
+        stats->bytesStored += enc->stored_bytes;
+        stats->matchCount += enc->match_count;
+        stats->matchBytes += enc->match_bytes;
+        stats->repMatchCount += enc->rep_count;
+        stats->repMatchBytes += enc->rep_bytes;
+    }
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getThreadStats(const FL2_CCtx* cctx, unsigned thread, FL2_threadStats* stats)
+{
+    if (thread >= cctx->jobCount)
+        return FL2_ERROR(parameter_outOfBound);
+    *stats = cctx->jobs[thread].stats;
+    return 0;
+}
+
+/* FL2_compressWithDictionary() :
+ * Compresses src primed with the preset dictionary. The first block is assembled in dict_buf
+ * after the dictionary, which begins the block as if it were the overlap of a previous one.
+ * The rest of the source is compressed in place. */
+static size_t FL2_compressWithDictionary(FL2_CCtx* const cctx,
+    const BYTE* const src, size_t const srcSize,
+    BYTE* const dst, size_t const dstCapacity)
+{
+    size_t const prefixMax = (size_t)1 << (cctx->params.rParams.dictionary_log - 1);
+    size_t prefix = cctx->dict_size;
+    size_t first;
+    size_t overlap;
+    size_t cSize;
+    size_t res;
+
+    /* Trim by a multiple of 16 bytes so the position states match those of the decoder,
+     * which counts positions from the start of the whole dictionary */
+    if (prefix > prefixMax)
+        prefix -= (prefix - prefixMax + 15) & ~(size_t)15;
+    first = MIN(srcSize, ((size_t)1 << cctx->params.rParams.dictionary_log) - prefix);
+
+    CHECK_F(FL2_reserveDictBuffer(cctx, cctx->dict_size + first));
+    memcpy(cctx->dict_buf + cctx->dict_size, src, first);
+
+    cSize = FL2_compressBlock(cctx, cctx->dict_buf + cctx->dict_size - prefix, prefix, prefix + first, dst, dstCapacity, NULL, NULL, NULL);
+    if (FL2_isError(cSize) || first == srcSize)
+        return cSize;
+
+    /* FL2_advanceBlock() selected the overlap or a dictionary reset */
+    overlap = MIN(cctx->curBlock.start, first);
+    res = FL2_compressBlock(cctx, src + first - overlap, overlap, srcSize - first + overlap, dst + cSize, dstCapacity - cSize, NULL, NULL, NULL);
+    if (FL2_isError(res))
+        return res;
+    return cSize + res;
+}
+
+/* FL2_beginLongMatcher() :
+ * Prepares the long-distance matcher for the source of a one-shot compression, if enabled.
+ * The whole source is in memory, so matches can reach before the current block. */
+static size_t FL2_beginLongMatcher(FL2_CCtx* const cctx, const void* const src, size_t const srcSize)
+{
+    unsigned const windowLog = cctx->params.longWindowLog;
+
+    if (!FL2_useLongMatcher(cctx, srcSize))
+        return 0;
+    if (cctx->ldm != NULL && FL2_ldmWindowLog(cctx->ldm) != windowLog) {
+        FL2_ldmFree(cctx->ldm);
+        cctx->ldm = NULL;
+    }
+    if (cctx->ldm == NULL) {
+        cctx->ldm = FL2_ldmCreate(windowLog, cctx->customMem);
+        if (cctx->ldm == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+    FL2_ldmReset(cctx->ldm, src);
+    cctx->ldm_active = 1;
+    return 0;
+}
+
+/* FL2_endLongMatcher() :
+ * Clears the long matches from the encoders, which are shared with the other modes. */
+static void FL2_endLongMatcher(FL2_CCtx* const cctx)
+{
+    if (!cctx->ldm_active)
+        return;
+    cctx->ldm_active = 0;
+    FL2_setLongMatches(cctx, 0);
+}
+
 static BYTE FL2_getProp(FL2_CCtx* cctx, size_t dictionary_size)
 {
     return FL2_getDictSizeProp(dictionary_size)
 #ifndef NO_XXHASH
-        | (BYTE)((cctx->params.doXXH != 0) << FL2_PROP_HASH_BIT)
+        | (BYTE)((cctx->hash.type != FL2_HASH_NONE) << FL2_PROP_HASH_BIT)
+        | (BYTE)((cctx->hash.type == FL2_HASH_XXH64) << FL2_PROP_HASH64_BIT)
 #endif
         ;
 }
 
+/* FL2_compressXz() :
+ * Writes src as a .xz stream with one block per dictionary-sized section.
+ * A preset dictionary cannot be expressed in the format. */
+static size_t FL2_compressXz(FL2_CCtx* const cctx,
+    BYTE* const dst, size_t const dstCapacity,
+    const void* const src, size_t const srcSize)
+{
+    size_t cSize;
+    size_t indexSize;
+
+    if (cctx->dict_size)
+        return FL2_ERROR(parameter_unsupported);
+    if (dstCapacity < XZ_STREAM_HEADER_SIZE)
+        return FL2_ERROR(dstSize_tooSmall);
+    FL2_xzWriteStreamHeader(dst, cctx->xz_check);
+
+    cSize = FL2_compressBlock(cctx, src, 0, srcSize, dst + XZ_STREAM_HEADER_SIZE, dstCapacity - XZ_STREAM_HEADER_SIZE, NULL, NULL, NULL);
+    if (FL2_isError(cSize))
+        return cSize;
+    cSize += XZ_STREAM_HEADER_SIZE;
+
+    indexSize = FL2_xzIndexFinish(&cctx->xz_index, cctx->xz_check);
+    if (FL2_isError(indexSize))
+        return indexSize;
+    DEBUGLOG(5, "Writing index : %u blocks, %u bytes", (U32)cctx->xz_index.count, (U32)indexSize);
+    if (dstCapacity - cSize < indexSize)
+        return FL2_ERROR(dstSize_tooSmall);
+    memcpy(dst + cSize, cctx->xz_index.data + cctx->xz_index.start, indexSize);
+    return cSize + indexSize;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     void* dst, size_t dstCapacity,
     const void* src, size_t srcSize,
@@ -437,10 +1390,22 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     if (dstCapacity < 2U - cctx->params.omitProp) /* empty LZMA2 stream is byte sequence {0, 0} */
         return FL2_ERROR(dstSize_tooSmall);
 
+    CHECK_F(FL2_fitMemoryLimit(cctx, srcSize, 0));
     FL2_beginFrame(cctx);
+    CHECK_F(FL2_beginHash(cctx));
+
+    if (cctx->xz_check != 0)
+        return FL2_compressXz(cctx, dst, dstCapacity, src, srcSize);
 
     dstBuf += !cctx->params.omitProp;
-    cSize = FL2_compressBlock(cctx, src, 0, srcSize, dstBuf, end - dstBuf, NULL, NULL, NULL);
+    if (cctx->dict_size) {
+        cSize = FL2_compressWithDictionary(cctx, src, srcSize, dstBuf, end - dstBuf);
+    }
+    else {
+        CHECK_F(FL2_beginLongMatcher(cctx, src, srcSize));
+        cSize = FL2_compressBlock(cctx, src, 0, srcSize, dstBuf, end - dstBuf, NULL, NULL, NULL);
+        FL2_endLongMatcher(cctx);
+    }
     if(!cctx->params.omitProp)
         dstBuf[-1] = FL2_getProp(cctx, cctx->dictMax);
 
@@ -453,22 +1418,34 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     *dstBuf++ = LZMA2_END_MARKER;
 
 #ifndef NO_XXHASH
-    if (cctx->params.doXXH && !cctx->params.omitProp) {
-        XXH32_canonical_t canonical;
+    if (cctx->hash.type != FL2_HASH_NONE) {
+        size_t const hashSize = FL2_hashSize(cctx->hash.type);
         DEBUGLOG(5, "Writing hash");
-        if(end - dstBuf < XXHASH_SIZEOF)
+        if((size_t)(end - dstBuf) < hashSize)
             return FL2_ERROR(dstSize_tooSmall);
-        XXH32_canonicalFromHash(&canonical, XXH32(src, srcSize, 0));
-        memcpy(dstBuf, &canonical, XXHASH_SIZEOF);
-        dstBuf += XXHASH_SIZEOF;
+        FL2_hashDigest(&cctx->hash, dstBuf);
+        dstBuf += hashSize;
     }
 #endif
+    if (cctx->params.seekTable && !cctx->params.omitProp) {
+        size_t const tableSize = FL2_finishSeekTable(cctx);
+        if (FL2_isError(tableSize))
+            return tableSize;
+        DEBUGLOG(5, "Writing seek table : %u bytes", (U32)tableSize);
+        if ((size_t)(end - dstBuf) < tableSize)
+            return FL2_ERROR(dstSize_tooSmall);
+        memcpy(dstBuf, cctx->seek_table, tableSize);
+        dstBuf += tableSize;
+    }
     return dstBuf - (BYTE*)dst;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_blockOverlap(const FL2_CCtx* cctx)
 {
-	return OVERLAP_FROM_DICT_LOG(cctx->params.rParams.dictionary_log, cctx->params.rParams.overlap_fraction);
+    /* .xz blocks are independent, so each begins with a dictionary reset */
+    if (cctx->xz_check != 0)
+        return 0;
+    return OVERLAP_FROM_DICT_LOG(cctx->params.rParams.dictionary_log, cctx->params.rParams.overlap_fraction);
 }
 
 FL2LIB_API void FL2LIB_CALL FL2_shiftBlock(FL2_CCtx* cctx, FL2_blockBuffer *block)
@@ -478,7 +1455,7 @@ FL2LIB_API void FL2LIB_CALL FL2_shiftBlock(FL2_CCtx* cctx, FL2_blockBuffer *bloc
 
 FL2LIB_API void FL2LIB_CALL FL2_shiftBlock_switch(FL2_CCtx* cctx, FL2_blockBuffer *block, unsigned char *dst)
 {
-    size_t const block_overlap = OVERLAP_FROM_DICT_LOG(cctx->params.rParams.dictionary_log, cctx->params.rParams.overlap_fraction);
+    size_t const block_overlap = FL2_blockOverlap(cctx);
 
 	if (block_overlap == 0) {
 		block->start = 0;
@@ -521,10 +1498,19 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtxBlock(FL2_CCtx* cctx,
 FL2LIB_API size_t FL2LIB_CALL FL2_endFrame(FL2_CCtx* ctx,
     void* dst, size_t dstCapacity)
 {
+    size_t tableSize = 0;
     if (!dstCapacity)
         return FL2_ERROR(dstSize_tooSmall);
     *(BYTE*)dst = LZMA2_END_MARKER;
-    return 1;
+    if (ctx->params.seekTable && !ctx->params.omitProp) {
+        tableSize = FL2_finishSeekTable(ctx);
+        if (FL2_isError(tableSize))
+            return tableSize;
+        if (dstCapacity - 1 < tableSize)
+            return FL2_ERROR(dstSize_tooSmall);
+        memcpy((BYTE*)dst + 1, ctx->seek_table, tableSize);
+    }
+    return 1 + tableSize;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtxBlock_toFn(FL2_CCtx* cctx,
@@ -539,9 +1525,17 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endFrame_toFn(FL2_CCtx* ctx,
     FL2_writerFn writeFn, void* opaque)
 {
     BYTE c = LZMA2_END_MARKER;
+    size_t tableSize = 0;
     if(writeFn(&c, 1, opaque))
         return FL2_ERROR(write_failed);
-    return 1;
+    if (ctx->params.seekTable && !ctx->params.omitProp) {
+        tableSize = FL2_finishSeekTable(ctx);
+        if (FL2_isError(tableSize))
+            return tableSize;
+        if (writeFn(ctx->seek_table, tableSize, opaque))
+            return FL2_ERROR(write_failed);
+    }
+    return 1 + tableSize;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_compressMt(void* dst, size_t dstCapacity,
@@ -567,6 +1561,149 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compress(void* dst, size_t dstCapacity,
     return FL2_compressMt(dst, dstCapacity, src, srcSize, compressionLevel, 1);
 }
 
+/* FL2_batchCompressJob() : FL2POOL_function type
+ * Compresses buffers below batch_split with worker n until none are left. */
+static void FL2_batchCompressJob(void* const jobDescription, size_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+    FL2_batchWorker* const worker = &cctx->batch[n];
+
+    for (;;) {
+        size_t const index = (size_t)FL2_atomic_increment(cctx->batch_next);
+        const FL2_inBuffer* src;
+        FL2_outBuffer* dst;
+        size_t cSize;
+
+        if (index >= cctx->batch_count)
+            break;
+        src = &cctx->batch_srcs[index];
+        if (src->size - src->pos >= cctx->batch_split)
+            continue;
+        dst = &cctx->batch_dsts[index];
+        cSize = FL2_compressCCtx(worker->cctx, (BYTE*)dst->dst + dst->pos, dst->size - dst->pos,
+            (const BYTE*)src->src + src->pos, src->size - src->pos, 0);
+        if (FL2_isError(cSize)) {
+            /* buffers are taken in order, so the first error of a worker has its lowest index */
+            if (!worker->err) {
+                worker->err = cSize;
+                worker->err_index = index;
+            }
+        }
+        else {
+            dst->pos += cSize;
+            worker->written += cSize;
+        }
+    }
+}
+
+/* FL2_initBatchWorkers() :
+ * Creates the worker contexts if necessary and gives them the parameters and dictionary of cctx.
+ * The workers run at the same time, so each gets an equal part of `memoryLimit` (MiB, 0 for none). */
+static size_t FL2_initBatchWorkers(FL2_CCtx* const cctx, unsigned const memoryLimit)
+{
+    unsigned const workerLimit = memoryLimit ? MAX(memoryLimit / cctx->jobCount, 1U) : 0;
+
+    if (cctx->batch == NULL) {
+        cctx->batch = FL2_malloc(cctx->jobCount * sizeof(FL2_batchWorker), cctx->customMem);
+        if (cctx->batch == NULL)
+            return FL2_ERROR(memory_allocation);
+        for (unsigned u = 0; u < cctx->jobCount; ++u)
+            cctx->batch[u].cctx = NULL;
+    }
+#ifndef FL2_SINGLETHREAD
+    if (cctx->batch_pool == NULL) {
+        cctx->batch_pool = FL2POOL_createView(cctx->factory);
+        if (cctx->batch_pool == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+#endif
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        FL2_batchWorker* const worker = &cctx->batch[u];
+        if (worker->cctx == NULL) {
+            worker->cctx = FL2_createCCtx_internal(1, cctx->customMem, NULL);
+            if (worker->cctx == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        worker->cctx->params = cctx->params;
+        worker->cctx->params.memoryLimit = workerLimit;
+        CHECK_F(FL2_CCtx_loadDictionary(worker->cctx, cctx->dict_buf, cctx->dict_size));
+        worker->written = 0;
+        worker->err = 0;
+    }
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_compressBatch(FL2_CCtx* cctx,
+    const FL2_inBuffer* srcs, FL2_outBuffer* dsts, size_t count)
+{
+    unsigned const memoryLimit = cctx->params.memoryLimit;
+    size_t total = 0;
+    size_t err = 0;
+    size_t err_index = count;
+    size_t large = 0;
+
+    DEBUGLOG(4, "FL2_compressBatch : %u buffers", (U32)count);
+
+    /* A buffer which gives every thread a slice is compressed by the whole context */
+    cctx->batch_split = (cctx->jobCount > 1) ? (size_t)MIN_BYTES_PER_THREAD * cctx->jobCount : 0;
+    for (size_t i = 0; i < count; ++i)
+        large += (srcs[i].size - srcs[i].pos >= cctx->batch_split);
+
+    if (large < count) {
+        /* The workers start on the small buffers before the large ones are compressed. If both
+         * kinds are present, the context and the workers each get half of the memory limit. */
+        CHECK_F(FL2_initBatchWorkers(cctx, large ? memoryLimit / 2 : memoryLimit));
+        cctx->batch_srcs = srcs;
+        cctx->batch_dsts = dsts;
+        cctx->batch_count = count;
+        cctx->batch_next = ATOMIC_INITIAL_VALUE;
+#ifndef FL2_SINGLETHREAD
+        for (size_t u = 1; u < cctx->jobCount; ++u)
+            FL2POOL_add(cctx->batch_pool, FL2_batchCompressJob, cctx, u);
+#endif
+        if (large && memoryLimit)
+            cctx->params.memoryLimit = MAX(memoryLimit - memoryLimit / 2, 1U);
+    }
+
+    for (size_t i = 0; i < count && large; ++i) {
+        size_t const srcSize = srcs[i].size - srcs[i].pos;
+        size_t cSize;
+        if (srcSize < cctx->batch_split)
+            continue;
+        cSize = FL2_compressCCtx(cctx, (BYTE*)dsts[i].dst + dsts[i].pos, dsts[i].size - dsts[i].pos,
+            (const BYTE*)srcs[i].src + srcs[i].pos, srcSize, 0);
+        if (FL2_isError(cSize)) {
+            if (!err) {
+                err = cSize;
+                err_index = i;
+            }
+        }
+        else {
+            dsts[i].pos += cSize;
+            total += cSize;
+        }
+    }
+    cctx->params.memoryLimit = memoryLimit;
+
+    if (large == count)
+        return err ? err : total;
+
+    /* The calling thread joins the workers once it is done with the large buffers */
+    FL2_batchCompressJob(cctx, 0);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->batch_pool);
+#endif
+
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        total += cctx->batch[u].written;
+        if (cctx->batch[u].err && cctx->batch[u].err_index < err_index) {
+            err = cctx->batch[u].err;
+            err_index = cctx->batch[u].err_index;
+        }
+    }
+    return err ? err : total;
+}
+
 FL2LIB_API BYTE FL2LIB_CALL FL2_dictSizeProp(FL2_CCtx* cctx)
 {
     return FL2_getDictSizeProp(cctx->dictMax ? cctx->dictMax : (size_t)1 << cctx->params.rParams.dictionary_log);
@@ -696,7 +1833,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
 
     case FL2_p_strategy:
         if ((int)value >= 0) { /* < 0 : does not change current strategy */
-            CLAMPCHECK(value, (unsigned)FL2_fast, (unsigned)FL2_ultra);
+            CLAMPCHECK(value, (unsigned)FL2_fast, (unsigned)FL2_adaptive);
             cctx->params.cParams.strategy = (FL2_strategy)value;
         }
         return (size_t)cctx->params.cParams.strategy;
@@ -704,7 +1841,8 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
 #ifndef NO_XXHASH
     case FL2_p_doXXHash:
         if ((int)value >= 0) { /* < 0 : does not change doXXHash */
-            cctx->params.doXXH = value != 0;
+            CLAMPCHECK(value, FL2_HASH_NONE, FL2_HASH_XXH64);
+            cctx->params.doXXH = (BYTE)value;
         }
         return cctx->params.doXXH;
 #endif
@@ -714,6 +1852,92 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
             cctx->params.omitProp = value != 0;
         }
         return cctx->params.omitProp;
+
+    case FL2_p_seekTable:
+        if ((int)value >= 0) { /* < 0 : does not change seekTable */
+            cctx->params.seekTable = value != 0;
+        }
+        return cctx->params.seekTable;
+
+    case FL2_p_pipelineDepth:
+        if ((int)value >= 0) { /* < 0 : does not change pipelineDepth */
+            CLAMPCHECK(value, FL2_PIPELINE_DEPTH_MIN, FL2_PIPELINE_DEPTH_MAX);
+            cctx->params.pipelineDepth = (BYTE)value;
+        }
+        return cctx->params.pipelineDepth;
+
+    case FL2_p_incrementalPrices:
+        if ((int)value >= 0) { /* < 0 : does not change incrementalPrices */
+            cctx->params.cParams.incremental_prices = value != 0;
+        }
+        return cctx->params.cParams.incremental_prices;
+
+    case FL2_p_adaptiveThroughput:
+        if ((int)value >= 0) { /* < 0 : does not change adaptiveThroughput */
+            cctx->params.cParams.adaptive_throughput = value;
+        }
+        return cctx->params.cParams.adaptive_throughput;
+
+    case FL2_p_randomFilter:
+        if ((int)value >= 0) { /* < 0 : does not change randomFilter */
+            cctx->params.cParams.random_filter = value != 0;
+        }
+        return cctx->params.cParams.random_filter;
+
+    case FL2_p_contentBlockLog:
+        if ((int)value >= 0) { /* < 0 : does not change contentBlockLog */
+            if (value)
+                CLAMPCHECK(value, FL2_CONTENT_BLOCK_LOG_MIN, FL2_CONTENT_BLOCK_LOG_MAX);
+            cctx->params.contentBlockLog = (BYTE)value;
+        }
+        return cctx->params.contentBlockLog;
+    case FL2_p_collectStats:
+        if ((int)value >= 0) { /* < 0 : does not change collectStats */
+            cctx->params.collectStats = value != 0;
+        }
+        return cctx->params.collectStats;
+
+    case FL2_p_memoryLimit:
+        if ((int)value >= 0) { /* < 0 : does not change memoryLimit */
+            cctx->params.memoryLimit = value;
+        }
+        return cctx->params.memoryLimit;
+
+    case FL2_p_memoryPriority:
+        if ((int)value >= 0) { /* < 0 : does not change memoryPriority */
+            cctx->params.memoryPriority = value != 0;
+        }
+        return cctx->params.memoryPriority;
+
+    case FL2_p_longWindowLog:
+        if ((int)value >= 0) { /* < 0 : does not change longWindowLog */
+            if (value)
+                CLAMPCHECK(value, FL2_DICTLOG_MIN, FL2_DICTLOG_MAX);
+            cctx->params.longWindowLog = (BYTE)value;
+        }
+        return cctx->params.longWindowLog;
+
+    case FL2_p_secondMatcher:
+        if ((int)value >= 0) { /* < 0 : does not change secondMatcher */
+            CLAMPCHECK(value, FL2_SECOND_MATCHER_MIN, FL2_SECOND_MATCHER_MAX);
+            cctx->params.cParams.second_matcher = value;
+        }
+        return cctx->params.cParams.second_matcher;
+
+    case FL2_p_flushWindowLog:
+        if ((int)value >= 0) { /* < 0 : does not change flushWindowLog */
+            if (value)
+                CLAMPCHECK(value, FL2_FLUSH_WINDOW_LOG_MIN, FL2_DICTLOG_MAX);
+            cctx->params.flushWindowLog = (BYTE)value;
+        }
+        return cctx->params.flushWindowLog;
+
+    case FL2_p_xzFormat:
+        if ((int)value >= 0) { /* < 0 : does not change xzFormat */
+            CLAMPCHECK(value, FL2_XZ_FORMAT_MIN, FL2_XZ_FORMAT_MAX);
+            cctx->params.xzFormat = (BYTE)value;
+        }
+        return cctx->params.xzFormat;
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         if ((int)value >= 0) { /* < 0 : does not change useRefMF */
@@ -727,30 +1951,79 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
 
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream(void)
 {
-    FL2_CCtx* const cctx = FL2_createCCtx();
-    FL2_CStream* const fcs = malloc(sizeof(FL2_CStream));
+    return FL2_createCStreamMt(1);
+}
+
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamMt(unsigned nbThreads)
+{
+    FL2_customMem const defaultMem = { NULL, NULL, NULL };
+    return FL2_createCStream_advanced(nbThreads, defaultMem);
+}
+
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream_advanced(unsigned nbThreads, FL2_customMem customMem)
+{
+    FL2_CCtx* const cctx = FL2_createCCtx_advanced(nbThreads, customMem);
+    FL2_CStream* const fcs = cctx != NULL ? FL2_malloc(sizeof(FL2_CStream), customMem) : NULL;
+
+    DEBUGLOG(3, "FL2_createCStream_advanced : %u threads", nbThreads);
+
+    if (fcs == NULL) {
+        FL2_freeCCtx(cctx);
+        return NULL;
+    }
+    fcs->cctx = cctx;
+    fcs->inBuff.bufSize = 0;
+    fcs->inBuff.data = NULL;
+    fcs->inBuff.start = 0;
+    fcs->inBuff.end = 0;
+    fcs->spare = NULL;
+    fcs->out_thread = 0;
+    fcs->thread_count = 0;
+    fcs->out_pos = 0;
+    fcs->hash_pos = 0;
+    fcs->seek_pos = 0;
+    fcs->xz_pos = 0;
+    fcs->head_pos = 0;
+    fcs->tail_pos = 0;
+    fcs->end_marked = 0;
+    fcs->wrote_prop = 0;
+    fcs->pipe_pending = 0;
+    fcs->ref_data = NULL;
+    fcs->ref_size = 0;
+    fcs->ref_pos = 0;
+    fcs->cut_pos = 0;
+    fcs->cut_end = 0;
+    fcs->cut_hash = 0;
+    for (size_t u = 0; u < 256; ++u) {
+        /* any fixed pseudo-random values will do, but they are part of the format of the cut points */
+        U64 h = (u + 1) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ULL;
+        fcs->gear[u] = h ^ (h >> 29);
+    }
+#ifndef FL2_SINGLETHREAD
+    fcs->compressThread = NULL;
+    fcs->job_result = 0;
+    fcs->job_running = 0;
+#endif
+    return fcs;
+}
+
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamAsync(unsigned nbThreads)
+{
+    FL2_CStream* const fcs = FL2_createCStreamMt(nbThreads);
+
+#ifndef FL2_SINGLETHREAD
+    if (fcs == NULL)
+        return NULL;
 
-    DEBUGLOG(3, "FL2_createCStream");
+    DEBUGLOG(3, "FL2_createCStreamAsync");
 
-    if (cctx == NULL || fcs == NULL) {
-        free(cctx);
-        free(fcs);
+    fcs->compressThread = FL2POOL_create(1);
+    if (fcs->compressThread == NULL) {
+        FL2_freeCStream(fcs);
         return NULL;
     }
-    fcs->cctx = cctx;
-    fcs->inBuff.bufSize = 0;
-    fcs->inBuff.data = NULL;
-    fcs->inBuff.start = 0;
-    fcs->inBuff.end = 0;
-#ifndef NO_XXHASH
-    fcs->xxh = NULL;
 #endif
-    fcs->out_thread = 0;
-    fcs->thread_count = 0;
-    fcs->out_pos = 0;
-    fcs->hash_pos = 0;
-    fcs->end_marked = 0;
-    fcs->wrote_prop = 0;
     return fcs;
 }
 
@@ -761,12 +2034,15 @@ FL2LIB_API size_t FL2LIB_CALL FL2_freeCStream(FL2_CStream* fcs)
 
     DEBUGLOG(3, "FL2_freeCStream");
 
-    free(fcs->inBuff.data);
-#ifndef NO_XXHASH
-    XXH32_freeState(fcs->xxh);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(fcs->compressThread);
 #endif
-    FL2_freeCCtx(fcs->cctx);
-    free(fcs);
+    FL2_free(fcs->inBuff.data, fcs->cctx->customMem);
+    FL2_free(fcs->spare, fcs->cctx->customMem);
+    {   FL2_customMem const customMem = fcs->cctx->customMem;
+        FL2_freeCCtx(fcs->cctx);
+        FL2_free(fcs, customMem);
+    }
     return 0;
 }
 
@@ -774,34 +2050,232 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
 {
     DEBUGLOG(4, "FL2_initCStream level %d", compressionLevel);
 
+#ifndef FL2_SINGLETHREAD
+    /* abandon any unfinished frame */
+    FL2POOL_waitAll(fcs->compressThread);
+    fcs->job_running = 0;
+#endif
     fcs->inBuff.start = 0;
     fcs->inBuff.end = 0;
     fcs->out_thread = 0;
     fcs->thread_count = 0;
     fcs->out_pos = 0;
     fcs->hash_pos = 0;
+    fcs->seek_pos = 0;
+    fcs->xz_pos = 0;
+    fcs->head_pos = 0;
+    fcs->tail_pos = 0;
     fcs->end_marked = 0;
     fcs->wrote_prop = 0;
+    fcs->pipe_pending = 0;
+    fcs->ref_data = NULL;
+    fcs->ref_size = 0;
+    fcs->ref_pos = 0;
+    fcs->cut_pos = 0;
+    fcs->cut_end = 0;
+    fcs->cut_hash = 0;
 
     FL2_CCtx_setParameter(fcs->cctx, FL2_p_compressionLevel, compressionLevel);
 
-#ifndef NO_XXHASH
-    if (fcs->cctx->params.doXXH && !fcs->cctx->params.omitProp) {
-        if (fcs->xxh == NULL) {
-            fcs->xxh = XXH32_createState();
-            if (fcs->xxh == NULL)
+#ifndef FL2_SINGLETHREAD
+    CHECK_F(FL2_fitMemoryLimit(fcs->cctx, 0, 1 + (fcs->compressThread != NULL)));
+#else
+    CHECK_F(FL2_fitMemoryLimit(fcs->cctx, 0, 1));
+#endif
+    FL2_beginFrame(fcs->cctx);
+    return FL2_beginHash(fcs->cctx);
+}
+
+/* FL2_switchBuffers() :
+ * Copies the overlap section to the spare buffer and continues reading input there,
+ * leaving the data of the pending block intact */
+static void FL2_switchBuffers(FL2_CStream* const fcs)
+{
+    BYTE* const data = fcs->inBuff.data;
+    size_t const block_overlap = FL2_blockOverlap(fcs->cctx);
+
+    if (block_overlap && fcs->inBuff.end <= block_overlap)
+        memcpy(fcs->spare, data, fcs->inBuff.end);
+    else
+        FL2_shiftBlock_switch(fcs->cctx, &fcs->inBuff, fcs->spare);
+    fcs->inBuff.data = fcs->spare;
+    fcs->spare = data;
+}
+
+/* FL2_compressStreamPipelined() :
+ * Builds the match table for new input while encoding the pending block, if any.
+ * When flushing, a pending block is encoded even if there is no new input. */
+static size_t FL2_compressStreamPipelined(FL2_CStream* const fcs, int const flushing)
+{
+    FL2_CCtx* const cctx = fcs->cctx;
+    int const build = fcs->inBuff.start < fcs->inBuff.end;
+    int const encode = fcs->pipe_pending;
+
+    if (!build && !(encode && flushing))
+        return 0;
+
+    if (build) {
+        if (fcs->spare == NULL) {
+            fcs->spare = FL2_malloc(fcs->inBuff.bufSize, fcs->cctx->customMem);
+            if (fcs->spare == NULL)
                 return FL2_ERROR(memory_allocation);
         }
-        XXH32_reset(fcs->xxh, 0);
+        cctx->pipeBlock.data = fcs->inBuff.data;
+        cctx->pipeBlock.start = fcs->inBuff.start;
+        cctx->pipeBlock.end = fcs->inBuff.end;
+    }
+    if (encode) {
+        /* the pending block's table is encoded and then holds the output */
+        FL2_matchTable* const tbl = cctx->matchTable;
+        cctx->matchTable = cctx->pipeTable;
+        cctx->pipeTable = tbl;
     }
-#endif
 
-    FL2_beginFrame(fcs->cctx);
+    fcs->out_thread = 0;
+    fcs->thread_count = FL2_compressPipelined(cctx, encode, build);
+    if (FL2_isError(fcs->thread_count))
+        return fcs->thread_count;
+
+    fcs->pipe_pending = (BYTE)build;
+    if (build) {
+        cctx->curBlock = cctx->pipeBlock;
+        cctx->block_total += fcs->inBuff.end - fcs->inBuff.start;
+        fcs->inBuff.start = fcs->inBuff.end;
+        FL2_switchBuffers(fcs);
+    }
+    return 0;
+}
+
+/* FL2_writeStreamPart() :
+ * Writes as much of the `size` bytes at src as fits, continuing from *pos.
+ * Returns nonzero if some remain. */
+static int FL2_writeStreamPart(FL2_outBuffer* const output, const BYTE* const src, size_t const size, size_t* const pos)
+{
+    size_t const to_write = MIN(size - *pos, output->size - output->pos);
+
+    memcpy((BYTE*)output->dst + output->pos, src + *pos, to_write);
+    output->pos += to_write;
+    *pos += to_write;
+    return *pos < size;
+}
+
+/* FL2_writeStreamOutput() :
+ * Writes the property byte or .xz stream header if not done yet, and as much of the
+ * compressed data as fits. A .xz block's header and tail are written with its data. */
+static size_t FL2_writeStreamOutput(FL2_CStream* const fcs, FL2_outBuffer* const output, int const ending)
+{
+    FL2_CCtx* const cctx = fcs->cctx;
+
+    if (output->pos >= output->size)
+        return 0;
+
+    if (!fcs->wrote_prop && cctx->xz_check != 0) {
+        BYTE header[XZ_STREAM_HEADER_SIZE];
+        FL2_xzWriteStreamHeader(header, cctx->xz_check);
+        if (FL2_writeStreamPart(output, header, XZ_STREAM_HEADER_SIZE, &fcs->xz_pos))
+            return 0;
+        fcs->xz_pos = 0;
+        fcs->wrote_prop = 1;
+    }
+    else if (!fcs->wrote_prop && !cctx->params.omitProp) {
+        size_t dictionary_size = ending ? cctx->dictMax : (size_t)1 << cctx->params.rParams.dictionary_log;
+        ((BYTE*)output->dst)[output->pos] = FL2_getProp(cctx, dictionary_size);
+        DEBUGLOG(4, "Writing property byte : 0x%X", ((BYTE*)output->dst)[output->pos]);
+        ++output->pos;
+        fcs->wrote_prop = 1;
+    }
+    for (; fcs->out_thread < fcs->thread_count; ++fcs->out_thread) {
+        const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[fcs->out_thread].block.start);
+        size_t const cSize = cctx->jobs[fcs->out_thread].cSize;
+
+        if (FL2_isError(cSize))
+            return cSize;
+
+        /* a .xz block header precedes the first slice and the tail follows the last */
+        if (fcs->out_thread == 0 && FL2_writeStreamPart(output, cctx->xz_head, cctx->xz_head_size, &fcs->head_pos))
+            break;
+
+        DEBUGLOG(5, "CStream : writing %u bytes", (U32)MIN(cSize - fcs->out_pos, output->size - output->pos));
+
+        if (FL2_writeStreamPart(output, outBuf, cSize, &fcs->out_pos))
+            break;
+        if (fcs->out_thread + 1 == fcs->thread_count && FL2_writeStreamPart(output, cctx->xz_tail, cctx->xz_tail_size, &fcs->tail_pos))
+            break;
+
+        fcs->out_pos = 0;
+    }
+    if (fcs->out_thread == fcs->thread_count) {
+        fcs->head_pos = 0;
+        fcs->tail_pos = 0;
+    }
     return 0;
 }
 
+/* FL2_findContentCut() :
+ * Continues the rolling hash over new input and sets cut_end at the first position where
+ * the top contentBlockLog bits of the hash are zero, after a minimum block size. The hash
+ * depends only on the last 64 bytes, so the cuts in identical regions of two streams
+ * fall in the same places. */
+static void FL2_findContentCut(FL2_CStream* const fcs)
+{
+    unsigned const log = fcs->cctx->params.contentBlockLog;
+    const BYTE* const data = fcs->inBuff.data;
+    size_t const end = fcs->inBuff.end;
+    size_t const min_end = fcs->inBuff.start + ((size_t)1 << (log - 3));
+    U64 const mask = ~(U64)0 << (64 - log);
+    U64 hash = fcs->cut_hash;
+    size_t pos = fcs->cut_pos;
+
+    if (fcs->cut_end != 0)
+        return;
+    for (; pos < end; ++pos) {
+        hash = (hash << 1) + fcs->gear[data[pos]];
+        if ((hash & mask) == 0 && pos >= min_end) {
+            fcs->cut_end = ++pos;
+            break;
+        }
+    }
+    fcs->cut_pos = pos;
+    fcs->cut_hash = hash;
+}
+
+/* FL2_nextContentBlock() :
+ * Moves the input following the block just compressed to the start of the buffer. The next
+ * block begins with a dictionary reset, so no overlap is kept. */
+static void FL2_nextContentBlock(FL2_CStream* const fcs, size_t const block_end)
+{
+    size_t const rest = fcs->inBuff.end - block_end;
+
+    DEBUGLOG(5, "CStream : content block of %u bytes, %u following", (U32)block_end, (U32)rest);
+
+    memmove(fcs->inBuff.data, fcs->inBuff.data + block_end, rest);
+    fcs->inBuff.start = 0;
+    fcs->inBuff.end = rest;
+    fcs->cut_pos -= block_end;
+    fcs->cut_end = 0;
+    fcs->cctx->block_total = 0;
+    FL2_findContentCut(fcs);
+}
+
+/* FL2_setStreamBlock() :
+ * Sets curBlock to the input from inBuff.start to block_end. When flushing with
+ * flushWindowLog set, the block begins at most 2 ^ flushWindowLog bytes before the new
+ * data, so the match table covers only that window. Distances stay valid because the
+ * encoder never looks before the block. */
+static void FL2_setStreamBlock(FL2_CStream* const fcs, size_t const block_end, int const flushing)
+{
+    FL2_CCtx* const cctx = fcs->cctx;
+    size_t prefix = fcs->inBuff.start;
+
+    if (flushing && cctx->params.flushWindowLog)
+        prefix = MIN(prefix, (size_t)1 << cctx->params.flushWindowLog);
+    cctx->curBlock.data = fcs->inBuff.data + fcs->inBuff.start - prefix;
+    cctx->curBlock.start = prefix;
+    cctx->curBlock.end = block_end - fcs->inBuff.start + prefix;
+}
+
 static size_t FL2_compressStream_internal(FL2_CStream* const fcs,
-    FL2_outBuffer* const output, int const ending)
+    FL2_outBuffer* const output, int const ending, int const flushing)
 {
     FL2_CCtx* const cctx = fcs->cctx;
 
@@ -809,56 +2283,155 @@ static size_t FL2_compressStream_internal(FL2_CStream* const fcs,
         return 0;
 
     if (fcs->out_thread == fcs->thread_count) {
-        if (fcs->inBuff.start < fcs->inBuff.end) {
-#ifndef NO_XXHASH
-            if (cctx->params.doXXH && !cctx->params.omitProp) {
-                XXH32_update(fcs->xxh, fcs->inBuff.data + fcs->inBuff.start, fcs->inBuff.end - fcs->inBuff.start);
+        if (fcs->ref_data != NULL) {
+            if (fcs->ref_pos < fcs->ref_size) {
+                size_t const dictionary_size = (size_t)1 << cctx->params.rParams.dictionary_log;
+                cctx->curBlock.end = cctx->curBlock.start + MIN(fcs->ref_size - fcs->ref_pos, dictionary_size - cctx->curBlock.start);
+                fcs->out_thread = 0;
+                fcs->thread_count = FL2_compressCurBlock(cctx, NULL, 0, NULL, NULL);
+                if (FL2_isError(fcs->thread_count))
+                    return fcs->thread_count;
+
+                fcs->ref_pos += cctx->curBlock.end - cctx->curBlock.start;
+                FL2_advanceBlock(cctx, fcs->ref_size - fcs->ref_pos);
             }
-#endif
-            cctx->curBlock.data = fcs->inBuff.data;
-            cctx->curBlock.start = fcs->inBuff.start;
-            cctx->curBlock.end = fcs->inBuff.end;
+        }
+        else if (cctx->params.pipelineDepth) {
+            CHECK_F(FL2_compressStreamPipelined(fcs, flushing));
+        }
+        else if (fcs->inBuff.start < fcs->inBuff.end) {
+            /* content-defined blocks end at the cut, or at the end of a full buffer */
+            size_t const block_end = (cctx->params.contentBlockLog && fcs->cut_end != 0) ? fcs->cut_end : fcs->inBuff.end;
+            FL2_setStreamBlock(fcs, block_end, flushing);
 
             fcs->out_thread = 0;
-            fcs->thread_count = FL2_compressCurBlock(cctx, NULL, NULL);
+            fcs->thread_count = FL2_compressCurBlock(cctx, NULL, 0, NULL, NULL);
             if (FL2_isError(fcs->thread_count))
                 return fcs->thread_count;
 
-            fcs->inBuff.start = fcs->inBuff.end;
+            if (cctx->params.contentBlockLog) {
+                FL2_nextContentBlock(fcs, block_end);
+            }
+            else {
+                cctx->block_total += fcs->inBuff.end - fcs->inBuff.start;
+                fcs->inBuff.start = fcs->inBuff.end;
+            }
         }
-        if (!fcs->wrote_prop && !cctx->params.omitProp) {
-            size_t dictionary_size = ending ? cctx->dictMax : (size_t)1 << cctx->params.rParams.dictionary_log;
-            ((BYTE*)output->dst)[output->pos] = FL2_getProp(cctx, dictionary_size);
-            DEBUGLOG(4, "Writing property byte : 0x%X", ((BYTE*)output->dst)[output->pos]);
-            ++output->pos;
-            fcs->wrote_prop = 1;
+    }
+    return FL2_writeStreamOutput(fcs, output, ending);
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_compressStreamJob() : FL2POOL_function type */
+static void FL2_compressStreamJob(void* const jobDescription, size_t n)
+{
+    FL2_CStream* const fcs = (FL2_CStream*)jobDescription;
+    (void)n;
+
+    fcs->job_result = FL2_compressCurBlock(fcs->cctx, NULL, 0, NULL, NULL);
+}
+
+/* FL2_collectJob() :
+ * Takes the result of the background job if it has finished. Never blocks. */
+static size_t FL2_collectJob(FL2_CStream* const fcs)
+{
+    if (fcs->job_running && FL2POOL_waitAllTimeout(fcs->compressThread, 0) == 0) {
+        fcs->job_running = 0;
+        fcs->thread_count = fcs->job_result;
+    }
+    if (!fcs->job_running && FL2_isError(fcs->thread_count))
+        return fcs->thread_count;
+    return 0;
+}
+
+/* FL2_compressStreamAsync_internal() :
+ * Writes the output of a finished job, then hands the input block to the background
+ * thread if it is full, or if flushing. The overlap is moved to the spare buffer so
+ * input can be read during compression. Never blocks. */
+static size_t FL2_compressStreamAsync_internal(FL2_CStream* const fcs,
+    FL2_outBuffer* const output, int const ending, int const flushing)
+{
+    FL2_CCtx* const cctx = fcs->cctx;
+
+    CHECK_F(FL2_collectJob(fcs));
+    if (fcs->job_running)
+        return 0;
+
+    CHECK_F(FL2_writeStreamOutput(fcs, output, ending));
+
+    if (fcs->out_thread == fcs->thread_count
+        && fcs->inBuff.start < fcs->inBuff.end
+        && (flushing || fcs->inBuff.end == fcs->inBuff.bufSize))
+    {
+        if (fcs->spare == NULL) {
+            fcs->spare = FL2_malloc(fcs->inBuff.bufSize, fcs->cctx->customMem);
+            if (fcs->spare == NULL)
+                return FL2_ERROR(memory_allocation);
         }
+        FL2_setStreamBlock(fcs, fcs->inBuff.end, flushing);
+        cctx->block_total += fcs->inBuff.end - fcs->inBuff.start;
+        fcs->inBuff.start = fcs->inBuff.end;
+        FL2_switchBuffers(fcs);
+
+        DEBUGLOG(5, "CStream : starting job, %u bytes", (U32)(cctx->curBlock.end - cctx->curBlock.start));
+
+        fcs->out_thread = 0;
+        fcs->thread_count = 0;
+        fcs->job_running = 1;
+        FL2POOL_add(fcs->compressThread, FL2_compressStreamJob, fcs, 0);
     }
-    for (; fcs->out_thread < fcs->thread_count; ++fcs->out_thread) {
-        const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[fcs->out_thread].block.start) + fcs->out_pos;
-        BYTE* const dstBuf = (BYTE*)output->dst + output->pos;
-        size_t const dstCapacity = output->size - output->pos;
-        size_t to_write = cctx->jobs[fcs->out_thread].cSize;
+    return 0;
+}
 
-        if (FL2_isError(to_write))
-            return to_write;
+static size_t FL2_compressStreamAsync(FL2_CStream* const fcs, FL2_outBuffer* const output, FL2_inBuffer* const input)
+{
+    FL2_blockBuffer* const inBuff = &fcs->inBuff;
+    size_t const block_overlap = FL2_blockOverlap(fcs->cctx);
 
-        to_write = MIN(to_write - fcs->out_pos, dstCapacity);
+    CHECK_F(FL2_compressStreamAsync_internal(fcs, output, 0, 0));
 
-        DEBUGLOG(5, "CStream : writing %u bytes", (U32)to_write);
+    while (input->pos < input->size) {
+        size_t toRead;
 
-        memcpy(dstBuf, outBuf, to_write);
-        fcs->out_pos += to_write;
-        output->pos += to_write;
+        if (inBuff->data == NULL) {
+            inBuff->bufSize = (size_t)1 << fcs->cctx->params.rParams.dictionary_log;
+
+            DEBUGLOG(3, "Allocating input buffer : %u bytes", (U32)inBuff->bufSize);
+
+            inBuff->data = FL2_malloc(inBuff->bufSize, fcs->cctx->customMem);
+
+            if (inBuff->data == NULL)
+                return FL2_ERROR(memory_allocation);
+
+            inBuff->start = 0;
+            inBuff->end = 0;
+        }
+        if (inBuff->start > block_overlap) {
+            FL2_shiftBlock(fcs->cctx, inBuff);
+        }
+        toRead = MIN(input->size - input->pos, inBuff->bufSize - inBuff->end);
 
-        if (fcs->out_pos < cctx->jobs[fcs->out_thread].cSize)
+        DEBUGLOG(5, "CStream : reading %u bytes", (U32)toRead);
+
+        memcpy(inBuff->data + inBuff->end, (const char*)input->src + input->pos, toRead);
+        input->pos += toRead;
+        inBuff->end += toRead;
+
+        if (inBuff->end < inBuff->bufSize)
             break;
 
-        fcs->out_pos = 0;
+        CHECK_F(FL2_compressStreamAsync_internal(fcs, output, 0, 0));
+
+        /* the background job or unwritten output is holding up the input */
+        if (inBuff->end == inBuff->bufSize)
+            break;
     }
-    return 0;
+    return (inBuff->data == NULL) ? (size_t)1 << fcs->cctx->params.rParams.dictionary_log : inBuff->bufSize - inBuff->end;
 }
 
+#endif /* FL2_SINGLETHREAD */
+
 static size_t FL2_remainingOutputSize(FL2_CStream* const fcs)
 {
     FL2_CCtx* const cctx = fcs->cctx;
@@ -876,14 +2449,33 @@ static size_t FL2_remainingOutputSize(FL2_CStream* const fcs)
         total += to_write - pos;
         pos = 0;
     }
-    return total;
+    if (fcs->out_thread < fcs->thread_count)
+        total += cctx->xz_head_size - fcs->head_pos + cctx->xz_tail_size - fcs->tail_pos;
+    if (!fcs->wrote_prop && cctx->xz_check != 0)
+        total += XZ_STREAM_HEADER_SIZE - fcs->xz_pos;
+    /* a pending block or referenced input adds output of unknown size */
+    return total + fcs->pipe_pending + (fcs->ref_pos < fcs->ref_size);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer* output, FL2_inBuffer* input)
 {
     FL2_blockBuffer* const inBuff = &fcs->inBuff;
     FL2_CCtx* const cctx = fcs->cctx;
-    size_t block_overlap = OVERLAP_FROM_DICT_LOG(cctx->params.rParams.dictionary_log, cctx->params.rParams.overlap_fraction);
+    size_t block_overlap = FL2_blockOverlap(cctx);
+
+    if (fcs->ref_data != NULL)
+        return FL2_ERROR(stage_wrong);
+
+    if ((cctx->params.contentBlockLog || cctx->xz_check) && cctx->params.pipelineDepth)
+        return FL2_ERROR(parameter_unsupported);
+
+#ifndef FL2_SINGLETHREAD
+    if (fcs->compressThread != NULL) {
+        if (cctx->params.contentBlockLog || cctx->xz_check)
+            return FL2_ERROR(parameter_unsupported);
+        return FL2_compressStreamAsync(fcs, output, input);
+    }
+#endif
 
     if (FL2_isError(fcs->thread_count))
         return fcs->thread_count;
@@ -895,7 +2487,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer
 
             DEBUGLOG(3, "Allocating input buffer : %u bytes", (U32)inBuff->bufSize);
 
-            inBuff->data = malloc(inBuff->bufSize);
+            inBuff->data = FL2_malloc(inBuff->bufSize, fcs->cctx->customMem);
 
             if (inBuff->data == NULL)
                 return FL2_ERROR(memory_allocation);
@@ -908,16 +2500,22 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer
         }
         if (fcs->out_thread == fcs->thread_count) {
             /* no compressed output to write, so read */
-            size_t const toRead = MIN(input->size - input->pos, inBuff->bufSize - inBuff->end);
+            size_t toRead = MIN(input->size - input->pos, inBuff->bufSize - inBuff->end);
+
+            /* read no more than a minimum content block at a time, so little input follows a cut */
+            if (cctx->params.contentBlockLog)
+                toRead = MIN(toRead, (size_t)1 << (cctx->params.contentBlockLog - 3));
 
             DEBUGLOG(5, "CStream : reading %u bytes", (U32)toRead);
 
             memcpy(inBuff->data + inBuff->end, (char*)input->src + input->pos, toRead);
             input->pos += toRead;
             inBuff->end += toRead;
+            if (cctx->params.contentBlockLog)
+                FL2_findContentCut(fcs);
         }
-        if (inBuff->end == inBuff->bufSize || fcs->out_thread < fcs->thread_count) {
-            CHECK_F(FL2_compressStream_internal(fcs, output, 0));
+        if (inBuff->end == inBuff->bufSize || fcs->cut_end != 0 || fcs->out_thread < fcs->thread_count) {
+            CHECK_F(FL2_compressStream_internal(fcs, output, 0, 0));
         }
         /* compressed output remains, so output buffer is full */
         if (fcs->out_thread < fcs->thread_count)
@@ -926,8 +2524,40 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer
     return (inBuff->data == NULL) ? (size_t)1 << cctx->params.rParams.dictionary_log : inBuff->bufSize - inBuff->end;
 }
 
+FL2LIB_API size_t FL2LIB_CALL FL2_compressStreamRef(FL2_CStream* fcs, const void* base, size_t size)
+{
+    FL2_CCtx* const cctx = fcs->cctx;
+
+    DEBUGLOG(4, "FL2_compressStreamRef : %u bytes", (U32)size);
+
+    /* must be the only input of the frame */
+    if (fcs->inBuff.end != 0 || fcs->ref_data != NULL || fcs->wrote_prop)
+        return FL2_ERROR(stage_wrong);
+    if (cctx->params.contentBlockLog || cctx->xz_check)
+        return FL2_ERROR(parameter_unsupported);
+#ifndef FL2_SINGLETHREAD
+    if (fcs->compressThread != NULL)
+        return FL2_ERROR(parameter_unsupported);
+#endif
+    fcs->ref_data = base;
+    fcs->ref_size = size;
+    fcs->ref_pos = 0;
+    cctx->curBlock.data = base;
+    cctx->curBlock.start = 0;
+    return 0;
+}
+
 static size_t FL2_flushStream_internal(FL2_CStream* fcs, FL2_outBuffer* output, int ending)
 {
+#ifndef FL2_SINGLETHREAD
+    if (fcs->compressThread != NULL) {
+        CHECK_F(FL2_compressStreamAsync_internal(fcs, output, ending, 1));
+        /* a running job or unprocessed input adds output of unknown size */
+        if (fcs->job_running)
+            return 1;
+        return FL2_remainingOutputSize(fcs) + (fcs->inBuff.start < fcs->inBuff.end);
+    }
+#endif
     if (FL2_isError(fcs->thread_count))
         return fcs->thread_count;
 
@@ -935,9 +2565,17 @@ static size_t FL2_flushStream_internal(FL2_CStream* fcs, FL2_outBuffer* output,
         (U32)(fcs->inBuff.end - fcs->inBuff.start),
         (U32)FL2_remainingOutputSize(fcs));
 
-    CHECK_F(FL2_compressStream_internal(fcs, output, ending));
+    /* input following a content-defined cut is compressed as a separate block */
+    do {
+        CHECK_F(FL2_compressStream_internal(fcs, output, ending, 1));
+    } while ((fcs->pipe_pending || fcs->ref_pos < fcs->ref_size || fcs->inBuff.start < fcs->inBuff.end)
+        && fcs->out_thread == fcs->thread_count && output->pos < output->size);
 
-    return FL2_remainingOutputSize(fcs);
+    {   size_t const remaining = FL2_remainingOutputSize(fcs);
+        if (FL2_isError(remaining))
+            return remaining;
+        return remaining + (fcs->inBuff.start < fcs->inBuff.end);
+    }
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer* output)
@@ -945,6 +2583,23 @@ FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer* o
     return FL2_flushStream_internal(fcs, output, 0);
 }
 
+/* FL2_endXzStream() :
+ * Writes the .xz index and stream footer after the last block */
+static size_t FL2_endXzStream(FL2_CStream* const fcs, FL2_outBuffer* const output)
+{
+    FL2_xzIndex* const index = &fcs->cctx->xz_index;
+    size_t size;
+
+    if (!fcs->end_marked) {
+        CHECK_F(FL2_xzIndexFinish(index, fcs->cctx->xz_check));
+        fcs->end_marked = 1;
+    }
+    size = index->size - index->start;
+    DEBUGLOG(4, "Writing index : %u bytes", (U32)(size - fcs->xz_pos));
+    FL2_writeStreamPart(output, index->data + index->start, size, &fcs->xz_pos);
+    return size - fcs->xz_pos;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer* output)
 {
     {   size_t cSize = FL2_flushStream_internal(fcs, output, 1);
@@ -952,6 +2607,9 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer* out
             return cSize;
     }
 
+    if (fcs->cctx->xz_check != 0)
+        return FL2_endXzStream(fcs, output);
+
     if(!fcs->end_marked) {
         if (output->pos >= output->size)
             return 1;
@@ -959,34 +2617,205 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer* out
         ((BYTE*)output->dst)[output->pos] = LZMA2_END_MARKER;
         ++output->pos;
         fcs->end_marked = 1;
+        if (fcs->cctx->params.seekTable && !fcs->cctx->params.omitProp)
+            CHECK_F(FL2_finishSeekTable(fcs->cctx));
     }
 
 #ifndef NO_XXHASH
-    if (fcs->cctx->params.doXXH && !fcs->cctx->params.omitProp && fcs->hash_pos < XXHASH_SIZEOF) {
-        size_t const to_write = MIN(output->size - output->pos, XXHASH_SIZEOF - fcs->hash_pos);
-        XXH32_canonical_t canonical;
-
-        if (output->pos >= output->size)
-            return 1;
+    {   size_t const hashSize = FL2_hashSize(fcs->cctx->hash.type);
+        if (fcs->hash_pos < hashSize) {
+            size_t const to_write = MIN(output->size - output->pos, hashSize - fcs->hash_pos);
+            BYTE digest[FL2_HASH_SIZE_MAX];
+
+            if (output->pos >= output->size)
+                return 1;
+
+            FL2_hashDigest(&fcs->cctx->hash, digest);
+            DEBUGLOG(4, "Writing hash : %u bytes", (U32)to_write);
+            memcpy((BYTE*)output->dst + output->pos, digest + fcs->hash_pos, to_write);
+            output->pos += to_write;
+            fcs->hash_pos += to_write;
+            if (fcs->hash_pos < hashSize)
+                return 1;
+        }
+    }
+#endif
+    if (fcs->cctx->params.seekTable && !fcs->cctx->params.omitProp && fcs->seek_pos < fcs->cctx->seek_size) {
+        size_t const to_write = MIN(output->size - output->pos, fcs->cctx->seek_size - fcs->seek_pos);
 
-        XXH32_canonicalFromHash(&canonical, XXH32_digest(fcs->xxh));
-        DEBUGLOG(4, "Writing XXH32 : %u bytes", (U32)to_write);
-        memcpy((BYTE*)output->dst + output->pos, canonical.digest + fcs->hash_pos, to_write);
+        DEBUGLOG(4, "Writing seek table : %u bytes", (U32)to_write);
+        memcpy((BYTE*)output->dst + output->pos, fcs->cctx->seek_table + fcs->seek_pos, to_write);
         output->pos += to_write;
-        fcs->hash_pos += to_write;
-        return fcs->hash_pos < XXHASH_SIZEOF;
+        fcs->seek_pos += to_write;
+        return fcs->cctx->seek_size - fcs->seek_pos;
+    }
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_waitStream(FL2_CStream* fcs, unsigned timeout)
+{
+#ifndef FL2_SINGLETHREAD
+    if (fcs->job_running) {
+        if (timeout == (unsigned)-1)
+            FL2POOL_waitAll(fcs->compressThread);
+        else if (FL2POOL_waitAllTimeout(fcs->compressThread, timeout))
+            return 1;
+        CHECK_F(FL2_collectJob(fcs));
     }
+#else
+    (void)fcs;
+    (void)timeout;
 #endif
     return 0;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameter(FL2_CStream* fcs, FL2_cParameter param, unsigned value)
 {
-    if (fcs->inBuff.start < fcs->inBuff.end)
+    if (fcs->inBuff.start < fcs->inBuff.end || fcs->pipe_pending)
+        return FL2_ERROR(stage_wrong);
+#ifndef FL2_SINGLETHREAD
+    if (fcs->job_running)
         return FL2_ERROR(stage_wrong);
+#endif
+    if (param == FL2_p_xzFormat
+#ifndef NO_XXHASH
+        || param == FL2_p_doXXHash || param == FL2_p_omitProperties
+#endif
+        ) {
+        size_t const res = FL2_CCtx_setParameter(fcs->cctx, param, value);
+        /* the checksum follows the parameters until the first block of the frame is compressed */
+        if (!FL2_isError(res) && fcs->cctx->dictMax == 0 && !fcs->wrote_prop)
+            CHECK_F(FL2_beginHash(fcs->cctx));
+        return res;
+    }
     return FL2_CCtx_setParameter(fcs->cctx, param, value);
 }
 
+/* FL2_checkParameters() :
+ * Returns 0 if all parameters of the set are in bounds, or an error code. */
+static size_t FL2_checkParameters(const FL2_compressionParameters* const params)
+{
+    CLAMPCHECK(params->dictionaryLog, FL2_DICTLOG_MIN, FL2_DICTLOG_MAX);
+    CLAMPCHECK(params->overlapFraction, FL2_BLOCK_OVERLAP_MIN, FL2_BLOCK_OVERLAP_MAX);
+    CLAMPCHECK(params->chainLog, FL2_CHAINLOG_MIN, FL2_CHAINLOG_MAX);
+    CLAMPCHECK(params->searchLog, FL2_SEARCHLOG_MIN, FL2_SEARCHLOG_MAX);
+    CLAMPCHECK(params->searchDepth, FL2_SEARCH_DEPTH_MIN, FL2_SEARCH_DEPTH_MAX);
+    CLAMPCHECK(params->fastLength, FL2_FASTLENGTH_MIN, FL2_FASTLENGTH_MAX);
+    CLAMPCHECK(params->divideAndConquer, 0, 1);
+    CLAMPCHECK(params->bufferLog, FL2_BUFFER_SIZE_LOG_MIN, FL2_BUFFER_SIZE_LOG_MAX);
+    CLAMPCHECK(params->strategy, (unsigned)FL2_fast, (unsigned)FL2_adaptive);
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getLevelParameters(int compressionLevel, int highCompression, FL2_compressionParameters* params)
+{
+    if (compressionLevel < 1 || compressionLevel > (highCompression ? FL2_MAX_HIGH_CLEVEL : FL2_MAX_CLEVEL))
+        return FL2_ERROR(parameter_outOfBound);
+    *params = highCompression ? FL2_highCParameters[compressionLevel] : FL2_defaultCParameters[compressionLevel];
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameters(FL2_CCtx* cctx, const FL2_compressionParameters* params)
+{
+    CHECK_F(FL2_checkParameters(params));
+    FL2_fillParameters(cctx, params);
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameters(FL2_CStream* fcs, const FL2_compressionParameters* params)
+{
+    if (fcs->inBuff.start < fcs->inBuff.end || fcs->pipe_pending)
+        return FL2_ERROR(stage_wrong);
+#ifndef FL2_SINGLETHREAD
+    if (fcs->job_running)
+        return FL2_ERROR(stage_wrong);
+#endif
+    return FL2_CCtx_setParameters(fcs->cctx, params);
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CCtx_getParameters(const FL2_CCtx* cctx, FL2_compressionParameters* params)
+{
+    const FL2_lzma2Parameters* const cParams = &cctx->params.cParams;
+    const RMF_parameters* const rParams = &cctx->params.rParams;
+    params->dictionaryLog = rParams->dictionary_log;
+    params->overlapFraction = rParams->overlap_fraction;
+    params->chainLog = cParams->second_dict_bits;
+    params->searchLog = ZSTD_highbit32(cParams->match_cycles);
+    params->searchDepth = rParams->depth;
+    params->fastLength = cParams->fast_length;
+    params->divideAndConquer = rParams->divide_and_conquer;
+    params->bufferLog = rParams->match_buffer_log;
+    params->strategy = (unsigned)cParams->strategy;
+}
+
+/* Fields in the order of the text form */
+static const size_t FL2_parameterFields[] = {
+    offsetof(FL2_compressionParameters, dictionaryLog),
+    offsetof(FL2_compressionParameters, overlapFraction),
+    offsetof(FL2_compressionParameters, chainLog),
+    offsetof(FL2_compressionParameters, searchLog),
+    offsetof(FL2_compressionParameters, searchDepth),
+    offsetof(FL2_compressionParameters, fastLength),
+    offsetof(FL2_compressionParameters, divideAndConquer),
+    offsetof(FL2_compressionParameters, bufferLog),
+    offsetof(FL2_compressionParameters, strategy)
+};
+
+#define FL2_PARAMETERS_COUNT (sizeof(FL2_parameterFields) / sizeof(FL2_parameterFields[0]))
+
+FL2LIB_API size_t FL2LIB_CALL FL2_parametersToString(char* dst, size_t dstCapacity, const FL2_compressionParameters* params)
+{
+    char text[FL2_PARAMETERS_STRING_MAX];
+    size_t len = 0;
+
+    CHECK_F(FL2_checkParameters(params));
+    for (size_t n = 0; n < FL2_PARAMETERS_COUNT; ++n) {
+        unsigned const value = *(const unsigned*)((const BYTE*)params + FL2_parameterFields[n]);
+        int const written = snprintf(text + len, sizeof(text) - len, (n != 0) ? ",%u" : "%u", value);
+        if (written < 0 || (size_t)written >= sizeof(text) - len)
+            return FL2_ERROR(GENERIC);
+        len += (size_t)written;
+    }
+    if (len >= dstCapacity)
+        return FL2_ERROR(dstSize_tooSmall);
+    memcpy(dst, text, len + 1);
+    return len;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_parametersFromString(FL2_compressionParameters* params, const char* src)
+{
+    FL2_compressionParameters set;
+
+    for (size_t n = 0; n < FL2_PARAMETERS_COUNT; ++n) {
+        unsigned value = 0;
+        if (n != 0 && *src++ != ',')
+            return FL2_ERROR(parameter_outOfBound);
+        if (*src < '0' || *src > '9')
+            return FL2_ERROR(parameter_outOfBound);
+        for (; *src >= '0' && *src <= '9'; ++src) {
+            if (value > 9999)
+                return FL2_ERROR(parameter_outOfBound);
+            value = value * 10 + (unsigned)(*src - '0');
+        }
+        *(unsigned*)((BYTE*)&set + FL2_parameterFields[n]) = value;
+    }
+    if (*src != '\0')
+        return FL2_ERROR(parameter_outOfBound);
+    CHECK_F(FL2_checkParameters(&set));
+    *params = set;
+    return 0;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CStream_getRandomFilterStats(const FL2_CStream* fcs, unsigned long long* bytesTested, unsigned long long* bytesRandom)
+{
+    FL2_CCtx_getRandomFilterStats(fcs->cctx, bytesTested, bytesRandom);
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_CStream_getStats(const FL2_CStream* fcs, FL2_compressStats* stats)
+{
+    FL2_CCtx_getStats(fcs->cctx, stats);
+}
+
 
 size_t FL2_memoryUsage_internal(unsigned const dictionaryLog, unsigned const bufferLog, unsigned const searchDepth,
     unsigned chainLog, FL2_strategy strategy,
@@ -1006,14 +2835,35 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize(int compressionLevel, unsigne
         nbThreads);
 }
 
+/* FL2_smallMemoryUsage_internal() :
+ * Memory usage for a block of up to FL2_SMALL_INPUT_MAX bytes, which doesn't use the radix match finder. */
+static size_t FL2_smallMemoryUsage_internal(size_t const srcSize, unsigned const chainLog, FL2_strategy const strategy,
+    unsigned const nbThreads)
+{
+    return RMF_smallMemoryUsage(srcSize) + FL2_lzma2MemoryUsage(chainLog, strategy, nbThreads);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_bySize(int compressionLevel, size_t srcSize, unsigned nbThreads)
+{
+    if (srcSize == 0 || srcSize > FL2_SMALL_INPUT_MAX)
+        return FL2_estimateCCtxSize(compressionLevel, nbThreads);
+    return FL2_smallMemoryUsage_internal(srcSize,
+        FL2_defaultCParameters[compressionLevel].chainLog,
+        FL2_defaultCParameters[compressionLevel].strategy,
+        nbThreads);
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx * cctx)
 {
-    return FL2_memoryUsage_internal(cctx->params.rParams.dictionary_log,
+    size_t const size = FL2_memoryUsage_internal(cctx->params.rParams.dictionary_log,
         cctx->params.rParams.match_buffer_log,
         cctx->params.rParams.depth,
         cctx->params.cParams.second_dict_bits,
         cctx->params.cParams.strategy,
-        cctx->jobCount);
+        cctx->threadLimit);
+    if (cctx->params.longWindowLog > cctx->params.rParams.dictionary_log)
+        return size + FL2_ldmMemoryUsage(cctx->params.longWindowLog);
+    return size;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsigned nbThreads)
@@ -1024,6 +2874,19 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsi
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCCtx(const FL2_CStream* fcs)
 {
-    return FL2_estimateCCtxSize_usingCCtx(fcs->cctx)
-        + ((size_t)1 << fcs->cctx->params.rParams.dictionary_log);
+    const FL2_CCtx* const cctx = fcs->cctx;
+    size_t size = FL2_estimateCCtxSize_usingCCtx(cctx)
+        + ((size_t)1 << cctx->params.rParams.dictionary_log);
+#ifndef FL2_SINGLETHREAD
+    if (fcs->compressThread != NULL) {
+        /* second input buffer */
+        return size + ((size_t)1 << cctx->params.rParams.dictionary_log);
+    }
+#endif
+    if (cctx->params.pipelineDepth) {
+        /* second match table and input buffer */
+        size += RMF_memoryUsage(cctx->params.rParams.dictionary_log, cctx->params.rParams.match_buffer_log, cctx->params.rParams.depth, cctx->threadLimit)
+            + ((size_t)1 << cctx->params.rParams.dictionary_log);
+    }
+    return size;
 }
@@ -19,30 +19,19 @@
 #include "data_block.h"
 #include "radix_internal.h"
 #include "lzma2_enc.h"
+#include "fl2_ldm.h"
+#include "fl2_xz.h"
 #include "fast-lzma2.h"
 #include "fl2_threading.h"
 #include "fl2_pool.h"
 #ifndef NO_XXHASH
-#  include "xxhash.h"
+#  include "fl2_hash.h"
 #endif
 
 #if defined (__cplusplus)
 extern "C" {
 #endif
 
-typedef struct {
-    unsigned dictionaryLog;    /* largest match distance : larger == more compression, more memory needed during decompression; >= 27 == more memory, slower */
-    unsigned overlapFraction;  /* overlap between consecutive blocks in 1/16 units: larger == more compression, slower */
-    unsigned chainLog;         /* fully searched segment : larger == more compression, slower, more memory; hybrid mode only (ultra) */
-    unsigned searchLog;        /* nb of searches : larger == more compression, slower; hybrid mode only (ultra) */
-    unsigned searchDepth;      /* maximum depth for resolving string matches : larger == more compression, slower; >= 64 == more memory, slower */
-    unsigned fastLength;       /* acceptable match size for parser, not less than searchDepth : larger == more compression, slower; fast bytes parameter from 7-zip */
-    unsigned divideAndConquer; /* split long chains of 2-byte matches into shorter chains with a small overlap : faster, somewhat less compression; enabled by default */
-    unsigned bufferLog;        /* buffer size for processing match chains is (dictionaryLog - bufferLog) : when divideAndConquer enabled, affects compression; */
-                               /* when divideAndConquer disabled, affects speed in a hardware-dependent manner */
-    FL2_strategy strategy;     /* encoder strategy : fast, optimized or ultra (hybrid) */
-} FL2_compressionParameters;
-
 /*-*************************************
 *  Context memory management
 ***************************************/
@@ -56,40 +45,117 @@ typedef struct {
     BYTE doXXH;
 #endif
     BYTE omitProp;
+    BYTE seekTable;
+    BYTE pipelineDepth;
+    BYTE contentBlockLog;
+    BYTE collectStats;
+    BYTE memoryPriority;
+    BYTE longWindowLog;   /* long-distance matcher window, or 0 for none */
+    BYTE flushWindowLog;  /* prefix kept before flushed data, or 0 for the whole buffer */
+    BYTE xzFormat;        /* .xz output and its check, or 0 for the FL2 frame */
+    unsigned memoryLimit; /* MiB, or 0 for none */
 } FL2_CCtx_params;
 
 typedef struct {
     FL2_CCtx* cctx;
     FL2_lzmaEncoderCtx* enc;
     FL2_dataBlock block;
+    BYTE* dst;          /* direct output destination, or NULL to write to the match table */
+    size_t dstCapacity;
     size_t cSize;
+    U64 busy;           /* stats : time spent working in the current phase */
+    FL2_threadStats stats;
 } FL2_job;
 
+typedef struct {
+    FL2_CCtx* cctx;     /* single-threaded context, created on first use */
+    size_t written;     /* total compressed size of the buffers done */
+    size_t err;         /* error of the first buffer which failed, or 0 */
+    size_t err_index;
+} FL2_batchWorker;
+
 struct FL2_CCtx_s {
     FL2_CCtx_params params;
 #ifndef FL2_SINGLETHREAD
     FL2POOL_ctx* factory;
+    FL2POOL_ctx* batch_pool;    /* view of factory for the FL2_compressBatch() workers */
 #endif
     FL2_dataBlock curBlock;
     size_t dictMax;
     U64 block_total;
+    BYTE* seek_table;   /* serialized seek table entries */
+    size_t seek_size;
+    size_t seek_cap;
+    unsigned xz_check;  /* check ID of the .xz stream being written, or 0 */
+    U64 xz_check_value; /* check of curBlock */
+    BYTE xz_head[XZ_BLOCK_HEADER_MAX];  /* header of the .xz block holding curBlock */
+    size_t xz_head_size;
+    BYTE xz_tail[XZ_BLOCK_TAIL_MAX];    /* end marker, padding and check of the block */
+    size_t xz_tail_size;
+    FL2_xzIndex xz_index;
+    U64 in_total;       /* uncompressed bytes in the current frame */
+    U64 out_total;      /* LZMA2 data bytes in the current frame */
+    U64 filter_total;   /* bytes tested by the random filter in the current frame */
+    U64 filter_random;  /* bytes it excluded from the match table */
+    FL2_compressStats stats;
     FL2_matchTable* matchTable;
+    FL2_matchTable* pipeTable;  /* pipelined streaming : table of the next block */
+    FL2_dataBlock pipeBlock;
+    size_t encThreads;
+    size_t pipeThreads;
+    FL2_matchTable* initTable;  /* table and block for the multithreaded init */
+    FL2_dataBlock initBlock;
+    size_t initThreads;
+    BYTE* dict_buf;     /* preset dictionary, followed by the first block of the input */
+    size_t dict_size;
+    size_t dict_cap;
+    FL2_ldm* ldm;       /* long-distance matcher, created for FL2_p_longWindowLog */
+    BYTE ldm_active;    /* FL2_compressCCtx() is feeding the source to ldm */
+    U32* slice_cost;    /* estimated encoding cost of each unit of curBlock, for slicing */
+    size_t slice_cost_cap;
+    FL2_batchWorker* batch;     /* one per thread for FL2_compressBatch(), or NULL */
+    const FL2_inBuffer* batch_srcs;
+    FL2_outBuffer* batch_dsts;
+    size_t batch_count;
+    size_t batch_split;         /* buffers at least this large are compressed with all threads */
+    FL2_atomic batch_next;      /* next buffer for a worker to take */
+#ifndef NO_XXHASH
+    FL2_hash hash;      /* checksum of the frame, updated with each block during its compression */
+#endif
+    FL2_customMem customMem;
+    FL2_CCtx* poolNext;         /* next idle context in an FL2_CCtxPool */
     unsigned jobCount;
+    unsigned threadLimit;       /* number of jobs used, reduced from jobCount to meet FL2_p_memoryLimit */
     FL2_job jobs[1];
 };
 
 struct FL2_CStream_s {
     FL2_CCtx* cctx;
     FL2_blockBuffer inBuff;
-#ifndef NO_XXHASH
-    XXH32_state_t *xxh;
-#endif
+    BYTE* spare;        /* pipelined streaming : holds the pending block */
+    const BYTE* ref_data; /* caller-owned input registered with FL2_compressStreamRef() */
+    size_t ref_size;
+    size_t ref_pos;
     size_t thread_count;
     size_t out_thread;
     size_t out_pos;
     size_t hash_pos;
+    size_t seek_pos;
+    size_t xz_pos;      /* bytes written of the .xz stream header, or of the index and footer */
+    size_t head_pos;    /* bytes written of the .xz block header and tail */
+    size_t tail_pos;
+    size_t cut_pos;     /* content-defined blocks : next input position to hash */
+    size_t cut_end;     /* end of the next block, or 0 if no cut was found yet */
+    U64 cut_hash;       /* rolling hash of the input before cut_pos */
+    U64 gear[256];      /* rolling hash values of each byte */
     BYTE end_marked;
     BYTE wrote_prop;
+    BYTE pipe_pending;  /* a block with a built match table awaits encoding */
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_ctx* compressThread; /* async mode : runs the block compression */
+    size_t job_result;
+    BYTE job_running;
+#endif
 };
 
 #if defined (__cplusplus)
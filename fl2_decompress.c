@@ -15,10 +15,17 @@
 #include "mem.h"
 #include "util.h"
 #include "lzma2_dec.h"
+#include "fl2_threading.h"
+#include "fl2_pool.h"
+#include "atomic.h"
 #ifndef NO_XXHASH
-#  include "xxhash.h"
+#  include "fl2_hash.h"
 #endif
 
+/* Single-threaded decoding into dst updates the hash after each step of this size,
+ * while the output is still in the L2 cache */
+#define FL2_HASH_STEP_SIZE ((size_t)1 << 18)
+
 FL2LIB_API size_t FL2LIB_CALL FL2_findDecompressedSize(const void *src, size_t srcSize)
 {
     return FLzma2Dec_UnpackSize(src, srcSize);
@@ -26,9 +33,16 @@ FL2LIB_API size_t FL2LIB_CALL FL2_findDecompressedSize(const void *src, size_t s
 
 FL2LIB_API size_t FL2LIB_CALL FL2_decompress(void* dst, size_t dstCapacity,
     const void* src, size_t compressedSize)
+{
+    return FL2_decompressMt(dst, dstCapacity, src, compressedSize, 1);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressMt(void* dst, size_t dstCapacity,
+    const void* src, size_t compressedSize,
+    unsigned nbThreads)
 {
     size_t dSize;
-    FL2_DCtx* const dctx = FL2_createDCtx();
+    FL2_DCtx* const dctx = FL2_createDCtxMt(nbThreads);
     if(dctx == NULL)
         return FL2_ERROR(memory_allocation);
     dSize = FL2_decompressDCtx(dctx,
@@ -38,26 +52,400 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompress(void* dst, size_t dstCapacity,
     return dSize;
 }
 
+/* A segment is a run of chunks beginning with a dictionary reset, which can be decoded
+ * independently of the rest of the stream */
+typedef struct
+{
+    CLzma2Dec dec;
+    size_t packPos;
+    size_t packSize;
+    size_t unpackPos;
+    size_t unpackSize;
+    size_t res;
+} FL2_decJob;
+
+typedef struct
+{
+    FL2_DCtx* dctx;     /* single-threaded context, created on first use */
+    size_t written;     /* total decompressed size of the frames done */
+    size_t err;         /* error of the first frame which failed, or 0 */
+    size_t err_index;
+} FL2_decBatchWorker;
+
+struct FL2_DCtx_s
+{
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_ctx* factory;
+#endif
+    const BYTE* src;
+    BYTE* dst;
+    FL2_DCtx* poolNext;     /* next idle context in an FL2_DCtxPool */
+    BYTE* dict_buf;         /* preset dictionary, followed by the output when decoding with it */
+    size_t dict_size;
+    size_t dict_cap;
+#ifndef NO_XXHASH
+    FL2_hash hash;
+#endif
+    FL2_decBatchWorker* batch;  /* one per thread for FL2_decompressBatch(), or NULL */
+    const FL2_inBuffer* batch_srcs;
+    FL2_outBuffer* batch_dsts;
+    size_t batch_count;
+    FL2_atomic batch_next;      /* next frame for a worker to take */
+    unsigned jobCount;
+    BYTE prop;
+    FL2_decJob jobs[1];
+};
+
 FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtx(void)
 {
-    DEBUGLOG(3, "FL2_createDCtx");
-    FL2_DCtx* const dctx = malloc(sizeof(FL2_DCtx));
-    if (dctx) {
-        LzmaDec_Construct(dctx);
+    return FL2_createDCtxMt(1);
+}
+
+/* FL2_createDCtx_internal() :
+ * Creates a context which runs its jobs on the threads of sharedPool if not NULL. */
+static FL2_DCtx* FL2_createDCtx_internal(unsigned nbThreads, FL2POOL_ctx* const sharedPool)
+{
+    FL2_DCtx* dctx;
+
+    nbThreads = FL2_checkNbThreads(nbThreads);
+
+    DEBUGLOG(3, "FL2_createDCtxMt : %u threads", nbThreads);
+
+    dctx = malloc(sizeof(FL2_DCtx) + (nbThreads - 1) * sizeof(FL2_decJob));
+    if (dctx == NULL)
+        return NULL;
+
+    dctx->poolNext = NULL;
+    dctx->dict_buf = NULL;
+    dctx->dict_size = 0;
+    dctx->dict_cap = 0;
+    dctx->batch = NULL;
+#ifndef NO_XXHASH
+    FL2_hashInit(&dctx->hash);
+#endif
+    dctx->jobCount = nbThreads;
+    for (unsigned u = 0; u < nbThreads; ++u) {
+        LzmaDec_Construct(&dctx->jobs[u].dec);
+    }
+
+#ifndef FL2_SINGLETHREAD
+    dctx->factory = (sharedPool != NULL) ? FL2POOL_createView(sharedPool) : FL2POOL_create(nbThreads - 1);
+    if (nbThreads > 1 && dctx->factory == NULL) {
+        FL2_freeDCtx(dctx);
+        return NULL;
     }
+#else
+    (void)sharedPool;
+#endif
+
     return dctx;
 }
 
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtxMt(unsigned nbThreads)
+{
+    return FL2_createDCtx_internal(nbThreads, NULL);
+}
+
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtxWithPool(FL2_threadPool* pool)
+{
+    return FL2_createDCtx_internal(pool->nbThreads, pool->factory);
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_freeDCtx(FL2_DCtx* dctx)
 {
     if (dctx != NULL) {
-        DEBUGLOG(3, "FL2_freeDCtx");
-        FLzmaDec_Free(dctx);
+        DEBUGLOG(3, "FL2_freeDCtx : %u threads", dctx->jobCount);
+        for (unsigned u = 0; u < dctx->jobCount; ++u) {
+            FLzmaDec_Free(&dctx->jobs[u].dec);
+        }
+#ifndef FL2_SINGLETHREAD
+        FL2POOL_free(dctx->factory);
+#endif
+        free(dctx->dict_buf);
+        if (dctx->batch != NULL) {
+            for (unsigned u = 0; u < dctx->jobCount; ++u)
+                FL2_freeDCtx(dctx->batch[u].dctx);
+            free(dctx->batch);
+        }
+#ifndef NO_XXHASH
+        FL2_hashFree(&dctx->hash);
+#endif
         free(dctx);
     }
     return 0;
 }
 
+FL2LIB_API unsigned FL2LIB_CALL FL2_DCtx_nbThreads(const FL2_DCtx* dctx)
+{
+    return dctx->jobCount;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_DCtx_setMemoryLimit(FL2_DCtx* dctx, size_t limit)
+{
+    for (unsigned u = 0; u < dctx->jobCount; ++u)
+        dctx->jobs[u].dec.dicLimit = limit;
+}
+
+struct FL2_DCtxPool_s {
+    ZSTD_pthread_mutex_t mutex;
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_ctx* factory;   /* worker threads shared by all contexts */
+#endif
+    FL2_DCtx* idle;
+    unsigned nbThreads;
+};
+
+FL2LIB_API FL2_DCtxPool* FL2LIB_CALL FL2_createDCtxPool(unsigned nbThreads)
+{
+    FL2_DCtxPool* const pool = malloc(sizeof(FL2_DCtxPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->nbThreads = FL2_checkNbThreads(nbThreads);
+    pool->idle = NULL;
+
+    DEBUGLOG(3, "FL2_createDCtxPool : %u threads", pool->nbThreads);
+
+#ifndef FL2_SINGLETHREAD
+    pool->factory = FL2POOL_create(pool->nbThreads - 1);
+    if (pool->nbThreads > 1 && pool->factory == NULL) {
+        free(pool);
+        return NULL;
+    }
+#endif
+    if (ZSTD_pthread_mutex_init(&pool->mutex, NULL)) {
+#ifndef FL2_SINGLETHREAD
+        FL2POOL_free(pool->factory);
+#endif
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_freeDCtxPool(FL2_DCtxPool* pool)
+{
+    if (pool == NULL)
+        return;
+
+    DEBUGLOG(3, "FL2_freeDCtxPool");
+
+    while (pool->idle != NULL) {
+        FL2_DCtx* const dctx = pool->idle;
+        pool->idle = dctx->poolNext;
+        FL2_freeDCtx(dctx);
+    }
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(pool->factory);
+#endif
+    ZSTD_pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_DCtxPool_acquire(FL2_DCtxPool* pool)
+{
+    FL2_DCtx* dctx;
+
+    ZSTD_pthread_mutex_lock(&pool->mutex);
+    dctx = pool->idle;
+    if (dctx != NULL)
+        pool->idle = dctx->poolNext;
+    ZSTD_pthread_mutex_unlock(&pool->mutex);
+
+    if (dctx == NULL) {
+#ifndef FL2_SINGLETHREAD
+        dctx = FL2_createDCtx_internal(pool->nbThreads, pool->factory);
+#else
+        dctx = FL2_createDCtx_internal(pool->nbThreads, NULL);
+#endif
+    }
+    else {
+        dctx->poolNext = NULL;
+        dctx->dict_size = 0;
+    }
+    return dctx;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_DCtxPool_release(FL2_DCtxPool* pool, FL2_DCtx* dctx)
+{
+    if (dctx == NULL)
+        return;
+
+    ZSTD_pthread_mutex_lock(&pool->mutex);
+    dctx->poolNext = pool->idle;
+    pool->idle = dctx;
+    ZSTD_pthread_mutex_unlock(&pool->mutex);
+}
+
+static size_t FL2_reserveBuffer(BYTE** const buf, size_t* const cap, size_t const size)
+{
+    if (size > *cap) {
+        size_t const newCap = MAX(size, *cap + (*cap >> 1));
+        BYTE* const newBuf = realloc(*buf, newCap);
+        if (newBuf == NULL)
+            return FL2_ERROR(memory_allocation);
+        *buf = newBuf;
+        *cap = newCap;
+    }
+    return FL2_error_no_error;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_DCtx_loadDictionary(FL2_DCtx* dctx, const void* dict, size_t dictSize)
+{
+    DEBUGLOG(4, "FL2_DCtx_loadDictionary : %u bytes", (U32)dictSize);
+
+    dctx->dict_size = 0;
+    if (dict == NULL || dictSize == 0)
+        return 0;
+    if (dictSize > ((size_t)1 << FL2_DICTLOG_MAX))
+        return FL2_ERROR(parameter_outOfBound);
+    CHECK_F(FL2_reserveBuffer(&dctx->dict_buf, &dctx->dict_cap, dictSize));
+    memcpy(dctx->dict_buf, dict, dictSize);
+    dctx->dict_size = dictSize;
+    return 0;
+}
+
+FL2LIB_API int FL2LIB_CALL FL2_setDecoderAsm(int enable)
+{
+    return LZMA2_setDecodeAsm(enable);
+}
+
+/* FL2_decodeSegment() : FL2POOL_function type */
+static void FL2_decodeSegment(void* const jobDescription, size_t n)
+{
+    FL2_DCtx* const dctx = (FL2_DCtx*)jobDescription;
+    FL2_decJob* const job = &dctx->jobs[n];
+    size_t srcLen = job->packSize;
+    size_t res;
+
+    job->res = FLzma2Dec_Init(&job->dec, dctx->prop, dctx->dst + job->unpackPos, job->unpackSize);
+    if (FL2_isError(job->res))
+        return;
+
+    /* The segment has no end marker, so decoding stops when the output is full */
+    res = FLzma2Dec_DecodeToDic(&job->dec, job->unpackSize, dctx->src + job->packPos, &srcLen, LZMA_FINISH_ANY);
+    if (FL2_isError(res))
+        job->res = res;
+    else if (job->dec.dicPos != job->unpackSize || srcLen != job->packSize)
+        job->res = FL2_ERROR(corruption_detected);
+    else
+        job->res = job->unpackSize;
+}
+
+/* Decode the segments stored in jobs[0 .. count-1], one per thread */
+static size_t FL2_decodeSegments(FL2_DCtx* const dctx, const BYTE* const src, BYTE* const dst, unsigned const count)
+{
+    DEBUGLOG(5, "FL2_decodeSegments : %u segments", count);
+
+    dctx->src = src;
+    dctx->dst = dst;
+
+#ifndef FL2_SINGLETHREAD
+    for (unsigned u = 1; u < count; ++u) {
+        FL2POOL_add(dctx->factory, FL2_decodeSegment, dctx, u);
+    }
+#endif
+
+    FL2_decodeSegment(dctx, 0);
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(dctx->factory);
+#endif
+
+    for (unsigned u = 0; u < count; ++u) {
+        if (FL2_isError(dctx->jobs[u].res))
+            return dctx->jobs[u].res;
+    }
+    return 0;
+}
+
+/* Split the stream into segments at each dictionary reset and decode up to jobCount of them concurrently */
+static size_t FL2_decompressSegments(FL2_DCtx* const dctx,
+    BYTE* const dst, size_t const dstCapacity,
+    const BYTE* const src, size_t const srcSize,
+    size_t* const srcPos)
+{
+    size_t pos = 0;
+    size_t unpackPos = 0;
+    int end = 0;
+
+    while (!end) {
+        unsigned count = 0;
+
+        for (; count < dctx->jobCount; ++count) {
+            FL2_decJob* const job = &dctx->jobs[count];
+            job->packPos = pos;
+            job->unpackPos = unpackPos;
+            for (;;) {
+                U32 packSize;
+                U32 unpackSize;
+                BYTE dicReset;
+                size_t const headerSize = FLzma2Dec_ParseChunk(src + pos, srcSize - pos, &packSize, &unpackSize, &dicReset);
+                if (FL2_isError(headerSize))
+                    return headerSize;
+                if (headerSize == 0)
+                    return FL2_ERROR(srcSize_wrong);
+                if (unpackSize == 0) {
+                    end = 1;
+                    break;
+                }
+                if (dicReset && pos != job->packPos)
+                    break;
+                if (packSize > srcSize - pos - headerSize)
+                    return FL2_ERROR(srcSize_wrong);
+                pos += headerSize + packSize;
+                unpackPos += unpackSize;
+            }
+            if (pos == job->packPos)
+                break;
+            job->packSize = pos - job->packPos;
+            job->unpackSize = unpackPos - job->unpackPos;
+            if (end) {
+                ++count;
+                break;
+            }
+        }
+        if (unpackPos > dstCapacity)
+            return FL2_ERROR(dstSize_tooSmall);
+        if (count)
+            CHECK_F(FL2_decodeSegments(dctx, src, dst, count));
+    }
+    /* Skip the end marker */
+    *srcPos = pos + 1;
+    return unpackPos;
+}
+
+/* FL2_decompressWithDictionary() :
+ * Decodes on one thread into dict_buf after the preset dictionary, which is
+ * referenced by the first segment, then copies the output to dst. */
+static size_t FL2_decompressWithDictionary(FL2_DCtx* const dctx, BYTE const prop,
+    BYTE* const dst, size_t const unpackSize,
+    const BYTE* const src, size_t* const srcPos)
+{
+    CLzma2Dec* const dec = &dctx->jobs[0].dec;
+    U32 const dictSize = (prop >= 40) ? 0xFFFFFFFF : LZMA2_DIC_SIZE_FROM_PROP(prop);
+    size_t const prefix = MIN(dctx->dict_size, dictSize);
+    BYTE* dic;
+    size_t res;
+
+    CHECK_F(FL2_reserveBuffer(&dctx->dict_buf, &dctx->dict_cap, dctx->dict_size + unpackSize));
+    dic = dctx->dict_buf + dctx->dict_size - prefix;
+
+    CHECK_F(FLzma2Dec_Init(dec, prop, dic, prefix + unpackSize));
+    CHECK_F(FLzma2Dec_InitDictionary(dec, dctx->dict_buf, dctx->dict_size));
+
+    res = FLzma2Dec_DecodeToDic(dec, prefix + unpackSize, src, srcPos, LZMA_FINISH_END);
+    if (FL2_isError(res))
+        return res;
+    if (res == LZMA_STATUS_NEEDS_MORE_INPUT)
+        return FL2_ERROR(srcSize_wrong);
+    if (dec->dicPos != prefix + unpackSize)
+        return FL2_ERROR(corruption_detected);
+
+    memcpy(dst, dic + prefix, unpackSize);
+    return unpackSize;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
     void* dst, size_t dstCapacity,
     const void* src, size_t srcSize)
@@ -65,6 +453,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
     size_t res;
     BYTE prop = *(const BYTE*)src;
     BYTE const do_hash = prop >> FL2_PROP_HASH_BIT;
+    BYTE hashed = 0;
     size_t dicPos;
     const BYTE *srcBuf = src;
     size_t srcPos;
@@ -73,41 +462,428 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
     ++srcBuf;
     --srcSize;
 
+    DEBUGLOG(4, "FL2_decompressDCtx : dict prop 0x%X, do hash %u", prop & FL2_LZMA_PROP_MASK, do_hash);
+
+#ifndef NO_XXHASH
+    if (do_hash && FL2_hashReset(&dctx->hash, FL2_hashTypeFromProp(prop)))
+        return FL2_ERROR(memory_allocation);
+#endif
     prop &= FL2_LZMA_PROP_MASK;
 
-    DEBUGLOG(4, "FL2_decompressDCtx : dict prop 0x%X, do hash %u", prop, do_hash);
+    if (dctx->dict_size) {
+        size_t const unpackSize = FLzma2Dec_UnpackSize(src, srcEnd + 1);
+        if (unpackSize == LZMA2_CONTENTSIZE_ERROR)
+            return FL2_ERROR(srcSize_wrong);
+        if (unpackSize > dstCapacity)
+            return FL2_ERROR(dstSize_tooSmall);
+        srcPos = srcSize;
+        dicPos = FL2_decompressWithDictionary(dctx, prop, dst, unpackSize, srcBuf, &srcPos);
+        if (FL2_isError(dicPos))
+            return dicPos;
+    }
+    else if (dctx->jobCount > 1) {
+        dctx->prop = prop;
+        dicPos = FL2_decompressSegments(dctx, dst, dstCapacity, srcBuf, srcSize, &srcPos);
+        if (FL2_isError(dicPos))
+            return dicPos;
+    }
+    else {
+        CLzma2Dec* const dec = &dctx->jobs[0].dec;
 
-    CHECK_F(FLzma2Dec_Init(dctx, prop, dst, dstCapacity));
+        /* when checking a hash, decode in steps and hash each while it is still in cache */
+        size_t const step = do_hash ? FL2_HASH_STEP_SIZE : dstCapacity;
 
-    dicPos = dctx->dicPos;
+        CHECK_F(FLzma2Dec_Init(dec, prop, dst, dstCapacity));
 
-    srcPos = srcSize;
-    res = FLzma2Dec_DecodeToDic(dctx, dstCapacity, srcBuf, &srcPos, LZMA_FINISH_END);
-    if (FL2_isError(res))
-        return res;
-    if (res == LZMA_STATUS_NEEDS_MORE_INPUT)
-        return FL2_ERROR(srcSize_wrong);
+        dicPos = dec->dicPos;
+        srcPos = 0;
+        do {
+            size_t const start = dec->dicPos;
+            size_t const limit = start + MIN(step, dstCapacity - start);
+            size_t srcLen = srcSize - srcPos;
 
-    dicPos = dctx->dicPos - dicPos;
+            res = FLzma2Dec_DecodeToDic(dec, limit, srcBuf + srcPos, &srcLen, (limit == dstCapacity) ? LZMA_FINISH_END : LZMA_FINISH_ANY);
+            srcPos += srcLen;
+            if (FL2_isError(res))
+                return res;
+            if (res == LZMA_STATUS_NEEDS_MORE_INPUT)
+                return FL2_ERROR(srcSize_wrong);
+#ifndef NO_XXHASH
+            if (do_hash)
+                FL2_hashUpdate(&dctx->hash, dec->dic + start, dec->dicPos - start);
+#endif
+        } while (res == LZMA_STATUS_NOT_FINISHED);
+
+        dicPos = dec->dicPos - dicPos;
+        hashed = 1;
+    }
 
 #ifndef NO_XXHASH
     if (do_hash) {
-        XXH32_canonical_t canonical;
-        U32 hash;
+        size_t const hashSize = FL2_hashSize(dctx->hash.type);
+        BYTE digest[FL2_HASH_SIZE_MAX];
 
         DEBUGLOG(4, "Checking hash");
 
-        if (srcEnd - srcPos < XXHASH_SIZEOF)
+        if (srcEnd - srcPos < hashSize)
             return FL2_ERROR(srcSize_wrong);
-        memcpy(&canonical, srcBuf + srcPos, XXHASH_SIZEOF);
-        hash = XXH32_hashFromCanonical(&canonical);
-        if (hash != XXH32(dst, dicPos, 0))
+        if (!hashed)
+            FL2_hashUpdate(&dctx->hash, dst, dicPos);
+        FL2_hashDigest(&dctx->hash, digest);
+        if (memcmp(digest, srcBuf + srcPos, hashSize) != 0)
             return FL2_ERROR(checksum_wrong);
     }
+#else
+    (void)hashed;
 #endif
     return dicPos;
 }
 
+/* FL2_isSegmented() :
+ * Returns nonzero if the frame has a dictionary reset after its first chunk, so the
+ * multithreaded decoder can split it. */
+static int FL2_isSegmented(const BYTE* const src, size_t const srcSize)
+{
+    size_t pos = 1;
+
+    while (pos < srcSize) {
+        U32 packSize;
+        U32 unpackSize;
+        BYTE dicReset;
+        size_t const headerSize = FLzma2Dec_ParseChunk(src + pos, srcSize - pos, &packSize, &unpackSize, &dicReset);
+        if (FL2_isError(headerSize) || headerSize == 0 || unpackSize == 0)
+            break;
+        if (dicReset && pos != 1)
+            return 1;
+        pos += headerSize + packSize;
+    }
+    return 0;
+}
+
+/* FL2_batchDecompressFrame() :
+ * Decompresses frame `index` of the batch with dctx, adding the size to *written. */
+static size_t FL2_batchDecompressFrame(FL2_DCtx* const dctx, FL2_DCtx* const batch, size_t const index, size_t* const written)
+{
+    const FL2_inBuffer* const src = &batch->batch_srcs[index];
+    FL2_outBuffer* const dst = &batch->batch_dsts[index];
+    size_t dSize;
+
+    if (src->size - src->pos < 1)
+        return FL2_ERROR(srcSize_wrong);
+    dSize = FL2_decompressDCtx(dctx, (BYTE*)dst->dst + dst->pos, dst->size - dst->pos,
+        (const BYTE*)src->src + src->pos, src->size - src->pos);
+    if (!FL2_isError(dSize)) {
+        dst->pos += dSize;
+        *written += dSize;
+    }
+    return dSize;
+}
+
+/* FL2_batchDecompressJob() : FL2POOL_function type
+ * Decompresses single-segment frames with worker n until none are left. */
+static void FL2_batchDecompressJob(void* const jobDescription, size_t const n)
+{
+    FL2_DCtx* const dctx = (FL2_DCtx*)jobDescription;
+    FL2_decBatchWorker* const worker = &dctx->batch[n];
+
+    for (;;) {
+        size_t const index = (size_t)FL2_atomic_increment(dctx->batch_next);
+        const FL2_inBuffer* src;
+        size_t dSize;
+
+        if (index >= dctx->batch_count)
+            break;
+        src = &dctx->batch_srcs[index];
+        if (dctx->dict_size == 0 && FL2_isSegmented((const BYTE*)src->src + src->pos, src->size - src->pos))
+            continue;
+        dSize = FL2_batchDecompressFrame(worker->dctx, dctx, index, &worker->written);
+        /* frames are taken in order, so the first error of a worker has its lowest index */
+        if (FL2_isError(dSize) && !worker->err) {
+            worker->err = dSize;
+            worker->err_index = index;
+        }
+    }
+}
+
+/* FL2_initBatchWorkers() :
+ * Creates the worker contexts if necessary and gives them the dictionary and memory limit of dctx. */
+static size_t FL2_initBatchWorkers(FL2_DCtx* const dctx)
+{
+    if (dctx->batch == NULL) {
+        dctx->batch = malloc(dctx->jobCount * sizeof(FL2_decBatchWorker));
+        if (dctx->batch == NULL)
+            return FL2_ERROR(memory_allocation);
+        for (unsigned u = 0; u < dctx->jobCount; ++u)
+            dctx->batch[u].dctx = NULL;
+    }
+    for (unsigned u = 0; u < dctx->jobCount; ++u) {
+        FL2_decBatchWorker* const worker = &dctx->batch[u];
+        if (worker->dctx == NULL) {
+            worker->dctx = FL2_createDCtx_internal(1, NULL);
+            if (worker->dctx == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        worker->dctx->jobs[0].dec.dicLimit = dctx->jobs[0].dec.dicLimit;
+        CHECK_F(FL2_DCtx_loadDictionary(worker->dctx, dctx->dict_buf, dctx->dict_size));
+        worker->written = 0;
+        worker->err = 0;
+    }
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressBatch(FL2_DCtx* dctx,
+    const FL2_inBuffer* srcs, FL2_outBuffer* dsts, size_t count)
+{
+    size_t total = 0;
+    size_t err = 0;
+    size_t err_index = count;
+
+    DEBUGLOG(4, "FL2_decompressBatch : %u frames", (U32)count);
+
+    dctx->batch_srcs = srcs;
+    dctx->batch_dsts = dsts;
+    dctx->batch_count = count;
+    /* Frames the multithreaded decoder can split are decoded by the whole context. Decoding
+     * with a dictionary uses one thread, so those frames all go to the workers. */
+    if (dctx->jobCount == 1 || dctx->dict_size == 0) {
+        for (size_t i = 0; i < count; ++i) {
+            size_t dSize;
+            if (dctx->jobCount > 1 && !FL2_isSegmented((const BYTE*)srcs[i].src + srcs[i].pos, srcs[i].size - srcs[i].pos))
+                continue;
+            dSize = FL2_batchDecompressFrame(dctx, dctx, i, &total);
+            if (FL2_isError(dSize) && !err) {
+                err = dSize;
+                err_index = i;
+            }
+        }
+    }
+    if (dctx->jobCount == 1)
+        return err ? err : total;
+
+    CHECK_F(FL2_initBatchWorkers(dctx));
+    dctx->batch_next = ATOMIC_INITIAL_VALUE;
+#ifndef FL2_SINGLETHREAD
+    for (size_t u = 1; u < dctx->jobCount; ++u)
+        FL2POOL_add(dctx->factory, FL2_batchDecompressJob, dctx, u);
+#endif
+    FL2_batchDecompressJob(dctx, 0);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(dctx->factory);
+#endif
+
+    for (unsigned u = 0; u < dctx->jobCount; ++u) {
+        total += dctx->batch[u].written;
+        if (dctx->batch[u].err && dctx->batch[u].err_index < err_index) {
+            err = dctx->batch[u].err;
+            err_index = dctx->batch[u].err_index;
+        }
+    }
+    return err ? err : total;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx_toFn(FL2_DCtx* dctx,
+    const void* src, size_t srcSize,
+    FL2_writerFn writeFn, void* opaque)
+{
+    CLzma2Dec* const dec = &dctx->jobs[0].dec;
+    const BYTE* srcBuf = src;
+    size_t total = 0;
+    BYTE prop;
+    BYTE do_hash;
+
+    if (srcSize < 1)
+        return FL2_ERROR(srcSize_wrong);
+
+    prop = *srcBuf++ & FL2_LZMA_PROP_MASK;
+    do_hash = *(const BYTE*)src >> FL2_PROP_HASH_BIT;
+    --srcSize;
+
+    DEBUGLOG(4, "FL2_decompressDCtx_toFn : dict prop 0x%X, do hash %u", prop, do_hash);
+
+    /* decode into the ring dictionary and write straight out of it */
+    CHECK_F(FLzma2Dec_Init(dec, prop, NULL, 0));
+    if (dctx->dict_size)
+        CHECK_F(FLzma2Dec_InitDictionary(dec, dctx->dict_buf, dctx->dict_size));
+
+#ifndef NO_XXHASH
+    if (do_hash && FL2_hashReset(&dctx->hash, FL2_hashTypeFromProp(*(const BYTE*)src)))
+        return FL2_ERROR(memory_allocation);
+#endif
+
+    for (;;) {
+        size_t srcLen = srcSize;
+        size_t dicPos;
+        size_t outLen;
+        size_t res;
+
+        if (dec->dicPos == dec->dicBufSize)
+            CHECK_F(FLzma2Dec_WrapDic(dec));
+        dicPos = dec->dicPos;
+
+        res = FLzma2Dec_DecodeToDic(dec, dec->dicBufSize, srcBuf, &srcLen, LZMA_FINISH_ANY);
+        if (FL2_isError(res))
+            return res;
+        srcBuf += srcLen;
+        srcSize -= srcLen;
+
+        outLen = dec->dicPos - dicPos;
+        if (outLen != 0) {
+            if (writeFn(dec->dic + dicPos, outLen, opaque))
+                return FL2_ERROR(write_failed);
+#ifndef NO_XXHASH
+            if (do_hash)
+                FL2_hashUpdate(&dctx->hash, dec->dic + dicPos, outLen);
+#endif
+            total += outLen;
+        }
+        if (res == LZMA_STATUS_FINISHED_WITH_MARK)
+            break;
+        if (outLen == 0 && srcLen == 0)
+            return FL2_ERROR(srcSize_wrong);
+    }
+
+#ifndef NO_XXHASH
+    if (do_hash) {
+        size_t const hashSize = FL2_hashSize(dctx->hash.type);
+        BYTE digest[FL2_HASH_SIZE_MAX];
+
+        DEBUGLOG(4, "Checking hash");
+
+        if (srcSize < hashSize)
+            return FL2_ERROR(srcSize_wrong);
+        FL2_hashDigest(&dctx->hash, digest);
+        if (memcmp(digest, srcBuf, hashSize) != 0)
+            return FL2_ERROR(checksum_wrong);
+    }
+#endif
+    return total;
+}
+
+/* FL2_decodeRangeSegment() :
+ * Decodes the segment at `src` from its start, discarding `skip` bytes and
+ * writing the following `size` bytes to `dst`. The first segment of a frame
+ * compressed with a preset dictionary is passed the dictionary in `dict`. */
+static size_t FL2_decodeRangeSegment(CLzma2Dec* const dec, BYTE const prop,
+    const BYTE* const dict, size_t const dictSize,
+    const BYTE* src, size_t srcSize,
+    U64 skip, BYTE* dst, size_t size)
+{
+    CHECK_F(FLzma2Dec_Init(dec, prop, NULL, 0));
+    if (dictSize)
+        CHECK_F(FLzma2Dec_InitDictionary(dec, dict, dictSize));
+
+    while (size) {
+        size_t srcLen = srcSize;
+        size_t dicPos;
+        size_t outLen;
+        size_t res;
+
+        if (dec->dicPos == dec->dicBufSize)
+            CHECK_F(FLzma2Dec_WrapDic(dec));
+        dicPos = dec->dicPos;
+        outLen = dec->dicBufSize - dicPos;
+        outLen = skip ? (size_t)MIN((U64)outLen, skip) : MIN(outLen, size);
+
+        res = FLzma2Dec_DecodeToDic(dec, dicPos + outLen, src, &srcLen, LZMA_FINISH_ANY);
+        if (FL2_isError(res))
+            return res;
+        src += srcLen;
+        srcSize -= srcLen;
+
+        outLen = dec->dicPos - dicPos;
+        if (skip) {
+            skip -= outLen;
+        }
+        else {
+            memcpy(dst, dec->dic + dicPos, outLen);
+            dst += outLen;
+            size -= outLen;
+        }
+        if (outLen == 0 && srcLen == 0)
+            return FL2_ERROR(srcSize_wrong);
+    }
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRange(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long uOffset, size_t uLen)
+{
+    const BYTE* const srcBuf = src;
+    BYTE* const dstBuf = dst;
+    const BYTE* table;
+    size_t tablePos;
+    U32 count;
+    U32 lo, hi;
+    U64 total;
+    U64 cTotal;
+    size_t hashSize;
+    BYTE prop;
+
+    /* The frame header does not record a table, so the trailer is accepted only if the
+     * magic, the count, the first entry and the end marker before the hash all agree */
+    if (srcSize < 1 + FL2_SEEK_ENTRY_SIZE + FL2_SEEK_FOOTER_SIZE
+        || MEM_readLE32(srcBuf + srcSize - 4) != FL2_SEEK_TABLE_MAGIC)
+        return FL2_ERROR(seekTable_missing);
+
+    count = MEM_readLE32(srcBuf + srcSize - FL2_SEEK_FOOTER_SIZE);
+    if (count == 0 || count > (srcSize - 1 - FL2_SEEK_FOOTER_SIZE) / FL2_SEEK_ENTRY_SIZE)
+        return FL2_ERROR(seekTable_missing);
+    tablePos = srcSize - FL2_SEEK_FOOTER_SIZE - (size_t)count * FL2_SEEK_ENTRY_SIZE;
+    table = srcBuf + tablePos;
+    if (MEM_readLE64(table) != 0 || MEM_readLE64(table + 8) != 0)
+        return FL2_ERROR(seekTable_missing);
+
+    /* the last entry is the position of the end marker, which the hash follows */
+    hashSize = (srcBuf[0] >> FL2_PROP_HASH_BIT) ? (((srcBuf[0] >> FL2_PROP_HASH64_BIT) & 1) ? 8 : 4) : 0;
+    cTotal = MEM_readLE64(table + (size_t)(count - 1) * FL2_SEEK_ENTRY_SIZE + 8);
+    if (cTotal >= tablePos || cTotal + 2 + hashSize != tablePos || srcBuf[1 + cTotal] != 0)
+        return FL2_ERROR(seekTable_missing);
+    prop = srcBuf[0] & FL2_LZMA_PROP_MASK;
+
+    total = MEM_readLE64(table + (size_t)(count - 1) * FL2_SEEK_ENTRY_SIZE);
+    if (uOffset >= total)
+        return 0;
+    uLen = (size_t)MIN((U64)uLen, total - uOffset);
+    if (dstCapacity < uLen)
+        return FL2_ERROR(dstSize_tooSmall);
+
+    DEBUGLOG(4, "FL2_decompressRange : %u entries, offset %u, %u bytes", count, (U32)uOffset, (U32)uLen);
+
+    /* find the last segment starting at or before uOffset */
+    lo = 0;
+    hi = count - 1;
+    while (hi - lo > 1) {
+        U32 const mid = lo + ((hi - lo) >> 1);
+        if (MEM_readLE64(table + (size_t)mid * FL2_SEEK_ENTRY_SIZE) <= uOffset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    for (size_t pos = 0; pos < uLen; ++lo) {
+        const BYTE* const entry = table + (size_t)lo * FL2_SEEK_ENTRY_SIZE;
+        U64 const uStart = MEM_readLE64(entry);
+        U64 const uEnd = MEM_readLE64(entry + FL2_SEEK_ENTRY_SIZE);
+        U64 const cStart = MEM_readLE64(entry + 8);
+        U64 const cEnd = MEM_readLE64(entry + FL2_SEEK_ENTRY_SIZE + 8);
+        U64 const skip = uOffset + pos - uStart;
+        size_t toCopy;
+
+        if (uOffset + pos < uStart || uEnd <= uOffset + pos || cEnd < cStart || cEnd >= tablePos)
+            return FL2_ERROR(corruption_detected);
+        toCopy = (size_t)MIN((U64)(uLen - pos), uEnd - uOffset - pos);
+
+        CHECK_F(FL2_decodeRangeSegment(&dctx->jobs[0].dec, prop,
+            dctx->dict_buf, (uStart == 0) ? dctx->dict_size : 0,
+            srcBuf + 1 + cStart, (size_t)(cEnd - cStart),
+            skip, dstBuf + pos, toCopy));
+        pos += toCopy;
+    }
+    return uLen;
+}
+
 typedef enum
 {
     FL2DEC_STAGE_INIT,
@@ -119,8 +895,31 @@ typedef enum
 struct FL2_DStream_s
 {
     CLzma2Dec dec;
+#ifndef FL2_SINGLETHREAD
+    FL2_DCtx* dctx;     /* non-NULL for multithreaded decompression */
+    BYTE* inBuff;       /* compressed data of complete segments and the open segment */
+    size_t inSize;
+    size_t inCap;
+    size_t inPos;       /* read position when switching to single-threaded decoding */
+    BYTE* outBuff;      /* decoded segments waiting to be flushed */
+    size_t outSize;
+    size_t outCap;
+    size_t outPos;
+    size_t segStart;    /* inBuff position of the open segment */
+    size_t segUnpack;   /* uncompressed size of the open segment */
+    size_t unpackTotal; /* uncompressed size of the complete segments */
+    size_t segMax;      /* segments larger than this are decoded on a single thread */
+    U32 chunkRemain;    /* data of the current chunk still to be buffered */
+    unsigned segCount;
+    unsigned segLimit;  /* segments decoded concurrently, fewer than jobCount under a memory limit */
+    unsigned hdrSize;
+    BYTE hdr[LZMA2_CHUNK_HEADER_MAX];
+    BYTE prop;
+    BYTE endMark;
+    BYTE serial;        /* decoding on a single thread */
+#endif
 #ifndef NO_XXHASH
-    XXH32_state_t *xxh;
+    FL2_hash hash;
 #endif
     DecoderStage stage;
     BYTE do_hash;
@@ -133,21 +932,64 @@ FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStream(void)
     if (fds) {
         LzmaDec_Construct(&fds->dec);
         fds->stage = FL2DEC_STAGE_INIT;
+#ifndef FL2_SINGLETHREAD
+        fds->dctx = NULL;
+        fds->inBuff = NULL;
+        fds->inCap = 0;
+        fds->outBuff = NULL;
+        fds->outCap = 0;
+#endif
 #ifndef NO_XXHASH
-        fds->xxh = NULL;
+        FL2_hashInit(&fds->hash);
 #endif
         fds->do_hash = 0;
     }
     return fds;
 }
 
+FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads)
+{
+    FL2_DStream* const fds = FL2_createDStream();
+#ifndef FL2_SINGLETHREAD
+    DEBUGLOG(3, "FL2_createDStreamMt");
+    if (fds && nbThreads != 1) {
+        fds->dctx = FL2_createDCtxMt(nbThreads);
+        if (fds->dctx == NULL) {
+            FL2_freeDStream(fds);
+            return NULL;
+        }
+        if (fds->dctx->jobCount == 1) {
+            FL2_freeDCtx(fds->dctx);
+            fds->dctx = NULL;
+        }
+    }
+#else
+    (void)nbThreads;
+#endif
+    return fds;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_DStream_setMemoryLimit(FL2_DStream* fds, size_t limit)
+{
+    fds->dec.dicLimit = limit;
+#ifndef FL2_SINGLETHREAD
+    if (fds->dctx != NULL)
+        FL2_DCtx_setMemoryLimit(fds->dctx, limit);
+#endif
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_freeDStream(FL2_DStream* fds)
 {
     if (fds != NULL) {
         DEBUGLOG(3, "FL2_freeDStream");
         FLzmaDec_Free(&fds->dec);
+#ifndef FL2_SINGLETHREAD
+        FL2_freeDCtx(fds->dctx);
+        free(fds->inBuff);
+        free(fds->outBuff);
+#endif
 #ifndef NO_XXHASH
-        XXH32_freeState(fds->xxh);
+        FL2_hashFree(&fds->hash);
 #endif
         free(fds);
     }
@@ -162,68 +1004,257 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initDStream(FL2_DStream* fds)
     return 0;
 }
 
-FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuffer* output, FL2_inBuffer* input)
+static size_t FL2_decodeToOutput(FL2_DStream* const fds, FL2_outBuffer* const output, const BYTE* const src, size_t* const srcSize)
+{
+    size_t destSize = output->size - output->pos;
+    size_t const res = FLzma2Dec_DecodeToBuf(&fds->dec, (BYTE*)output->dst + output->pos, &destSize, src, srcSize, LZMA_FINISH_ANY);
+
+    DEBUGLOG(5, "Decoded %u bytes", (U32)destSize);
+
+#ifndef NO_XXHASH
+    if(fds->do_hash)
+        FL2_hashUpdate(&fds->hash, (BYTE*)output->dst + output->pos, destSize);
+#endif
+
+    output->pos += destSize;
+
+    if (FL2_isError(res))
+        return res;
+    if (res == LZMA_STATUS_FINISHED_WITH_MARK) {
+        DEBUGLOG(4, "Found end mark");
+        fds->stage = fds->do_hash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
+    }
+    return FL2_error_no_error;
+}
+
+#ifndef FL2_SINGLETHREAD
+
+static void FL2_closeSegment(FL2_DStream* const fds)
 {
+    if (fds->inSize > fds->segStart) {
+        FL2_decJob* const job = &fds->dctx->jobs[fds->segCount++];
+        job->packPos = fds->segStart;
+        job->packSize = fds->inSize - fds->segStart;
+        job->unpackPos = fds->unpackTotal;
+        job->unpackSize = fds->segUnpack;
+        fds->unpackTotal += fds->segUnpack;
+        fds->segStart = fds->inSize;
+        fds->segUnpack = 0;
+    }
+}
+
+/* Decode all complete segments into outBuff. Only called when the open segment is empty. */
+static size_t FL2_flushSegments(FL2_DStream* const fds)
+{
+    if (fds->segCount == 0)
+        return FL2_error_no_error;
+    CHECK_F(FL2_reserveBuffer(&fds->outBuff, &fds->outCap, fds->unpackTotal));
+    CHECK_F(FL2_decodeSegments(fds->dctx, fds->inBuff, fds->outBuff, fds->segCount));
+    fds->outSize = fds->unpackTotal;
+    fds->outPos = 0;
+    fds->inSize = 0;
+    fds->segStart = 0;
+    fds->unpackTotal = 0;
+    fds->segCount = 0;
+    return FL2_error_no_error;
+}
+
+static size_t FL2_initStreamMt(FL2_DStream* const fds, BYTE const prop)
+{
+    U32 const dictSize = (prop >= 40) ? 0xFFFFFFFF : LZMA2_DIC_SIZE_FROM_PROP(prop);
+    fds->dctx->prop = prop;
+    fds->prop = prop;
+    fds->inSize = 0;
+    fds->inPos = 0;
+    fds->outSize = 0;
+    fds->outPos = 0;
+    fds->segStart = 0;
+    fds->segUnpack = 0;
+    fds->unpackTotal = 0;
+    /* The encoder resets the dictionary every 4 dictionary sizes by default (FL2_p_blockSizeLog) */
+    fds->segMax = (size_t)MIN((U64)dictSize << 2, (U64)(size_t)-1);
+    fds->chunkRemain = 0;
+    fds->segCount = 0;
+    fds->hdrSize = 0;
+    fds->endMark = 0;
+    fds->segLimit = fds->dctx->jobCount;
+    if (fds->dec.dicLimit != 0) {
+        /* Each segment in flight holds up to segMax of output and about as much input */
+        U64 const segments = (U64)fds->dec.dicLimit / ((U64)fds->segMax * 2);
+        fds->segLimit = (unsigned)MIN((U64)fds->segLimit, segments);
+    }
+    fds->serial = (fds->segLimit < 2);
+    if (fds->serial) {
+        DEBUGLOG(4, "Memory limit allows %u segments; decoding on a single thread", fds->segLimit);
+        CHECK_F(FLzma2Dec_Init(&fds->dec, prop, NULL, 0));
+    }
+    return FL2_error_no_error;
+}
+
+static size_t FL2_decompressStreamSerial(FL2_DStream* const fds, FL2_outBuffer* const output, FL2_inBuffer* const input)
+{
+    if (fds->inPos < fds->inSize) {
+        /* Data buffered for multithreaded decoding ends on a chunk header, so it can be fully consumed */
+        size_t srcSize = fds->inSize - fds->inPos;
+        CHECK_F(FL2_decodeToOutput(fds, output, fds->inBuff + fds->inPos, &srcSize));
+        fds->inPos += srcSize;
+        if (fds->inPos < fds->inSize)
+            return FL2_error_no_error;
+    }
     if (input->pos < input->size) {
-        if (fds->stage == FL2DEC_STAGE_INIT) {
-            BYTE prop = ((const BYTE*)input->src)[input->pos];
-            ++input->pos;
-            fds->do_hash = prop >> FL2_PROP_HASH_BIT;
-            prop &= FL2_LZMA_PROP_MASK;
+        size_t srcSize = input->size - input->pos;
+        size_t const res = FL2_decodeToOutput(fds, output, (const BYTE*)input->src + input->pos, &srcSize);
+        input->pos += srcSize;
+        if (FL2_isError(res))
+            return res;
+    }
+    return FL2_error_no_error;
+}
+
+/* Buffers the input one segment at a time and decodes up to jobCount segments concurrently.
+ * Input is never read beyond the end marker. */
+static size_t FL2_decompressStreamMt(FL2_DStream* const fds, FL2_outBuffer* const output, FL2_inBuffer* const input)
+{
+    const BYTE* const src = (const BYTE*)input->src;
 
-            CHECK_F(FLzma2Dec_Init(&fds->dec, prop, NULL, 0));
+    if (fds->serial)
+        return FL2_decompressStreamSerial(fds, output, input);
 
+    for (;;) {
+        if (fds->outPos < fds->outSize) {
+            size_t const toFlush = MIN(fds->outSize - fds->outPos, output->size - output->pos);
+            memcpy((BYTE*)output->dst + output->pos, fds->outBuff + fds->outPos, toFlush);
 #ifndef NO_XXHASH
-            if (fds->do_hash) {
-                if (fds->xxh == NULL) {
-                    DEBUGLOG(3, "Creating hash state");
-                    fds->xxh = XXH32_createState();
-                    if (fds->xxh == NULL)
-                        return FL2_ERROR(memory_allocation);
+            if (fds->do_hash)
+                FL2_hashUpdate(&fds->hash, fds->outBuff + fds->outPos, toFlush);
+#endif
+            fds->outPos += toFlush;
+            output->pos += toFlush;
+            if (fds->outPos < fds->outSize)
+                return FL2_error_no_error;
+        }
+        if (fds->endMark) {
+            fds->stage = fds->do_hash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
+            return FL2_error_no_error;
+        }
+        if (input->pos >= input->size)
+            return FL2_error_no_error;
+
+        if (fds->chunkRemain == 0) {
+            U32 packSize;
+            U32 unpackSize;
+            BYTE dicReset;
+            size_t headerSize;
+
+            while ((headerSize = FLzma2Dec_ParseChunk(fds->hdr, fds->hdrSize, &packSize, &unpackSize, &dicReset)) == 0) {
+                if (input->pos >= input->size)
+                    return FL2_error_no_error;
+                fds->hdr[fds->hdrSize++] = src[input->pos++];
+            }
+            if (FL2_isError(headerSize))
+                return headerSize;
+            if (unpackSize == 0) {
+                DEBUGLOG(4, "Found end mark");
+                FL2_closeSegment(fds);
+                CHECK_F(FL2_flushSegments(fds));
+                fds->hdrSize = 0;
+                fds->endMark = 1;
+                continue;
+            }
+            if (dicReset) {
+                FL2_closeSegment(fds);
+                if (fds->segCount == fds->segLimit) {
+                    /* The header is retained and parsed again after flushing */
+                    CHECK_F(FL2_flushSegments(fds));
+                    continue;
                 }
-                XXH32_reset(fds->xxh, 0);
             }
-#endif
-            fds->stage = FL2DEC_STAGE_DECOMP;
+            CHECK_F(FL2_reserveBuffer(&fds->inBuff, &fds->inCap, fds->inSize + headerSize + packSize));
+            memcpy(fds->inBuff + fds->inSize, fds->hdr, headerSize);
+            fds->inSize += headerSize;
+            fds->hdrSize = 0;
+            fds->chunkRemain = packSize;
+            fds->segUnpack += unpackSize;
+            if (fds->segUnpack > fds->segMax) {
+                /* No dictionary reset in range. From the first buffered segment onward,
+                 * the stream is decoded on this thread. */
+                DEBUGLOG(4, "Segment too large; switching to single-threaded decoding");
+                CHECK_F(FLzma2Dec_Init(&fds->dec, fds->prop, NULL, 0));
+                fds->inPos = 0;
+                fds->serial = 1;
+                return FL2_decompressStreamSerial(fds, output, input);
+            }
         }
-        if (fds->stage == FL2DEC_STAGE_DECOMP) {
-            size_t destSize = output->size - output->pos;
-            size_t srcSize = input->size - input->pos;
-            size_t const res = FLzma2Dec_DecodeToBuf(&fds->dec, (BYTE*)output->dst + output->pos, &destSize, (const BYTE*)input->src + input->pos, &srcSize, LZMA_FINISH_ANY);
+        {   size_t const toRead = MIN(fds->chunkRemain, input->size - input->pos);
+            memcpy(fds->inBuff + fds->inSize, src + input->pos, toRead);
+            fds->inSize += toRead;
+            fds->chunkRemain -= (U32)toRead;
+            input->pos += toRead;
+        }
+    }
+}
 
-            DEBUGLOG(5, "Decoded %u bytes", (U32)destSize);
+#endif /* FL2_SINGLETHREAD */
 
-#ifndef NO_XXHASH
-            if(fds->do_hash)
-                XXH32_update(fds->xxh, (BYTE*)output->dst + output->pos, destSize);
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuffer* output, FL2_inBuffer* input)
+{
+    if (fds->stage == FL2DEC_STAGE_INIT) {
+        BYTE prop;
+
+        if (input->pos >= input->size)
+            return 1;
+
+        prop = ((const BYTE*)input->src)[input->pos];
+        ++input->pos;
+        fds->do_hash = prop >> FL2_PROP_HASH_BIT;
+
+#ifndef FL2_SINGLETHREAD
+        if (fds->dctx != NULL) {
+            /* segments are buffered instead of decoding into a dictionary */
+            BYTE const dictProp = prop & FL2_LZMA_PROP_MASK;
+            if (fds->dec.dicLimit && (dictProp >= 40 || LZMA2_DIC_SIZE_FROM_PROP(dictProp) > fds->dec.dicLimit))
+                return FL2_ERROR(memoryLimit_exceeded);
+            CHECK_F(FL2_initStreamMt(fds, dictProp));
+        }
+        else
 #endif
+        CHECK_F(FLzma2Dec_Init(&fds->dec, prop & FL2_LZMA_PROP_MASK, NULL, 0));
 
-            output->pos += destSize;
+#ifndef NO_XXHASH
+        if (fds->do_hash && FL2_hashReset(&fds->hash, FL2_hashTypeFromProp(prop)))
+            return FL2_ERROR(memory_allocation);
+#endif
+        fds->stage = FL2DEC_STAGE_DECOMP;
+    }
+    if (fds->stage == FL2DEC_STAGE_DECOMP) {
+#ifndef FL2_SINGLETHREAD
+        if (fds->dctx != NULL) {
+            CHECK_F(FL2_decompressStreamMt(fds, output, input));
+        }
+        else
+#endif
+        if (input->pos < input->size) {
+            size_t srcSize = input->size - input->pos;
+            size_t const res = FL2_decodeToOutput(fds, output, (const BYTE*)input->src + input->pos, &srcSize);
             input->pos += srcSize;
-
             if (FL2_isError(res))
                 return res;
-            if (res == LZMA_STATUS_FINISHED_WITH_MARK) {
-                DEBUGLOG(4, "Found end mark");
-                fds->stage = fds->do_hash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
-            }
         }
-        if (fds->stage == FL2DEC_STAGE_HASH) {
+    }
+    if (fds->stage == FL2DEC_STAGE_HASH && input->pos < input->size) {
 #ifndef NO_XXHASH
-            XXH32_canonical_t canonical;
-            U32 hash;
+        size_t const hashSize = FL2_hashSize(fds->hash.type);
+        BYTE digest[FL2_HASH_SIZE_MAX];
 
-            DEBUGLOG(4, "Checking hash");
+        DEBUGLOG(4, "Checking hash");
 
-            if (input->size - input->pos < XXHASH_SIZEOF)
-                return 1;
-            memcpy(&canonical, (BYTE*)input->src + input->pos, XXHASH_SIZEOF);
-            hash = XXH32_hashFromCanonical(&canonical);
-            if (hash != XXH32_digest(fds->xxh))
-                return FL2_ERROR(checksum_wrong);
+        if (input->size - input->pos < hashSize)
+            return 1;
+        FL2_hashDigest(&fds->hash, digest);
+        if (memcmp(digest, (const BYTE*)input->src + input->pos, hashSize) != 0)
+            return FL2_ERROR(checksum_wrong);
 #endif
-            fds->stage = FL2DEC_STAGE_FINISHED;
-        }
+        fds->stage = FL2DEC_STAGE_FINISHED;
     }
     return fds->stage != FL2DEC_STAGE_FINISHED;
-}
\ No newline at end of file
+}
@@ -28,6 +28,8 @@ const char* ERR_getErrorString(ERR_enum code)
     case PREFIX(memory_allocation): return "Allocation error : not enough memory";
     case PREFIX(dstSize_tooSmall): return "Destination buffer is too small";
     case PREFIX(srcSize_wrong): return "Src size is incorrect";
+    case PREFIX(seekTable_missing): return "Frame has no seek table";
+    case PREFIX(memoryLimit_exceeded): return "Memory limit exceeded";
         /* following error codes are not stable and may be removed or changed in a future version */
     case PREFIX(maxCode):
     default: return notErrorCode;
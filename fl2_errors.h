@@ -42,6 +42,8 @@ typedef enum {
   FL2_error_srcSize_wrong    = 11,
   FL2_error_write_failed     = 12,
   FL2_error_canceled         = 13,
+  FL2_error_seekTable_missing = 14,
+  FL2_error_memoryLimit_exceeded = 15,
   FL2_error_maxCode = 20  /* never EVER use this value directly, it can change in future versions! Use FL2_isError() instead */
 } FL2_ErrorCode;
 
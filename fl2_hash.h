@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018, Conor McCarthy
+ * All rights reserved.
+ *
+ * This source code is licensed under both the BSD-style license (found in the
+ * LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ * in the COPYING file in the root directory of this source tree).
+ * You may select, at your option, one of the above-listed licenses.
+ */
+
+#ifndef FL2_HASH_H_
+#define FL2_HASH_H_
+
+#ifndef NO_XXHASH
+
+#include <string.h>
+#include "fl2_internal.h"
+#include "xxhash.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Frame checksum types. FL2_PROP_HASH_BIT of the property byte is set if there is
+ * a checksum after the end marker, and FL2_PROP_HASH64_BIT selects XXH64 over XXH32. */
+#define FL2_HASH_NONE 0
+#define FL2_HASH_XXH32 1
+#define FL2_HASH_XXH64 2
+#define FL2_HASH_SIZE_MAX sizeof(XXH64_canonical_t)
+
+typedef struct {
+    XXH32_state_t* xxh32;
+    XXH64_state_t* xxh64;
+    unsigned type;
+} FL2_hash;
+
+MEM_STATIC void FL2_hashInit(FL2_hash* const hash)
+{
+    hash->xxh32 = NULL;
+    hash->xxh64 = NULL;
+    hash->type = FL2_HASH_NONE;
+}
+
+MEM_STATIC void FL2_hashFree(FL2_hash* const hash)
+{
+    XXH32_freeState(hash->xxh32);
+    XXH64_freeState(hash->xxh64);
+    FL2_hashInit(hash);
+}
+
+/* FL2_hashReset() :
+ * Starts a new checksum of `type`, creating its state if necessary.
+ * Returns nonzero if allocation failed. */
+MEM_STATIC int FL2_hashReset(FL2_hash* const hash, unsigned const type)
+{
+    hash->type = type;
+    if (type == FL2_HASH_XXH64) {
+        if (hash->xxh64 == NULL && (hash->xxh64 = XXH64_createState()) == NULL)
+            return 1;
+        XXH64_reset(hash->xxh64, 0);
+    }
+    else if (type == FL2_HASH_XXH32) {
+        if (hash->xxh32 == NULL && (hash->xxh32 = XXH32_createState()) == NULL)
+            return 1;
+        XXH32_reset(hash->xxh32, 0);
+    }
+    return 0;
+}
+
+MEM_STATIC void FL2_hashUpdate(FL2_hash* const hash, const void* const src, size_t const size)
+{
+    if (hash->type == FL2_HASH_XXH64)
+        XXH64_update(hash->xxh64, src, size);
+    else if (hash->type == FL2_HASH_XXH32)
+        XXH32_update(hash->xxh32, src, size);
+}
+
+MEM_STATIC size_t FL2_hashSize(unsigned const type)
+{
+    return (type == FL2_HASH_XXH64) ? sizeof(XXH64_canonical_t)
+        : (type == FL2_HASH_XXH32) ? sizeof(XXH32_canonical_t)
+        : 0;
+}
+
+/* FL2_hashDigest() :
+ * Writes the checksum in canonical (big-endian) form, FL2_hashSize() bytes. */
+MEM_STATIC void FL2_hashDigest(const FL2_hash* const hash, BYTE* const dst)
+{
+    if (hash->type == FL2_HASH_XXH64) {
+        XXH64_canonical_t canonical;
+        XXH64_canonicalFromHash(&canonical, XXH64_digest(hash->xxh64));
+        memcpy(dst, &canonical, sizeof(canonical));
+    }
+    else if (hash->type == FL2_HASH_XXH32) {
+        XXH32_canonical_t canonical;
+        XXH32_canonicalFromHash(&canonical, XXH32_digest(hash->xxh32));
+        memcpy(dst, &canonical, sizeof(canonical));
+    }
+}
+
+/* FL2_hashTypeFromProp() :
+ * Returns the checksum type signalled by a property byte. */
+MEM_STATIC unsigned FL2_hashTypeFromProp(BYTE const prop)
+{
+    if (!((prop >> FL2_PROP_HASH_BIT) & 1))
+        return FL2_HASH_NONE;
+    return ((prop >> FL2_PROP_HASH64_BIT) & 1) ? FL2_HASH_XXH64 : FL2_HASH_XXH32;
+}
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* NO_XXHASH */
+
+#endif /* FL2_HASH_H_ */
@@ -19,6 +19,7 @@
 #include "mem.h"
 #include "compiler.h"
 #include "fl2_error_private.h"
+#include "fast-lzma2.h"   /* FL2_customMem */
 
 
 #if defined (__cplusplus)
@@ -26,10 +27,13 @@ extern "C" {
 #endif
 
 #define FL2_PROP_HASH_BIT 7
+#define FL2_PROP_HASH64_BIT 6
 #define FL2_LZMA_PROP_MASK 0x3FU
-#ifndef NO_XXHASH
-#  define XXHASH_SIZEOF sizeof(XXH32_canonical_t)
-#endif
+/* Seek table : (count) entries of LE64 uncompressed position and LE64 position in
+ * the LZMA2 data, the last being the end of the data, followed by LE32 count and LE32 magic */
+#define FL2_SEEK_ENTRY_SIZE 16U
+#define FL2_SEEK_FOOTER_SIZE 8U
+#define FL2_SEEK_TABLE_MAGIC 0x53324C46U /* "FL2S" */
 
 /*-*************************************
 *  Debug
@@ -80,6 +84,31 @@ extern int g_debuglog_enable;
 #define CHECK_F(f) { size_t const errcod = f; if (ERR_isError(errcod)) return errcod; }  /* check and Forward error code */
 #define CHECK_E(f, e) { size_t const errcod = f; if (ERR_isError(errcod)) return FL2_ERROR(e); }  /* check and send Error code */
 
+/* Counters for FL2_CCtx_getStats(), compiled out if FL2_NO_STATS is defined */
+#ifndef FL2_NO_STATS
+#  define FL2_STATS_ADD(counter, n) ((counter) += (n))
+#else
+#  define FL2_STATS_ADD(counter, n) ((void)0)
+#endif
+
+/*-*************************************
+*  Memory allocation
+***************************************/
+void* FL2_malloc(size_t size, FL2_customMem customMem);
+void FL2_free(void* ptr, FL2_customMem customMem);
+
+/* FL2_checkNbThreads() :
+ * Returns the number of threads a context will use when nbThreads are requested,
+ * where 0 means one per physical core. */
+unsigned FL2_checkNbThreads(unsigned nbThreads);
+
+/* Worker threads shared by the contexts created with FL2_createCCtxWithPool() and
+ * FL2_createDCtxWithPool(). Each context adds its jobs through its own view. */
+struct FL2_threadPool_s {
+    struct FL2POOL_ctx_s* factory;  /* nbThreads - 1 threads, NULL if nbThreads == 1 */
+    unsigned nbThreads;
+};
+
 MEM_STATIC U32 ZSTD_highbit32(U32 val)
 {
     assert(val != 0);
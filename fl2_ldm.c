@@ -0,0 +1,184 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <string.h>     /* memset, memmove */
+#include "fl2_ldm.h"
+#include "count.h"
+
+#define LDM_BUCKET_SIZE (1U << LDM_BUCKET_LOG)
+
+typedef struct
+{
+    U32 pos;    /* low 32 bits of the source position. Distances are less than 2 ^ 32. */
+    U32 check;
+} LDM_entry;
+
+struct FL2_ldm_s
+{
+    FL2_customMem customMem;
+    unsigned window_log;
+    unsigned hash_log;          /* number of buckets, as a power of 2 */
+    const BYTE* base;
+    size_t lower;               /* source position of the last dictionary reset */
+    U64 rolling;
+    FL2_longMatch* matches;
+    size_t match_count;
+    size_t match_cap;
+    U32 max_dist;
+    U64 gear[256];
+    LDM_entry table[1];
+};
+
+static unsigned FL2_ldmHashLog(unsigned const window_log)
+{
+    return window_log - LDM_HASH_RATE_LOG - LDM_BUCKET_LOG;
+}
+
+size_t FL2_ldmMemoryUsage(unsigned const window_log)
+{
+    return sizeof(FL2_ldm) + ((sizeof(LDM_entry) << FL2_ldmHashLog(window_log) << LDM_BUCKET_LOG) - sizeof(LDM_entry));
+}
+
+FL2_ldm* FL2_ldmCreate(unsigned const window_log, FL2_customMem const customMem)
+{
+    FL2_ldm* const ldm = FL2_malloc(FL2_ldmMemoryUsage(window_log), customMem);
+
+    DEBUGLOG(3, "FL2_ldmCreate : window log %u", window_log);
+
+    if (ldm == NULL)
+        return NULL;
+    ldm->customMem = customMem;
+    ldm->window_log = window_log;
+    ldm->hash_log = FL2_ldmHashLog(window_log);
+    ldm->matches = NULL;
+    ldm->match_count = 0;
+    ldm->match_cap = 0;
+    for (size_t u = 0; u < 256; ++u) {
+        U64 h = (u + 1) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ULL;
+        ldm->gear[u] = h ^ (h >> 29);
+    }
+    FL2_ldmReset(ldm, NULL);
+    return ldm;
+}
+
+void FL2_ldmFree(FL2_ldm* const ldm)
+{
+    if (ldm == NULL)
+        return;
+    FL2_free(ldm->matches, ldm->customMem);
+    FL2_free(ldm, ldm->customMem);
+}
+
+unsigned FL2_ldmWindowLog(const FL2_ldm* const ldm)
+{
+    return ldm->window_log;
+}
+
+void FL2_ldmReset(FL2_ldm* const ldm, const BYTE* const base)
+{
+    ldm->base = base;
+    ldm->lower = 0;
+    ldm->rolling = 0;
+    ldm->match_count = 0;
+    ldm->max_dist = 0;
+    memset(ldm->table, 0, sizeof(LDM_entry) << ldm->hash_log << LDM_BUCKET_LOG);
+}
+
+const FL2_longMatch* FL2_ldmMatches(const FL2_ldm* const ldm)
+{
+    return ldm->matches;
+}
+
+U32 FL2_ldmMaxDist(const FL2_ldm* const ldm)
+{
+    return ldm->max_dist;
+}
+
+/* Positions where the top LDM_HASH_RATE_LOG bits of a gear hash of the preceding bytes are zero
+ * are indexed, so identical content is indexed at the same points wherever it occurs. The bits
+ * below select the bucket. */
+size_t FL2_ldmFindMatches(FL2_ldm* const ldm, FL2_dataBlock const block)
+{
+    const BYTE* const data = block.data;
+    size_t const block_base = (size_t)(block.data - ldm->base);
+    U32 const window_max = (U32)1 << ldm->window_log;
+    unsigned const index_shift = 64 - LDM_HASH_RATE_LOG - ldm->hash_log;
+    size_t const bucket_mask = ((size_t)1 << ldm->hash_log) - 1;
+    /* matches do not overlap, so this is the most there can be */
+    size_t const match_max = (block.end - block.start) / LDM_MIN_MATCH + 1;
+    U64 rolling = ldm->rolling;
+    size_t match_end = block.start;
+
+    ldm->match_count = 0;
+    ldm->max_dist = 0;
+    if (block.start == 0)
+        ldm->lower = block_base;
+    if (match_max > ldm->match_cap) {
+        FL2_free(ldm->matches, ldm->customMem);
+        ldm->matches = FL2_malloc(match_max * sizeof(FL2_longMatch), ldm->customMem);
+        ldm->match_cap = (ldm->matches != NULL) ? match_max : 0;
+        if (ldm->matches == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+
+    for (size_t index = block.start; index < block.end; ++index) {
+        size_t const pos = block_base + index;
+        LDM_entry* bucket;
+        U32 check;
+
+        rolling = (rolling << 1) + ldm->gear[data[index]];
+        if ((rolling >> (64 - LDM_HASH_RATE_LOG)) != 0)
+            continue;
+
+        bucket = ldm->table + (((size_t)(rolling >> index_shift) & bucket_mask) << LDM_BUCKET_LOG);
+        check = (U32)rolling;
+        if (index >= match_end) {
+            size_t best_len = 0;
+            size_t best_back = 0;
+            U32 best_dist = 0;
+            for (size_t n = 0; n < LDM_BUCKET_SIZE; ++n) {
+                U32 const dist = (U32)pos - bucket[n].pos;
+                size_t cand;
+                size_t len;
+                size_t back = 0;
+                if (bucket[n].check != check || dist == 0 || dist >= window_max || pos - ldm->lower < dist)
+                    continue;
+                cand = pos - dist;
+                /* the match table finds matches within the block */
+                if (cand >= block_base)
+                    continue;
+                len = ZSTD_count(data + index, ldm->base + cand, data + block.end);
+                while (index - back > match_end && cand - back > ldm->lower
+                    && data[index - back - 1] == ldm->base[cand - back - 1])
+                    ++back;
+                if (len + back > best_len + best_back) {
+                    best_len = len;
+                    best_back = back;
+                    best_dist = dist;
+                }
+            }
+            if (best_len + best_back >= LDM_MIN_MATCH) {
+                FL2_longMatch* const match = ldm->matches + ldm->match_count++;
+                match->pos = (U32)(index - best_back);
+                match->length = (U32)(best_len + best_back);
+                match->dist = best_dist - 1;
+                ldm->max_dist = MAX(ldm->max_dist, match->dist);
+                match_end = index + best_len;
+            }
+        }
+        memmove(bucket + 1, bucket, (LDM_BUCKET_SIZE - 1) * sizeof(LDM_entry));
+        bucket[0].pos = (U32)pos;
+        bucket[0].check = check;
+    }
+    ldm->rolling = rolling;
+    DEBUGLOG(5, "FL2_ldmFindMatches : %u matches, max dist %u", (U32)ldm->match_count, ldm->max_dist);
+    return ldm->match_count;
+}
@@ -0,0 +1,69 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#ifndef FL2_LDM_H_
+#define FL2_LDM_H_
+
+#include "mem.h"
+#include "data_block.h"
+#include "fl2_internal.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Long-distance matcher for one-shot compression. A sparse rolling-hash index over the
+ * source before the radix match table's block supplies matches at distances up to
+ * 2 ^ FL2_p_longWindowLog, which the encoders use when they are longer than the
+ * match found in the table. */
+
+#define LDM_MIN_MATCH 64U       /* shortest match reported */
+#define LDM_HASH_RATE_LOG 6U    /* one position in 2 ^ LDM_HASH_RATE_LOG is indexed, on average */
+#define LDM_BUCKET_LOG 2U       /* entries per hash bucket, as a power of 2 */
+
+typedef struct
+{
+    U32 pos;    /* start of the match in block.data */
+    U32 length;
+    U32 dist;   /* distance - 1, as in the radix table matches */
+} FL2_longMatch;
+
+typedef struct FL2_ldm_s FL2_ldm;
+
+FL2_ldm* FL2_ldmCreate(unsigned window_log, FL2_customMem customMem);
+
+void FL2_ldmFree(FL2_ldm* ldm);
+
+unsigned FL2_ldmWindowLog(const FL2_ldm* ldm);
+
+/* FL2_ldmReset() :
+ * Begins indexing a new source buffer starting at `base`. */
+void FL2_ldmReset(FL2_ldm* ldm, const BYTE* base);
+
+/* FL2_ldmFindMatches() :
+ * Indexes block.start .. block.end of a block within the source passed to FL2_ldmReset(),
+ * and finds matches there to data before block.data. Blocks must be passed in order.
+ * A block starting at 0 is a dictionary reset, and no match reaches before it.
+ * Returns the number of matches, or an error code. */
+size_t FL2_ldmFindMatches(FL2_ldm* ldm, FL2_dataBlock const block);
+
+/* Matches of the last FL2_ldmFindMatches() call, in order of position */
+const FL2_longMatch* FL2_ldmMatches(const FL2_ldm* ldm);
+
+/* Largest distance - 1 of the last matches found */
+U32 FL2_ldmMaxDist(const FL2_ldm* ldm);
+
+size_t FL2_ldmMemoryUsage(unsigned window_log);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* FL2_LDM_H_ */
@@ -31,27 +31,40 @@ typedef struct FL2POOL_job_s {
     FL2POOL_function function;
     void *opaque;
 	size_t n;
+    FL2POOL_ctx *owner;
 } FL2POOL_job;
 
+/* Queue slots per thread. Producers block only when this many jobs per thread are waiting. */
+#define FL2POOL_QUEUE_PER_THREAD 4
+
 struct FL2POOL_ctx_s {
+    /* The pool which owns the threads, queue and synchronization objects.
+     * Points to itself except in a view. */
+    FL2POOL_ctx *root;
     /* Keep track of the threads */
     ZSTD_pthread_t *threads;
     size_t numThreads;
+    /* Applied by each thread when it starts */
+    unsigned long long affinity;
+    int priority;
 
-    /* The queue is a single job */
-    FL2POOL_job queue;
+    /* The queue is a circular buffer shared by all views */
+    FL2POOL_job *queue;
+    size_t queueHead;
+    size_t queueTail;
+    size_t queueSize;
 
-    /* The number of threads working on jobs */
-    size_t numThreadsBusy;
-    /* Indicates if the queue is empty */
-    int queueEmpty;
+    /* The number of jobs added through this context which have not completed */
+    size_t numJobsPending;
 
-    /* The mutex protects the queue */
+    /* The mutex protects the queue and the pending counts of all views */
     ZSTD_pthread_mutex_t queueMutex;
     /* Condition variable for pushers to wait on when the queue is full */
     ZSTD_pthread_cond_t queuePushCond;
     /* Condition variables for poppers to wait on when the queue is empty */
     ZSTD_pthread_cond_t queuePopCond;
+    /* Condition variable for the waiters of any view, signaled when a job completes */
+    ZSTD_pthread_cond_t jobDoneCond;
     /* Indicates if the queue is shutting down */
     int shutdown;
 };
@@ -64,58 +77,71 @@ struct FL2POOL_ctx_s {
 static void* FL2POOL_thread(void* opaque) {
     FL2POOL_ctx* const ctx = (FL2POOL_ctx*)opaque;
     if (!ctx) { return NULL; }
+    ZSTD_pthread_setCurrentAttributes(ctx->affinity, ctx->priority);
     for (;;) {
         /* Lock the mutex and wait for a non-empty queue or until shutdown */
         ZSTD_pthread_mutex_lock(&ctx->queueMutex);
 
-        while (ctx->queueEmpty && !ctx->shutdown) {
+        while (ctx->queueHead == ctx->queueTail && !ctx->shutdown) {
             ZSTD_pthread_cond_wait(&ctx->queuePopCond, &ctx->queueMutex);
         }
         /* empty => shutting down: so stop */
-        if (ctx->queueEmpty) {
+        if (ctx->queueHead == ctx->queueTail) {
             ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
             return opaque;
         }
         /* Pop a job off the queue */
-        {   FL2POOL_job const job = ctx->queue;
-            ctx->queueEmpty = 1;
+        {   FL2POOL_job const job = ctx->queue[ctx->queueHead];
+            ctx->queueHead = (ctx->queueHead + 1) % ctx->queueSize;
             /* Unlock the mutex, signal a pusher, and run the job */
             ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
             ZSTD_pthread_cond_signal(&ctx->queuePushCond);
 
             job.function(job.opaque, job.n);
 
-			ZSTD_pthread_mutex_lock(&ctx->queueMutex);
-			ctx->numThreadsBusy--;
-			ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
-			ZSTD_pthread_cond_signal(&ctx->queuePushCond);
-		}
+            ZSTD_pthread_mutex_lock(&ctx->queueMutex);
+            job.owner->numJobsPending--;
+            ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
+            /* the waiters of all views share the condition */
+            ZSTD_pthread_cond_broadcast(&ctx->jobDoneCond);
+        }
     }  /* for (;;) */
     /* Unreachable */
 }
 
 FL2POOL_ctx* FL2POOL_create(size_t numThreads) {
+    return FL2POOL_create_advanced(numThreads, 0, 0);
+}
+
+FL2POOL_ctx* FL2POOL_create_advanced(size_t numThreads, unsigned long long affinity, int priority) {
     FL2POOL_ctx* ctx;
     /* Check the parameters */
     if (!numThreads) { return NULL; }
     /* Allocate the context and zero initialize */
     ctx = (FL2POOL_ctx*)calloc(1, sizeof(FL2POOL_ctx));
     if (!ctx) { return NULL; }
+    ctx->root = ctx;
+    ctx->affinity = affinity;
+    ctx->priority = priority;
     /* Initialize the job queue.
      * It needs one extra space since one space is wasted to differentiate empty
      * and full queues.
      */
-    ctx->numThreadsBusy = 0;
-    ctx->queueEmpty = 1;
+    ctx->queueSize = numThreads * FL2POOL_QUEUE_PER_THREAD + 1;
+    ctx->queue = (FL2POOL_job*)malloc(ctx->queueSize * sizeof(FL2POOL_job));
+    ctx->queueHead = 0;
+    ctx->queueTail = 0;
+    ctx->numJobsPending = 0;
     (void)ZSTD_pthread_mutex_init(&ctx->queueMutex, NULL);
     (void)ZSTD_pthread_cond_init(&ctx->queuePushCond, NULL);
     (void)ZSTD_pthread_cond_init(&ctx->queuePopCond, NULL);
+    (void)ZSTD_pthread_cond_init(&ctx->jobDoneCond, NULL);
     ctx->shutdown = 0;
     /* Allocate space for the thread handles */
     ctx->threads = (ZSTD_pthread_t*)malloc(numThreads * sizeof(ZSTD_pthread_t));
     ctx->numThreads = 0;
     /* Check for errors */
-    if (!ctx->threads) { FL2POOL_free(ctx); return NULL; }
+    if (!ctx->threads || !ctx->queue) { FL2POOL_free(ctx); return NULL; }
     /* Initialize the threads */
     {   size_t i;
         for (i = 0; i < numThreads; ++i) {
@@ -140,6 +166,7 @@ static void FL2POOL_join(FL2POOL_ctx* ctx) {
     /* Wake up sleeping threads */
     ZSTD_pthread_cond_broadcast(&ctx->queuePushCond);
     ZSTD_pthread_cond_broadcast(&ctx->queuePopCond);
+    ZSTD_pthread_cond_broadcast(&ctx->jobDoneCond);
     /* Join all of the threads */
     {   size_t i;
         for (i = 0; i < ctx->numThreads; ++i) {
@@ -147,12 +174,27 @@ static void FL2POOL_join(FL2POOL_ctx* ctx) {
     }   }
 }
 
+FL2POOL_ctx* FL2POOL_createView(FL2POOL_ctx* pool) {
+    FL2POOL_ctx* ctx;
+    if (!pool) { return NULL; }
+    ctx = (FL2POOL_ctx*)calloc(1, sizeof(FL2POOL_ctx));
+    if (!ctx) { return NULL; }
+    ctx->root = pool->root;
+    return ctx;
+}
+
 void FL2POOL_free(FL2POOL_ctx *ctx) {
     if (!ctx) { return; }
+    if (ctx->root != ctx) {
+        free(ctx);
+        return;
+    }
     FL2POOL_join(ctx);
     ZSTD_pthread_mutex_destroy(&ctx->queueMutex);
     ZSTD_pthread_cond_destroy(&ctx->queuePushCond);
     ZSTD_pthread_cond_destroy(&ctx->queuePopCond);
+    ZSTD_pthread_cond_destroy(&ctx->jobDoneCond);
+    free(ctx->queue);
     free(ctx->threads);
     free(ctx);
 }
@@ -160,42 +202,69 @@ void FL2POOL_free(FL2POOL_ctx *ctx) {
 size_t FL2POOL_sizeof(FL2POOL_ctx *ctx) {
     if (ctx==NULL) return 0;  /* supports sizeof NULL */
     return sizeof(*ctx)
+        + ctx->queueSize * sizeof(FL2POOL_job)
         + ctx->numThreads * sizeof(ZSTD_pthread_t);
 }
 
 void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, size_t n) {
     FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
+    FL2POOL_ctx* root;
     if (!ctx)
 		return; 
 
-    ZSTD_pthread_mutex_lock(&ctx->queueMutex);
-    {   FL2POOL_job const job = {function, opaque, n};
+    root = ctx->root;
+    ZSTD_pthread_mutex_lock(&root->queueMutex);
+    {   FL2POOL_job const job = {function, opaque, n, ctx};
 
-        /* Wait until there is space in the queue for the new job */
-        while (!ctx->queueEmpty && !ctx->shutdown) {
-          ZSTD_pthread_cond_wait(&ctx->queuePushCond, &ctx->queueMutex);
+        /* Wait until there is space in the queue for the new job.
+         * Other producers may move the tail while this one waits. */
+        while ((root->queueTail + 1) % root->queueSize == root->queueHead && !root->shutdown) {
+          ZSTD_pthread_cond_wait(&root->queuePushCond, &root->queueMutex);
         }
         /* The queue is still going => there is space */
-        if (!ctx->shutdown) {
-			ctx->numThreadsBusy++;
-			ctx->queueEmpty = 0;
-            ctx->queue = job;
+        if (!root->shutdown) {
+            ctx->numJobsPending++;
+            root->queue[root->queueTail] = job;
+            root->queueTail = (root->queueTail + 1) % root->queueSize;
         }
     }
-    ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
-    ZSTD_pthread_cond_signal(&ctx->queuePopCond);
+    ZSTD_pthread_mutex_unlock(&root->queueMutex);
+    ZSTD_pthread_cond_signal(&root->queuePopCond);
 }
 
 void FL2POOL_waitAll(void *ctxVoid)
 {
     FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
+    FL2POOL_ctx* root;
     if (!ctx) { return; }
 
-    ZSTD_pthread_mutex_lock(&ctx->queueMutex);
-    while (ctx->numThreadsBusy && !ctx->shutdown) {
-        ZSTD_pthread_cond_wait(&ctx->queuePushCond, &ctx->queueMutex);
+    root = ctx->root;
+    ZSTD_pthread_mutex_lock(&root->queueMutex);
+    while (ctx->numJobsPending && !root->shutdown) {
+        ZSTD_pthread_cond_wait(&root->jobDoneCond, &root->queueMutex);
     }
-    ZSTD_pthread_mutex_unlock(&ctx->queueMutex);
+    ZSTD_pthread_mutex_unlock(&root->queueMutex);
+}
+
+size_t FL2POOL_waitAllTimeout(void *ctxVoid, unsigned timeout)
+{
+    FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
+    FL2POOL_ctx* root;
+    ZSTD_pthread_deadline_t deadline;
+    size_t pending;
+    if (!ctx) { return 0; }
+
+    /* jobDoneCond is broadcast for every job of the root, so the deadline is fixed on entry */
+    ZSTD_pthread_deadline(&deadline, timeout);
+    root = ctx->root;
+    ZSTD_pthread_mutex_lock(&root->queueMutex);
+    if (timeout) while (ctx->numJobsPending && !root->shutdown) {
+        if (ZSTD_pthread_cond_timedwait(&root->jobDoneCond, &root->queueMutex, &deadline))
+            break;
+    }
+    pending = ctx->numJobsPending;
+    ZSTD_pthread_mutex_unlock(&root->queueMutex);
+    return pending;
 }
 
 #endif  /* FL2_SINGLETHREAD */
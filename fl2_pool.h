@@ -28,12 +28,26 @@ typedef struct FL2POOL_ctx_s FL2POOL_ctx;
 */
 FL2POOL_ctx *FL2POOL_create(size_t numThreads);
 
+/*! FL2POOL_create_advanced() :
+*  Same as FL2POOL_create(), and each thread applies ZSTD_pthread_setCurrentAttributes()
+*  with `affinity` and `priority` when it starts.
+*/
+FL2POOL_ctx *FL2POOL_create_advanced(size_t numThreads, unsigned long long affinity, int priority);
+
 
 /*! FL2POOL_free() :
 Free a thread pool returned by FL2POOL_create().
 */
 void FL2POOL_free(FL2POOL_ctx *ctx);
 
+/*! FL2POOL_createView() :
+*  Create a handle which adds jobs to the threads of `pool`.
+*  FL2POOL_waitAll() on a view waits only for the jobs added through it, so several
+*  contexts can share one set of threads. Views must be freed before their pool.
+* @return : FL2POOL_ctx pointer on success, else NULL.
+*/
+FL2POOL_ctx *FL2POOL_createView(FL2POOL_ctx *pool);
+
 /*! FL2POOL_sizeof() :
 return memory usage of pool returned by FL2POOL_create().
 */
@@ -45,7 +59,8 @@ The function type that can be added to a thread pool.
 typedef void(*FL2POOL_function)(void *, size_t);
 
 /*! FL2POOL_add() :
-Add the job `function(opaque)` to the thread pool.
+Add the job `function(opaque)` to the thread pool. Jobs of all views share one queue
+and start in the order they were added.
 Possibly blocks until there is room in the queue.
 Note : The function may be executed asynchronously, so `opaque` must live until the function has been completed.
 */
@@ -53,6 +68,12 @@ void FL2POOL_add(void *ctx, FL2POOL_function function, void *opaque, size_t n);
 
 void FL2POOL_waitAll(void *ctx);
 
+/*! FL2POOL_waitAllTimeout() :
+Wait at most `timeout` milliseconds for all jobs to complete. A timeout of 0 only polls.
+@return : the number of jobs added through `ctx` which have not completed.
+*/
+size_t FL2POOL_waitAllTimeout(void *ctx, unsigned timeout);
+
 #if defined (__cplusplus)
 }
 #endif
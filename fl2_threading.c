@@ -14,6 +14,10 @@
  * This file will hold wrapper for systems, which do not support pthreads
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE   /* sched_setaffinity, CPU_SET */
+#endif
+
 /* create fake symbol to avoid empty translation unit warning */
 int g_ZSTD_threading_useles_symbol;
 
@@ -54,6 +58,21 @@ int ZSTD_pthread_create(ZSTD_pthread_t* thread, const void* unused,
         return 0;
 }
 
+int ZSTD_pthread_cond_timedwait(ZSTD_pthread_cond_t* cond, ZSTD_pthread_mutex_t* mutex, const ZSTD_pthread_deadline_t* deadline)
+{
+    ULONGLONG const now = GetTickCount64();
+    DWORD const ms = (now < *deadline) ? (DWORD)(*deadline - now) : 0;
+    return !SleepConditionVariableCS(cond, mutex, ms);
+}
+
+void ZSTD_pthread_setCurrentAttributes(unsigned long long affinity, int priority)
+{
+    if (affinity != 0)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)affinity);
+    if (priority > 0)
+        SetThreadPriority(GetCurrentThread(), (priority >= 10) ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL);
+}
+
 int ZSTD_pthread_join(ZSTD_pthread_t thread, void **value_ptr)
 {
     DWORD result;
@@ -72,4 +91,46 @@ int ZSTD_pthread_join(ZSTD_pthread_t thread, void **value_ptr)
     }
 }
 
+#elif !defined(FL2_SINGLETHREAD)
+
+#include <time.h>
+#if defined(__linux__)
+#  include <sched.h>          /* sched_setaffinity */
+#  include <sys/resource.h>   /* setpriority */
+#  include <sys/syscall.h>    /* SYS_gettid */
+#  include <unistd.h>         /* syscall */
+#endif
+#include "fl2_threading.h"
+
+void ZSTD_pthread_deadline(ZSTD_pthread_deadline_t* deadline, unsigned ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_nsec -= 1000000000;
+        ++deadline->tv_sec;
+    }
+}
+
+void ZSTD_pthread_setCurrentAttributes(unsigned long long affinity, int priority)
+{
+#if defined(__linux__)
+    if (affinity != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i)
+            if ((affinity >> i) & 1)
+                CPU_SET(i, &set);
+        (void)sched_setaffinity(0, sizeof(set), &set);
+    }
+    /* Linux applies the nice value to a single thread */
+    if (priority > 0)
+        (void)setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), priority);
+#else
+    (void)affinity;
+    (void)priority;
+#endif
+}
+
 #endif   /* FL2_SINGLETHREAD */
@@ -55,6 +55,12 @@ extern "C" {
 #define ZSTD_pthread_cond_signal(a)     WakeConditionVariable((a))
 #define ZSTD_pthread_cond_broadcast(a)  WakeAllConditionVariable((a))
 
+/* an absolute time for ZSTD_pthread_cond_timedwait() */
+typedef ULONGLONG ZSTD_pthread_deadline_t;
+#define ZSTD_pthread_deadline(a, ms)    (*(a) = GetTickCount64() + (ms))
+/* wait until `deadline` at most. Returns 0 if signaled. */
+int ZSTD_pthread_cond_timedwait(ZSTD_pthread_cond_t* cond, ZSTD_pthread_mutex_t* mutex, const ZSTD_pthread_deadline_t* deadline);
+
 /* ZSTD_pthread_create() and ZSTD_pthread_join() */
 typedef struct {
     HANDLE handle;
@@ -66,6 +72,7 @@ int ZSTD_pthread_create(ZSTD_pthread_t* thread, const void* unused,
                    void* (*start_routine) (void*), void* arg);
 
 int ZSTD_pthread_join(ZSTD_pthread_t thread, void** value_ptr);
+void ZSTD_pthread_setCurrentAttributes(unsigned long long affinity, int priority);
 
 /**
  * add here more wrappers as required
@@ -75,6 +82,7 @@ int ZSTD_pthread_join(ZSTD_pthread_t thread, void** value_ptr);
 #elif !defined(FL2_SINGLETHREAD)   /* posix assumed ; need a better detection method */
 /* ===   POSIX Systems   === */
 #  include <pthread.h>
+#  include <time.h>
 
 #define ZSTD_pthread_mutex_t            pthread_mutex_t
 #define ZSTD_pthread_mutex_init(a, b)   pthread_mutex_init((a), (b))
@@ -86,13 +94,24 @@ int ZSTD_pthread_join(ZSTD_pthread_t thread, void** value_ptr);
 #define ZSTD_pthread_cond_init(a, b)    pthread_cond_init((a), (b))
 #define ZSTD_pthread_cond_destroy(a)    pthread_cond_destroy((a))
 #define ZSTD_pthread_cond_wait(a, b)    pthread_cond_wait((a), (b))
+/* wait until `deadline` at most. Returns 0 if signaled. */
+#define ZSTD_pthread_cond_timedwait(a, b, d) pthread_cond_timedwait((a), (b), (d))
 #define ZSTD_pthread_cond_signal(a)     pthread_cond_signal((a))
 #define ZSTD_pthread_cond_broadcast(a)  pthread_cond_broadcast((a))
 
+/* an absolute time for ZSTD_pthread_cond_timedwait() */
+typedef struct timespec ZSTD_pthread_deadline_t;
+/* set `deadline` to `ms` milliseconds from now */
+void ZSTD_pthread_deadline(ZSTD_pthread_deadline_t* deadline, unsigned ms);
+
 #define ZSTD_pthread_t                  pthread_t
 #define ZSTD_pthread_create(a, b, c, d) pthread_create((a), (b), (c), (d))
 #define ZSTD_pthread_join(a, b)         pthread_join((a),(b))
 
+/* restrict the calling thread to the CPUs in `affinity` if not 0, and lower its priority to
+ * nice value `priority` if > 0. Only Linux supports these. */
+void ZSTD_pthread_setCurrentAttributes(unsigned long long affinity, int priority);
+
 #else  /* FL2_SINGLETHREAD defined */
 /* No multithreading support */
 
@@ -0,0 +1,197 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdlib.h>     /* qsort */
+#include <string.h>     /* memcmp, memcpy */
+#include "fast-lzma2.h"
+#include "fl2_internal.h"
+#include "util.h"
+#include "fl2_compress_internal.h"
+
+/* Variations of one set: bufferLog and searchDepth up and down, overlapFraction up and down,
+ * and divideAndConquer switched */
+#define TUNE_VARIATIONS 7U
+/* Candidates which compress the sample in less time are timed again, up to TUNE_RUNS times */
+#define TUNE_MIN_TIME 100000U
+#define TUNE_RUNS 3U
+
+static int FL2_tuneContains(const FL2_tuneResult* const list, size_t const count, const FL2_compressionParameters* const params)
+{
+    for (size_t n = 0; n < count; ++n)
+        if (memcmp(&list[n].params, params, sizeof(*params)) == 0)
+            return 1;
+    return 0;
+}
+
+/* The level sets, and the variations of each of them if all are on the front */
+static size_t FL2_tuneCandidatesMax(void)
+{
+    return (size_t)(FL2_maxCLevel() + FL2_maxHighCLevel()) * (TUNE_VARIATIONS + 1);
+}
+
+/* Adds params to the list if it isn't already there */
+static void FL2_tuneAdd(FL2_tuneResult* const list, size_t* const count, const FL2_compressionParameters* const params)
+{
+    if (!FL2_tuneContains(list, *count, params) && *count < FL2_tuneCandidatesMax()) {
+        list[*count].params = *params;
+        list[*count].cSize = 0;
+        list[*count].time = 0;
+        ++*count;
+    }
+}
+
+static size_t FL2_tuneVariations(const FL2_compressionParameters* const base, FL2_compressionParameters* const vars)
+{
+    size_t n = 0;
+
+    if (base->bufferLog > FL2_BUFFER_SIZE_LOG_MIN) {
+        vars[n] = *base;
+        --vars[n++].bufferLog;
+    }
+    if (base->bufferLog < FL2_BUFFER_SIZE_LOG_MAX) {
+        vars[n] = *base;
+        ++vars[n++].bufferLog;
+    }
+    if (base->searchDepth > FL2_SEARCH_DEPTH_MIN) {
+        vars[n] = *base;
+        vars[n++].searchDepth = MAX(base->searchDepth / 2, FL2_SEARCH_DEPTH_MIN);
+    }
+    if (base->searchDepth < FL2_SEARCH_DEPTH_MAX) {
+        vars[n] = *base;
+        vars[n++].searchDepth = MIN(base->searchDepth * 2, FL2_SEARCH_DEPTH_MAX);
+    }
+    if (base->overlapFraction > FL2_BLOCK_OVERLAP_MIN) {
+        vars[n] = *base;
+        --vars[n++].overlapFraction;
+    }
+    if (base->overlapFraction < FL2_BLOCK_OVERLAP_MAX) {
+        vars[n] = *base;
+        ++vars[n++].overlapFraction;
+    }
+    vars[n] = *base;
+    vars[n++].divideAndConquer = !base->divideAndConquer;
+    return n;
+}
+
+/* Compresses the sample with the parameters of the result, and records the fastest time */
+static size_t FL2_tuneMeasure(FL2_CCtx* const cctx, FL2_tuneResult* const result,
+    const void* const sample, size_t const sampleSize,
+    void* const dst, size_t const dstCapacity)
+{
+    CHECK_F(FL2_CCtx_setParameters(cctx, &result->params));
+    result->srcSize = sampleSize;
+    result->time = (unsigned long long)-1;
+    for (unsigned run = 0; run < TUNE_RUNS; ++run) {
+        UTIL_time_t const start = UTIL_getTime();
+        size_t const cSize = FL2_compressCCtx(cctx, dst, dstCapacity, sample, sampleSize, 0);
+        U64 const time = UTIL_clockSpanMicro(start);
+
+        if (FL2_isError(cSize))
+            return cSize;
+        result->cSize = cSize;
+        result->time = MIN(result->time, time);
+        if (time >= TUNE_MIN_TIME)
+            break;
+    }
+    DEBUGLOG(4, "FL2_tuneMeasure : %u bytes in %u us", (U32)result->cSize, (U32)result->time);
+    return 0;
+}
+
+static int FL2_tuneCompare(const void* const a, const void* const b)
+{
+    const FL2_tuneResult* const ra = (const FL2_tuneResult*)a;
+    const FL2_tuneResult* const rb = (const FL2_tuneResult*)b;
+    if (ra->time != rb->time)
+        return (ra->time < rb->time) ? -1 : 1;
+    if (ra->cSize != rb->cSize)
+        return (ra->cSize < rb->cSize) ? -1 : 1;
+    return 0;
+}
+
+/* FL2_tuneFront() :
+ * Sorts the results fastest first, and moves those which compress better than every faster
+ * one to the start, in order. Returns the number on the front. */
+static size_t FL2_tuneFront(FL2_tuneResult* const list, size_t const count)
+{
+    size_t front = 0;
+
+    qsort(list, count, sizeof(*list), FL2_tuneCompare);
+    for (size_t n = 0; n < count; ++n) {
+        if (front == 0 || list[n].cSize < list[front - 1].cSize) {
+            /* list[front] has already been passed over, so it can take the place of list[n] */
+            FL2_tuneResult const result = list[n];
+            list[n] = list[front];
+            list[front++] = result;
+        }
+    }
+    return front;
+}
+
+static size_t FL2_tune(FL2_CCtx* const cctx, const void* const sample, size_t const sampleSize,
+    FL2_tuneResult* const list, void* const dst, size_t const dstCapacity)
+{
+    unsigned const dictionaryLog = cctx->params.rParams.dictionary_log;
+    size_t count = 0;
+    size_t measured;
+    size_t front;
+
+    /* The level sets, with the dictionary size chosen by the caller */
+    for (int high = 0; high < 2; ++high) {
+        int const maxLevel = high ? FL2_maxHighCLevel() : FL2_maxCLevel();
+        for (int level = 1; level <= maxLevel; ++level) {
+            FL2_compressionParameters params;
+            FL2_getLevelParameters(level, high, &params);
+            params.dictionaryLog = dictionaryLog;
+            FL2_tuneAdd(list, &count, &params);
+        }
+    }
+    for (size_t n = 0; n < count; ++n)
+        CHECK_F(FL2_tuneMeasure(cctx, list + n, sample, sampleSize, dst, dstCapacity));
+
+    /* Variations around the front */
+    front = FL2_tuneFront(list, count);
+    measured = count;
+    for (size_t n = 0; n < front; ++n) {
+        FL2_compressionParameters vars[TUNE_VARIATIONS];
+        size_t const nbVars = FL2_tuneVariations(&list[n].params, vars);
+        for (size_t v = 0; v < nbVars; ++v)
+            FL2_tuneAdd(list, &count, vars + v);
+    }
+    for (size_t n = measured; n < count; ++n)
+        CHECK_F(FL2_tuneMeasure(cctx, list + n, sample, sampleSize, dst, dstCapacity));
+
+    front = FL2_tuneFront(list, count);
+    DEBUGLOG(3, "FL2_tune : %u candidates, %u on the front", (U32)count, (U32)front);
+    return front;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_tune(FL2_CCtx* cctx, const void* sample, size_t sampleSize,
+    FL2_tuneResult* results, size_t maxResults)
+{
+    FL2_CCtx_params const saved = cctx->params;
+    size_t const dstCapacity = FL2_XZ_COMPRESSBOUND(sampleSize, FL2_DICTLOG_MIN);
+    FL2_tuneResult* const list = FL2_malloc(FL2_tuneCandidatesMax() * sizeof(FL2_tuneResult), cctx->customMem);
+    void* const dst = FL2_malloc(dstCapacity, cctx->customMem);
+    size_t res;
+
+    if (sampleSize == 0)
+        res = FL2_ERROR(srcSize_wrong);
+    else if (list == NULL || dst == NULL)
+        res = FL2_ERROR(memory_allocation);
+    else
+        res = FL2_tune(cctx, sample, sampleSize, list, dst, dstCapacity);
+
+    cctx->params = saved;
+    if (!FL2_isError(res) && maxResults != 0)
+        memcpy(results, list, MIN(res, maxResults) * sizeof(FL2_tuneResult));
+    FL2_free(dst, cctx->customMem);
+    FL2_free(list, cctx->customMem);
+    return res;
+}
@@ -0,0 +1,334 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdlib.h>     /* realloc, free */
+#include <string.h>     /* memset */
+#include "fl2_xz.h"
+
+#define XZ_FILTER_LZMA2 0x21U
+#define XZ_BLOCK_FLAGS_SIZES 0xC0U  /* compressed and uncompressed sizes present, one filter */
+#define XZ_VLI_SIZE_MAX 9U
+#define XZ_INDEX_RECORD_MAX (XZ_VLI_SIZE_MAX * 2U)
+
+static const BYTE xz_header_magic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+static const BYTE xz_footer_magic[2] = { 'Y', 'Z' };
+
+/* Reflected CRC-32 (IEEE 802.3) and CRC-64 (ECMA-182) tables */
+static const U32 crc32_table[256] = {
+    0x00000000U, 0x77073096U, 0xEE0E612CU, 0x990951BAU, 0x076DC419U, 0x706AF48FU,
+    0xE963A535U, 0x9E6495A3U, 0x0EDB8832U, 0x79DCB8A4U, 0xE0D5E91EU, 0x97D2D988U,
+    0x09B64C2BU, 0x7EB17CBDU, 0xE7B82D07U, 0x90BF1D91U, 0x1DB71064U, 0x6AB020F2U,
+    0xF3B97148U, 0x84BE41DEU, 0x1ADAD47DU, 0x6DDDE4EBU, 0xF4D4B551U, 0x83D385C7U,
+    0x136C9856U, 0x646BA8C0U, 0xFD62F97AU, 0x8A65C9ECU, 0x14015C4FU, 0x63066CD9U,
+    0xFA0F3D63U, 0x8D080DF5U, 0x3B6E20C8U, 0x4C69105EU, 0xD56041E4U, 0xA2677172U,
+    0x3C03E4D1U, 0x4B04D447U, 0xD20D85FDU, 0xA50AB56BU, 0x35B5A8FAU, 0x42B2986CU,
+    0xDBBBC9D6U, 0xACBCF940U, 0x32D86CE3U, 0x45DF5C75U, 0xDCD60DCFU, 0xABD13D59U,
+    0x26D930ACU, 0x51DE003AU, 0xC8D75180U, 0xBFD06116U, 0x21B4F4B5U, 0x56B3C423U,
+    0xCFBA9599U, 0xB8BDA50FU, 0x2802B89EU, 0x5F058808U, 0xC60CD9B2U, 0xB10BE924U,
+    0x2F6F7C87U, 0x58684C11U, 0xC1611DABU, 0xB6662D3DU, 0x76DC4190U, 0x01DB7106U,
+    0x98D220BCU, 0xEFD5102AU, 0x71B18589U, 0x06B6B51FU, 0x9FBFE4A5U, 0xE8B8D433U,
+    0x7807C9A2U, 0x0F00F934U, 0x9609A88EU, 0xE10E9818U, 0x7F6A0DBBU, 0x086D3D2DU,
+    0x91646C97U, 0xE6635C01U, 0x6B6B51F4U, 0x1C6C6162U, 0x856530D8U, 0xF262004EU,
+    0x6C0695EDU, 0x1B01A57BU, 0x8208F4C1U, 0xF50FC457U, 0x65B0D9C6U, 0x12B7E950U,
+    0x8BBEB8EAU, 0xFCB9887CU, 0x62DD1DDFU, 0x15DA2D49U, 0x8CD37CF3U, 0xFBD44C65U,
+    0x4DB26158U, 0x3AB551CEU, 0xA3BC0074U, 0xD4BB30E2U, 0x4ADFA541U, 0x3DD895D7U,
+    0xA4D1C46DU, 0xD3D6F4FBU, 0x4369E96AU, 0x346ED9FCU, 0xAD678846U, 0xDA60B8D0U,
+    0x44042D73U, 0x33031DE5U, 0xAA0A4C5FU, 0xDD0D7CC9U, 0x5005713CU, 0x270241AAU,
+    0xBE0B1010U, 0xC90C2086U, 0x5768B525U, 0x206F85B3U, 0xB966D409U, 0xCE61E49FU,
+    0x5EDEF90EU, 0x29D9C998U, 0xB0D09822U, 0xC7D7A8B4U, 0x59B33D17U, 0x2EB40D81U,
+    0xB7BD5C3BU, 0xC0BA6CADU, 0xEDB88320U, 0x9ABFB3B6U, 0x03B6E20CU, 0x74B1D29AU,
+    0xEAD54739U, 0x9DD277AFU, 0x04DB2615U, 0x73DC1683U, 0xE3630B12U, 0x94643B84U,
+    0x0D6D6A3EU, 0x7A6A5AA8U, 0xE40ECF0BU, 0x9309FF9DU, 0x0A00AE27U, 0x7D079EB1U,
+    0xF00F9344U, 0x8708A3D2U, 0x1E01F268U, 0x6906C2FEU, 0xF762575DU, 0x806567CBU,
+    0x196C3671U, 0x6E6B06E7U, 0xFED41B76U, 0x89D32BE0U, 0x10DA7A5AU, 0x67DD4ACCU,
+    0xF9B9DF6FU, 0x8EBEEFF9U, 0x17B7BE43U, 0x60B08ED5U, 0xD6D6A3E8U, 0xA1D1937EU,
+    0x38D8C2C4U, 0x4FDFF252U, 0xD1BB67F1U, 0xA6BC5767U, 0x3FB506DDU, 0x48B2364BU,
+    0xD80D2BDAU, 0xAF0A1B4CU, 0x36034AF6U, 0x41047A60U, 0xDF60EFC3U, 0xA867DF55U,
+    0x316E8EEFU, 0x4669BE79U, 0xCB61B38CU, 0xBC66831AU, 0x256FD2A0U, 0x5268E236U,
+    0xCC0C7795U, 0xBB0B4703U, 0x220216B9U, 0x5505262FU, 0xC5BA3BBEU, 0xB2BD0B28U,
+    0x2BB45A92U, 0x5CB36A04U, 0xC2D7FFA7U, 0xB5D0CF31U, 0x2CD99E8BU, 0x5BDEAE1DU,
+    0x9B64C2B0U, 0xEC63F226U, 0x756AA39CU, 0x026D930AU, 0x9C0906A9U, 0xEB0E363FU,
+    0x72076785U, 0x05005713U, 0x95BF4A82U, 0xE2B87A14U, 0x7BB12BAEU, 0x0CB61B38U,
+    0x92D28E9BU, 0xE5D5BE0DU, 0x7CDCEFB7U, 0x0BDBDF21U, 0x86D3D2D4U, 0xF1D4E242U,
+    0x68DDB3F8U, 0x1FDA836EU, 0x81BE16CDU, 0xF6B9265BU, 0x6FB077E1U, 0x18B74777U,
+    0x88085AE6U, 0xFF0F6A70U, 0x66063BCAU, 0x11010B5CU, 0x8F659EFFU, 0xF862AE69U,
+    0x616BFFD3U, 0x166CCF45U, 0xA00AE278U, 0xD70DD2EEU, 0x4E048354U, 0x3903B3C2U,
+    0xA7672661U, 0xD06016F7U, 0x4969474DU, 0x3E6E77DBU, 0xAED16A4AU, 0xD9D65ADCU,
+    0x40DF0B66U, 0x37D83BF0U, 0xA9BCAE53U, 0xDEBB9EC5U, 0x47B2CF7FU, 0x30B5FFE9U,
+    0xBDBDF21CU, 0xCABAC28AU, 0x53B39330U, 0x24B4A3A6U, 0xBAD03605U, 0xCDD70693U,
+    0x54DE5729U, 0x23D967BFU, 0xB3667A2EU, 0xC4614AB8U, 0x5D681B02U, 0x2A6F2B94U,
+    0xB40BBE37U, 0xC30C8EA1U, 0x5A05DF1BU, 0x2D02EF8DU
+};
+
+static const U64 crc64_table[256] = {
+    0x0000000000000000ULL, 0xB32E4CBE03A75F6FULL, 0xF4843657A840A05BULL,
+    0x47AA7AE9ABE7FF34ULL, 0x7BD0C384FF8F5E33ULL, 0xC8FE8F3AFC28015CULL,
+    0x8F54F5D357CFFE68ULL, 0x3C7AB96D5468A107ULL, 0xF7A18709FF1EBC66ULL,
+    0x448FCBB7FCB9E309ULL, 0x0325B15E575E1C3DULL, 0xB00BFDE054F94352ULL,
+    0x8C71448D0091E255ULL, 0x3F5F08330336BD3AULL, 0x78F572DAA8D1420EULL,
+    0xCBDB3E64AB761D61ULL, 0x7D9BA13851336649ULL, 0xCEB5ED8652943926ULL,
+    0x891F976FF973C612ULL, 0x3A31DBD1FAD4997DULL, 0x064B62BCAEBC387AULL,
+    0xB5652E02AD1B6715ULL, 0xF2CF54EB06FC9821ULL, 0x41E11855055BC74EULL,
+    0x8A3A2631AE2DDA2FULL, 0x39146A8FAD8A8540ULL, 0x7EBE1066066D7A74ULL,
+    0xCD905CD805CA251BULL, 0xF1EAE5B551A2841CULL, 0x42C4A90B5205DB73ULL,
+    0x056ED3E2F9E22447ULL, 0xB6409F5CFA457B28ULL, 0xFB374270A266CC92ULL,
+    0x48190ECEA1C193FDULL, 0x0FB374270A266CC9ULL, 0xBC9D3899098133A6ULL,
+    0x80E781F45DE992A1ULL, 0x33C9CD4A5E4ECDCEULL, 0x7463B7A3F5A932FAULL,
+    0xC74DFB1DF60E6D95ULL, 0x0C96C5795D7870F4ULL, 0xBFB889C75EDF2F9BULL,
+    0xF812F32EF538D0AFULL, 0x4B3CBF90F69F8FC0ULL, 0x774606FDA2F72EC7ULL,
+    0xC4684A43A15071A8ULL, 0x83C230AA0AB78E9CULL, 0x30EC7C140910D1F3ULL,
+    0x86ACE348F355AADBULL, 0x3582AFF6F0F2F5B4ULL, 0x7228D51F5B150A80ULL,
+    0xC10699A158B255EFULL, 0xFD7C20CC0CDAF4E8ULL, 0x4E526C720F7DAB87ULL,
+    0x09F8169BA49A54B3ULL, 0xBAD65A25A73D0BDCULL, 0x710D64410C4B16BDULL,
+    0xC22328FF0FEC49D2ULL, 0x85895216A40BB6E6ULL, 0x36A71EA8A7ACE989ULL,
+    0x0ADDA7C5F3C4488EULL, 0xB9F3EB7BF06317E1ULL, 0xFE5991925B84E8D5ULL,
+    0x4D77DD2C5823B7BAULL, 0x64B62BCAEBC387A1ULL, 0xD7986774E864D8CEULL,
+    0x90321D9D438327FAULL, 0x231C512340247895ULL, 0x1F66E84E144CD992ULL,
+    0xAC48A4F017EB86FDULL, 0xEBE2DE19BC0C79C9ULL, 0x58CC92A7BFAB26A6ULL,
+    0x9317ACC314DD3BC7ULL, 0x2039E07D177A64A8ULL, 0x67939A94BC9D9B9CULL,
+    0xD4BDD62ABF3AC4F3ULL, 0xE8C76F47EB5265F4ULL, 0x5BE923F9E8F53A9BULL,
+    0x1C4359104312C5AFULL, 0xAF6D15AE40B59AC0ULL, 0x192D8AF2BAF0E1E8ULL,
+    0xAA03C64CB957BE87ULL, 0xEDA9BCA512B041B3ULL, 0x5E87F01B11171EDCULL,
+    0x62FD4976457FBFDBULL, 0xD1D305C846D8E0B4ULL, 0x96797F21ED3F1F80ULL,
+    0x2557339FEE9840EFULL, 0xEE8C0DFB45EE5D8EULL, 0x5DA24145464902E1ULL,
+    0x1A083BACEDAEFDD5ULL, 0xA9267712EE09A2BAULL, 0x955CCE7FBA6103BDULL,
+    0x267282C1B9C65CD2ULL, 0x61D8F8281221A3E6ULL, 0xD2F6B4961186FC89ULL,
+    0x9F8169BA49A54B33ULL, 0x2CAF25044A02145CULL, 0x6B055FEDE1E5EB68ULL,
+    0xD82B1353E242B407ULL, 0xE451AA3EB62A1500ULL, 0x577FE680B58D4A6FULL,
+    0x10D59C691E6AB55BULL, 0xA3FBD0D71DCDEA34ULL, 0x6820EEB3B6BBF755ULL,
+    0xDB0EA20DB51CA83AULL, 0x9CA4D8E41EFB570EULL, 0x2F8A945A1D5C0861ULL,
+    0x13F02D374934A966ULL, 0xA0DE61894A93F609ULL, 0xE7741B60E174093DULL,
+    0x545A57DEE2D35652ULL, 0xE21AC88218962D7AULL, 0x5134843C1B317215ULL,
+    0x169EFED5B0D68D21ULL, 0xA5B0B26BB371D24EULL, 0x99CA0B06E7197349ULL,
+    0x2AE447B8E4BE2C26ULL, 0x6D4E3D514F59D312ULL, 0xDE6071EF4CFE8C7DULL,
+    0x15BB4F8BE788911CULL, 0xA6950335E42FCE73ULL, 0xE13F79DC4FC83147ULL,
+    0x521135624C6F6E28ULL, 0x6E6B8C0F1807CF2FULL, 0xDD45C0B11BA09040ULL,
+    0x9AEFBA58B0476F74ULL, 0x29C1F6E6B3E0301BULL, 0xC96C5795D7870F42ULL,
+    0x7A421B2BD420502DULL, 0x3DE861C27FC7AF19ULL, 0x8EC62D7C7C60F076ULL,
+    0xB2BC941128085171ULL, 0x0192D8AF2BAF0E1EULL, 0x4638A2468048F12AULL,
+    0xF516EEF883EFAE45ULL, 0x3ECDD09C2899B324ULL, 0x8DE39C222B3EEC4BULL,
+    0xCA49E6CB80D9137FULL, 0x7967AA75837E4C10ULL, 0x451D1318D716ED17ULL,
+    0xF6335FA6D4B1B278ULL, 0xB199254F7F564D4CULL, 0x02B769F17CF11223ULL,
+    0xB4F7F6AD86B4690BULL, 0x07D9BA1385133664ULL, 0x4073C0FA2EF4C950ULL,
+    0xF35D8C442D53963FULL, 0xCF273529793B3738ULL, 0x7C0979977A9C6857ULL,
+    0x3BA3037ED17B9763ULL, 0x888D4FC0D2DCC80CULL, 0x435671A479AAD56DULL,
+    0xF0783D1A7A0D8A02ULL, 0xB7D247F3D1EA7536ULL, 0x04FC0B4DD24D2A59ULL,
+    0x3886B22086258B5EULL, 0x8BA8FE9E8582D431ULL, 0xCC0284772E652B05ULL,
+    0x7F2CC8C92DC2746AULL, 0x325B15E575E1C3D0ULL, 0x8175595B76469CBFULL,
+    0xC6DF23B2DDA1638BULL, 0x75F16F0CDE063CE4ULL, 0x498BD6618A6E9DE3ULL,
+    0xFAA59ADF89C9C28CULL, 0xBD0FE036222E3DB8ULL, 0x0E21AC88218962D7ULL,
+    0xC5FA92EC8AFF7FB6ULL, 0x76D4DE52895820D9ULL, 0x317EA4BB22BFDFEDULL,
+    0x8250E80521188082ULL, 0xBE2A516875702185ULL, 0x0D041DD676D77EEAULL,
+    0x4AAE673FDD3081DEULL, 0xF9802B81DE97DEB1ULL, 0x4FC0B4DD24D2A599ULL,
+    0xFCEEF8632775FAF6ULL, 0xBB44828A8C9205C2ULL, 0x086ACE348F355AADULL,
+    0x34107759DB5DFBAAULL, 0x873E3BE7D8FAA4C5ULL, 0xC094410E731D5BF1ULL,
+    0x73BA0DB070BA049EULL, 0xB86133D4DBCC19FFULL, 0x0B4F7F6AD86B4690ULL,
+    0x4CE50583738CB9A4ULL, 0xFFCB493D702BE6CBULL, 0xC3B1F050244347CCULL,
+    0x709FBCEE27E418A3ULL, 0x3735C6078C03E797ULL, 0x841B8AB98FA4B8F8ULL,
+    0xADDA7C5F3C4488E3ULL, 0x1EF430E13FE3D78CULL, 0x595E4A08940428B8ULL,
+    0xEA7006B697A377D7ULL, 0xD60ABFDBC3CBD6D0ULL, 0x6524F365C06C89BFULL,
+    0x228E898C6B8B768BULL, 0x91A0C532682C29E4ULL, 0x5A7BFB56C35A3485ULL,
+    0xE955B7E8C0FD6BEAULL, 0xAEFFCD016B1A94DEULL, 0x1DD181BF68BDCBB1ULL,
+    0x21AB38D23CD56AB6ULL, 0x9285746C3F7235D9ULL, 0xD52F0E859495CAEDULL,
+    0x6601423B97329582ULL, 0xD041DD676D77EEAAULL, 0x636F91D96ED0B1C5ULL,
+    0x24C5EB30C5374EF1ULL, 0x97EBA78EC690119EULL, 0xAB911EE392F8B099ULL,
+    0x18BF525D915FEFF6ULL, 0x5F1528B43AB810C2ULL, 0xEC3B640A391F4FADULL,
+    0x27E05A6E926952CCULL, 0x94CE16D091CE0DA3ULL, 0xD3646C393A29F297ULL,
+    0x604A2087398EADF8ULL, 0x5C3099EA6DE60CFFULL, 0xEF1ED5546E415390ULL,
+    0xA8B4AFBDC5A6ACA4ULL, 0x1B9AE303C601F3CBULL, 0x56ED3E2F9E224471ULL,
+    0xE5C372919D851B1EULL, 0xA26908783662E42AULL, 0x114744C635C5BB45ULL,
+    0x2D3DFDAB61AD1A42ULL, 0x9E13B115620A452DULL, 0xD9B9CBFCC9EDBA19ULL,
+    0x6A978742CA4AE576ULL, 0xA14CB926613CF817ULL, 0x1262F598629BA778ULL,
+    0x55C88F71C97C584CULL, 0xE6E6C3CFCADB0723ULL, 0xDA9C7AA29EB3A624ULL,
+    0x69B2361C9D14F94BULL, 0x2E184CF536F3067FULL, 0x9D36004B35545910ULL,
+    0x2B769F17CF112238ULL, 0x9858D3A9CCB67D57ULL, 0xDFF2A94067518263ULL,
+    0x6CDCE5FE64F6DD0CULL, 0x50A65C93309E7C0BULL, 0xE388102D33392364ULL,
+    0xA4226AC498DEDC50ULL, 0x170C267A9B79833FULL, 0xDCD7181E300F9E5EULL,
+    0x6FF954A033A8C131ULL, 0x28532E49984F3E05ULL, 0x9B7D62F79BE8616AULL,
+    0xA707DB9ACF80C06DULL, 0x14299724CC279F02ULL, 0x5383EDCD67C06036ULL,
+    0xE0ADA17364673F59ULL
+};
+
+U32 FL2_crc32(U32 crc, const void* const src, size_t const size)
+{
+    const BYTE* const data = (const BYTE*)src;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = crc32_table[(BYTE)crc ^ data[i]] ^ (crc >> 8);
+    return ~crc;
+}
+
+U64 FL2_crc64(U64 crc, const void* const src, size_t const size)
+{
+    const BYTE* const data = (const BYTE*)src;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = crc64_table[(BYTE)crc ^ data[i]] ^ (crc >> 8);
+    return ~crc;
+}
+
+unsigned FL2_xzCheckId(unsigned const xzFormat)
+{
+    return (xzFormat == 1) ? XZ_CHECK_CRC32
+        : (xzFormat == 2) ? XZ_CHECK_CRC64
+        : 0;
+}
+
+size_t FL2_xzCheckSize(unsigned const checkId)
+{
+    return (checkId == XZ_CHECK_CRC64) ? 8 : (checkId == XZ_CHECK_CRC32) ? 4 : 0;
+}
+
+U64 FL2_xzCheck(unsigned const checkId, const void* const src, size_t const size)
+{
+    if (checkId == XZ_CHECK_CRC64)
+        return FL2_crc64(0, src, size);
+    return FL2_crc32(0, src, size);
+}
+
+static size_t XzVliSize(U64 value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+static size_t XzWriteVli(BYTE* const dst, U64 value)
+{
+    size_t pos = 0;
+    while (value >= 0x80) {
+        dst[pos++] = (BYTE)value | 0x80;
+        value >>= 7;
+    }
+    dst[pos++] = (BYTE)value;
+    return pos;
+}
+
+void FL2_xzWriteStreamHeader(BYTE* const dst, unsigned const checkId)
+{
+    memcpy(dst, xz_header_magic, sizeof(xz_header_magic));
+    dst[6] = 0;
+    dst[7] = (BYTE)checkId;
+    MEM_writeLE32(dst + 8, FL2_crc32(0, dst + 6, 2));
+}
+
+size_t FL2_xzBlockHeaderSize(U64 const uSize)
+{
+    /* size byte, flags, the sizes and the LZMA2 filter flags, padded to 4 bytes, then the CRC32 */
+    size_t const size = 2 + XzVliSize(FL2_COMPRESSBOUND(uSize)) + XzVliSize(uSize) + 3;
+    return ((size + 3) & ~(size_t)3) + 4;
+}
+
+void FL2_xzWriteBlockHeader(BYTE* const dst, size_t const headerSize, U64 const cSize, U64 const uSize, BYTE const dictProp)
+{
+    size_t pos = 2;
+
+    /* a compressed size shorter than the bound leaves more header padding */
+    memset(dst, 0, headerSize - 4);
+    dst[0] = (BYTE)(headerSize / 4 - 1);
+    dst[1] = XZ_BLOCK_FLAGS_SIZES;
+    pos += XzWriteVli(dst + pos, cSize);
+    pos += XzWriteVli(dst + pos, uSize);
+    dst[pos++] = XZ_FILTER_LZMA2;
+    dst[pos++] = 1; /* size of the filter properties */
+    dst[pos] = dictProp;
+    MEM_writeLE32(dst + headerSize - 4, FL2_crc32(0, dst, headerSize - 4));
+}
+
+size_t FL2_xzWriteBlockTail(BYTE* const dst, U64 const cSize, unsigned const checkId, U64 const check)
+{
+    size_t const padding = (size_t)(0 - cSize) & 3;
+    size_t pos = 0;
+
+    dst[pos++] = 0; /* LZMA2 end marker */
+    memset(dst + pos, 0, padding);
+    pos += padding;
+    if (checkId == XZ_CHECK_CRC64)
+        MEM_writeLE64(dst + pos, check);
+    else if (checkId == XZ_CHECK_CRC32)
+        MEM_writeLE32(dst + pos, (U32)check);
+    return pos + FL2_xzCheckSize(checkId);
+}
+
+void FL2_xzIndexInit(FL2_xzIndex* const index)
+{
+    index->data = NULL;
+    index->cap = 0;
+    FL2_xzIndexReset(index);
+}
+
+void FL2_xzIndexFree(FL2_xzIndex* const index)
+{
+    free(index->data);
+    FL2_xzIndexInit(index);
+}
+
+void FL2_xzIndexReset(FL2_xzIndex* const index)
+{
+    index->size = XZ_INDEX_PREFIX_MAX;
+    index->start = 0;
+    index->count = 0;
+}
+
+/* Ensures room for `size` more bytes */
+static size_t XzIndexReserve(FL2_xzIndex* const index, size_t const size)
+{
+    if (index->size + size > index->cap) {
+        size_t const cap = MAX(index->cap * 2, index->size + size + XZ_INDEX_RECORD_MAX * 64);
+        BYTE* const data = realloc(index->data, cap);
+        if (data == NULL)
+            return FL2_ERROR(memory_allocation);
+        index->data = data;
+        index->cap = cap;
+    }
+    return 0;
+}
+
+size_t FL2_xzIndexAdd(FL2_xzIndex* const index, U64 const unpaddedSize, U64 const uSize)
+{
+    CHECK_F(XzIndexReserve(index, XZ_INDEX_RECORD_MAX));
+    index->size += XzWriteVli(index->data + index->size, unpaddedSize);
+    index->size += XzWriteVli(index->data + index->size, uSize);
+    ++index->count;
+    return 0;
+}
+
+size_t FL2_xzIndexFinish(FL2_xzIndex* const index, unsigned const checkId)
+{
+    size_t padding;
+    size_t indexSize;
+    BYTE* footer;
+
+    CHECK_F(XzIndexReserve(index, 3 + 4 + XZ_STREAM_FOOTER_SIZE));
+    /* the indicator and count go immediately before the records */
+    index->start = XZ_INDEX_PREFIX_MAX - 1 - XzVliSize(index->count);
+    index->data[index->start] = 0;
+    XzWriteVli(index->data + index->start + 1, index->count);
+
+    padding = (size_t)(0 - (index->size - index->start)) & 3;
+    memset(index->data + index->size, 0, padding);
+    index->size += padding;
+    MEM_writeLE32(index->data + index->size, FL2_crc32(0, index->data + index->start, index->size - index->start));
+    index->size += 4;
+    indexSize = index->size - index->start;
+
+    footer = index->data + index->size;
+    MEM_writeLE32(footer + 4, (U32)(indexSize / 4 - 1));
+    footer[8] = 0;
+    footer[9] = (BYTE)checkId;
+    MEM_writeLE32(footer, FL2_crc32(0, footer + 4, 6));
+    memcpy(footer + 10, xz_footer_magic, sizeof(xz_footer_magic));
+    index->size += XZ_STREAM_FOOTER_SIZE;
+
+    return index->size - index->start;
+}
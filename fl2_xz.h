@@ -0,0 +1,97 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#ifndef FL2_XZ_H_
+#define FL2_XZ_H_
+
+#include "mem.h"
+#include "fl2_internal.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* .xz container output for FL2_p_xzFormat. A stream is a header, a sequence of blocks, an
+ * index of the block sizes and a footer. Each block holds an LZMA2 stream which begins with a
+ * dictionary reset, and has its compressed and uncompressed sizes in its header, so xz and
+ * other decoders can decode the blocks in parallel. */
+
+#define XZ_STREAM_HEADER_SIZE 12U
+#define XZ_STREAM_FOOTER_SIZE 12U
+#define XZ_BLOCK_HEADER_MAX 28U     /* both sizes present, one filter */
+#define XZ_BLOCK_TAIL_MAX 12U       /* LZMA2 end marker, block padding and a CRC64 */
+#define XZ_INDEX_PREFIX_MAX 10U     /* index indicator and record count */
+
+/* Check IDs of the stream flags */
+#define XZ_CHECK_CRC32 1U
+#define XZ_CHECK_CRC64 4U
+
+U32 FL2_crc32(U32 crc, const void* src, size_t size);
+U64 FL2_crc64(U64 crc, const void* src, size_t size);
+
+/* FL2_xzCheckId() :
+ * Returns the check ID selected by a FL2_p_xzFormat value, or 0 if .xz output is off. */
+unsigned FL2_xzCheckId(unsigned xzFormat);
+
+size_t FL2_xzCheckSize(unsigned checkId);
+
+/* FL2_xzCheck() :
+ * Returns the check of a whole block of uncompressed data */
+U64 FL2_xzCheck(unsigned checkId, const void* src, size_t size);
+
+/* Writes XZ_STREAM_HEADER_SIZE bytes */
+void FL2_xzWriteStreamHeader(BYTE* dst, unsigned checkId);
+
+/* FL2_xzBlockHeaderSize() :
+ * Size of the header of a block of uSize bytes. It is large enough for the compressed
+ * size of the block to be as much as FL2_COMPRESSBOUND(uSize), so it can be reserved
+ * before compression, and the header written afterward. */
+size_t FL2_xzBlockHeaderSize(U64 uSize);
+
+/* FL2_xzWriteBlockHeader() :
+ * Writes headerSize bytes, from FL2_xzBlockHeaderSize(). cSize is the size of the LZMA2
+ * data including its end marker. */
+void FL2_xzWriteBlockHeader(BYTE* dst, size_t headerSize, U64 cSize, U64 uSize, BYTE dictProp);
+
+/* FL2_xzWriteBlockTail() :
+ * Writes the LZMA2 end marker, which is included in cSize, then the block padding and the
+ * check. Returns the size written, at most XZ_BLOCK_TAIL_MAX. */
+size_t FL2_xzWriteBlockTail(BYTE* dst, U64 cSize, unsigned checkId, U64 check);
+
+typedef struct {
+    BYTE* data;     /* XZ_INDEX_PREFIX_MAX bytes reserved for the prefix, then the records */
+    size_t size;
+    size_t cap;
+    size_t start;   /* position of the finished index in data */
+    U64 count;
+} FL2_xzIndex;
+
+void FL2_xzIndexInit(FL2_xzIndex* index);
+
+void FL2_xzIndexFree(FL2_xzIndex* index);
+
+/* Removes all records */
+void FL2_xzIndexReset(FL2_xzIndex* index);
+
+/* FL2_xzIndexAdd() :
+ * Adds the record of a block. unpaddedSize is the size of the block header, the LZMA2 data
+ * and the check. Returns 0, or an error code. */
+size_t FL2_xzIndexAdd(FL2_xzIndex* index, U64 unpaddedSize, U64 uSize);
+
+/* FL2_xzIndexFinish() :
+ * Completes the index and appends the stream footer. The result is at data + start.
+ * Returns its size, or an error code. */
+size_t FL2_xzIndexFinish(FL2_xzIndex* index, unsigned checkId);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* FL2_XZ_H_ */
@@ -8,6 +8,7 @@ Modified for FL2 by Conor McCarthy */
 #include "platform.h"
 
 #include <string.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #define kNumTopBits 24
@@ -160,7 +161,6 @@ S - Props
 #define LZMA2_GET_LZMA_MODE(control) ((control >> 5) & 3)
 #define LZMA2_IS_THERE_PROP(mode) ((mode) >= 2)
 
-#define LZMA2_DIC_SIZE_FROM_PROP(p) (((U32)2 | ((p) & 1)) << ((p) / 2 + 11))
 
 #ifdef SHOW_DEBUG_INFO
 #define PRF(x) x
@@ -367,21 +367,32 @@ Out:
     1 - Error
 */
 
-#ifdef LZMA2_DEC_OPT
-
-int LzmaDec_DecodeReal(CLzma2Dec *p, size_t limit, const BYTE *bufLimit);
+#define kMatchCopyWide 16
 
-#else
+/* Copies a match of len >= width from a distance of at least width bytes in
+   steps of width bytes. No step reads a byte it has not yet written, and the
+   last step ends at the end of the match so nothing past it is touched. This
+   matters when the dictionary is circular or shared between decode threads. */
+FORCE_INLINE_TEMPLATE void LzmaDec_CopyWide(BYTE *dest, ptrdiff_t src, size_t len, size_t width)
+{
+  BYTE *const last = dest + len - width;
+  do {
+    memcpy(dest, dest + src, width);
+    dest += width;
+  } while (dest < last);
+  memcpy(last, last + src, width);
+}
 
-static int LzmaDec_DecodeReal(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+/* The properties are passed as constants to specialize the loop for the common settings */
+FORCE_INLINE_TEMPLATE int LzmaDec_DecodeRealProps(CLzma2Dec *p, size_t limit, const BYTE *bufLimit,
+    unsigned const pb, unsigned const lc, unsigned const lp)
 {
   Probability *probs = GET_PROBS;
 
   unsigned state = p->state;
   U32 rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
-  unsigned pbMask = ((unsigned)1 << (p->prop.pb)) - 1;
-  unsigned lc = p->prop.lc;
-  unsigned lpMask = ((unsigned)0x100 << p->prop.lp) - ((unsigned)0x100 >> lc);
+  unsigned pbMask = ((unsigned)1 << pb) - 1;
+  unsigned lpMask = ((unsigned)0x100 << lp) - ((unsigned)0x100 >> lc);
 
   BYTE *dic = p->dic;
   size_t dicBufSize = p->dicBufSize;
@@ -702,9 +713,18 @@ static int LzmaDec_DecodeReal(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
           ptrdiff_t src = (ptrdiff_t)pos - (ptrdiff_t)dicPos;
           const BYTE *lim = dest + curLen;
           dicPos += curLen;
-          do
-            *(dest) = (BYTE)*(dest + src);
-          while (++dest != lim);
+          if (src <= -kMatchCopyWide && curLen >= kMatchCopyWide)
+            LzmaDec_CopyWide(dest, src, curLen, kMatchCopyWide);
+          else if (src <= -8 && curLen >= 8)
+            LzmaDec_CopyWide(dest, src, curLen, 8);
+          else if (src == -1)
+            memset(dest, dest[-1], curLen);
+          else
+          {
+            do
+              *(dest) = (BYTE)*(dest + src);
+            while (++dest != lim);
+          }
         }
         else
         {
@@ -738,6 +758,71 @@ static int LzmaDec_DecodeReal(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
   return 0;
 }
 
+static int LzmaDec_DecodeReal_lc3_lp0_pb2(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+{
+  return LzmaDec_DecodeRealProps(p, limit, bufLimit, 2, 3, 0);
+}
+
+static int LzmaDec_DecodeReal_lc0_lp2_pb2(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+{
+  return LzmaDec_DecodeRealProps(p, limit, bufLimit, 2, 0, 2);
+}
+
+static int LzmaDec_DecodeReal_any(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+{
+  return LzmaDec_DecodeRealProps(p, limit, bufLimit, p->prop.pb, p->prop.lc, p->prop.lp);
+}
+
+static int LzmaDec_DecodeReal_C(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+{
+  if (p->prop.pb == 2 && p->prop.lc == 3 && p->prop.lp == 0)
+    return LzmaDec_DecodeReal_lc3_lp0_pb2(p, limit, bufLimit);
+  if (p->prop.pb == 2 && p->prop.lc == 0 && p->prop.lp == 2)
+    return LzmaDec_DecodeReal_lc0_lp2_pb2(p, limit, bufLimit);
+  return LzmaDec_DecodeReal_any(p, limit, bufLimit);
+}
+
+#ifdef LZMA2_DEC_OPT
+
+/* LzmaDecOpt.asm (MSVC) or LzmaDecOpt.S (GNU as) */
+int LzmaDec_DecodeReal_3(CLzma2Dec *p, size_t limit, const BYTE *bufLimit);
+
+/* Field offsets hard-coded in the asm */
+typedef char LZMA2_asmLayoutCheck[(offsetof(CLzma2Dec, dic) == 8
+    && offsetof(CLzma2Dec, probs_1664) == 40
+    && offsetof(CLzma2Dec, range) == 48
+    && offsetof(CLzma2Dec, reps) == 64
+    && offsetof(CLzma2Dec, state) == 80
+    && offsetof(CLzma2Dec, remainLen) == 88) ? 1 : -1];
+
+static int g_decodeAsm = 1;
+
+int LZMA2_setDecodeAsm(int enable)
+{
+    g_decodeAsm = (enable != 0);
+    return g_decodeAsm;
+}
+
+static int LzmaDec_DecodeReal(CLzma2Dec *p, size_t limit, const BYTE *bufLimit)
+{
+    if (g_decodeAsm) {
+        int const res = LzmaDec_DecodeReal_3(p, limit, bufLimit);
+        /* The asm loop accepts an LZMA end marker, which is not valid in LZMA2 */
+        return res | (p->remainLen == kMatchSpecLenStart);
+    }
+    return LzmaDec_DecodeReal_C(p, limit, bufLimit);
+}
+
+#else
+
+int LZMA2_setDecodeAsm(int enable)
+{
+    (void)enable;
+    return 0;
+}
+
+#define LzmaDec_DecodeReal LzmaDec_DecodeReal_C
+
 #endif
 
 static void LzmaDec_WriteRem(CLzma2Dec *p, size_t limit)
@@ -914,7 +999,11 @@ size_t FLzmaDec_DecodeToBuf(CLzma2Dec *p, BYTE *dest, size_t *destLen, const BYT
     ELzmaFinishMode curFinishMode;
     size_t res;
     if (p->dicPos == p->dicBufSize)
-      p->dicPos = 0;
+    {
+      res = FLzma2Dec_WrapDic(p);
+      if (ERR_isError(res))
+        return res;
+    }
     dicPos = p->dicPos;
     if (outSize > p->dicBufSize - dicPos)
     {
@@ -945,6 +1034,8 @@ void LzmaDec_Construct(CLzma2Dec *p)
 {
     p->dic = NULL;
     p->extDic = 1;
+    p->dicLimit = 0;
+    p->dicFull = 0;
     p->state2 = LZMA2_STATE_FINISHED;
 	p->probs_1664 = p->probs + 1664;
 }
@@ -976,8 +1067,14 @@ size_t FLzma2Dec_Init(CLzma2Dec *p, BYTE dictProp, BYTE *dic, size_t dicBufSize)
         dicBufSize = ((size_t)dictSize + mask) & ~mask;
         if (dicBufSize < dictSize)
             dicBufSize = dictSize;
-
-        if (!p->dic || dicBufSize != p->dicBufSize) {
+        if (p->dicLimit && dicBufSize > p->dicLimit)
+            return FL2_ERROR(memoryLimit_exceeded);
+
+        p->dicFull = dicBufSize;
+        /* The dictionary of the previous frame is kept if it is no larger than this one needs.
+         * Otherwise a small one is allocated, and it grows as the frame is decoded. */
+        if (!p->dic || p->extDic || p->dicBufSize > dicBufSize) {
+            dicBufSize = MIN(dicBufSize, LZMA2_DIC_INIT_SIZE);
             LzmaDec_FreeDict(p);
             p->dic = (BYTE *)malloc(dicBufSize);
             if (!p->dic)
@@ -986,11 +1083,15 @@ size_t FLzma2Dec_Init(CLzma2Dec *p, BYTE dictProp, BYTE *dic, size_t dicBufSize)
             }
             p->extDic = 0;
         }
+        else {
+            dicBufSize = p->dicBufSize;
+        }
     }
     else {
         LzmaDec_FreeDict(p);
         p->dic = dic;
         p->extDic = 1;
+        p->dicFull = dicBufSize;
     }
     p->dicBufSize = dicBufSize;
     p->prop.lc = 3;
@@ -1006,6 +1107,46 @@ size_t FLzma2Dec_Init(CLzma2Dec *p, BYTE dictProp, BYTE *dic, size_t dicBufSize)
     return FL2_error_no_error;
 }
 
+/* Enlarges an internal dictionary to at least minSize, doubling it and limited to its full
+ * size. It has not wrapped, so its contents are preserved. */
+static size_t LzmaDec_GrowDict(CLzma2Dec *p, size_t minSize)
+{
+    size_t size = (p->dicFull - p->dicBufSize > p->dicBufSize) ? p->dicBufSize * 2 : p->dicFull;
+    BYTE *dic;
+    if (size < minSize)
+        size = MIN(minSize, p->dicFull);
+    dic = (BYTE *)realloc(p->dic, size);
+    if (!dic)
+        return FL2_ERROR(memory_allocation);
+    p->dic = dic;
+    p->dicBufSize = size;
+    return FL2_error_no_error;
+}
+
+size_t FLzma2Dec_WrapDic(CLzma2Dec *p)
+{
+    if (p->dicBufSize < p->dicFull)
+        return LzmaDec_GrowDict(p, 0);
+    p->dicPos = 0;
+    return FL2_error_no_error;
+}
+
+size_t FLzma2Dec_InitDictionary(CLzma2Dec *p, const BYTE *dict, size_t dictSize)
+{
+    size_t size = MIN(dictSize, p->prop.dicSize);
+    if (size > p->dicBufSize && p->dicBufSize < p->dicFull)
+        CHECK_F(LzmaDec_GrowDict(p, size));
+    size = MIN(size, p->dicBufSize);
+    memmove(p->dic, dict + dictSize - size, size);
+    p->dicPos = size;
+    /* Position states count from the start of the dictionary */
+    p->processedPos = (U32)dictSize;
+    if (dictSize >= p->prop.dicSize)
+        p->checkDicSize = p->prop.dicSize;
+    p->needInitDic = 0;
+    return FL2_error_no_error;
+}
+
 static void LzmaDec_UpdateWithUncompressed(CLzma2Dec *p, const BYTE *src, size_t size)
 {
     memcpy(p->dic + p->dicPos, src, size);
@@ -1212,8 +1353,11 @@ size_t FLzma2Dec_DecodeToBuf(CLzma2Dec *p, BYTE *dest, size_t *destLen, const BY
         ELzmaFinishMode curFinishMode;
         size_t res;
 
-        if (p->dicPos == p->dicBufSize)
-            p->dicPos = 0;
+        if (p->dicPos == p->dicBufSize) {
+            res = FLzma2Dec_WrapDic(p);
+            if (ERR_isError(res))
+                return res;
+        }
         dicPos = p->dicPos;
         curFinishMode = LZMA_FINISH_ANY;
         outCur = p->dicBufSize - dicPos;
@@ -1267,3 +1411,33 @@ size_t FLzma2Dec_UnpackSize(const BYTE *src, size_t srcLen)
     }
     return LZMA2_CONTENTSIZE_ERROR;
 }
+
+size_t FLzma2Dec_ParseChunk(const BYTE *src, size_t srcLen, U32 *packSize, U32 *unpackSize, BYTE *dicReset)
+{
+    ptrdiff_t len = srcLen;
+    U32 unpack = 0;
+    U32 pack = 0;
+    BYTE control;
+    CLzmaProps prop;
+    unsigned const state = Lzma2Dec_NextChunkInfo(&control, &unpack, &pack, &prop, src, &len);
+    if (state == LZMA2_STATE_ERROR)
+        return FL2_ERROR(corruption_detected);
+    if (state == LZMA2_STATE_CONTROL)
+        return 0;
+    *dicReset = 0;
+    if (state == LZMA2_STATE_FINISHED) {
+        *packSize = 0;
+        *unpackSize = 0;
+        return 1;
+    }
+    *unpackSize = unpack;
+    if (LZMA2_IS_UNCOMPRESSED_STATE(control)) {
+        *packSize = unpack;
+        *dicReset = (control == LZMA2_CONTROL_COPY_RESET_DIC);
+    }
+    else {
+        *packSize = pack;
+        *dicReset = (LZMA2_GET_LZMA_MODE(control) == 3);
+    }
+    return len;
+}
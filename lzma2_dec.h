@@ -129,6 +129,12 @@ Returns:
 
 #define LZMA2_LCLP_MAX 4U
 
+#define LZMA2_DIC_SIZE_FROM_PROP(p) (((U32)2 | ((p) & 1)) << ((p) / 2 + 11))
+
+/* Initial size of a dictionary allocated by FLzma2Dec_Init(). It grows up to the size given by
+   the dictionary property as data is decoded, so small frames use little memory. */
+#define LZMA2_DIC_INIT_SIZE ((size_t)1 << 16)
+
 
 typedef struct CLzma2Dec_s
 {
@@ -156,6 +162,8 @@ typedef struct CLzma2Dec_s
 	BYTE needFlush;
 	BYTE extDic;
 	BYTE pad_;
+    size_t dicLimit; /* largest dictionary allocated by FLzma2Dec_Init(), or 0 for no limit */
+    size_t dicFull;  /* dicBufSize when an internal dictionary is fully grown */
     Probability probs[NUM_BASE_PROBS + ((U32)LZMA_LIT_SIZE << LZMA2_LCLP_MAX)];
 } CLzma2Dec;
 
@@ -216,14 +224,40 @@ size_t FLzmaDec_DecodeToBuf(CLzma2Dec *p, BYTE *dest, size_t *destLen,
 
 size_t FLzma2Dec_UnpackSize(const BYTE *src, size_t srcLen);
 
+/* FLzma2Dec_ParseChunk() :
+   Reads the header of the chunk at src.
+   Returns the header size, 0 if srcLen is too small for the header, or an error.
+   The end marker returns 1 with *unpackSize == 0.
+   *packSize receives the size of the chunk data following the header. A chunk that sets
+   *dicReset does not depend on any previous data and can be decoded independently. */
+#define LZMA2_CHUNK_HEADER_MAX 6
+
+size_t FLzma2Dec_ParseChunk(const BYTE *src, size_t srcLen, U32 *packSize, U32 *unpackSize, BYTE *dicReset);
+
 size_t FLzma2Dec_Init(CLzma2Dec *p, BYTE dictProp, BYTE *dic, size_t dicBufSize);
 
+/* FLzma2Dec_InitDictionary() :
+   Primes a decoder initialized with FLzma2Dec_Init() with the preset dictionary used by the encoder,
+   so the first chunk does not have to reset the dictionary. The end of dict is moved to the start of
+   the dictionary buffer, where it may already be in place. Returns 0 or an error. */
+size_t FLzma2Dec_InitDictionary(CLzma2Dec *p, const BYTE *dict, size_t dictSize);
+
+/* FLzma2Dec_WrapDic() :
+   Called when dicPos reaches dicBufSize before decoding more. An internal dictionary smaller
+   than its full size is enlarged, otherwise dicPos wraps to the start. Returns 0 or an error. */
+size_t FLzma2Dec_WrapDic(CLzma2Dec *p);
+
 size_t FLzma2Dec_DecodeToDic(CLzma2Dec *p, size_t dicLimit,
     const BYTE *src, size_t *srcLen, ELzmaFinishMode finishMode);
 
 size_t FLzma2Dec_DecodeToBuf(CLzma2Dec *p, BYTE *dest, size_t *destLen,
     const BYTE *src, size_t *srcLen, ELzmaFinishMode finishMode);
 
+/* LZMA2_setDecodeAsm() :
+   Selects the asm decode loop for all decoders if the library was built with LZMA2_DEC_OPT,
+   otherwise the C loop is always used. Returns 1 if the asm loop is selected. */
+int LZMA2_setDecodeAsm(int enable);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -80,9 +80,21 @@ Public domain
 #define kHash3Bits 14U
 #define kNullLink -1
 
+#define kHashRowLog 4U
+#define kHashRowEntries (1U << kHashRowLog)
+#define kHashRowMask (kHashRowEntries - 1U)
+
 #define kMinTestChunkSize 0x4000U
 #define kRandomFilterMarginBits 8U
 
+/* FL2_adaptive chunk selection. A chunk with at least 7/8 of its bytes in matches of
+ * kAdaptiveLongMatch or longer gains little from the optimal parser. Costs are nominal
+ * single-thread encoder speeds in picoseconds per byte, used to meet the throughput
+ * target without making the output depend on timing. */
+#define kAdaptiveLongMatch 32U
+#define kAdaptiveFastCost 15000U
+#define kAdaptiveOptCost 40000U
+
 static const BYTE kLiteralNextStates[kNumStates] = { 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 4, 5 };
 #define LiteralNextState(s) kLiteralNextStates[s]
 static const BYTE kMatchNextStates[kNumStates] = { 7, 7, 7, 7, 7, 7, 7, 10, 10, 10, 10, 10 };
@@ -99,6 +111,7 @@ typedef struct
     size_t table_size;
     unsigned prices[kNumPositionStatesMax][kLenNumSymbolsTotal];
     unsigned counters[kNumPositionStatesMax];
+    unsigned dirty; /* pos_state bit mask of tables to refresh in incremental mode */
     Probability choice;
     Probability choice_2;
     Probability low[kNumPositionStatesMax << kLenNumLowBits];
@@ -132,7 +145,6 @@ typedef struct
 {
     size_t state;
     U32 reps[kNumReps];
-    U32 price;
     unsigned prev_index;
     U32 prev_dist;
     unsigned prev_index_2;
@@ -150,6 +162,14 @@ typedef struct {
     S32 hash_chain_3[1];
 } HashChains;
 
+/* A bucket of the row matcher. Entries are written at descending slots starting from head,
+ * so a scan from head finds the newest first. */
+typedef struct {
+    BYTE tags[kHashRowEntries];
+    S32 pos[kHashRowEntries];
+    U32 head;
+} HashRow;
+
 typedef struct
 {
     U32 length;
@@ -167,6 +187,7 @@ struct FL2_lzmaEncoderCtx_s
     size_t pos_mask;
     unsigned match_cycles;
     FL2_strategy strategy;
+    unsigned incremental_prices;
 
     RangeEncoder rc;
 
@@ -175,23 +196,39 @@ struct FL2_lzmaEncoderCtx_s
     unsigned match_price_count;
     unsigned align_price_count;
     size_t dist_price_table_size;
+    unsigned dist_slot_dirty;   /* len-to-pos state bit mask, incremental mode only */
+    unsigned dist_footer_dirty; /* dist slot bit mask, incremental mode only */
     unsigned align_prices[kAlignTableSize];
     unsigned dist_slot_prices[kNumLenToPosStates][kDistTableSizeMax];
     unsigned distance_prices[kNumLenToPosStates][kNumFullDistances];
+    unsigned dist_footer_prices[kNumFullDistances];
 
     Match matches[kMatchLenMax-kMatchLenMin];
     size_t match_count;
 
+    /* The prices are kept apart from the nodes because the parser compares many more */
+    /* prices than it updates nodes */
+    U32 opt_prices[kOptimizerBufferSize];
     OptimalNode opt_buf[kOptimizerBufferSize];
 
     BYTE* out_buf;
 
     HashChains* hash_buf;
+    HashRow* hash_rows;     /* replaces hash_buf when the row matcher is selected */
+    unsigned row_log;
+    unsigned second_matcher;
     ptrdiff_t chain_mask_2;
     ptrdiff_t chain_mask_3;
     ptrdiff_t hash_dict_3;
     ptrdiff_t hash_prev_index;
     ptrdiff_t hash_alloc_3;
+
+    const FL2_longMatch* long_matches; /* long-distance matches of the block, or NULL */
+    size_t long_count;
+    size_t long_next;   /* first long match not ending before the last position queried */
+    size_t long_max_dist;
+
+    FL2_lzma2Stats stats;
 };
 
 FL2_lzmaEncoderCtx* FL2_lzma2Create()
@@ -215,26 +252,63 @@ FL2_lzmaEncoderCtx* FL2_lzma2Create()
     enc->pos_mask = (1 << enc->pb) - 1;
     enc->match_cycles = 1;
     enc->strategy = FL2_ultra;
+    enc->incremental_prices = 0;
     enc->match_price_count = kDistanceRepriceFrequency;
     enc->align_price_count = kAlignRepriceFrequency;
     enc->dist_price_table_size = kDistTableSizeMax;
     enc->hash_buf = NULL;
+    enc->hash_rows = NULL;
+    enc->row_log = 0;
+    enc->second_matcher = FL2_SECOND_MATCHER_CHAIN;
     enc->hash_dict_3 = 0;
     enc->chain_mask_3 = 0;
     enc->hash_alloc_3 = 0;
+    enc->long_matches = NULL;
+    enc->long_count = 0;
+    enc->long_next = 0;
+    enc->long_max_dist = 0;
+    FL2_lzma2ResetStats(enc);
     return enc;
 }
 
+const FL2_lzma2Stats* FL2_lzma2GetStats(const FL2_lzmaEncoderCtx* enc)
+{
+    return &enc->stats;
+}
+
+void FL2_lzma2ResetStats(FL2_lzmaEncoderCtx* enc)
+{
+    memset(&enc->stats, 0, sizeof(enc->stats));
+}
+
+void FL2_lzma2SetLongMatches(FL2_lzmaEncoderCtx* enc, const FL2_longMatch* matches, size_t count, size_t max_dist)
+{
+    enc->long_matches = matches;
+    enc->long_count = count;
+    enc->long_max_dist = max_dist;
+}
+
 void FL2_lzma2Free(FL2_lzmaEncoderCtx* enc)
 {
     if (enc == NULL)
         return;
     free(enc->hash_buf);
+    free(enc->hash_rows);
     free(enc->out_buf);
     free(enc);
 }
 
-#define GetLiteralProbs(enc, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & enc->lit_pos_mask) << enc->lc) + ((prev_symbol) >> (8 - enc->lc))) * kNumLiterals * kNumLitTables)
+/* Literal and position state layouts. Each is passed as a constant to specialize the encoders
+ * for the common lc/lp/pb settings. PROPS_ANY reads the settings from the encoder. */
+#define PROPS_ANY 0
+#define PROPS_LC3_LP0_PB2 1
+#define PROPS_LC0_LP2_PB2 2
+
+#define PropsLc(enc, props) ((props) == PROPS_LC3_LP0_PB2 ? 3U : (props) == PROPS_LC0_LP2_PB2 ? 0U : (enc)->lc)
+#define PropsLitPosMask(enc, props) ((props) == PROPS_LC3_LP0_PB2 ? 0U : (props) == PROPS_LC0_LP2_PB2 ? 3U : (enc)->lit_pos_mask)
+#define PropsPosMask(enc, props) ((props) != PROPS_ANY ? 3U : (enc)->pos_mask)
+
+#define GetLiteralProbs(enc, props, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & PropsLitPosMask(enc, props)) << PropsLc(enc, props)) + ((prev_symbol) >> (8 - PropsLc(enc, props)))) * kNumLiterals * kNumLitTables)
 
 #define GetLenToDistState(len) (((len) < kNumLenToPosStates + 1) ? (len) - 2 : kNumLenToPosStates - 1)
 
@@ -295,12 +369,13 @@ static unsigned GetLiteralPriceMatched(RangeEncoder* rc, const Probability *prob
     return price;
 }
 
-static void EncodeLiteral(FL2_lzmaEncoderCtx* enc, size_t index, U32 symbol, unsigned prev_symbol)
+HINT_INLINE
+void EncodeLiteral(FL2_lzmaEncoderCtx* enc, int const props, size_t index, U32 symbol, unsigned prev_symbol)
 {
-    EncodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & enc->pos_mask]);
+    EncodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & PropsPosMask(enc, props)]);
     enc->states.state = LiteralNextState(enc->states.state);
 
-    {   Probability* prob_table = GetLiteralProbs(enc, index, prev_symbol);
+    {   Probability* prob_table = GetLiteralProbs(enc, props, index, prev_symbol);
         symbol |= 0x100;
         do {
             EncodeBit(&enc->rc, prob_table + (symbol >> 8), symbol & (1 << 7));
@@ -309,13 +384,14 @@ static void EncodeLiteral(FL2_lzmaEncoderCtx* enc, size_t index, U32 symbol, uns
     }
 }
 
-static void EncodeLiteralMatched(FL2_lzmaEncoderCtx* enc, const BYTE* data_block, size_t index, U32 symbol)
+HINT_INLINE
+void EncodeLiteralMatched(FL2_lzmaEncoderCtx* enc, int const props, const BYTE* data_block, size_t index, U32 symbol)
 {
-    EncodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & enc->pos_mask]);
+    EncodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & PropsPosMask(enc, props)]);
     enc->states.state = LiteralNextState(enc->states.state);
 
     {   unsigned match_symbol = data_block[index - enc->states.reps[0] - 1];
-        Probability* prob_table = GetLiteralProbs(enc, index, data_block[index - 1]);
+        Probability* prob_table = GetLiteralProbs(enc, props, index, data_block[index - 1]);
         unsigned offset = 0x100;
         symbol |= 0x100;
         do {
@@ -329,39 +405,54 @@ static void EncodeLiteralMatched(FL2_lzmaEncoderCtx* enc, const BYTE* data_block
 }
 
 HINT_INLINE
-void EncodeLiteralBuf(FL2_lzmaEncoderCtx* enc, const BYTE* data_block, size_t index)
+void EncodeLiteralBuf(FL2_lzmaEncoderCtx* enc, int const props, const BYTE* data_block, size_t index)
 {
     U32 symbol = data_block[index];
     if (IsCharState(enc->states.state)) {
         unsigned prev_symbol = data_block[index - 1];
-        EncodeLiteral(enc, index, symbol, prev_symbol);
+        EncodeLiteral(enc, props, index, symbol, prev_symbol);
     }
     else {
-        EncodeLiteralMatched(enc, data_block, index, symbol);
+        EncodeLiteralMatched(enc, props, data_block, index, symbol);
     }
 }
 
+/* Match table layouts. Each is passed as a constant to specialize the encoders. */
+#define TABLE_BITPACK 0
+#define TABLE_STRUCTURED 1
+#define TABLE_COMPACT 2
+
+#define TableLinkBits(format) ((format) == TABLE_COMPACT ? COMPACT_LINK_BITS : RADIX_LINK_BITS)
+#define TableLinkMask(format) ((format) == TABLE_COMPACT ? COMPACT_LINK_MASK : RADIX_LINK_MASK)
+#define TableMaxLength(format) ((format) == TABLE_COMPACT ? COMPACT_MAX_LENGTH : BITPACK_MAX_LENGTH)
+
+static int FL2_tableFormat(const FL2_matchTable* const tbl)
+{
+    return tbl->isStruct ? TABLE_STRUCTURED : tbl->isCompact ? TABLE_COMPACT : TABLE_BITPACK;
+}
+
+/* Extends a match in a bitpack or compact table, which differ only in the link width */
 static size_t RMF_bitpackExtendMatch(const BYTE* const data,
     const U32* const table,
     ptrdiff_t const start_index,
     ptrdiff_t limit,
     U32 const link,
-    size_t const length)
+    size_t const length,
+    unsigned const link_bits)
 {
+    U32 const link_mask = ((U32)1 << link_bits) - 1;
     ptrdiff_t end_index = start_index + length;
     ptrdiff_t dist = start_index - link;
     if (limit > start_index + (ptrdiff_t)kMatchLenMax)
         limit = start_index + kMatchLenMax;
-    while (end_index < limit && end_index - (ptrdiff_t)(table[end_index] & RADIX_LINK_MASK) == dist) {
-        end_index += table[end_index] >> RADIX_LINK_BITS;
+    while (end_index < limit && end_index - (ptrdiff_t)(table[end_index] & link_mask) == dist) {
+        end_index += table[end_index] >> link_bits;
     }
     if (end_index >= limit) {
         DEBUGLOG(7, "RMF_bitpackExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(limit - start_index));
         return limit - start_index;
     }
-    while (end_index < limit && data[end_index - dist] == data[end_index]) {
-        ++end_index;
-    }
+    end_index += ZSTD_countLong(data + end_index, data + end_index - dist, data + limit);
     DEBUGLOG(7, "RMF_bitpackExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
 }
@@ -388,9 +479,7 @@ static size_t RMF_structuredExtendMatch(const BYTE* const data,
         DEBUGLOG(7, "RMF_structuredExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(limit - start_index));
         return limit - start_index;
     }
-    while (end_index < limit && data[end_index - dist] == data[end_index]) {
-        ++end_index;
-    }
+    end_index += ZSTD_countLong(data + end_index, data + end_index - dist, data + limit);
     DEBUGLOG(7, "RMF_structuredExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
 }
@@ -399,10 +488,10 @@ FORCE_INLINE_TEMPLATE
 Match FL2_radixGetMatch(FL2_dataBlock block,
     FL2_matchTable* tbl,
     unsigned max_depth,
-    int structTbl,
+    int const tblFormat,
     size_t index)
 {
-    if (structTbl)
+    if (tblFormat == TABLE_STRUCTURED)
     {
         Match match;
         U32 link = GetMatchLink(tbl->table, index);
@@ -435,16 +524,16 @@ Match FL2_radixGetMatch(FL2_dataBlock block,
         match.length = 0;
         if (link == RADIX_NULL_LINK)
             return match;
-        length = link >> RADIX_LINK_BITS;
-        link &= RADIX_LINK_MASK;
+        length = link >> TableLinkBits(tblFormat);
+        link &= TableLinkMask(tblFormat);
         dist = index - link - 1;
         if (length > block.end - index) {
             match.length = (U32)(block.end - index);
         }
         else if (length == max_depth
-            || length == BITPACK_MAX_LENGTH /* from HandleRepeat */)
+            || length == TableMaxLength(tblFormat) /* from HandleRepeat */)
         {
-            match.length = (U32)RMF_bitpackExtendMatch(block.data, tbl->table, index, block.end, link, length);
+            match.length = (U32)RMF_bitpackExtendMatch(block.data, tbl->table, index, block.end, link, length, TableLinkBits(tblFormat));
         }
         else {
             match.length = (U32)length;
@@ -458,10 +547,10 @@ FORCE_INLINE_TEMPLATE
 Match FL2_radixGetNextMatch(FL2_dataBlock block,
     FL2_matchTable* tbl,
     unsigned max_depth,
-    int structTbl,
+    int const tblFormat,
     size_t index)
 {
-    if (structTbl)
+    if (tblFormat == TABLE_STRUCTURED)
     {
         Match match;
         U32 link = GetMatchLink(tbl->table, index);
@@ -498,10 +587,10 @@ Match FL2_radixGetNextMatch(FL2_dataBlock block,
         match.length = 0;
         if (link == RADIX_NULL_LINK)
             return match;
-        length = link >> RADIX_LINK_BITS;
-        link &= RADIX_LINK_MASK;
+        length = link >> TableLinkBits(tblFormat);
+        link &= TableLinkMask(tblFormat);
         dist = index - link - 1;
-        if (link - 1 == (tbl->table[index - 1] & RADIX_LINK_MASK)) {
+        if (link - 1 == (tbl->table[index - 1] & TableLinkMask(tblFormat))) {
             /* same distance, one byte shorter */
             return match;
         }
@@ -509,9 +598,9 @@ Match FL2_radixGetNextMatch(FL2_dataBlock block,
             match.length = (U32)(block.end - index);
         }
         else if (length == max_depth
-            || length == BITPACK_MAX_LENGTH /* from HandleRepeat */)
+            || length == TableMaxLength(tblFormat) /* from HandleRepeat */)
         {
-            match.length = (U32)RMF_bitpackExtendMatch(block.data, tbl->table, index, block.end, link, length);
+            match.length = (U32)RMF_bitpackExtendMatch(block.data, tbl->table, index, block.end, link, length, TableLinkBits(tblFormat));
         }
         else {
             match.length = (U32)length;
@@ -521,6 +610,61 @@ Match FL2_radixGetNextMatch(FL2_dataBlock block,
     }
 }
 
+/* Substitutes the long-distance match covering index if it is longer. The optimal parser
+ * can query positions behind the last one, so the cursor moves both ways. */
+static Match AddLongMatch(FL2_lzmaEncoderCtx* const enc, FL2_dataBlock const block, size_t const index, Match match)
+{
+    const FL2_longMatch* const matches = enc->long_matches;
+    size_t n = enc->long_next;
+    size_t length;
+
+    while (n > 0 && matches[n - 1].pos + matches[n - 1].length > index)
+        --n;
+    while (n < enc->long_count && matches[n].pos + matches[n].length <= index)
+        ++n;
+    enc->long_next = n;
+    if (n == enc->long_count || matches[n].pos > index)
+        return match;
+    length = MIN(matches[n].pos + matches[n].length - index, MIN(block.end - index, kMatchLenMax));
+    if (length > match.length) {
+        match.length = (U32)length;
+        match.dist = matches[n].dist;
+    }
+    return match;
+}
+
+/* Returns nonzero if a long-distance match overlaps start..end. The match table knows
+ * nothing of them, so a chunk containing one is never treated as random. */
+static int HasLongMatch(const FL2_lzmaEncoderCtx* const enc, size_t const start, size_t const end)
+{
+    const FL2_longMatch* const matches = enc->long_matches;
+    size_t lo = 0;
+    size_t hi = enc->long_count;
+
+    while (lo < hi) {
+        size_t const mid = (lo + hi) >> 1;
+        if (matches[mid].pos + matches[mid].length <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < enc->long_count && matches[lo].pos < end;
+}
+
+FORCE_INLINE_TEMPLATE
+Match FL2_encoderGetMatch(FL2_lzmaEncoderCtx* const enc,
+    FL2_dataBlock block,
+    FL2_matchTable* tbl,
+    unsigned max_depth,
+    int const tblFormat,
+    size_t index)
+{
+    Match const match = FL2_radixGetMatch(block, tbl, max_depth, tblFormat, index);
+    if (enc->long_count == 0)
+        return match;
+    return AddLongMatch(enc, block, index, match);
+}
+
 static void LengthStates_SetPrices(RangeEncoder* rc, LengthStates* ls, size_t pos_state)
 {
     unsigned prob = ls->choice;
@@ -531,14 +675,15 @@ static void LengthStates_SetPrices(RangeEncoder* rc, LengthStates* ls, size_t po
     prob = ls->choice_2;
     b0 = a1 + GET_PRICE_0(rc, prob);
     b1 = a1 + GET_PRICE_1(rc, prob);
-    for (; i < kLenNumLowSymbols && i < ls->table_size; ++i) {
-        ls->prices[pos_state][i] = a0 + GetTreePrice(rc, ls->low + (pos_state << kLenNumLowBits), kLenNumLowBits, i);
-    }
-    for (; i < kLenNumLowSymbols + kLenNumMidSymbols && i < ls->table_size; ++i) {
-        ls->prices[pos_state][i] = b0 + GetTreePrice(rc, ls->mid + (pos_state << kLenNumMidBits), kLenNumMidBits, i - kLenNumLowSymbols);
+    i = MIN(ls->table_size, kLenNumLowSymbols);
+    FillTreePrices(rc, ls->low + (pos_state << kLenNumLowBits), kLenNumLowBits, a0, ls->prices[pos_state], i);
+    if (ls->table_size > kLenNumLowSymbols) {
+        i = MIN(ls->table_size, kLenNumLowSymbols + kLenNumMidSymbols) - kLenNumLowSymbols;
+        FillTreePrices(rc, ls->mid + (pos_state << kLenNumMidBits), kLenNumMidBits, b0, ls->prices[pos_state] + kLenNumLowSymbols, i);
     }
-    for (; i < ls->table_size; ++i) {
-        ls->prices[pos_state][i] = b1 + GetTreePrice(rc, ls->high, kLenNumHighBits, i - kLenNumLowSymbols - kLenNumMidSymbols);
+    if (ls->table_size > kLenNumLowSymbols + kLenNumMidSymbols) {
+        i = ls->table_size - kLenNumLowSymbols - kLenNumMidSymbols;
+        FillTreePrices(rc, ls->high, kLenNumHighBits, b1, ls->prices[pos_state] + kLenNumLowSymbols + kLenNumMidSymbols, i);
     }
     ls->counters[pos_state] = (unsigned)(ls->table_size);
 }
@@ -561,7 +706,10 @@ static void EncodeLength(FL2_lzmaEncoderCtx* enc, LengthStates* len_prob_table,
             EncodeBitTree(&enc->rc, len_prob_table->high, kLenNumHighBits, len - kLenNumLowSymbols - kLenNumMidSymbols);
         }
     }
-    if (enc->strategy != FL2_fast && --len_prob_table->counters[pos_state] == 0) {
+    if (enc->incremental_prices) {
+        len_prob_table->dirty |= 1U << pos_state;
+    }
+    else if (enc->strategy != FL2_fast && --len_prob_table->counters[pos_state] == 0) {
         LengthStates_SetPrices(&enc->rc, len_prob_table, pos_state);
     }
 }
@@ -569,6 +717,8 @@ static void EncodeLength(FL2_lzmaEncoderCtx* enc, LengthStates* len_prob_table,
 static void EncodeRepMatch(FL2_lzmaEncoderCtx* enc, unsigned len, unsigned rep, size_t pos_state)
 {
     DEBUGLOG(7, "EncodeRepMatch : length %u, rep %u", len, rep);
+    FL2_STATS_ADD(enc->stats.rep_count, 1);
+    FL2_STATS_ADD(enc->stats.rep_bytes, len);
     EncodeBit1(&enc->rc, &enc->states.is_match[enc->states.state][pos_state]);
     EncodeBit1(&enc->rc, &enc->states.is_rep[enc->states.state]);
     if (rep == 0) {
@@ -637,19 +787,24 @@ static size_t GetDistSlot(U32 distance)
 static void EncodeNormalMatch(FL2_lzmaEncoderCtx* enc, unsigned len, U32 dist, size_t pos_state)
 {
     DEBUGLOG(7, "EncodeNormalMatch : length %u, dist %u", len, dist);
+    FL2_STATS_ADD(enc->stats.match_count, 1);
+    FL2_STATS_ADD(enc->stats.match_bytes, len);
     EncodeBit1(&enc->rc, &enc->states.is_match[enc->states.state][pos_state]);
     EncodeBit0(&enc->rc, &enc->states.is_rep[enc->states.state]);
     enc->states.state = MatchNextState(enc->states.state);
     EncodeLength(enc, &enc->states.len_states, len, pos_state);
 
     {   size_t dist_slot = GetDistSlot(dist);
-        EncodeBitTree(&enc->rc, enc->states.dist_slot_encoders[GetLenToDistState(len)], kNumPosSlotBits, (unsigned)(dist_slot));
+        size_t const len_to_dist_state = GetLenToDistState(len);
+        EncodeBitTree(&enc->rc, enc->states.dist_slot_encoders[len_to_dist_state], kNumPosSlotBits, (unsigned)(dist_slot));
+        enc->dist_slot_dirty |= 1U << len_to_dist_state;
         if (dist_slot >= kStartPosModelIndex) {
             unsigned footerBits = ((unsigned)(dist_slot >> 1) - 1);
             size_t base = ((2 | (dist_slot & 1)) << footerBits);
             unsigned posReduced = (unsigned)(dist - base);
             if (dist_slot < kEndPosModelIndex) {
                 EncodeBitTreeReverse(&enc->rc, enc->states.dist_encoders + base - dist_slot - 1, footerBits, posReduced);
+                enc->dist_footer_dirty |= 1U << dist_slot;
             }
             else {
                 EncodeDirect(&enc->rc, posReduced >> kNumAlignBits, footerBits - kNumAlignBits);
@@ -673,11 +828,12 @@ FORCE_INLINE_TEMPLATE
 size_t EncodeChunkFast(FL2_lzmaEncoderCtx* enc,
     FL2_dataBlock const block,
     FL2_matchTable* tbl,
-    int structTbl,
+    int const tblFormat,
+    int const props,
     size_t index,
     size_t uncompressed_end)
 {
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = PropsPosMask(enc, props);
     size_t prev = index;
     unsigned search_depth = tbl->params.depth;
     while (index < uncompressed_end && enc->rc.out_index < enc->rc.chunk_size)
@@ -687,7 +843,7 @@ size_t EncodeChunkFast(FL2_lzmaEncoderCtx* enc,
         /* Table of distance restrictions for short matches */
         static const U32 max_dist_table[] = { 0, 0, 0, 1 << 6, 1 << 14 };
         /* Get a match from the table, extended to its full length */
-        Match bestMatch = FL2_radixGetMatch(block, tbl, search_depth, structTbl, index);
+        Match bestMatch = FL2_encoderGetMatch(enc, block, tbl, search_depth, tblFormat, index);
         if (bestMatch.length < kMatchLenMin) {
             ++index;
             continue;
@@ -738,7 +894,7 @@ size_t EncodeChunkFast(FL2_lzmaEncoderCtx* enc,
 
         for (size_t next = index + 1; bestMatch.length < kMatchLenMax && next < uncompressed_end; ++next) {
             /* lazy matching scheme from ZSTD */
-            Match next_match = FL2_radixGetNextMatch(block, tbl, search_depth, structTbl, next);
+            Match next_match = FL2_radixGetNextMatch(block, tbl, search_depth, tblFormat, next);
             if (next_match.length >= kMatchLenMin) {
                 Match bestRep;
                 Match repMatch;
@@ -780,7 +936,7 @@ size_t EncodeChunkFast(FL2_lzmaEncoderCtx* enc,
                 Match bestRep;
                 Match repMatch;
                 ++next;
-                next_match = FL2_radixGetNextMatch(block, tbl, search_depth, structTbl, next);
+                next_match = FL2_radixGetNextMatch(block, tbl, search_depth, tblFormat, next);
                 if (next_match.length < 4)
                     break;
                 data = block.data + next;
@@ -827,7 +983,7 @@ _encode:
                 EncodeRepMatch(enc, 1, 0, prev & pos_mask);
             }
             else {
-                EncodeLiteralBuf(enc, block.data, prev);
+                EncodeLiteralBuf(enc, props, block.data, prev);
             }
             ++prev;
         }
@@ -850,7 +1006,7 @@ _encode:
             EncodeRepMatch(enc, 1, 0, prev & pos_mask);
         }
         else {
-            EncodeLiteralBuf(enc, block.data, prev);
+            EncodeLiteralBuf(enc, props, block.data, prev);
         }
         ++prev;
     }
@@ -890,9 +1046,10 @@ static void ReverseOptimalChain(OptimalNode* opt_buf, size_t cur)
     } while (cur != 0);
 }
 
-static unsigned GetLiteralPrice(FL2_lzmaEncoderCtx* enc, size_t index, size_t state, unsigned prev_symbol, U32 symbol, unsigned match_byte)
+HINT_INLINE
+unsigned GetLiteralPrice(FL2_lzmaEncoderCtx* enc, int const props, size_t index, size_t state, unsigned prev_symbol, U32 symbol, unsigned match_byte)
 {
-    const Probability* prob_table = GetLiteralProbs(enc, index, prev_symbol);
+    const Probability* prob_table = GetLiteralProbs(enc, props, index, prev_symbol);
     if (IsCharState(state)) {
         unsigned price = 0;
         symbol |= 0x100;
@@ -909,27 +1066,51 @@ static void HashReset(FL2_lzmaEncoderCtx* enc, unsigned dictionary_bits_3)
 {
     enc->hash_dict_3 = (ptrdiff_t)1 << dictionary_bits_3;
     enc->chain_mask_3 = enc->hash_dict_3 - 1;
-    memset(enc->hash_buf->table_3, 0xFF, sizeof(enc->hash_buf->table_3));
+    if (enc->hash_rows != NULL) {
+        /* the same number of entries as the hash chain */
+        enc->row_log = dictionary_bits_3 - kHashRowLog;
+        memset(enc->hash_rows, 0xFF, sizeof(HashRow) << enc->row_log);
+    }
+    else {
+        memset(enc->hash_buf->table_3, 0xFF, sizeof(enc->hash_buf->table_3));
+    }
 }
 
 static int HashCreate(FL2_lzmaEncoderCtx* enc, unsigned dictionary_bits_3)
 {
-    DEBUGLOG(3, "Create hash chain : dict bits %u", dictionary_bits_3);
-    if (enc->hash_buf) {
-        free(enc->hash_buf);
+    DEBUGLOG(3, "Create hash %s : dict bits %u", (enc->second_matcher == FL2_SECOND_MATCHER_ROWS) ? "rows" : "chain", dictionary_bits_3);
+    free(enc->hash_buf);
+    free(enc->hash_rows);
+    enc->hash_buf = NULL;
+    enc->hash_rows = NULL;
+    enc->hash_alloc_3 = 0;
+    if (enc->second_matcher == FL2_SECOND_MATCHER_ROWS) {
+        enc->hash_rows = malloc(sizeof(HashRow) << (dictionary_bits_3 - kHashRowLog));
+        if (enc->hash_rows == NULL)
+            return 1;
+    }
+    else {
+        enc->hash_buf = malloc(sizeof(HashChains) + (((size_t)1 << dictionary_bits_3) - 1) * sizeof(S32));
+        if (enc->hash_buf == NULL)
+            return 1;
     }
     enc->hash_alloc_3 = (ptrdiff_t)1 << dictionary_bits_3;
-    enc->hash_buf = malloc(sizeof(HashChains) + (enc->hash_alloc_3 - 1) * sizeof(S32));
-    if (enc->hash_buf == NULL)
-        return 1;
     HashReset(enc, dictionary_bits_3);
     return 0;
 }
 
-/* Create a hash chain for hybrid mode */
+/* Returns nonzero if the hash tables must be created for the settings */
+static int HashNeedsCreate(const FL2_lzmaEncoderCtx* enc, unsigned dictionary_bits_3)
+{
+    return enc->hash_alloc_3 < ((ptrdiff_t)1 << dictionary_bits_3)
+        || (enc->hash_rows != NULL) != (enc->second_matcher == FL2_SECOND_MATCHER_ROWS);
+}
+
+/* Create a hash chain or rows for hybrid mode */
 int FL2_lzma2HashAlloc(FL2_lzmaEncoderCtx* enc, const FL2_lzma2Parameters* options)
 {
-    if (enc->strategy == FL2_ultra && enc->hash_alloc_3 < ((ptrdiff_t)1 << options->second_dict_bits)) {
+    enc->second_matcher = options->second_matcher;
+    if (enc->strategy == FL2_ultra && HashNeedsCreate(enc, options->second_dict_bits)) {
         return HashCreate(enc, options->second_dict_bits);
     }
     return 0;
@@ -998,6 +1179,102 @@ size_t HashGetMatches(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
     return max_len;
 }
 
+/* The top 8 bits of the hash are the tag and the next row_log bits select the row */
+#define GET_ROW_HASH(data) (((MEM_readLE32(data)) << 8) * 506832829U)
+
+#define GetHashRow(enc, hash) ((enc)->hash_rows + (((hash) >> (24 - (enc)->row_log)) & (((U32)1 << (enc)->row_log) - 1)))
+
+/* Returns a bit mask of the row entries with a matching tag */
+HINT_INLINE
+U32 RowTagMask(const BYTE* const tags, BYTE const tag)
+{
+#if defined(COUNT_VECTOR_SSE2) || defined(COUNT_VECTOR_AVX2)
+    return (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)tags), _mm_set1_epi8((char)tag)));
+#else
+    U32 mask = 0;
+    for (unsigned n = 0; n < kHashRowEntries; ++n)
+        mask |= (U32)(tags[n] == tag) << n;
+    return mask;
+#endif
+}
+
+HINT_INLINE
+void RowInsert(HashRow* const row, BYTE const tag, ptrdiff_t const index)
+{
+    unsigned const head = (row->head - 1) & kHashRowMask;
+    row->tags[head] = tag;
+    row->pos[head] = (S32)index;
+    row->head = head;
+}
+
+/* Same as HashGetMatches() using the row matcher. The tags of a row are compared in one
+ * vector operation and only the positions with a matching tag are loaded. */
+HINT_INLINE
+size_t RowGetMatches(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
+    ptrdiff_t index,
+    size_t length_limit,
+    Match match)
+{
+    ptrdiff_t const hash_dict_3 = enc->hash_dict_3;
+    const BYTE* data = block.data;
+    ptrdiff_t const end_index = MAX(index - (((ptrdiff_t)match.dist < hash_dict_3) ? (ptrdiff_t)match.dist : hash_dict_3), 0);
+    U32 const hash = GET_ROW_HASH(data + index);
+    HashRow* const row = GetHashRow(enc, hash);
+    BYTE const tag = (BYTE)(hash >> 24);
+    size_t max_len = 2;
+    int cycles = enc->match_cycles;
+    unsigned head;
+    U32 mask;
+
+    enc->match_count = 0;
+    enc->hash_prev_index = MAX(enc->hash_prev_index, index - hash_dict_3);
+    /* Update the rows for any positions that were skipped */
+    while (++enc->hash_prev_index < index) {
+        U32 const h = GET_ROW_HASH(data + enc->hash_prev_index);
+        RowInsert(GetHashRow(enc, h), (BYTE)(h >> 24), enc->hash_prev_index);
+    }
+    data += index;
+    head = row->head & kHashRowMask;
+    /* Rotate the mask so bit 0 is the newest entry */
+    mask = RowTagMask(row->tags, tag);
+    mask = ((mask >> head) | (mask << (kHashRowEntries - head))) & (((U32)1 << kHashRowEntries) - 1);
+    for (; mask != 0 && cycles > 0; mask &= mask - 1, --cycles) {
+        ptrdiff_t const match_3 = row->pos[(ZSTD_highbit32(mask & (0U - mask)) + head) & kHashRowMask];
+        size_t len_test;
+        /* entries are in order of decreasing position */
+        if (match_3 < end_index)
+            break;
+        len_test = ZSTD_count(data, block.data + match_3, data + length_limit);
+        if (len_test > max_len) {
+            enc->matches[enc->match_count].length = (U32)len_test;
+            enc->matches[enc->match_count].dist = (U32)(index - match_3 - 1);
+            ++enc->match_count;
+            max_len = len_test;
+            if (len_test >= length_limit) {
+                break;
+            }
+        }
+    }
+    RowInsert(row, tag, index);
+    if ((unsigned)(max_len) < match.length) {
+        enc->matches[enc->match_count] = match;
+        ++enc->match_count;
+        return match.length;
+    }
+    return max_len;
+}
+
+HINT_INLINE
+size_t SecondGetMatches(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
+    ptrdiff_t index,
+    size_t length_limit,
+    Match match)
+{
+    if (enc->hash_rows != NULL)
+        return RowGetMatches(enc, block, index, length_limit, match);
+    return HashGetMatches(enc, block, index, length_limit, match);
+}
+
 #if defined(_MSC_VER)
 #  pragma warning(disable : 4701)  /* disable: C4701: potentially uninitialized local variable */
 #endif
@@ -1017,12 +1294,13 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
     size_t const cur,
     size_t len_end,
     int const is_hybrid,
+    int const props,
     U32* const reps)
 {
     OptimalNode* cur_opt = &enc->opt_buf[cur];
     size_t prev_index = cur_opt->prev_index;
     size_t state = enc->opt_buf[prev_index].state;
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = PropsPosMask(enc, props);
     size_t pos_state = (index & pos_mask);
     const BYTE* data = block.data + index;
     size_t const fast_length = enc->fast_length;
@@ -1098,14 +1376,14 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
     {   Probability is_match_prob = enc->states.is_match[state][pos_state];
         unsigned cur_byte = *data;
         unsigned match_byte = *(data - reps[0] - 1);
-        U32 cur_price = cur_opt->price;
+        U32 cur_price = enc->opt_prices[cur];
         U32 cur_and_lit_price = cur_price + GET_PRICE_0(rc, is_match_prob) +
-            GetLiteralPrice(enc, index, state, data[-1], cur_byte, match_byte);
+            GetLiteralPrice(enc, props, index, state, data[-1], cur_byte, match_byte);
         OptimalNode* next_opt = &enc->opt_buf[cur + 1];
         BYTE next_is_char = 0;
         /* Try literal */
-        if (cur_and_lit_price < next_opt->price) {
-            next_opt->price = cur_and_lit_price;
+        if (cur_and_lit_price < enc->opt_prices[cur + 1]) {
+            enc->opt_prices[cur + 1] = cur_and_lit_price;
             next_opt->prev_index = (unsigned)cur;
             MakeAsLiteral(*next_opt);
             next_is_char = 1;
@@ -1115,8 +1393,8 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
         if (match_byte == cur_byte) {
             /* Try 1-byte rep0 */
             U32 short_rep_price = rep_match_price + GetRepLen1Price(enc, state, pos_state);
-            if (short_rep_price <= next_opt->price) {
-                next_opt->price = short_rep_price;
+            if (short_rep_price <= enc->opt_prices[cur + 1]) {
+                enc->opt_prices[cur + 1] = short_rep_price;
                 next_opt->prev_index = (unsigned)cur;
                 MakeAsShortRep(*next_opt);
                 next_is_char = 1;
@@ -1138,9 +1416,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                     GET_PRICE_1(rc, enc->states.is_rep[state_2]);
                 size_t offset = cur + 1 + len_test_2;
                 U32 cur_and_len_price = next_rep_match_price + GetRepMatch0Price(enc, len_test_2, state_2, pos_state_next);
-                if (cur_and_len_price < enc->opt_buf[offset].price) {
+                if (cur_and_len_price < enc->opt_prices[offset]) {
                     len_end = MAX(len_end, offset);
-                    enc->opt_buf[offset].price = cur_and_len_price;
+                    enc->opt_prices[offset] = cur_and_len_price;
                     enc->opt_buf[offset].prev_index = (unsigned)(cur + 1);
                     enc->opt_buf[offset].prev_dist = 0;
                     enc->opt_buf[offset].is_combination = 1;
@@ -1167,9 +1445,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
             /* Try rep match */
             do {
                 U32 cur_and_len_price = cur_rep_price + enc->states.rep_len_states.prices[pos_state][len - kMatchLenMin];
-                OptimalNode* opt = &enc->opt_buf[cur + len];
-                if (cur_and_len_price < opt->price) {
-                    opt->price = cur_and_len_price;
+                if (cur_and_len_price < enc->opt_prices[cur + len]) {
+                    OptimalNode* const opt = &enc->opt_buf[cur + len];
+                    enc->opt_prices[cur + len] = cur_and_len_price;
                     opt->prev_index = (unsigned)cur;
                     opt->prev_dist = (U32)(rep_index);
                     opt->is_combination = 0;
@@ -1190,7 +1468,7 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                 U32 rep_lit_rep_total_price =
                     cur_rep_price + enc->states.rep_len_states.prices[pos_state][len_test - kMatchLenMin] +
                     GET_PRICE_0(rc, enc->states.is_match[state_2][pos_state_next]) +
-                    GetLiteralPriceMatched(&enc->rc, GetLiteralProbs(enc, index + len_test, data[len_test - 1]),
+                    GetLiteralPriceMatched(&enc->rc, GetLiteralProbs(enc, props, index + len_test, data[len_test - 1]),
                         data[len_test], data_2[len_test]);
                 size_t offset;
 
@@ -1201,9 +1479,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                     GET_PRICE_1(rc, enc->states.is_rep[state_2]);
                 offset = cur + len_test + 1 + len_test_2;
                 rep_lit_rep_total_price += GetRepMatch0Price(enc, len_test_2, state_2, pos_state_next);
-                if (rep_lit_rep_total_price < enc->opt_buf[offset].price) {
+                if (rep_lit_rep_total_price < enc->opt_prices[offset]) {
                     len_end = MAX(len_end, offset);
-                    enc->opt_buf[offset].price = rep_lit_rep_total_price;
+                    enc->opt_prices[offset] = rep_lit_rep_total_price;
                     enc->opt_buf[offset].prev_index = (unsigned)(cur + len_test + 1);
                     enc->opt_buf[offset].prev_dist = 0;
                     enc->opt_buf[offset].is_combination = 1;
@@ -1235,9 +1513,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                 else {
                     cur_and_len_price += enc->dist_slot_prices[len_to_dist_state][dist_slot] + enc->align_prices[cur_dist & kAlignMask];
                 }
-                opt = &enc->opt_buf[cur + len_test];
-                if (cur_and_len_price < opt->price) {
-                    opt->price = cur_and_len_price;
+                if (cur_and_len_price < enc->opt_prices[cur + len_test]) {
+                    opt = &enc->opt_buf[cur + len_test];
+                    enc->opt_prices[cur + len_test] = cur_and_len_price;
                     opt->prev_index = (unsigned)cur;
                     opt->prev_dist = (U32)(cur_dist + kNumReps);
                     opt->is_combination = 0;
@@ -1258,7 +1536,7 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                 main_len = match.length;
             }
             else {
-                main_len = HashGetMatches(enc, block, index, max_length, match);
+                main_len = SecondGetMatches(enc, block, index, max_length, match);
             }
             match_index = enc->match_count - 1;
             if (main_len == max_length
@@ -1291,9 +1569,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                     else {
                         cur_and_len_price += enc->dist_slot_prices[len_to_dist_state][dist_slot] + enc->align_prices[cur_dist & kAlignMask];
                     }
-                    opt = &enc->opt_buf[cur + len_test];
-                    if (cur_and_len_price < opt->price) {
-                        opt->price = cur_and_len_price;
+                    if (cur_and_len_price < enc->opt_prices[cur + len_test]) {
+                        opt = &enc->opt_buf[cur + len_test];
+                        enc->opt_prices[cur + len_test] = cur_and_len_price;
                         opt->prev_index = (unsigned)cur;
                         opt->prev_dist = (U32)(cur_dist + kNumReps);
                         opt->is_combination = 0;
@@ -1311,7 +1589,7 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                             size_t pos_state_next = (index + len_test) & pos_mask;
                             U32 match_lit_rep_total_price = cur_and_len_price +
                                 GET_PRICE_0(rc, enc->states.is_match[state_2][pos_state_next]) +
-                                GetLiteralPriceMatched(&enc->rc, GetLiteralProbs(enc, index + len_test, data[len_test - 1]),
+                                GetLiteralPriceMatched(&enc->rc, GetLiteralProbs(enc, props, index + len_test, data[len_test - 1]),
                                     data[len_test], data_2[len_test]);
                             size_t offset;
 
@@ -1322,9 +1600,9 @@ size_t OptimalParse(FL2_lzmaEncoderCtx* const enc, const FL2_dataBlock block,
                                 GET_PRICE_1(rc, enc->states.is_rep[state_2]);
                             offset = cur + rep_0_pos + len_test_2;
                             match_lit_rep_total_price += GetRepMatch0Price(enc, len_test_2, state_2, pos_state_next);
-                            if (match_lit_rep_total_price < enc->opt_buf[offset].price) {
+                            if (match_lit_rep_total_price < enc->opt_prices[offset]) {
                                 len_end = MAX(len_end, offset);
-                                enc->opt_buf[offset].price = match_lit_rep_total_price;
+                                enc->opt_prices[offset] = match_lit_rep_total_price;
                                 enc->opt_buf[offset].prev_index = (unsigned)(cur + rep_0_pos);
                                 enc->opt_buf[offset].prev_dist = 0;
                                 enc->opt_buf[offset].is_combination = 1;
@@ -1362,8 +1640,8 @@ void InitMatchesPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
             else {
                 cur_and_len_price += enc->align_prices[distance & kAlignMask] + enc->dist_slot_prices[len_to_dist_state][slot];
             }
-            if (cur_and_len_price < enc->opt_buf[len].price) {
-                enc->opt_buf[len].price = cur_and_len_price;
+            if (cur_and_len_price < enc->opt_prices[len]) {
+                enc->opt_prices[len] = cur_and_len_price;
                 enc->opt_buf[len].prev_index = 0;
                 enc->opt_buf[len].prev_dist = (U32)(distance + kNumReps);
                 enc->opt_buf[len].is_combination = 0;
@@ -1392,7 +1670,7 @@ static size_t InitMatchesPos0Best(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock b
             main_len = match.length;
         }
         else {
-            main_len = HashGetMatches(enc, block, index, MIN(block.end - index, enc->fast_length), match);
+            main_len = SecondGetMatches(enc, block, index, MIN(block.end - index, enc->fast_length), match);
         }
         match_index = 0;
         while (len > enc->matches[match_index].length) {
@@ -1413,8 +1691,8 @@ static size_t InitMatchesPos0Best(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock b
             else {
                 cur_and_len_price += enc->align_prices[distance & kAlignMask] + enc->dist_slot_prices[len_to_dist_state][slot];
             }
-            if (cur_and_len_price < enc->opt_buf[len].price) {
-                enc->opt_buf[len].price = cur_and_len_price;
+            if (cur_and_len_price < enc->opt_prices[len]) {
+                enc->opt_prices[len] = cur_and_len_price;
                 enc->opt_buf[len].prev_index = 0;
                 enc->opt_buf[len].prev_dist = (U32)(distance + kNumReps);
                 enc->opt_buf[len].is_combination = 0;
@@ -1443,6 +1721,7 @@ size_t InitOptimizerPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
     Match match,
     size_t index,
     int const is_hybrid,
+    int const props,
     U32* reps)
 {
     size_t max_length = MIN(block.end - index, kMatchLenMax);
@@ -1482,14 +1761,14 @@ size_t InitOptimizerPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
         unsigned rep_match_price;
         size_t len;
         size_t state = enc->states.state;
-        size_t pos_state = index & enc->pos_mask;
+        size_t pos_state = index & PropsPosMask(enc, props);
         Probability is_match_prob = enc->states.is_match[state][pos_state];
         Probability is_rep_prob = enc->states.is_rep[state];
 
         enc->opt_buf[0].state = state;
         /* Set the price for literal */
-        enc->opt_buf[1].price = GET_PRICE_0(rc, is_match_prob) +
-            GetLiteralPrice(enc, index, state, data[-1], cur_byte, match_byte);
+        enc->opt_prices[1] = GET_PRICE_0(rc, is_match_prob) +
+            GetLiteralPrice(enc, props, index, state, data[-1], cur_byte, match_byte);
         MakeAsLiteral(enc->opt_buf[1]);
 
         match_price = GET_PRICE_1(rc, is_match_prob);
@@ -1497,8 +1776,8 @@ size_t InitOptimizerPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
         if (match_byte == cur_byte) {
             /* Try 1-byte rep0 */
             unsigned short_rep_price = rep_match_price + GetRepLen1Price(enc, state, pos_state);
-            if (short_rep_price < enc->opt_buf[1].price) {
-                enc->opt_buf[1].price = short_rep_price;
+            if (short_rep_price < enc->opt_prices[1]) {
+                enc->opt_prices[1] = short_rep_price;
                 MakeAsShortRep(enc->opt_buf[1]);
             }
         }
@@ -1515,8 +1794,8 @@ size_t InitOptimizerPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
             /* Test every available length of the rep */
             do {
                 unsigned cur_and_len_price = price + enc->states.rep_len_states.prices[pos_state][rep_len - kMatchLenMin];
-                if (cur_and_len_price < enc->opt_buf[rep_len].price) {
-                    enc->opt_buf[rep_len].price = cur_and_len_price;
+                if (cur_and_len_price < enc->opt_prices[rep_len]) {
+                    enc->opt_prices[rep_len] = cur_and_len_price;
                     enc->opt_buf[rep_len].prev_index = 0;
                     enc->opt_buf[rep_len].prev_dist = (U32)(i);
                     enc->opt_buf[rep_len].is_combination = 0;
@@ -1542,8 +1821,9 @@ size_t InitOptimizerPos0(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
 FORCE_INLINE_TEMPLATE
 size_t EncodeOptimumSequence(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
     FL2_matchTable* tbl,
-    int const structTbl,
+    int const tblFormat,
     int const is_hybrid,
+    int const props,
     size_t start_index,
     size_t uncompressed_end,
     Match match)
@@ -1556,19 +1836,14 @@ size_t EncodeOptimumSequence(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
         size_t cur;
         unsigned prev_index;
         size_t i;
-        size_t const pos_mask = enc->pos_mask;
-        for (; (len_end & 3) != 0; --len_end) {
-            enc->opt_buf[len_end].price = kInfinityPrice;
-        }
-        for (; len_end >= 4; len_end -= 4) {
-            enc->opt_buf[len_end].price = kInfinityPrice;
-            enc->opt_buf[len_end - 1].price = kInfinityPrice;
-            enc->opt_buf[len_end - 2].price = kInfinityPrice;
-            enc->opt_buf[len_end - 3].price = kInfinityPrice;
+        size_t const pos_mask = PropsPosMask(enc, props);
+        /* The prices are contiguous so this loop vectorizes */
+        for (i = 1; i <= len_end; ++i) {
+            enc->opt_prices[i] = kInfinityPrice;
         }
         index = start_index;
         /* Set everything up at position 0 */
-        len_end = InitOptimizerPos0(enc, block, match, index, is_hybrid, reps);
+        len_end = InitOptimizerPos0(enc, block, match, index, is_hybrid, props, reps);
         match.length = 0;
         cur = 1;
         /* len_end == 0 if a match of fast_length was found */
@@ -1577,17 +1852,17 @@ size_t EncodeOptimumSequence(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
             /* Lazy termination of the optimal parser. In the second half of the buffer */
             /* a resolution within one byte is enough */
             for (; cur < (len_end - cur / (kOptimizerBufferSize / 2U)); ++cur, ++index) {
-                if (enc->opt_buf[cur + 1].price < enc->opt_buf[cur].price)
+                if (enc->opt_prices[cur + 1] < enc->opt_prices[cur])
                     continue;
-                match = FL2_radixGetMatch(block, tbl, search_depth, structTbl, index);
+                match = FL2_encoderGetMatch(enc, block, tbl, search_depth, tblFormat, index);
                 if (match.length >= enc->fast_length) {
                     break;
                 }
-                len_end = OptimalParse(enc, block, match, index, cur, len_end, is_hybrid, reps);
+                len_end = OptimalParse(enc, block, match, index, cur, len_end, is_hybrid, props, reps);
             }
             if (cur < len_end && match.length < enc->fast_length) {
                 /* Adjust the end point base on scaling up the price. */
-                cur += (enc->opt_buf[cur].price + enc->opt_buf[cur].price / cur) >= enc->opt_buf[cur + 1].price;
+                cur += (enc->opt_prices[cur] + enc->opt_prices[cur] / cur) >= enc->opt_prices[cur + 1];
             }
             DEBUGLOG(6, "End optimal parse at %u", (U32)cur);
             ReverseOptimalChain(enc->opt_buf, cur);
@@ -1600,14 +1875,14 @@ size_t EncodeOptimumSequence(FL2_lzmaEncoderCtx* enc, const FL2_dataBlock block,
             prev_index = enc->opt_buf[i].prev_index;
             if (len == 1 && enc->opt_buf[i].prev_dist == kNullDist)
             {
-                EncodeLiteralBuf(enc, block.data, start_index + i);
+                EncodeLiteralBuf(enc, props, block.data, start_index + i);
             }
             else {
                 size_t match_index = start_index + i;
                 U32 dist = enc->opt_buf[i].prev_dist;
                 /* The last match will be truncated to fit in the optimal buffer so get the full length */
                 if (i + len >= kOptimizerBufferSize - 1 && dist >= kNumReps) {
-                    Match lastmatch = FL2_radixGetMatch(block, tbl, search_depth, tbl->isStruct, match_index);
+                    Match lastmatch = FL2_encoderGetMatch(enc, block, tbl, search_depth, tblFormat, match_index);
                     if (lastmatch.length > len) {
                         len = lastmatch.length;
                         dist = lastmatch.dist + kNumReps;
@@ -1639,48 +1914,105 @@ static void UpdateLengthPrices(FL2_lzmaEncoderCtx* enc, LengthStates* len_states
 
 static void FillAlignPrices(FL2_lzmaEncoderCtx* enc)
 {
-    for (size_t i = 0; i < kAlignTableSize; ++i) {
-        enc->align_prices[i] = GetReverseTreePrice(&enc->rc, enc->states.dist_align_encoders, kNumAlignBits, i);
-    }
+    FillReverseTreePrices(&enc->rc, enc->states.dist_align_encoders, kNumAlignBits, enc->align_prices);
     enc->align_price_count = 0;
 }
 
+static void FillDistanceFooterPrices(FL2_lzmaEncoderCtx* enc, size_t dist_slot)
+{
+    /* Each slot below kEndPosModelIndex has its own reverse tree for the footer bits */
+    unsigned footerBits = (unsigned)((dist_slot >> 1) - 1);
+    size_t base = ((2 | (dist_slot & 1)) << footerBits);
+    FillReverseTreePrices(&enc->rc, enc->states.dist_encoders + base - dist_slot - 1,
+        footerBits,
+        enc->dist_footer_prices + base);
+}
+
+static void FillDistanceSlotPrices(FL2_lzmaEncoderCtx* enc, size_t lenToPosState)
+{
+    const Probability* encoder = enc->states.dist_slot_encoders[lenToPosState];
+    FillTreePrices(&enc->rc, encoder, kNumPosSlotBits, 0, enc->dist_slot_prices[lenToPosState], enc->dist_price_table_size);
+    for (size_t dist_slot = kEndPosModelIndex; dist_slot < enc->dist_price_table_size; ++dist_slot) {
+        enc->dist_slot_prices[lenToPosState][dist_slot] += (((unsigned)(dist_slot >> 1) - 1) - kNumAlignBits) << kNumBitPriceShiftBits;
+    }
+}
+
+/* Combines slot and footer prices for distances in [start, end) */
+static void CombineDistancePrices(FL2_lzmaEncoderCtx* enc, size_t lenToPosState, size_t start, size_t end)
+{
+    size_t i = start;
+    for (; i < kStartPosModelIndex && i < end; ++i) {
+        enc->distance_prices[lenToPosState][i] = enc->dist_slot_prices[lenToPosState][i];
+    }
+    for (; i < end; ++i) {
+        enc->distance_prices[lenToPosState][i] = enc->dist_slot_prices[lenToPosState][distance_table[i]]
+            + enc->dist_footer_prices[i];
+    }
+}
+
 static void FillDistancesPrices(FL2_lzmaEncoderCtx* enc)
 {
-    static const size_t kLastLenToPosState = kNumLenToPosStates - 1;
-    for (size_t i = kStartPosModelIndex; i < kNumFullDistances; ++i) {
-        size_t dist_slot = distance_table[i];
-        unsigned footerBits = (unsigned)((dist_slot >> 1) - 1);
-        size_t base = ((2 | (dist_slot & 1)) << footerBits);
-        enc->distance_prices[kLastLenToPosState][i] = GetReverseTreePrice(&enc->rc, enc->states.dist_encoders + base - dist_slot - 1,
-            footerBits,
-            i - base);
+    for (size_t dist_slot = kStartPosModelIndex; dist_slot < kEndPosModelIndex; ++dist_slot) {
+        FillDistanceFooterPrices(enc, dist_slot);
     }
     for (size_t lenToPosState = 0; lenToPosState < kNumLenToPosStates; ++lenToPosState) {
-        const Probability* encoder = enc->states.dist_slot_encoders[lenToPosState];
-        for (size_t dist_slot = 0; dist_slot < enc->dist_price_table_size; ++dist_slot) {
-            enc->dist_slot_prices[lenToPosState][dist_slot] = GetTreePrice(&enc->rc, encoder, kNumPosSlotBits, dist_slot);
-        }
-        for (size_t dist_slot = kEndPosModelIndex; dist_slot < enc->dist_price_table_size; ++dist_slot) {
-            enc->dist_slot_prices[lenToPosState][dist_slot] += (((unsigned)(dist_slot >> 1) - 1) - kNumAlignBits) << kNumBitPriceShiftBits;
-        }
-        size_t i = 0;
-        for (; i < kStartPosModelIndex; ++i) {
-            enc->distance_prices[lenToPosState][i] = enc->dist_slot_prices[lenToPosState][i];
-        }
-        for (; i < kNumFullDistances; ++i) {
-            enc->distance_prices[lenToPosState][i] = enc->dist_slot_prices[lenToPosState][distance_table[i]]
-                + enc->distance_prices[kLastLenToPosState][i];
-        }
+        FillDistanceSlotPrices(enc, lenToPosState);
+        CombineDistancePrices(enc, lenToPosState, 0, kNumFullDistances);
     }
     enc->match_price_count = 0;
+    enc->dist_slot_dirty = 0;
+    enc->dist_footer_dirty = 0;
+}
+
+/* UpdateDirtyPrices() :
+ * Incremental mode. Re-prices only the tables whose probabilities were changed by
+ * the sequence just encoded, so every parse step sees current prices. */
+static void UpdateDirtyPrices(FL2_lzmaEncoderCtx* enc)
+{
+    for (size_t pos_state = 0; pos_state <= enc->pos_mask; ++pos_state) {
+        if (enc->states.len_states.dirty & (1U << pos_state))
+            LengthStates_SetPrices(&enc->rc, &enc->states.len_states, pos_state);
+        if (enc->states.rep_len_states.dirty & (1U << pos_state))
+            LengthStates_SetPrices(&enc->rc, &enc->states.rep_len_states, pos_state);
+    }
+    enc->states.len_states.dirty = 0;
+    enc->states.rep_len_states.dirty = 0;
+    if (enc->dist_slot_dirty | enc->dist_footer_dirty) {
+        for (size_t dist_slot = kStartPosModelIndex; dist_slot < kEndPosModelIndex; ++dist_slot) {
+            if (enc->dist_footer_dirty & (1U << dist_slot))
+                FillDistanceFooterPrices(enc, dist_slot);
+        }
+        for (size_t lenToPosState = 0; lenToPosState < kNumLenToPosStates; ++lenToPosState) {
+            if (enc->dist_slot_dirty & (1U << lenToPosState)) {
+                FillDistanceSlotPrices(enc, lenToPosState);
+                CombineDistancePrices(enc, lenToPosState, 0, kNumFullDistances);
+            }
+            else {
+                /* Only footer prices changed */
+                for (size_t dist_slot = kStartPosModelIndex; dist_slot < kEndPosModelIndex; ++dist_slot) {
+                    if (!(enc->dist_footer_dirty & (1U << dist_slot)))
+                        continue;
+                    unsigned const footerBits = (unsigned)((dist_slot >> 1) - 1);
+                    size_t const base = ((2 | (dist_slot & 1)) << footerBits);
+                    CombineDistancePrices(enc, lenToPosState, base, base + ((size_t)1 << footerBits));
+                }
+            }
+        }
+        enc->match_price_count = 0;
+        enc->dist_slot_dirty = 0;
+        enc->dist_footer_dirty = 0;
+    }
+    if (enc->align_price_count != 0) {
+        FillAlignPrices(enc);
+    }
 }
 
 FORCE_INLINE_TEMPLATE
 size_t EncodeChunkBest(FL2_lzmaEncoderCtx* enc,
     FL2_dataBlock const block,
     FL2_matchTable* tbl,
-    int const structTbl,
+    int const tblFormat,
+    int const props,
     size_t index,
     size_t uncompressed_end)
 {
@@ -1691,27 +2023,32 @@ size_t EncodeChunkBest(FL2_lzmaEncoderCtx* enc,
     UpdateLengthPrices(enc, &enc->states.rep_len_states);
     while (index < uncompressed_end && enc->rc.out_index < enc->rc.chunk_size)
     {
-        Match match = FL2_radixGetMatch(block, tbl, search_depth, structTbl, index);
+        Match match = FL2_encoderGetMatch(enc, block, tbl, search_depth, tblFormat, index);
         if (match.length > 1) {
             if (enc->strategy != FL2_ultra) {
-                index = EncodeOptimumSequence(enc, block, tbl, structTbl, 0, index, uncompressed_end, match);
+                index = EncodeOptimumSequence(enc, block, tbl, tblFormat, 0, props, index, uncompressed_end, match);
             }
             else {
-                index = EncodeOptimumSequence(enc, block, tbl, structTbl, 1, index, uncompressed_end, match);
+                index = EncodeOptimumSequence(enc, block, tbl, tblFormat, 1, props, index, uncompressed_end, match);
             }
-            if (enc->match_price_count >= kDistanceRepriceFrequency) {
-                FillDistancesPrices(enc);
+            if (enc->incremental_prices) {
+                UpdateDirtyPrices(enc);
             }
-            if (enc->align_price_count >= kAlignRepriceFrequency) {
-                FillAlignPrices(enc);
+            else {
+                if (enc->match_price_count >= kDistanceRepriceFrequency) {
+                    FillDistancesPrices(enc);
+                }
+                if (enc->align_price_count >= kAlignRepriceFrequency) {
+                    FillAlignPrices(enc);
+                }
             }
         }
         else {
             if (block.data[index] == block.data[index - enc->states.reps[0] - 1]) {
-                EncodeRepMatch(enc, 1, 0, index & enc->pos_mask);
+                EncodeRepMatch(enc, 1, 0, index & PropsPosMask(enc, props));
             }
             else {
-                EncodeLiteralBuf(enc, block.data, index);
+                EncodeLiteralBuf(enc, props, block.data, index);
             }
             ++index;
         }
@@ -1734,6 +2071,7 @@ static void LengthStates_Reset(LengthStates* ls, unsigned fast_length)
         ls->high[i] = kProbInitValue;
     }
     ls->table_size = fast_length + 1 - kMatchLenMin;
+    ls->dirty = 0;
 }
 
 static void EncoderStates_Reset(EncoderStates* es, unsigned lc, unsigned lp, unsigned fast_length)
@@ -1791,6 +2129,7 @@ BYTE FL2_getDictSizeProp(size_t dictionary_size)
 size_t FL2_lzma2MemoryUsage(unsigned chain_log, FL2_strategy strategy, unsigned thread_count)
 {
     size_t size = sizeof(FL2_lzmaEncoderCtx) + kChunkBufferSize;
+    /* the row matcher uses less than the hash chain */
     if(strategy == FL2_ultra)
         size += sizeof(HashChains) + (sizeof(U32) << chain_log) - sizeof(U32);
     return size * thread_count;
@@ -1856,6 +2195,7 @@ BYTE IsChunkRandom(const FL2_matchTable* const tbl,
 			}
 		}
 		else {
+			unsigned const link_bits = TableLinkBits(FL2_tableFormat(tbl));
 			size_t prev_dist = 0;
 			for (size_t index = start; index < end; ) {
 				U32 const link = tbl->table[index];
@@ -1865,8 +2205,8 @@ BYTE IsChunkRandom(const FL2_matchTable* const tbl,
 					prev_dist = 0;
 				}
 				else {
-					size_t length = link >> RADIX_LINK_BITS;
-					size_t dist = index - (link & RADIX_LINK_MASK);
+					size_t length = link >> link_bits;
+					size_t dist = index - (link & (((U32)1 << link_bits) - 1));
 					if (length > 4)
 						count += dist != prev_dist;
 					else
@@ -1898,6 +2238,147 @@ BYTE IsChunkRandom(const FL2_matchTable* const tbl,
 	return 0;
 }
 
+static size_t CountLongMatchBytes(const FL2_matchTable* const tbl,
+    const FL2_dataBlock block, size_t const start, size_t const end)
+{
+    size_t count = 0;
+    if (tbl->isStruct) {
+        for (size_t index = start; index < end; ) {
+            if (GetMatchLink(tbl->table, index) == RADIX_NULL_LINK) {
+                ++index;
+            }
+            else {
+                size_t const length = GetMatchLength(tbl->table, index);
+                if (length >= kAdaptiveLongMatch)
+                    count += length;
+                index += length;
+            }
+        }
+    }
+    else {
+        unsigned const link_bits = TableLinkBits(FL2_tableFormat(tbl));
+        for (size_t index = start; index < end; ) {
+            U32 const link = tbl->table[index];
+            if (link == RADIX_NULL_LINK) {
+                ++index;
+            }
+            else {
+                size_t const length = link >> link_bits;
+                if (length >= kAdaptiveLongMatch)
+                    count += length;
+                index += length;
+            }
+        }
+    }
+    return count;
+}
+
+/* FL2_lzma2EstimateCost() :
+ * Estimates the encoding time of start..end from the match table, as the number of
+ * symbols a greedy parse would emit. Ranges which will be stored cost 1/64 per byte. */
+size_t FL2_lzma2EstimateCost(const FL2_matchTable* const tbl,
+    const FL2_dataBlock block, size_t const start, size_t const end,
+    FL2_strategy strategy)
+{
+    FL2_dataBlock range = block;
+    size_t count = 0;
+    if (strategy == FL2_adaptive)
+        strategy = FL2_opt;
+    range.end = end;
+    if (RMF_randomRunEnd(tbl, start, end) >= end || IsChunkRandom(tbl, range, start, strategy))
+        return ((end - start) >> 6) + 1;
+    if (tbl->isStruct) {
+        for (size_t index = start; index < end; ++count) {
+            if (GetMatchLink(tbl->table, index) == RADIX_NULL_LINK)
+                ++index;
+            else
+                index += GetMatchLength(tbl->table, index);
+        }
+    }
+    else {
+        unsigned const link_bits = TableLinkBits(FL2_tableFormat(tbl));
+        for (size_t index = start; index < end; ++count) {
+            U32 const link = tbl->table[index];
+            if (link == RADIX_NULL_LINK)
+                ++index;
+            else
+                index += link >> link_bits;
+        }
+    }
+    return count;
+}
+
+/* SelectChunkStrategy() :
+ * Chooses the encoder for the chunk at start in FL2_adaptive mode. Highly redundant
+ * chunks get the fast encoder, and others the optimal parser if the time budget allows. */
+static FL2_strategy SelectChunkStrategy(const FL2_matchTable* const tbl,
+    const FL2_dataBlock block, size_t const start,
+    U64 const time_budget, U64 const time_spent, unsigned const throughput)
+{
+    size_t const end = MIN(start + kChunkSize, block.end);
+    size_t const chunk_size = end - start;
+    if (CountLongMatchBytes(tbl, block, start, end) >= chunk_size - (chunk_size >> 3))
+        return FL2_fast;
+    if (throughput != 0 && time_spent + (U64)chunk_size * kAdaptiveOptCost > time_budget + (U64)chunk_size * (1000000U / throughput))
+        return FL2_fast;
+    return FL2_opt;
+}
+
+/* Encodes a chunk starting at index, after the first byte if index == 0 */
+FORCE_INLINE_TEMPLATE
+size_t EncodeChunk(FL2_lzmaEncoderCtx* enc,
+    FL2_dataBlock const block,
+    FL2_matchTable* tbl,
+    int const props,
+    size_t index,
+    size_t chunk_end)
+{
+    if (enc->strategy == FL2_fast) {
+        size_t const end = MIN(chunk_end, index + kMaxChunkUncompressedSize);
+        if (tbl->isStruct)
+            return EncodeChunkFast(enc, block, tbl, TABLE_STRUCTURED, props, index + (index == 0), end);
+        if (tbl->isCompact)
+            return EncodeChunkFast(enc, block, tbl, TABLE_COMPACT, props, index + (index == 0), end);
+        return EncodeChunkFast(enc, block, tbl, TABLE_BITPACK, props, index + (index == 0), end);
+    }
+    else {
+        size_t const end = MIN(chunk_end, index + kMaxChunkUncompressedSize - kOptimizerBufferSize);
+        if (tbl->isStruct)
+            return EncodeChunkBest(enc, block, tbl, TABLE_STRUCTURED, props, index + (index == 0), end);
+        if (tbl->isCompact)
+            return EncodeChunkBest(enc, block, tbl, TABLE_COMPACT, props, index + (index == 0), end);
+        return EncodeChunkBest(enc, block, tbl, TABLE_BITPACK, props, index + (index == 0), end);
+    }
+}
+
+typedef size_t(*FL2_encodeChunkFn)(FL2_lzmaEncoderCtx* enc, FL2_dataBlock const block, FL2_matchTable* tbl, size_t index, size_t chunk_end);
+
+static size_t EncodeChunk_any(FL2_lzmaEncoderCtx* enc, FL2_dataBlock const block, FL2_matchTable* tbl, size_t index, size_t chunk_end)
+{
+    return EncodeChunk(enc, block, tbl, PROPS_ANY, index, chunk_end);
+}
+
+/* The default settings */
+static size_t EncodeChunk_lc3_lp0_pb2(FL2_lzmaEncoderCtx* enc, FL2_dataBlock const block, FL2_matchTable* tbl, size_t index, size_t chunk_end)
+{
+    return EncodeChunk(enc, block, tbl, PROPS_LC3_LP0_PB2, index, chunk_end);
+}
+
+/* Settings commonly used for executable code */
+static size_t EncodeChunk_lc0_lp2_pb2(FL2_lzmaEncoderCtx* enc, FL2_dataBlock const block, FL2_matchTable* tbl, size_t index, size_t chunk_end)
+{
+    return EncodeChunk(enc, block, tbl, PROPS_LC0_LP2_PB2, index, chunk_end);
+}
+
+static FL2_encodeChunkFn SelectEncodeChunk(const FL2_lzmaEncoderCtx* enc)
+{
+    if (enc->pb == 2 && enc->lc == 3 && enc->lp == 0)
+        return EncodeChunk_lc3_lp0_pb2;
+    if (enc->pb == 2 && enc->lc == 0 && enc->lp == 2)
+        return EncodeChunk_lc0_lp2_pb2;
+    return EncodeChunk_any;
+}
+
 #ifdef __GNUC__
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #else
@@ -1908,14 +2389,21 @@ size_t FL2_lzma2Encode(FL2_lzmaEncoderCtx* enc,
     FL2_matchTable* tbl,
     const FL2_dataBlock block,
     const FL2_lzma2Parameters* options,
+    BYTE* const dst, size_t const dstCapacity,
     FL2_progressFn progress, void* opaque, size_t base, U32 weight)
 {
     size_t const start = block.start;
-    BYTE* out_dest = enc->out_buf;
+    BYTE* const out_start = (dst != NULL) ? dst : RMF_getTableAsOutputBuffer(tbl, start);
+    /* The end is known only for dst; the match table is bounded by the read position */
+    BYTE* const out_end = (dst != NULL) ? dst + dstCapacity : NULL;
+    BYTE* out_dest = out_start;
 	/* Each encoder writes a properties byte because the upstream encoder(s) could */
 	/* write only uncompressed chunks with no properties. */
 	BYTE encode_properties = 1;
     BYTE next_is_random = 0;
+    U64 time_budget = 0;
+    U64 time_spent = 0;
+    FL2_encodeChunkFn encode_chunk;
 
     if (block.end <= block.start) {
         return 0;
@@ -1927,13 +2415,18 @@ size_t FL2_lzma2Encode(FL2_lzmaEncoderCtx* enc,
         enc->lp = 0;
     }
     enc->pb = options->pb;
-    enc->strategy = options->strategy;
+    encode_chunk = SelectEncodeChunk(enc);
+    /* FL2_adaptive selects fast or opt for each chunk */
+    enc->strategy = (options->strategy == FL2_adaptive) ? FL2_opt : options->strategy;
+    enc->incremental_prices = options->incremental_prices && options->strategy != FL2_fast;
     enc->fast_length = options->fast_length;
     enc->match_cycles = options->match_cycles;
-    Reset(enc, block.end);
+    Reset(enc, MAX(block.end, enc->long_max_dist + 1));
+    enc->long_next = 0;
+    enc->second_matcher = options->second_matcher;
     if (enc->strategy == FL2_ultra) {
-        /* Create a hash chain to put the encoder into hybrid mode */
-        if (enc->hash_alloc_3 < ((ptrdiff_t)1 << options->second_dict_bits)) {
+        /* Create a hash chain or rows to put the encoder into hybrid mode */
+        if (HashNeedsCreate(enc, options->second_dict_bits)) {
             if(HashCreate(enc, options->second_dict_bits) != 0)
                 return FL2_ERROR(memory_allocation);
         }
@@ -1951,55 +2444,56 @@ size_t FL2_lzma2Encode(FL2_lzmaEncoderCtx* enc,
         size_t next_index;
         size_t compressed_size;
         size_t uncompressed_size;
+        /* When writing to the match table the first chunk is staged in out_buf because the */
+        /* table data it overwrites is still needed. After the first chunk the compressed data */
+        /* will never catch up with the table position being read. A chunk written to dst is */
+        /* staged only when it could overrun the end of the buffer. */
+        BYTE* const chunk_dest = (dst == NULL)
+            ? ((index == start) ? enc->out_buf : out_dest)
+            : (((size_t)(out_end - out_dest) >= kChunkBufferSize) ? out_dest : enc->out_buf);
+        /* Windows excluded from the match table by the random filter are stored, and a */
+        /* compressed chunk stops at the next one */
+        size_t const random_end = RMF_randomRunEnd(tbl, index, block.end);
+        size_t const chunk_end = (random_end > index) ? random_end : RMF_nextRandom(tbl, index, block.end);
         RangeEncReset(&enc->rc);
-        SetOutputBuffer(&enc->rc, out_dest + header_size, kChunkSize);
+        SetOutputBuffer(&enc->rc, chunk_dest + header_size, kChunkSize);
+        next_is_random |= (random_end > index);
+        if (options->strategy == FL2_adaptive && !next_is_random) {
+            next_is_random = IsChunkRandom(tbl, block, index, FL2_opt)
+                && !HasLongMatch(enc, index, index + kChunkSize);
+            if (!next_is_random)
+                enc->strategy = SelectChunkStrategy(tbl, block, index, time_budget, time_spent, options->adaptive_throughput);
+        }
         if (!next_is_random) {
             saved_states = enc->states;
             if (index == 0) {
-                EncodeLiteral(enc, 0, block.data[0], 0);
-            }
-            if (enc->strategy == FL2_fast) {
-                if (tbl->isStruct) {
-                    next_index = EncodeChunkFast(enc, block, tbl, 1,
-                        index + (index == 0),
-                        MIN(block.end, index + kMaxChunkUncompressedSize));
-                }
-                else {
-                    next_index = EncodeChunkFast(enc, block, tbl, 0,
-                        index + (index == 0),
-                        MIN(block.end, index + kMaxChunkUncompressedSize));
-                }
-            }
-            else {
-                if (tbl->isStruct) {
-                    next_index = EncodeChunkBest(enc, block, tbl, 1,
-                        index + (index == 0),
-                        MIN(block.end, index + kMaxChunkUncompressedSize - kOptimizerBufferSize));
-                }
-                else {
-                    next_index = EncodeChunkBest(enc, block, tbl, 0,
-                        index + (index == 0),
-                        MIN(block.end, index + kMaxChunkUncompressedSize - kOptimizerBufferSize));
-                }
+                EncodeLiteral(enc, PROPS_ANY, 0, block.data[0], 0);
             }
+            next_index = encode_chunk(enc, block, tbl, index, chunk_end);
         }
         else {
-            next_index = MIN(index + kChunkSize, block.end);
+            next_index = MIN(index + kChunkSize, chunk_end);
         }
         compressed_size = enc->rc.out_index;
         uncompressed_size = next_index - index;
-        out_dest[1] = (BYTE)((uncompressed_size - 1) >> 8);
-        out_dest[2] = (BYTE)(uncompressed_size - 1);
+        if (options->strategy == FL2_adaptive && options->adaptive_throughput != 0) {
+            time_budget += (U64)uncompressed_size * (1000000U / options->adaptive_throughput);
+            if (!next_is_random)
+                time_spent += (U64)uncompressed_size * ((enc->strategy == FL2_fast) ? kAdaptiveFastCost : kAdaptiveOptCost);
+        }
+        chunk_dest[1] = (BYTE)((uncompressed_size - 1) >> 8);
+        chunk_dest[2] = (BYTE)(uncompressed_size - 1);
         /* Output an uncompressed chunk if necessary */
         if (next_is_random || uncompressed_size + 3 <= compressed_size + header_size) {
             DEBUGLOG(5, "Storing chunk : was %u => %u", (unsigned)uncompressed_size, (unsigned)compressed_size);
             if (index == 0) {
-                out_dest[0] = kChunkUncompressedDictReset;
+                chunk_dest[0] = kChunkUncompressedDictReset;
             }
             else {
-                out_dest[0] = kChunkUncompressed;
+                chunk_dest[0] = kChunkUncompressed;
             }
-            memcpy(out_dest + 3, block.data + index, uncompressed_size);
+            memcpy(chunk_dest + 3, block.data + index, uncompressed_size);
+            FL2_STATS_ADD(enc->stats.stored_bytes, uncompressed_size);
             compressed_size = uncompressed_size;
             header_size = 3;
             if (!next_is_random) {
@@ -2008,38 +2502,39 @@ size_t FL2_lzma2Encode(FL2_lzmaEncoderCtx* enc,
         }
         else {
             DEBUGLOG(5, "Compressed chunk : %u => %u", (unsigned)uncompressed_size, (unsigned)compressed_size);
+            FL2_STATS_ADD(enc->stats.compressed_bytes, uncompressed_size);
             if (index == 0) {
-                out_dest[0] = kChunkCompressedFlag | kChunkAllReset;
+                chunk_dest[0] = kChunkCompressedFlag | kChunkAllReset;
             }
             else if (encode_properties) {
-                out_dest[0] = kChunkCompressedFlag | kChunkStatePropertiesReset;
+                chunk_dest[0] = kChunkCompressedFlag | kChunkStatePropertiesReset;
             }
             else {
-                out_dest[0] = kChunkCompressedFlag | kChunkNothingReset;
+                chunk_dest[0] = kChunkCompressedFlag | kChunkNothingReset;
             }
-            out_dest[0] |= (BYTE)((uncompressed_size - 1) >> 16);
-            out_dest[3] = (BYTE)((compressed_size - 1) >> 8);
-            out_dest[4] = (BYTE)(compressed_size - 1);
+            chunk_dest[0] |= (BYTE)((uncompressed_size - 1) >> 16);
+            chunk_dest[3] = (BYTE)((compressed_size - 1) >> 8);
+            chunk_dest[4] = (BYTE)(compressed_size - 1);
             if (encode_properties) {
-                out_dest[5] = GetLcLpPbCode(enc);
+                chunk_dest[5] = GetLcLpPbCode(enc);
                 encode_properties = 0;
             }
         }
         if (next_is_random || uncompressed_size + 3 <= compressed_size + (compressed_size >> kRandomFilterMarginBits) + header_size)
         {
             /* Test the next chunk for compressibility */
-            next_is_random = IsChunkRandom(tbl, block, next_index, enc->strategy);
+            next_is_random = IsChunkRandom(tbl, block, next_index, enc->strategy)
+                && !HasLongMatch(enc, next_index, next_index + kChunkSize);
         }
-        if (index == start) {
-            /* After the first chunk we can write data to the match table because the */
-            /* compressed data will never catch up with the table position being read. */
-            out_dest = RMF_getTableAsOutputBuffer(tbl, start);
-            memcpy(out_dest, enc->out_buf, compressed_size + header_size);
+        if (chunk_dest != out_dest) {
+            if (dst != NULL && compressed_size + header_size > (size_t)(out_end - out_dest))
+                return FL2_ERROR(dstSize_tooSmall);
+            memcpy(out_dest, chunk_dest, compressed_size + header_size);
         }
         out_dest += compressed_size + header_size;
         index = next_index;
         if (progress && progress(base + (((index - start) * weight) >> 4), opaque) != 0)
             return FL2_ERROR(canceled);
     }
-    return out_dest - RMF_getTableAsOutputBuffer(tbl, start);
+    return out_dest - out_start;
 }
@@ -10,6 +10,7 @@ Public domain
 #include "mem.h"
 #include "data_block.h"
 #include "radix_mf.h"
+#include "fl2_ldm.h"
 
 #if defined (__cplusplus)
 extern "C" {
@@ -25,9 +26,14 @@ typedef struct FL2_lzmaEncoderCtx_s FL2_lzmaEncoderCtx;
 typedef enum {
     FL2_fast,
     FL2_opt,
-    FL2_ultra
+    FL2_ultra,
+    FL2_adaptive  /* fast, opt or stored, selected per chunk */
 } FL2_strategy;
 
+/* Secondary match finders of the ultra strategy, selected by FL2_p_secondMatcher */
+#define FL2_SECOND_MATCHER_CHAIN 0
+#define FL2_SECOND_MATCHER_ROWS 1
+
 typedef struct
 {
     unsigned lc;
@@ -37,9 +43,23 @@ typedef struct
     unsigned match_cycles;
     FL2_strategy strategy;
     unsigned second_dict_bits;
-    unsigned random_filter;
+    unsigned second_matcher;      /* FL2_SECOND_MATCHER_CHAIN or FL2_SECOND_MATCHER_ROWS */
+    unsigned random_filter;       /* exclude random windows from the match table, see RMF_filterRandom() */
+    unsigned incremental_prices;
+    unsigned adaptive_throughput; /* FL2_adaptive encoder speed target in MB/s, or 0 for none */
 } FL2_lzma2Parameters;
 
+/* Encoder counters for FL2_CCtx_getStats() */
+typedef struct
+{
+    U64 compressed_bytes; /* input bytes in compressed chunks */
+    U64 stored_bytes;     /* input bytes in uncompressed chunks */
+    U64 match_count;
+    U64 match_bytes;
+    U64 rep_count;
+    U64 rep_bytes;
+} FL2_lzma2Stats;
+
 
 FL2_lzmaEncoderCtx* FL2_lzma2Create();
 
@@ -47,12 +67,34 @@ void FL2_lzma2Free(FL2_lzmaEncoderCtx* enc);
 
 int FL2_lzma2HashAlloc(FL2_lzmaEncoderCtx* enc, const FL2_lzma2Parameters* options);
 
+/* FL2_lzma2GetStats() :
+ * Returns the counters accumulated since the encoder was created or FL2_lzma2ResetStats() was called. */
+const FL2_lzma2Stats* FL2_lzma2GetStats(const FL2_lzmaEncoderCtx* enc);
+
+void FL2_lzma2ResetStats(FL2_lzmaEncoderCtx* enc);
+
+/* FL2_lzma2SetLongMatches() :
+ * Gives the encoder long-distance matches for the blocks it encodes, sorted by position, or
+ * none if count is 0. The matches must stay valid while they are set. max_dist is the
+ * largest distance - 1 of the matches. */
+void FL2_lzma2SetLongMatches(FL2_lzmaEncoderCtx* enc, const FL2_longMatch* matches, size_t count, size_t max_dist);
+
+/* FL2_lzma2Encode() :
+ * Encodes block to dst, or to the match table memory at block.start if dst is NULL.
+ * Returns the compressed size or an error code. */
 size_t FL2_lzma2Encode(FL2_lzmaEncoderCtx* enc,
     FL2_matchTable* tbl,
     const FL2_dataBlock block,
     const FL2_lzma2Parameters* options,
+    BYTE* const dst, size_t const dstCapacity,
     FL2_progressFn progress, void* opaque, size_t base, U32 weight);
 
+/* FL2_lzma2EstimateCost() :
+ * Relative encoding cost of start..end of a block whose match table is built. */
+size_t FL2_lzma2EstimateCost(const FL2_matchTable* const tbl,
+    const FL2_dataBlock block, size_t const start, size_t const end,
+    FL2_strategy strategy);
+
 BYTE FL2_getDictSizeProp(size_t dictionary_size);
 
 size_t FL2_lzma2MemoryUsage(unsigned chain_log, FL2_strategy strategy, unsigned thread_count);
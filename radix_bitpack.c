@@ -40,6 +40,8 @@ typedef struct FL2_matchTable_s FL2_matchTable;
 
 #define IsNull(index) (tbl->table[index] == RADIX_NULL_LINK)
 
+#define PrefetchMatch(index) PREFETCH(tbl->table + (index))
+
 BYTE* RMF_bitpackAsOutputBuffer(FL2_matchTable* const tbl, size_t const index)
 {
     return (BYTE*)(tbl->table + index);
@@ -9,20 +9,21 @@
 */
 
 #include <stdio.h>  
+#include <string.h> /* memset */
 #include "count.h"
 
 #define MAX_READ_BEYOND_DEPTH 2
 
 /* If a repeating byte is found, fill that section of the table with matches of distance 1 */
-static size_t HandleRepeat(FL2_matchTable* const tbl, const BYTE* const data_block, size_t const start, ptrdiff_t const block_size, ptrdiff_t i, size_t const radix_16)
+static size_t HandleRepeat(FL2_matchTable* const tbl, RMF_tableHead* const heads, const BYTE* const data_block, size_t const start, ptrdiff_t const block_size, ptrdiff_t i, size_t const radix_16)
 {
     ptrdiff_t const rpt_index = i - (MAX_REPEAT / 2 - 2);
     ptrdiff_t rpt_end;
     /* Set the head to the first byte of the repeat and adjust the count */
-    tbl->list_heads[radix_16].head = (U32)(rpt_index - 1);
-    tbl->list_heads[radix_16].count -= MAX_REPEAT / 2 - 2;
+    heads[radix_16].head = (U32)(rpt_index - 1);
+    heads[radix_16].count -= MAX_REPEAT / 2 - 2;
     /* Find the end */
-    i += ZSTD_count(data_block + i + 2, data_block + i + 1, data_block + block_size);
+    i += ZSTD_countLong(data_block + i + 2, data_block + i + 1, data_block + block_size);
     rpt_end = i;
     /* No point if it's in the overlap region */
     if (i >= (ptrdiff_t)start) {
@@ -41,20 +42,20 @@ static size_t HandleRepeat(FL2_matchTable* const tbl, const BYTE* const data_blo
 }
 
 /* If a 2-byte repeat is found, fill that section of the table with matches of distance 2 */
-static size_t HandleRepeat2(FL2_matchTable* const tbl, const BYTE* const data_block, size_t const start, ptrdiff_t const block_size, ptrdiff_t i, size_t const radix_16)
+static size_t HandleRepeat2(FL2_matchTable* const tbl, RMF_tableHead* const heads, const BYTE* const data_block, size_t const start, ptrdiff_t const block_size, ptrdiff_t i, size_t const radix_16)
 {
     size_t radix_16_rev;
     ptrdiff_t const rpt_index = i - (MAX_REPEAT - 3);
     ptrdiff_t rpt_end;
 
     /* Set the head to the first byte of the repeat and adjust the count */
-    tbl->list_heads[radix_16].head = (U32)(rpt_index - 1);
-    tbl->list_heads[radix_16].count -= MAX_REPEAT / 2 - 2;
+    heads[radix_16].head = (U32)(rpt_index - 1);
+    heads[radix_16].count -= MAX_REPEAT / 2 - 2;
     radix_16_rev = ((radix_16 >> 8) | (radix_16 << 8)) & 0xFFFF;
-    tbl->list_heads[radix_16_rev].head = (U32)(rpt_index - 2);
-    tbl->list_heads[radix_16_rev].count -= MAX_REPEAT / 2 - 1;
+    heads[radix_16_rev].head = (U32)(rpt_index - 2);
+    heads[radix_16_rev].count -= MAX_REPEAT / 2 - 1;
     /* Find the end */
-    i += ZSTD_count(data_block + i + 2, data_block + i, data_block + block_size);
+    i += ZSTD_countLong(data_block + i + 2, data_block + i, data_block + block_size);
     rpt_end = i;
     /* No point if it's in the overlap region */
     if (i >= (ptrdiff_t)start) {
@@ -82,6 +83,10 @@ static void RadixInitReference(FL2_matchTable* const tbl, const void* const data
     for (ptrdiff_t i = 0; i < block_size; ++i)
     {
         size_t radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        if (RMF_isRandom(tbl, i)) {
+            SetNull(i);
+            continue;
+        }
         U32 prev = tbl->list_heads[radix_16].head;
         if (prev != RADIX_NULL_LINK) {
             SetMatchLinkAndLength(i, prev, 2U);
@@ -102,105 +107,235 @@ static void RadixInitReference(FL2_matchTable* const tbl, const void* const data
 }
 #endif
 
-size_t
-#ifdef RMF_BITPACK
-RMF_bitpackInit
-#else
-RMF_structuredInit
-#endif
-(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end)
+/* Builds the radix lists for positions [seg_start, seg_end) using the list heads in heads.
+ * The radix value of each new list is pushed onto tbl->stack, or stored in firsts with the
+ * position of its first occurrence if firsts is not NULL. Repeats are not followed to
+ * data_end or beyond. If last is set, seg_end is the second last position of the block,
+ * and the final two positions are also handled. */
+static size_t RadixInitSegment(FL2_matchTable* const tbl,
+    RMF_tableHead* const heads,
+    RMF_tableHead* const firsts,
+    size_t* const first_count,
+    const BYTE* const data_block,
+    size_t const start,
+    ptrdiff_t const seg_start,
+    ptrdiff_t const seg_end,
+    ptrdiff_t const data_end,
+    int const last)
 {
-    const BYTE* const data_block = (const BYTE*)data;
     size_t st_index = 0;
     size_t radix_16;
-    ptrdiff_t const block_size = end - 2;
     ptrdiff_t rpt_total = 0;
     U32 count = 0;
+    ptrdiff_t i = seg_start;
+    ptrdiff_t run_end;
 
-    if (end <= 2) {
-        for (size_t i = 0; i < end; ++i) {
-            SetNull(i);
-        }
-        return 0;
+    SetNull(i);
+    /* Initial 2-byte radix value */
+    radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+    if (firsts != NULL) {
+        firsts[st_index].head = (U32)i;
+        firsts[st_index].count = (U32)radix_16;
     }
-#ifdef RMF_REFERENCE
-    if (tbl->params.use_ref_mf) {
-        RadixInitReference(tbl, data, start, end);
-        return 0;
+    else {
+        tbl->stack[st_index] = (U32)radix_16;
     }
-#endif
-    SetNull(0);
-    /* Initial 2-byte radix value */
-    radix_16 = ((size_t)data_block[0] << 8) | data_block[1];
-    tbl->stack[st_index++] = (U32)radix_16;
-    tbl->list_heads[radix_16].head = 0;
-    tbl->list_heads[radix_16].count = 1;
+    ++st_index;
+    heads[radix_16].head = (U32)i;
+    heads[radix_16].count = 1;
 
-    radix_16 = ((size_t)((BYTE)radix_16) << 8) | data_block[2];
+    radix_16 = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
 
-	ptrdiff_t i = 1;
-    for (; i < block_size; ++i) {
-        /* Pre-load the next value for speed increase */
-        size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
+    run_end = RMF_nextRandom(tbl, i + 1, seg_end);
+    for (++i; ; ) {
+        for (; i < run_end; ++i) {
+            /* Pre-load the next value for speed increase */
+            size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
 
-        U32 const prev = tbl->list_heads[radix_16].head;
-        if (prev != RADIX_NULL_LINK) {
-            S32 dist = (S32)i - prev;
-            /* Check for repeat */
-            if (dist > 2) {
-                count = 0;
-                /* Link this position to the previous occurance */
-                InitMatchLink(i, prev);
-                /* Set the previous to this position */
-                tbl->list_heads[radix_16].head = (U32)i;
-                ++tbl->list_heads[radix_16].count;
-                radix_16 = next_radix;
-            }
-            else {
-                count += 3 - dist;
-                /* Do the usual if the repeat is too short */
-                if (count < MAX_REPEAT - 2) {
+            U32 const prev = heads[radix_16].head;
+            if (prev != RADIX_NULL_LINK) {
+                S32 dist = (S32)i - prev;
+                /* Check for repeat */
+                if (dist > 2) {
+                    count = 0;
+                    /* Link this position to the previous occurance */
                     InitMatchLink(i, prev);
-                    tbl->list_heads[radix_16].head = (U32)i;
-                    ++tbl->list_heads[radix_16].count;
+                    /* Set the previous to this position */
+                    heads[radix_16].head = (U32)i;
+                    ++heads[radix_16].count;
                     radix_16 = next_radix;
                 }
                 else {
-                    ptrdiff_t const prev_i = i;
-                    /* Eliminate the repeat from the linked list to save time */
-                    if (dist == 1) {
-                        i = HandleRepeat(tbl, data_block, start, end, i, radix_16);
-                        rpt_total += i - prev_i + MAX_REPEAT / 2U - 1;
+                    count += 3 - dist;
+                    /* Do the usual if the repeat is too short */
+                    if (count < MAX_REPEAT - 2) {
+                        InitMatchLink(i, prev);
+                        heads[radix_16].head = (U32)i;
+                        ++heads[radix_16].count;
+                        radix_16 = next_radix;
                     }
                     else {
-                        i = HandleRepeat2(tbl, data_block, start, end, i, radix_16);
-                        rpt_total += i - prev_i + MAX_REPEAT - 2;
+                        ptrdiff_t const prev_i = i;
+                        /* Eliminate the repeat from the linked list to save time */
+                        if (dist == 1) {
+                            i = HandleRepeat(tbl, heads, data_block, start, data_end, i, radix_16);
+                            rpt_total += i - prev_i + MAX_REPEAT / 2U - 1;
+                        }
+                        else {
+                            i = HandleRepeat2(tbl, heads, data_block, start, data_end, i, radix_16);
+                            rpt_total += i - prev_i + MAX_REPEAT - 2;
+                        }
+                        if (i < seg_end)
+                            radix_16 = ((size_t)data_block[i + 1] << 8) | data_block[i + 2];
+                        count = 0;
                     }
-					if (i < block_size)
-						radix_16 = ((size_t)data_block[i + 1] << 8) | data_block[i + 2];
-                    count = 0;
                 }
             }
+            else {
+                count = 0;
+                SetNull(i);
+                heads[radix_16].head = (U32)i;
+                heads[radix_16].count = 1;
+                if (firsts != NULL) {
+                    firsts[st_index].head = (U32)i;
+                    firsts[st_index].count = (U32)radix_16;
+                }
+                else {
+                    tbl->stack[st_index] = (U32)radix_16;
+                }
+                ++st_index;
+                radix_16 = next_radix;
+            }
+        }
+        if (i >= seg_end)
+            break;
+        /* Windows classified as random by RMF_filterRandom() are left out of the lists */
+        for (ptrdiff_t const skip_end = RMF_randomRunEnd(tbl, i, seg_end); i < skip_end; ++i) {
+            SetNull(i);
+        }
+        radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        if (i >= seg_end)
+            break;
+        count = 0;
+        run_end = RMF_nextRandom(tbl, i, seg_end);
+    }
+    if (last) {
+        /* Handle the last value */
+        if (i <= seg_end && !RMF_isRandom(tbl, seg_end) && heads[radix_16].head != RADIX_NULL_LINK) {
+            SetMatchLinkAndLength(seg_end, heads[radix_16].head, 2);
         }
         else {
-            count = 0;
+            SetNull(seg_end);
+        }
+        /* Never a match at the last byte */
+        SetNull(seg_end + 1);
+    }
+    *first_count = st_index;
+
+    return rpt_total;
+}
+
+size_t
+#ifdef RMF_BITPACK
+RMF_bitpackInit
+#elif defined(RMF_COMPACT)
+RMF_compactInit
+#else
+RMF_structuredInit
+#endif
+(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end)
+{
+    size_t st_index;
+    size_t rpt_total;
+
+    if (end <= 2) {
+        for (size_t i = 0; i < end; ++i) {
             SetNull(i);
-            tbl->list_heads[radix_16].head = (U32)i;
-            tbl->list_heads[radix_16].count = 1;
-            tbl->stack[st_index++] = (U32)radix_16;
-            radix_16 = next_radix;
         }
+        return 0;
     }
-    /* Handle the last value */
-    if (i <= block_size && tbl->list_heads[radix_16].head != RADIX_NULL_LINK) {
-        SetMatchLinkAndLength(block_size, tbl->list_heads[radix_16].head, 2);
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf) {
+        RadixInitReference(tbl, data, start, end);
+        return 0;
+    }
+#endif
+    rpt_total = RadixInitSegment(tbl, tbl->list_heads, NULL, &st_index, (const BYTE*)data, start, 0, end - 2, end, 1);
+
+    tbl->end_index = (U32)st_index;
+    tbl->st_index = ATOMIC_INITIAL_VALUE;
+
+    return rpt_total;
+}
+
+/* Segment job of a multithreaded table init. Segment 0 is built directly in the table's
+ * list heads and stack. The others use the first part of their builder's stack, which is
+ * not needed until the table build, for list heads and first occurrences. */
+void
+#ifdef RMF_BITPACK
+RMF_bitpackInitJob
+#elif defined(RMF_COMPACT)
+RMF_compactInitJob
+#else
+RMF_structuredInitJob
+#endif
+(FL2_matchTable* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end)
+{
+    RMF_builder* const builder = tbl->builders[job];
+    ptrdiff_t const block_size = end - 2;
+    ptrdiff_t const seg_size = block_size / job_count;
+    ptrdiff_t const seg_start = seg_size * job;
+    int const last = (job == job_count - 1);
+    ptrdiff_t const seg_end = last ? block_size : seg_start + seg_size;
+    /* Repeats stop one byte short of the next segment */
+    ptrdiff_t const data_end = last ? (ptrdiff_t)end : seg_end + 1;
+
+    if (job == 0) {
+        builder->rpt_total = RadixInitSegment(tbl, tbl->list_heads, NULL, &builder->first_count, (const BYTE*)data, start, seg_start, seg_end, data_end, last);
     }
     else {
-        SetNull(block_size);
+        RMF_tableHead* const heads = builder->stack;
+        memset(heads, 0xFF, RADIX16_TABLE_SIZE * sizeof(RMF_tableHead));
+        builder->rpt_total = RadixInitSegment(tbl, heads, heads + RADIX16_TABLE_SIZE, &builder->first_count, (const BYTE*)data, start, seg_start, seg_end, data_end, last);
     }
-    /* Never a match at the last byte */
-    SetNull(end - 1);
+}
+
+/* Joins the lists of each segment to those of the previous segments */
+size_t
+#ifdef RMF_BITPACK
+RMF_bitpackInitMerge
+#elif defined(RMF_COMPACT)
+RMF_compactInitMerge
+#else
+RMF_structuredInitMerge
+#endif
+(FL2_matchTable* const tbl, size_t const job_count)
+{
+    size_t st_index = tbl->builders[0]->first_count;
+    size_t rpt_total = tbl->builders[0]->rpt_total;
+
+    for (size_t job = 1; job < job_count; ++job) {
+        RMF_builder* const builder = tbl->builders[job];
+        const RMF_tableHead* const heads = builder->stack;
+        const RMF_tableHead* const firsts = heads + RADIX16_TABLE_SIZE;
 
+        for (size_t n = 0; n < builder->first_count; ++n) {
+            size_t const first = firsts[n].head;
+            size_t const radix_16 = firsts[n].count;
+            RMF_tableHead* const list_head = tbl->list_heads + radix_16;
+            if (list_head->head != RADIX_NULL_LINK) {
+                /* The first occurrence in the segment was set to null */
+                InitMatchLink(first, list_head->head);
+                list_head->head = heads[radix_16].head;
+                list_head->count += heads[radix_16].count;
+            }
+            else {
+                *list_head = heads[radix_16];
+                tbl->stack[st_index++] = (U32)radix_16;
+            }
+        }
+        rpt_total += builder->rpt_total;
+    }
     tbl->end_index = (U32)st_index;
     tbl->st_index = ATOMIC_INITIAL_VALUE;
 
@@ -240,6 +375,10 @@ static void RecurseListsBuffered(RMF_builder* const tbl,
         for (; count < list_count; ++count) {
             /* Pre-load next link */
             size_t const next_link = GetMatchLink(link);
+#if RMF_PREFETCH_DISTANCE
+            /* Start loading the data characters of the next link while this one is stored */
+            PREFETCH(data_src + next_link);
+#endif
             /* Get 4 data characters for later. This doesn't block on a cache miss. */
             tbl->match_buffer[count].src.u32 = MEM_read32(data_src + link);
             /* Record the actual location of this suffix */
@@ -263,6 +402,10 @@ static void RecurseListsBuffered(RMF_builder* const tbl,
             size_t const from = tbl->match_buffer[index].from;
             if (from < block_start)
                 return;
+#if RMF_PREFETCH_DISTANCE
+            if (index + RMF_PREFETCH_DISTANCE < count)
+                PrefetchMatch(tbl->match_buffer[index + RMF_PREFETCH_DISTANCE].from);
+#endif
 
             {   U32 length = tbl->match_buffer[index].next >> 24;
                 size_t next = tbl->match_buffer[index].next & BUFFER_LINK_MASK;
@@ -453,10 +596,7 @@ static void BruteForce(RMF_builder* const tbl,
         const BYTE* const data = data_src + buffer[i];
         do {
             const BYTE* data_2 = data_src + buffer[j];
-            size_t len_test = 0;
-            while (data[len_test] == data_2[len_test] && len_test < limit) {
-                ++len_test;
-            }
+            size_t const len_test = ZSTD_countLong(data, data_2, data + limit);
             if (len_test > longest) {
                 longest_index = j;
                 longest = len_test;
@@ -907,6 +1047,8 @@ static ptrdiff_t RMF_getNextList(FL2_matchTable* const tbl, unsigned const multi
 int
 #ifdef RMF_BITPACK
 RMF_bitpackBuildTable
+#elif defined(RMF_COMPACT)
+RMF_compactBuildTable
 #else
 RMF_structuredBuildTable
 #endif
@@ -981,6 +1123,8 @@ RMF_structuredBuildTable
 int
 #ifdef RMF_BITPACK
 RMF_bitpackIntegrityCheck
+#elif defined(RMF_COMPACT)
+RMF_compactIntegrityCheck
 #else
 RMF_structuredIntegrityCheck
 #endif
@@ -1034,15 +1178,15 @@ static size_t ExtendMatch(const FL2_matchTable* const tbl,
     if (end_index >= limit) {
         return limit - start_index;
     }
-    while (end_index < limit && data[end_index - dist] == data[end_index]) {
-        ++end_index;
-    }
+    end_index += ZSTD_countLong(data + end_index, data + end_index - dist, data + limit);
     return end_index - start_index;
 }
 
 size_t
 #ifdef RMF_BITPACK
 RMF_bitpackGetMatch
+#elif defined(RMF_COMPACT)
+RMF_compactGetMatch
 #else
 RMF_structuredGetMatch
 #endif
@@ -39,9 +39,26 @@ extern "C" {
 #define RADIX_LINK_MASK ((1UL << RADIX_LINK_BITS) - 1)
 #define RADIX_NULL_LINK 0xFFFFFFFFUL
 
+/* Compact tables pack a 24-bit link and a full 8-bit length into 32 bits. They replace
+ * the 5-byte structured units when the depth exceeds BITPACK_MAX_LENGTH but the
+ * dictionary is no larger than 16 MiB. */
+#define COMPACT_LINK_BITS 24
+#define COMPACT_LINK_MASK ((1UL << COMPACT_LINK_BITS) - 1)
+#define COMPACT_MAX_LENGTH STRUCTURED_MAX_LENGTH
+
+/* Number of match buffer entries to look ahead when prefetching. 0 disables prefetching. */
+#ifndef RMF_PREFETCH_DISTANCE
+#  define RMF_PREFETCH_DISTANCE 8
+#endif
+
 #define UNIT_BITS 2
 #define UNIT_MASK ((1UL << UNIT_BITS) - 1)
 
+/* Random filter window size. Windows classified as random are left out of the table. */
+#define RMF_RANDOM_WINDOW_LOG 16U
+#define RMF_RANDOM_WINDOW_MIN ((size_t)1 << 12)
+#define RMF_RANDOM_SAMPLE_STEP 16U
+
 typedef struct
 {
     U32 head;
@@ -78,6 +95,8 @@ typedef struct
     U32* table;
     size_t match_buffer_size;
     size_t match_buffer_limit;
+    size_t first_count; /* multithreaded init results */
+    size_t rpt_total;
     RMF_listTail tails_8[RADIX8_TABLE_SIZE];
     RMF_tableHead stack[STACK_SIZE];
     RMF_listTail tails_16[RADIX16_TABLE_SIZE];
@@ -90,16 +109,50 @@ struct FL2_matchTable_s
     long end_index;
     int isStruct;
     int allocStruct;
+    int isCompact;
     unsigned thread_count;
     RMF_parameters params;
     RMF_builder** builders;
-    U32 stack[RADIX16_TABLE_SIZE];
-    RMF_tableHead list_heads[RADIX16_TABLE_SIZE];
+    FL2_customMem customMem;
+    unsigned hash_log;          /* small inputs : hash size of the chain match finder, otherwise 0 */
+    U32* stack;                 /* radix tables only, allocated after the table */
+    RMF_tableHead* list_heads;
+    BYTE* random_map;           /* radix tables only : one flag per window, valid if random_count != 0 */
+    size_t random_count;
     U32 table[1];
 };
 
+#define RMF_isRandom(tbl, index) ((tbl)->random_count != 0 && (tbl)->random_map[(index) >> RMF_RANDOM_WINDOW_LOG])
+
+/* End of the run of random windows starting at index, or index if it is not random */
+MEM_STATIC size_t RMF_randomRunEnd(const struct FL2_matchTable_s* const tbl, size_t index, size_t const end)
+{
+    if (tbl->random_count == 0)
+        return index;
+    while (index < end && tbl->random_map[index >> RMF_RANDOM_WINDOW_LOG])
+        index = ((index >> RMF_RANDOM_WINDOW_LOG) + 1) << RMF_RANDOM_WINDOW_LOG;
+    return (index < end) ? index : end;
+}
+
+/* Start of the next random window at or after index, or end if there is none */
+MEM_STATIC size_t RMF_nextRandom(const struct FL2_matchTable_s* const tbl, size_t index, size_t const end)
+{
+    if (tbl->random_count == 0)
+        return end;
+    while (index < end && !tbl->random_map[index >> RMF_RANDOM_WINDOW_LOG])
+        index = ((index >> RMF_RANDOM_WINDOW_LOG) + 1) << RMF_RANDOM_WINDOW_LOG;
+    return (index < end) ? index : end;
+}
+
 size_t RMF_bitpackInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const start, size_t const end);
 size_t RMF_structuredInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const start, size_t const end);
+size_t RMF_compactInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const start, size_t const end);
+void RMF_bitpackInitJob(struct FL2_matchTable_s* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end);
+void RMF_structuredInitJob(struct FL2_matchTable_s* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end);
+void RMF_compactInitJob(struct FL2_matchTable_s* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end);
+size_t RMF_bitpackInitMerge(struct FL2_matchTable_s* const tbl, size_t const job_count);
+size_t RMF_structuredInitMerge(struct FL2_matchTable_s* const tbl, size_t const job_count);
+size_t RMF_compactInitMerge(struct FL2_matchTable_s* const tbl, size_t const job_count);
 int RMF_bitpackBuildTable(struct FL2_matchTable_s* const tbl,
 	size_t const job,
     unsigned const multi_thread,
@@ -110,6 +163,11 @@ int RMF_structuredBuildTable(struct FL2_matchTable_s* const tbl,
     unsigned const multi_thread,
     FL2_dataBlock const block,
     FL2_progressFn progress, void* opaque, U32 weight, size_t init_done);
+int RMF_compactBuildTable(struct FL2_matchTable_s* const tbl,
+	size_t const job,
+    unsigned const multi_thread,
+    FL2_dataBlock const block,
+    FL2_progressFn progress, void* opaque, U32 weight, size_t init_done);
 void RMF_recurseListChunk(RMF_builder* const tbl,
     const BYTE* const data_block,
     size_t const block_start,
@@ -119,10 +177,13 @@ void RMF_recurseListChunk(RMF_builder* const tbl,
     size_t const stack_base);
 int RMF_bitpackIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t index, size_t const end, unsigned const max_depth);
 int RMF_structuredIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t index, size_t const end, unsigned const max_depth);
+int RMF_compactIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t index, size_t const end, unsigned const max_depth);
 void RMF_bitpackLimitLengths(struct FL2_matchTable_s* const tbl, size_t const index);
 void RMF_structuredLimitLengths(struct FL2_matchTable_s* const tbl, size_t const index);
+void RMF_compactLimitLengths(struct FL2_matchTable_s* const tbl, size_t const index);
 BYTE* RMF_bitpackAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const index);
 BYTE* RMF_structuredAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const index);
+BYTE* RMF_compactAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const index);
 size_t RMF_bitpackGetMatch(const struct FL2_matchTable_s* const tbl,
     const BYTE* const data,
     size_t const index,
@@ -135,6 +196,12 @@ size_t RMF_structuredGetMatch(const struct FL2_matchTable_s* const tbl,
     size_t const limit,
     unsigned const max_depth,
     size_t* const offset_ptr);
+size_t RMF_compactGetMatch(const struct FL2_matchTable_s* const tbl,
+    const BYTE* const data,
+    size_t const index,
+    size_t const limit,
+    unsigned const max_depth,
+    size_t* const offset_ptr);
 
 #if defined (__cplusplus)
 }
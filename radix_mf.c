@@ -9,11 +9,12 @@
 */
 
 #include <stddef.h>     /* size_t, ptrdiff_t */
-#include <stdlib.h>     /* malloc, free */
+#include <string.h>     /* memset */
 #include "fast-lzma2.h"
 #include "mem.h"          /* U32, U64, MEM_64bits */
 #include "fl2_internal.h"
 #include "radix_internal.h"
+#include "count.h"
 
 #ifdef __GNUC__
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized" /* warning: 'rpt_head_next' may be used uninitialized in this function */
@@ -24,6 +25,9 @@
 #define MIN_MATCH_BUFFER_SIZE 256U /* min buffer size at least FL2_SEARCH_DEPTH_MAX + 2 for bounded build */
 #define MAX_MATCH_BUFFER_SIZE (1UL << 24) /* max buffer size constrained by 24-bit link values */
 
+#define SMALL_HASH_LOG_MAX 15U    /* hash table size limit of the small input match finder */
+#define SMALL_CUT_VALUE_BASE 16U  /* tree nodes visited per position is this plus half the depth */
+
 #define REPEAT_CHECK_TABLE ((1 << 1) | (1 << 2) | (1 << 4) | (1 << 8) | (1 << 16) | (1ULL << 32))
 
 static void RMF_initTailTable(RMF_builder* const tbl)
@@ -38,13 +42,15 @@ static void RMF_initTailTable(RMF_builder* const tbl)
     }
 }
 
-static RMF_builder* RMF_createBuilder(size_t match_buffer_size)
+static RMF_builder* RMF_createBuilder(size_t match_buffer_size, FL2_customMem const customMem)
 {
     match_buffer_size = MIN(match_buffer_size, MAX_MATCH_BUFFER_SIZE);
     match_buffer_size = MAX(match_buffer_size, MIN_MATCH_BUFFER_SIZE);
 
-    {   RMF_builder* const builder = (RMF_builder*)malloc(
-            sizeof(RMF_builder) + (match_buffer_size - 1) * sizeof(RMF_buildMatch));
+    {   RMF_builder* const builder = (RMF_builder*)FL2_malloc(
+            sizeof(RMF_builder) + (match_buffer_size - 1) * sizeof(RMF_buildMatch), customMem);
+        if (builder == NULL)
+            return NULL;
         builder->match_buffer_size = match_buffer_size;
         builder->match_buffer_limit = match_buffer_size;
         RMF_initTailTable(builder);
@@ -52,28 +58,28 @@ static RMF_builder* RMF_createBuilder(size_t match_buffer_size)
     }
 }
 
-static void RMF_freeBuilderTable(RMF_builder** const builders, unsigned const size)
+static void RMF_freeBuilderTable(RMF_builder** const builders, unsigned const size, FL2_customMem const customMem)
 {
     if (builders == NULL)
         return;
     for (unsigned i = 0; i < size; ++i) {
-        free(builders[i]);
+        FL2_free(builders[i], customMem);
     }
-    free(builders);
+    FL2_free(builders, customMem);
 }
 
-static RMF_builder** RMF_createBuilderTable(U32* const matchTable, size_t const match_buffer_size, unsigned const max_len, unsigned const size)
+static RMF_builder** RMF_createBuilderTable(U32* const matchTable, size_t const match_buffer_size, unsigned const max_len, unsigned const size, FL2_customMem const customMem)
 {
-    RMF_builder** builders = (RMF_builder**)malloc(size * sizeof(RMF_builder*));
+    RMF_builder** builders = (RMF_builder**)FL2_malloc(size * sizeof(RMF_builder*), customMem);
     DEBUGLOG(3, "RMF_createBuilderTable : match_buffer_size %u, builders %u", (U32)match_buffer_size, size);
     if (builders == NULL)
         return NULL;
     for (unsigned i = 0; i < size; ++i)
         builders[i] = NULL;
     for (unsigned i = 0; i < size; ++i) {
-        builders[i] = RMF_createBuilder(match_buffer_size);
+        builders[i] = RMF_createBuilder(match_buffer_size, customMem);
         if (builders[i] == NULL) {
-            RMF_freeBuilderTable(builders, i);
+            RMF_freeBuilderTable(builders, i, customMem);
             return NULL;
         }
         builders[i]->table = matchTable;
@@ -84,7 +90,8 @@ static RMF_builder** RMF_createBuilderTable(U32* const matchTable, size_t const
 
 static int RMF_isStruct(unsigned dictionary_log, unsigned depth)
 {
-    return dictionary_log > RADIX_LINK_BITS || depth > BITPACK_MAX_LENGTH;
+    return dictionary_log > RADIX_LINK_BITS
+        || (depth > BITPACK_MAX_LENGTH && dictionary_log > COMPACT_LINK_BITS);
 }
 
 static int RMF_isStructParam(const RMF_parameters* const params)
@@ -92,6 +99,40 @@ static int RMF_isStructParam(const RMF_parameters* const params)
     return RMF_isStruct(params->dictionary_log, params->depth);
 }
 
+/* Lengths beyond the bitpack maximum fit in a 32-bit entry if the links need 24 bits or less */
+static int RMF_isCompact(unsigned dictionary_log, unsigned depth)
+{
+    return depth > BITPACK_MAX_LENGTH && dictionary_log <= COMPACT_LINK_BITS;
+}
+
+static int RMF_isCompactParam(const RMF_parameters* const params)
+{
+    return RMF_isCompact(params->dictionary_log, params->depth);
+}
+
+static U32 RMF_maxLength(const FL2_matchTable* const tbl)
+{
+    return (tbl->isStruct || tbl->isCompact) ? STRUCTURED_MAX_LENGTH : BITPACK_MAX_LENGTH;
+}
+
+/* Inputs up to RMF_SMALL_INPUT_MAX use a binary tree match finder, which avoids the fixed
+ * cost of the 64K radix heads and the builders. dict_reduce == 0 means the input size is unknown. */
+static int RMF_isSmallInput(const RMF_parameters* const params, size_t const dict_reduce)
+{
+#ifdef RMF_REFERENCE
+    if (params->use_ref_mf)
+        return 0;
+#else
+    (void)params;
+#endif
+    return dict_reduce != 0 && dict_reduce <= RMF_SMALL_INPUT_MAX;
+}
+
+static unsigned RMF_smallHashLog(unsigned const dictionary_log)
+{
+    return MIN(dictionary_log - 1, SMALL_HASH_LOG_MAX);
+}
+
 /** RMF_clampCParams() :
 *  make CParam values within valid range.
 *  @return : valid CParams */
@@ -117,15 +158,23 @@ static size_t RMF_applyParameters_internal(FL2_matchTable* const tbl, const RMF_
         || (params->dictionary_log == tbl->params.dictionary_log && isStruct > tbl->allocStruct))
         return FL2_ERROR(parameter_unsupported);
 
+    if (tbl->hash_log) {
+        /* small table : always bitpacked, no builders */
+        tbl->params = *params;
+        tbl->params.dictionary_log = dictionary_log;
+        return 0;
+    }
+
     {   size_t const match_buffer_size = (size_t)1 << (params->dictionary_log - params->match_buffer_log);
         tbl->params = *params;
         tbl->params.dictionary_log = dictionary_log;
         tbl->isStruct = isStruct;
+        tbl->isCompact = !isStruct && RMF_isCompactParam(params);
         if (tbl->builders == NULL
             || match_buffer_size > tbl->builders[0]->match_buffer_size)
         {
-            RMF_freeBuilderTable(tbl->builders, tbl->thread_count);
-            tbl->builders = RMF_createBuilderTable(tbl->table, match_buffer_size, tbl->isStruct ? STRUCTURED_MAX_LENGTH : BITPACK_MAX_LENGTH, tbl->thread_count);
+            RMF_freeBuilderTable(tbl->builders, tbl->thread_count, tbl->customMem);
+            tbl->builders = RMF_createBuilderTable(tbl->table, match_buffer_size, RMF_maxLength(tbl), tbl->thread_count, tbl->customMem);
             if (tbl->builders == NULL) {
                 return FL2_ERROR(memory_allocation);
             }
@@ -133,7 +182,7 @@ static size_t RMF_applyParameters_internal(FL2_matchTable* const tbl, const RMF_
         else {
             for (unsigned i = 0; i < tbl->thread_count; ++i) {
                 tbl->builders[i]->match_buffer_limit = match_buffer_size;
-                tbl->builders[i]->max_len = tbl->isStruct ? STRUCTURED_MAX_LENGTH : BITPACK_MAX_LENGTH;
+                tbl->builders[i]->max_len = RMF_maxLength(tbl);
             }
         }
     }
@@ -149,33 +198,68 @@ static void RMF_reduceDict(RMF_parameters* const params, size_t const dict_reduc
         }
 }
 
-FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const p, size_t const dict_reduce, unsigned const thread_count)
+FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const p, size_t const dict_reduce, unsigned const thread_count, FL2_customMem const customMem)
 {
     int isStruct;
     size_t dictionary_size;
 	size_t table_bytes;
     FL2_matchTable* tbl;
     RMF_parameters params = RMF_clampParams(*p);
+    int const isSmall = RMF_isSmallInput(&params, dict_reduce);
 
     RMF_reduceDict(&params, dict_reduce);
-    isStruct = RMF_isStructParam(&params);
+    isStruct = !isSmall && RMF_isStructParam(&params);
     dictionary_size = (size_t)1 << params.dictionary_log;
 
-    DEBUGLOG(3, "RMF_createMatchTable : isStruct %d, dict %u", isStruct, (U32)dictionary_size);
+    DEBUGLOG(3, "RMF_createMatchTable : isStruct %d, isSmall %d, dict %u", isStruct, isSmall, (U32)dictionary_size);
+
+    if (isSmall) {
+        /* link table, binary tree and hash heads */
+        unsigned const hash_log = RMF_smallHashLog(params.dictionary_log);
+        tbl = (FL2_matchTable*)FL2_malloc(
+            sizeof(FL2_matchTable) + (dictionary_size * 3 + ((size_t)1 << hash_log) - 1) * sizeof(U32), customMem);
+        if (!tbl) return NULL;
+
+        tbl->customMem = customMem;
+        tbl->isStruct = 0;
+        tbl->allocStruct = 0;
+        tbl->isCompact = 0;
+        tbl->thread_count = 1;
+        tbl->params = params;
+        tbl->builders = NULL;
+        tbl->hash_log = hash_log;
+        tbl->stack = NULL;
+        tbl->list_heads = NULL;
+        tbl->random_map = NULL;
+        tbl->random_count = 0;
+        return tbl;
+    }
 
 	table_bytes = isStruct ? ((dictionary_size + 3U) / 4U) * sizeof(RMF_unit)
 		: dictionary_size * sizeof(U32);
-    tbl = (FL2_matchTable*)malloc(
-        sizeof(FL2_matchTable) + table_bytes - sizeof(U32));
+    tbl = (FL2_matchTable*)FL2_malloc(
+        sizeof(FL2_matchTable) + table_bytes - sizeof(U32)
+        + RADIX16_TABLE_SIZE * (sizeof(U32) + sizeof(RMF_tableHead))
+        + (dictionary_size >> RMF_RANDOM_WINDOW_LOG) + 1, customMem);
     if (!tbl) return NULL;
 
+    tbl->customMem = customMem;
     tbl->isStruct = isStruct;
     tbl->allocStruct = isStruct;
+    tbl->isCompact = 0;
     tbl->thread_count = thread_count + !thread_count;
     tbl->params = params;
     tbl->builders = NULL;
+    tbl->hash_log = 0;
+    tbl->stack = (U32*)((BYTE*)tbl->table + table_bytes);
+    tbl->list_heads = (RMF_tableHead*)(tbl->stack + RADIX16_TABLE_SIZE);
+    tbl->random_map = (BYTE*)(tbl->list_heads + RADIX16_TABLE_SIZE);
+    tbl->random_count = 0;
 
-    RMF_applyParameters_internal(tbl, &params);
+    if (FL2_isError(RMF_applyParameters_internal(tbl, &params))) {
+        RMF_freeMatchTable(tbl);
+        return NULL;
+    }
 
     for (size_t i = 0; i < RADIX16_TABLE_SIZE; i += 2) {
         tbl->list_heads[i].head = RADIX_NULL_LINK;
@@ -191,14 +275,17 @@ void RMF_freeMatchTable(FL2_matchTable* const tbl)
     if (tbl == NULL)
         return;
     DEBUGLOG(3, "RMF_freeMatchTable");
-    RMF_freeBuilderTable(tbl->builders, tbl->thread_count);
-    free(tbl);
+    RMF_freeBuilderTable(tbl->builders, tbl->thread_count, tbl->customMem);
+    FL2_free(tbl, tbl->customMem);
 }
 
 BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_parameters * const p, size_t const dict_reduce)
 {
     RMF_parameters params = RMF_clampParams(*p);
+    int const isSmall = RMF_isSmallInput(&params, dict_reduce);
     RMF_reduceDict(&params, dict_reduce);
+    if (tbl->hash_log)
+        return isSmall && tbl->params.dictionary_log >= params.dictionary_log;
     return tbl->params.dictionary_log > params.dictionary_log
         || (tbl->params.dictionary_log == params.dictionary_log && tbl->allocStruct >= RMF_isStructParam(&params));
 }
@@ -215,17 +302,248 @@ size_t RMF_threadCount(const FL2_matchTable* const tbl)
     return tbl->thread_count;
 }
 
+#define LIST_SIZE_BINS 32
+
+/* Reorder the stack so that the largest lists are taken first. Lists are binned by the
+ * high bit of their count, which is enough to stop a few long lists from being taken
+ * last by a single thread while the rest are idle. The order within a bin is kept. */
+static void RMF_sortLists(FL2_matchTable* const tbl)
+{
+    /* The builder stack isn't used until the table is built */
+    RMF_tableHead* const scratch = tbl->builders[0]->stack;
+    size_t const end_index = tbl->end_index;
+    size_t bins[LIST_SIZE_BINS];
+
+    memset(bins, 0, sizeof(bins));
+    for (size_t n = 0; n < end_index; ++n) {
+        U32 const radix_16 = tbl->stack[n];
+        U32 const bin = ZSTD_highbit32(tbl->list_heads[radix_16].count | 1);
+        scratch[n].head = radix_16;
+        scratch[n].count = bin;
+        ++bins[bin];
+    }
+    {   /* Convert to start positions in descending order of size */
+        size_t pos = 0;
+        for (size_t bin = LIST_SIZE_BINS; bin-- > 0; ) {
+            size_t const count = bins[bin];
+            bins[bin] = pos;
+            pos += count;
+        }
+    }
+    for (size_t n = 0; n < end_index; ++n) {
+        tbl->stack[bins[scratch[n].count]++] = scratch[n].head;
+    }
+}
+
+/* RMF_smallBuildTable() :
+ * Finds the longest match of up to the search depth at each position from start to end using a binary
+ * tree match finder, and stores it in bitpacked form. The links are compatible with a radix table, so
+ * the encoders and RMF_limitLengths() are not affected. */
+static void RMF_smallBuildTable(FL2_matchTable* const tbl, const BYTE* const data, size_t const start, size_t const end)
+{
+    U32* const table = tbl->table;
+    U32* const tree = table + ((size_t)1 << tbl->params.dictionary_log);
+    U32* const hash = tree + ((size_t)2 << tbl->params.dictionary_log);
+    unsigned const hash_shift = 32 - tbl->hash_log;
+    size_t const max_len = MIN(tbl->params.depth, BITPACK_MAX_LENGTH);
+    U32 const cut_value = SMALL_CUT_VALUE_BASE + (tbl->params.depth >> 1);
+
+    DEBUGLOG(5, "RMF_smallBuildTable : start %u, end %u", (U32)start, (U32)end);
+
+    memset(hash, 0xFF, sizeof(U32) << tbl->hash_log);
+    for (size_t index = 0; index + 1 < end; ++index) {
+        size_t const h = (MEM_read16(data + index) * 2654435761U) >> hash_shift;
+        const BYTE* const cur = data + index;
+        size_t const limit = MIN(max_len, end - index);
+        U32* ptr0 = tree + index * 2 + 1;   /* greater side */
+        U32* ptr1 = tree + index * 2;       /* lesser side */
+        size_t len0 = 0, len1 = 0;
+        size_t best_len = 1;
+        U32 candidate = hash[h];
+        U32 cut = cut_value;
+
+        hash[h] = (U32)index;
+        table[index] = RADIX_NULL_LINK;
+        for (;;) {
+            U32* pair;
+            const BYTE* ref;
+            size_t len;
+            if (candidate == RADIX_NULL_LINK || cut-- == 0) {
+                *ptr0 = *ptr1 = RADIX_NULL_LINK;
+                break;
+            }
+            pair = tree + (size_t)candidate * 2;
+            ref = data + candidate;
+            len = MIN(len0, len1);
+            while (len < limit && ref[len] == cur[len])
+                ++len;
+            if (len > best_len) {
+                best_len = len;
+                if (index >= start)
+                    table[index] = candidate | ((U32)len << RADIX_LINK_BITS);
+            }
+            if (len == limit) {
+                /* the candidate is replaced by the current position */
+                *ptr1 = pair[0];
+                *ptr0 = pair[1];
+                break;
+            }
+            if (ref[len] < cur[len]) {
+                *ptr1 = candidate;
+                ptr1 = pair + 1;
+                candidate = *ptr1;
+                len1 = len;
+            }
+            else {
+                *ptr0 = candidate;
+                ptr0 = pair;
+                candidate = *ptr0;
+                len0 = len;
+            }
+        }
+    }
+    if (end != 0)
+        table[end - 1] = RADIX_NULL_LINK;
+}
+
+/* Deviation of the histogram of n sampled bytes from uniform, as sum((count - avg)^2) * 256.
+ * The expected value for random data is about 256 * n. */
+static U64 RMF_histogramDeviation(const BYTE* const data, size_t const size, size_t const step)
+{
+    U32 counts[256];
+    size_t const n = size / step;
+    U64 total = 0;
+
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; ++i)
+        ++counts[data[i * step]];
+    for (size_t i = 0; i < 256; ++i) {
+        S64 const delta = (S64)counts[i] * 256 - (S64)n;
+        total += (U64)(delta * delta);
+    }
+    return total / 256;
+}
+
+/* RMF_isRandomWindow() :
+ * Tests a window for data which is not worth searching. A sampled byte histogram rejects
+ * most compressible data cheaply. Windows which pass are checked with the full histogram,
+ * then for the number of distinct 2-byte values, which is low for repetitive data with a
+ * flat byte distribution. */
+static int RMF_isRandomWindow(const BYTE* const data, size_t const size)
+{
+    U64 pairs[RADIX16_TABLE_SIZE / 64];
+    size_t distinct = 0;
+    size_t const sample_n = size / RMF_RANDOM_SAMPLE_STEP;
+
+    if (RMF_histogramDeviation(data, size, RMF_RANDOM_SAMPLE_STEP) > (U64)sample_n * 256 * 2)
+        return 0;
+    if (RMF_histogramDeviation(data, size, 1) * 2 > (U64)size * 256 * 3)
+        return 0;
+    memset(pairs, 0, sizeof(pairs));
+    for (size_t i = 0; i + 1 < size; ++i) {
+        size_t const radix_16 = MEM_read16(data + i);
+        U64 const bit = (U64)1 << (radix_16 & 63);
+        distinct += (pairs[radix_16 >> 6] & bit) == 0;
+        pairs[radix_16 >> 6] |= bit;
+    }
+    /* Random data averages 63% distinct for a full window */
+    return distinct * 16 >= (size - 1) * 9;
+}
+
+size_t RMF_filterRandom(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end, int const enable)
+{
+    size_t random_bytes = 0;
+
+    tbl->random_count = 0;
+    if (!enable || tbl->random_map == NULL)
+        return 0;
+    for (size_t index = 0; index < end; index += (size_t)1 << RMF_RANDOM_WINDOW_LOG) {
+        size_t const window_end = MIN(index + ((size_t)1 << RMF_RANDOM_WINDOW_LOG), end);
+        BYTE const is_random = window_end - index >= RMF_RANDOM_WINDOW_MIN
+            && RMF_isRandomWindow((const BYTE*)data + index, window_end - index);
+        tbl->random_map[index >> RMF_RANDOM_WINDOW_LOG] = is_random;
+        tbl->random_count += is_random;
+        if (is_random && window_end > start)
+            random_bytes += window_end - MAX(index, start);
+    }
+    DEBUGLOG(5, "RMF_filterRandom : %u random windows", (U32)tbl->random_count);
+    return random_bytes;
+}
+
+/* Clears the random flag of the windows overlapping start..end. Their table entries stay null. */
+void RMF_unmarkRandom(FL2_matchTable* const tbl, size_t const start, size_t const end)
+{
+    if (tbl->random_count == 0 || start >= end)
+        return;
+    for (size_t w = start >> RMF_RANDOM_WINDOW_LOG; w <= (end - 1) >> RMF_RANDOM_WINDOW_LOG; ++w) {
+        tbl->random_count -= tbl->random_map[w];
+        tbl->random_map[w] = 0;
+    }
+}
+
 size_t RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end)
 {
+    size_t rpt_total;
     DEBUGLOG(5, "RMF_initTable : start %u, size %u", (U32)start, (U32)end);
+    if (tbl->hash_log) {
+        RMF_smallBuildTable(tbl, (const BYTE*)data, start, end);
+        return 0;
+    }
+    if (tbl->isStruct) {
+        rpt_total = RMF_structuredInit(tbl, data, start, end);
+    }
+    else if (tbl->isCompact) {
+        rpt_total = RMF_compactInit(tbl, data, start, end);
+    }
+    else {
+        rpt_total = RMF_bitpackInit(tbl, data, start, end);
+    }
+    if (tbl->thread_count > 1 && end > 2)
+        RMF_sortLists(tbl);
+    return rpt_total;
+}
+
+/* RMF_initThreadCount() :
+ * Returns the number of jobs to use for RMF_initTableJob(), or 1 if the table should be
+ * initialized with RMF_initTable(). */
+size_t RMF_initThreadCount(const FL2_matchTable* const tbl, size_t const end)
+{
+    size_t const count = MIN(tbl->thread_count, end / RMF_MIN_BYTES_PER_INIT_THREAD);
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        return 1;
+#endif
+    return count + !count;
+}
+
+/* RMF_initTableJob() :
+ * Builds the radix lists for one segment of the block. Each job 0 to (job_count - 1) must
+ * complete before calling RMF_initTableMerge(). */
+void RMF_initTableJob(FL2_matchTable* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end)
+{
+    DEBUGLOG(5, "RMF_initTableJob : job %u of %u", (U32)job, (U32)job_count);
     if (tbl->isStruct) {
-        return RMF_structuredInit(tbl, data, start, end);
+        RMF_structuredInitJob(tbl, job, job_count, data, start, end);
+    }
+    else if (tbl->isCompact) {
+        RMF_compactInitJob(tbl, job, job_count, data, start, end);
     }
     else {
-        return RMF_bitpackInit(tbl, data, start, end);
+        RMF_bitpackInitJob(tbl, job, job_count, data, start, end);
     }
 }
 
+/* RMF_initTableMerge() :
+ * Completes a multithreaded init. Returns the same value as RMF_initTable(). */
+size_t RMF_initTableMerge(FL2_matchTable* const tbl, size_t const job_count)
+{
+    size_t const rpt_total = tbl->isStruct ? RMF_structuredInitMerge(tbl, job_count)
+        : tbl->isCompact ? RMF_compactInitMerge(tbl, job_count)
+        : RMF_bitpackInitMerge(tbl, job_count);
+    RMF_sortLists(tbl);
+    return rpt_total;
+}
+
 static void HandleRepeat(RMF_buildMatch* const match_buffer,
     const BYTE* const data_block,
     size_t const next,
@@ -239,8 +557,7 @@ static void HandleRepeat(RMF_buildMatch* const match_buffer,
     U32 length = depth + rpt_len;
     const BYTE* const data = data_block + match_buffer[index].from;
     const BYTE* const data_2 = data - rpt_len;
-    while (data[length] == data_2[length] && length < max_len)
-        ++length;
+    length += (U32)ZSTD_countLong(data + length, data_2 + length, data + max_len);
     for (; length <= max_len && count; --count) {
         next_i = match_buffer[index].next & 0xFFFFFF;
         match_buffer[index].next = (U32)next_i | (length << 24);
@@ -298,9 +615,7 @@ static void BruteForceBuffered(RMF_builder* const tbl,
             len_test -= slot;
             if (len_test) {
                 const BYTE* data_2 = buffer[j].data_src;
-                while (data[len_test] == data_2[len_test] && len_test < limit) {
-                    ++len_test;
-                }
+                len_test += ZSTD_countLong(data + len_test, data_2 + len_test, data + limit);
             }
             if (len_test > longest) {
                 longest_index = j;
@@ -420,27 +735,40 @@ void RMF_recurseListChunk_generic(RMF_builder* const tbl,
             /* Last element done separately */
             --list_count;
             /* slot is the char cache index. If 3 then chars need to be loaded. */
-            if (slot == 3 && max_depth != 6) do {
-                size_t const radix_8 = tbl->match_buffer[index].src.chars[3];
-                size_t const next_index = tbl->match_buffer[index].next & BUFFER_LINK_MASK;
-                /* Pre-load the next link and data bytes to avoid waiting for RAM access */
-                tbl->match_buffer[index].src.u32 = MEM_read32(data_src + link);
-                size_t const next_link = tbl->match_buffer[next_index].from;
-                U32 const prev = tbl->tails_8[radix_8].prev_index;
-                if (prev!=RADIX_NULL_LINK) {
-                    ++tbl->tails_8[radix_8].list_count;
-                    tbl->match_buffer[prev].next = (U32)index | ((U32)depth << 24);
-                }
-                else {
-                    tbl->tails_8[radix_8].list_count = 1;
-                    tbl->stack[st_index].head = (U32)index;
-                    tbl->stack[st_index].count = (U32)radix_8;
-                    ++st_index;
-                }
-                tbl->tails_8[radix_8].prev_index = (U32)index;
-                index = next_index;
-                link = next_link;
-            } while (--list_count != 0);
+            if (slot == 3 && max_depth != 6) {
+#if RMF_PREFETCH_DISTANCE
+                /* Follow the list ahead of index to prefetch the data to be loaded. */
+                /* The buffer links are in cache, and are not changed ahead of index. */
+                size_t pf_index = index;
+                for (size_t n = 0; n < RMF_PREFETCH_DISTANCE; ++n)
+                    pf_index = tbl->match_buffer[pf_index].next & BUFFER_LINK_MASK;
+#endif
+                do {
+                    size_t const radix_8 = tbl->match_buffer[index].src.chars[3];
+                    size_t const next_index = tbl->match_buffer[index].next & BUFFER_LINK_MASK;
+#if RMF_PREFETCH_DISTANCE
+                    PREFETCH(data_src + tbl->match_buffer[pf_index].from);
+                    pf_index = tbl->match_buffer[pf_index].next & BUFFER_LINK_MASK;
+#endif
+                    /* Pre-load the next link and data bytes to avoid waiting for RAM access */
+                    tbl->match_buffer[index].src.u32 = MEM_read32(data_src + link);
+                    size_t const next_link = tbl->match_buffer[next_index].from;
+                    U32 const prev = tbl->tails_8[radix_8].prev_index;
+                    if (prev!=RADIX_NULL_LINK) {
+                        ++tbl->tails_8[radix_8].list_count;
+                        tbl->match_buffer[prev].next = (U32)index | ((U32)depth << 24);
+                    }
+                    else {
+                        tbl->tails_8[radix_8].list_count = 1;
+                        tbl->stack[st_index].head = (U32)index;
+                        tbl->stack[st_index].count = (U32)radix_8;
+                        ++st_index;
+                    }
+                    tbl->tails_8[radix_8].prev_index = (U32)index;
+                    index = next_index;
+                    link = next_link;
+                } while (--list_count != 0);
+            }
             else do {
                 size_t const radix_8 = tbl->match_buffer[index].src.chars[slot];
                 size_t const next_index = tbl->match_buffer[index].next & BUFFER_LINK_MASK;
@@ -610,9 +938,16 @@ int RMF_buildTable(FL2_matchTable* const tbl,
     FL2_progressFn progress, void* opaque, U32 weight, size_t init_done)
 {
     DEBUGLOG(5, "RMF_buildTable : thread %u", (U32)job);
+    if (tbl->hash_log) {
+        /* built completely by RMF_initTable() */
+        return 0;
+    }
     if (tbl->isStruct) {
         return RMF_structuredBuildTable(tbl, job, multi_thread, block, progress, opaque, weight, init_done);
     }
+    else if (tbl->isCompact) {
+        return RMF_compactBuildTable(tbl, job, multi_thread, block, progress, opaque, weight, init_done);
+    }
     else {
         return RMF_bitpackBuildTable(tbl, job, multi_thread, block, progress, opaque, weight, init_done);
     }
@@ -623,6 +958,9 @@ int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data,
     if (tbl->isStruct) {
         return RMF_structuredIntegrityCheck(tbl, data, index, end, max_depth);
     }
+    else if (tbl->isCompact) {
+        return RMF_compactIntegrityCheck(tbl, data, index, end, max_depth);
+    }
     else {
         return RMF_bitpackIntegrityCheck(tbl, data, index, end, max_depth);
     }
@@ -638,6 +976,9 @@ size_t RMF_getMatch(FL2_matchTable* const tbl,
     if (tbl->isStruct) {
         return RMF_structuredGetMatch(tbl, data, index, limit, max_depth, offset_ptr);
     }
+    else if (tbl->isCompact) {
+        return RMF_compactGetMatch(tbl, data, index, limit, max_depth, offset_ptr);
+    }
     else {
         return RMF_bitpackGetMatch(tbl, data, index, limit, max_depth, offset_ptr);
     }
@@ -648,6 +989,9 @@ void RMF_limitLengths(FL2_matchTable* const tbl, size_t const index)
     if (tbl->isStruct) {
         RMF_structuredLimitLengths(tbl, index);
     }
+    else if (tbl->isCompact) {
+        RMF_compactLimitLengths(tbl, index);
+    }
     else {
         RMF_bitpackLimitLengths(tbl, index);
     }
@@ -658,11 +1002,22 @@ BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const index)
     if (tbl->isStruct) {
         return RMF_structuredAsOutputBuffer(tbl, index);
     }
+    else if (tbl->isCompact) {
+        return RMF_compactAsOutputBuffer(tbl, index);
+    }
     else {
         return RMF_bitpackAsOutputBuffer(tbl, index);
     }
 }
 
+size_t RMF_smallMemoryUsage(size_t const src_size)
+{
+    unsigned dict_log = DICTIONARY_LOG_MIN;
+    while (((size_t)1 << dict_log) < src_size)
+        ++dict_log;
+    return sizeof(FL2_matchTable) + (((size_t)3 << dict_log) + ((size_t)1 << RMF_smallHashLog(dict_log))) * sizeof(U32);
+}
+
 size_t RMF_memoryUsage(unsigned const dict_log, unsigned const buffer_log, unsigned const depth, unsigned thread_count)
 {
     size_t size = (size_t)(4U + RMF_isStruct(dict_log, depth)) << dict_log;
@@ -23,6 +23,8 @@ typedef struct FL2_matchTable_s FL2_matchTable;
 #define OVERLAP_FROM_DICT_LOG(d, o) (((size_t)1 << ((d) - 4)) * (o))
 
 #define RMF_MIN_BYTES_PER_THREAD 1024
+#define RMF_MIN_BYTES_PER_INIT_THREAD ((size_t)1 << 20)
+#define RMF_SMALL_INPUT_MAX FL2_SMALL_INPUT_MAX
 
 typedef struct
 {
@@ -37,12 +39,17 @@ typedef struct
 #endif
 } RMF_parameters;
 
-FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const params, size_t const dict_reduce, unsigned const thread_count);
+FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const params, size_t const dict_reduce, unsigned const thread_count, FL2_customMem const customMem);
 void RMF_freeMatchTable(FL2_matchTable* const tbl);
 BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_parameters* const params, size_t const dict_reduce);
 size_t RMF_applyParameters(FL2_matchTable* const tbl, const RMF_parameters* const params, size_t const dict_reduce);
 size_t RMF_threadCount(const FL2_matchTable * const tbl);
+size_t RMF_filterRandom(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end, int const enable);
+void RMF_unmarkRandom(FL2_matchTable* const tbl, size_t const start, size_t const end);
 size_t RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end);
+size_t RMF_initThreadCount(const FL2_matchTable* const tbl, size_t const end);
+void RMF_initTableJob(FL2_matchTable* const tbl, size_t const job, size_t const job_count, const void* const data, size_t const start, size_t const end);
+size_t RMF_initTableMerge(FL2_matchTable* const tbl, size_t const job_count);
 int RMF_buildTable(FL2_matchTable* const tbl,
 	size_t const job,
     unsigned const multi_thread,
@@ -51,6 +58,7 @@ int RMF_buildTable(FL2_matchTable* const tbl,
 int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data, size_t const index, size_t const end, unsigned const max_depth);
 void RMF_limitLengths(FL2_matchTable* const tbl, size_t const index);
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const index);
+size_t RMF_smallMemoryUsage(size_t const src_size);
 size_t RMF_memoryUsage(unsigned const dict_log, unsigned const buffer_log, unsigned const depth, unsigned thread_count);
 
 #if defined (__cplusplus)
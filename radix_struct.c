@@ -40,6 +40,8 @@ typedef struct FL2_matchTable_s FL2_matchTable;
 
 #define IsNull(index) (((RMF_unit*)tbl->table)[(index) >> UNIT_BITS].links[(index) & UNIT_MASK] == RADIX_NULL_LINK)
 
+#define PrefetchMatch(index) PREFETCH((RMF_unit*)tbl->table + ((index) >> UNIT_BITS))
+
 BYTE* RMF_structuredAsOutputBuffer(FL2_matchTable* const tbl, size_t const index)
 {
     return (BYTE*)((RMF_unit*)tbl->table + (index >> UNIT_BITS) + ((index & UNIT_MASK) != 0));
@@ -32,70 +32,115 @@ void SetOutputBuffer(RangeEncoder* const rc, BYTE *const out_buffer, size_t chun
 {
     rc->out_buffer = out_buffer;
     rc->chunk_size = chunk_size;
-    rc->out_index = 0;
+    out_buffer[0] = 0;
+    rc->out_index = 1;
 }
 
 void RangeEncReset(RangeEncoder* const rc)
 {
     rc->low = 0;
     rc->range = (U32)-1;
-    rc->cache_size = 1;
-    rc->cache = 0;
 }
 
-void ShiftLow(RangeEncoder* const rc)
+void RangeEncCarry(RangeEncoder* const rc)
 {
-	if (rc->low < 0xFF000000 || rc->low > 0xFFFFFFFF)
-	{
-		BYTE temp = rc->cache;
-		do {
-			assert (rc->out_index < rc->chunk_size - 4096);
-            rc->out_buffer[rc->out_index++] = temp + (BYTE)(rc->low >> 32);
-            temp = 0xFF;
-		} while (--rc->cache_size != 0);
-        rc->cache = (BYTE)(rc->low >> 24);
-	}
-	++rc->cache_size;
-    rc->low = (rc->low << 8) & 0xFFFFFFFF;
+    /* The first byte is 0 and low + range never exceeds 2^32 at the start, so the carry
+     * always stops at or before the first byte */
+    size_t index = rc->out_index;
+    assert(rc->out_index < rc->chunk_size - 4096);
+    while (++rc->out_buffer[--index] == 0)
+        assert(index > 1);
+    rc->low &= 0xFFFFFFFF;
 }
 
+/* The tree functions encode with a local copy of the encoder. Stores to the output buffer can
+ * alias *rc, which would otherwise reload its fields after every byte. */
 void EncodeBitTree(RangeEncoder* const rc, Probability *const probs, unsigned bit_count, unsigned symbol)
 {
+    RangeEncoder r = *rc;
 	size_t tree_index = 1;
     assert(bit_count > 0);
     do {
         unsigned bit;
 		--bit_count;
 		bit = (symbol >> bit_count) & 1;
-		EncodeBit(rc, &probs[tree_index], bit);
+		EncodeBit(&r, &probs[tree_index], bit);
 		tree_index = (tree_index << 1) | bit;
 	} while (bit_count != 0);
+    *rc = r;
 }
 
 void EncodeBitTreeReverse(RangeEncoder* const rc, Probability *const probs, unsigned bit_count, unsigned symbol)
 {
+    RangeEncoder r = *rc;
 	unsigned tree_index = 1;
     assert(bit_count != 0);
     do {
 		unsigned bit = symbol & 1;
-		EncodeBit(rc, &probs[tree_index], bit);
+		EncodeBit(&r, &probs[tree_index], bit);
 		tree_index = (tree_index << 1) + bit;
 		symbol >>= 1;
 	} while (--bit_count != 0);
+    *rc = r;
+}
+
+/* Each node's price is shared by all symbols beneath it, so the tables are filled breadth-first
+ * with about two table lookups per symbol instead of one per bit. Each level is a run of
+ * independent additions which the compiler can vectorize. */
+void FillTreePrices(RangeEncoder* const rc, const Probability* const prob_table, unsigned const bit_count,
+    unsigned const base_price, unsigned* const prices, size_t const count)
+{
+    unsigned node_prices[1U << kTreePricesBitsMax];
+    size_t const top = (size_t)1 << bit_count;
+    size_t const last = top + count - 1;
+
+    (void)rc;
+    assert(bit_count <= kTreePricesBitsMax && count != 0 && count <= top);
+    node_prices[1] = base_price;
+    /* only the ancestors of symbols below count */
+    for (unsigned depth = 1; depth < bit_count; ++depth) {
+        size_t const end = last >> (bit_count - depth);
+        for (size_t node = (size_t)1 << depth; node <= end; ++node)
+            node_prices[node] = node_prices[node >> 1] + GET_PRICE(rc, prob_table[node >> 1], node & 1);
+    }
+    for (size_t node = top; node <= last; ++node)
+        prices[node - top] = node_prices[node >> 1] + GET_PRICE(rc, prob_table[node >> 1], node & 1);
+}
+
+void FillReverseTreePrices(RangeEncoder* const rc, const Probability* const prob_table, unsigned const bit_count,
+    unsigned* const prices)
+{
+    unsigned node_prices[2U << kTreePricesBitsMax];
+    size_t const top = (size_t)1 << bit_count;
+
+    (void)rc;
+    assert(bit_count <= kTreePricesBitsMax);
+    node_prices[1] = 0;
+    for (size_t node = 2; node < top * 2; ++node)
+        node_prices[node] = node_prices[node >> 1] + GET_PRICE(rc, prob_table[node >> 1], node & 1);
+    /* The leaf of a symbol holds its bits in reverse order */
+    for (size_t symbol = 0; symbol < top; ++symbol) {
+        size_t node = 1;
+        for (size_t s = symbol, i = bit_count; i != 0; --i, s >>= 1)
+            node = (node << 1) | (s & 1);
+        prices[symbol] = node_prices[node];
+    }
 }
 
 void EncodeDirect(RangeEncoder* const rc, unsigned value, unsigned bit_count)
 {
+    RangeEncoder r = *rc;
 	assert(bit_count > 0);
 	do {
-        rc->range >>= 1;
+        r.range >>= 1;
 		--bit_count;
-        rc->low += rc->range & -((int)(value >> bit_count) & 1);
-		if (rc->range < kTopValue) {
-            rc->range <<= 8;
-			ShiftLow(rc);
+        r.low += r.range & -((int)(value >> bit_count) & 1);
+		if (r.range < kTopValue) {
+            r.range <<= 8;
+			ShiftLow(&r);
 		}
 	} while (bit_count != 0);
+    *rc = r;
 }
 
 
@@ -32,24 +32,37 @@ typedef U16 Probability;
 
 extern const unsigned price_table[kBitModelTotal >> kNumMoveReducingBits];
 
+/* Bytes are written to out_buffer as soon as they are shifted out of low, and a carry out of
+ * low is added to the bytes already written. The whole chunk is in out_buffer, so this replaces
+ * the cache byte and count of pending 0xFF bytes of the reference encoder, and the bytes for a
+ * sequence of symbols are the same. out_index includes the bytes the reference encoder would
+ * still hold back, so it is ahead by one plus the length of any run of pending 0xFF bytes, and
+ * the chunk_size checks can end a chunk at a different symbol. */
 typedef struct
 {
 	BYTE *out_buffer;
 	size_t out_index;
 	size_t chunk_size;
-	U64 cache_size;
 	U64 low;
 	U32 range;
-	BYTE cache;
 } RangeEncoder;
 
 void RangeEncReset(RangeEncoder* const rc);
 
+/* Also writes the first byte of the range coded data, which is always 0 */
 void SetOutputBuffer(RangeEncoder* const rc, BYTE *const out_buffer, size_t chunk_size);
 
-void RangeEncReset(RangeEncoder* const rc);
+/* Adds the carry out of low to the output */
+void RangeEncCarry(RangeEncoder* const rc);
 
-void ShiftLow(RangeEncoder* const rc);
+HINT_INLINE
+void ShiftLow(RangeEncoder* const rc)
+{
+    if (rc->low > 0xFFFFFFFF)
+        RangeEncCarry(rc);
+    rc->out_buffer[rc->out_index++] = (BYTE)(rc->low >> 24);
+    rc->low = (rc->low << 8) & 0xFFFFFFFF;
+}
 
 void EncodeBitTree(RangeEncoder* const rc, Probability *const probs, unsigned bit_count, unsigned symbol);
 
@@ -57,6 +70,18 @@ void EncodeBitTreeReverse(RangeEncoder* const rc, Probability *const probs, unsi
 
 void EncodeDirect(RangeEncoder* const rc, unsigned value, unsigned bit_count);
 
+#define kTreePricesBitsMax 8U
+
+/* Write base_price plus the price of each symbol 0 to (count - 1) in a bit tree of up to
+ * kTreePricesBitsMax bits to prices[]. Same result as GetTreePrice() for each symbol. */
+void FillTreePrices(RangeEncoder* const rc, const Probability* const prob_table, unsigned const bit_count,
+    unsigned const base_price, unsigned* const prices, size_t const count);
+
+/* Write the price of every symbol in a reverse bit tree to prices[].
+ * Same result as GetReverseTreePrice() for each symbol. */
+void FillReverseTreePrices(RangeEncoder* const rc, const Probability* const prob_table, unsigned const bit_count,
+    unsigned* const prices);
+
 HINT_INLINE
 void EncodeBit0(RangeEncoder* const rc, Probability *const rprob)
 {
@@ -85,21 +110,18 @@ void EncodeBit1(RangeEncoder* const rc, Probability *const rprob)
 	}
 }
 
+/* Branch-free, because the bits of a tree are often unpredictable */
 HINT_INLINE
 void EncodeBit(RangeEncoder* const rc, Probability *const rprob, unsigned const bit)
 {
-	unsigned prob = *rprob;
-	if (bit != 0) {
-		U32 new_bound = (rc->range >> kNumBitModelTotalBits) * prob;
-        rc->low += new_bound;
-        rc->range -= new_bound;
-		prob -= prob >> kNumMoveBits;
-	}
-	else {
-        rc->range = (rc->range >> kNumBitModelTotalBits) * prob;
-		prob += (kBitModelTotal - prob) >> kNumMoveBits;
-	}
-	*rprob = (Probability)prob;
+	unsigned const prob = *rprob;
+	U32 const mask = 0U - (U32)(bit != 0);
+	U32 const bound = (rc->range >> kNumBitModelTotalBits) * prob;
+	U32 const prob_0 = prob + ((kBitModelTotal - prob) >> kNumMoveBits);
+	U32 const prob_1 = prob - (prob >> kNumMoveBits);
+	rc->low += bound & mask;
+	rc->range = (bound & ~mask) | ((rc->range - bound) & mask);
+	*rprob = (Probability)(prob_1 ^ ((prob_0 ^ prob_1) & ~mask));
 	if (rc->range < kTopValue) {
         rc->range <<= 8;
 		ShiftLow(rc);
@@ -143,10 +165,11 @@ unsigned GetReverseTreePrice(RangeEncoder* const rc, const Probability* const pr
 	return price;
 }
 
+/* The last 4 bytes of low. The reference encoder shifts 5 times, the last to release its cache. */
 HINT_INLINE
 void Flush(RangeEncoder* const rc)
 {
-    for (int i = 0; i < 5; ++i)
+    for (int i = 0; i < 4; ++i)
         ShiftLow(rc);
 }
 
@@ -270,6 +270,66 @@ static int callback(const void *src, size_t size, void *opaque)
     return 0;
 }
 
+static size_t readVli(const BYTE* src, size_t* pos)
+{
+    size_t value = 0;
+    unsigned shift = 0;
+    BYTE b;
+    do {
+        b = src[(*pos)++];
+        value |= (size_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return value;
+}
+
+/* Decodes each block of a .xz stream on its own, with the sizes from its header.
+ * Returns the number of blocks, or -1 if the stream is invalid or the data differs. */
+static int decodeXzBlocks(const BYTE* xz, size_t xzSize, const BYTE* orig, size_t origSize, BYTE* lzma2, BYTE* decoded)
+{
+    static const BYTE magic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0 };
+    size_t pos = 12;
+    size_t uPos = 0;
+    int count = 0;
+
+    if (xzSize < 24 || memcmp(xz, magic, 6) || xz[xzSize - 2] != 'Y' || xz[xzSize - 1] != 'Z')
+        return -1;
+    while (xz[pos] != 0) {
+        size_t const headerSize = ((size_t)xz[pos] + 1) * 4;
+        size_t field = pos + 2;
+        size_t const cSize = readVli(xz, &field);
+        size_t const uSize = readVli(xz, &field);
+        size_t const checkSize = (xz[7] == 4) ? 8 : 4;
+        if (xz[pos + 1] != 0xC0 || xz[field] != 0x21 || uPos + uSize > origSize)
+            return -1;
+        /* the block's LZMA2 data with a property byte is a frame without a checksum */
+        lzma2[0] = xz[field + 2];
+        memcpy(lzma2 + 1, xz + pos + headerSize, cSize);
+        if (FL2_decompress(decoded, uSize, lzma2, cSize + 1) != uSize || memcmp(decoded, orig + uPos, uSize))
+            return -1;
+        uPos += uSize;
+        pos += headerSize + ((cSize + 3) & ~(size_t)3) + checkSize;
+        ++count;
+    }
+    /* the index record count */
+    ++pos;
+    if (uPos != origSize || readVli(xz, &pos) != (size_t)count)
+        return -1;
+    return count;
+}
+
+static void* countingAlloc(void* opaque, size_t size)
+{
+    ++*(int*)opaque;
+    return malloc(size);
+}
+
+static void countingFree(void* opaque, void* address)
+{
+    --*(int*)opaque;
+    free(address);
+}
+
 /*=============================================
 *   Unit tests
 =============================================*/
@@ -383,6 +443,78 @@ static int basicUnitTests(U32 seed, double compressibility)
     }
     DISPLAYLEVEL(4, "OK \n");
 
+    DISPLAYLEVEL(4, "test%3i : decompress to callback fn : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DCtx* const dctx = FL2_createDCtx();
+        FL2_outBuffer out = { decodedBuffer, CNBuffSize, 0 };
+        size_t r;
+        if (cctx == NULL || dctx == NULL) goto _output_error;
+        /* the ring dictionary is smaller than the content */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_doXXHash, 1);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        memset(decodedBuffer, 0, CNBuffSize);
+        r = FL2_decompressDCtx_toFn(dctx, compressedBuffer, cSize, callback, &out);
+        if (r != CNBuffSize || out.pos != r || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        /* a truncated frame is detected */
+        out.pos = 0;
+        if (!FL2_isError(FL2_decompressDCtx_toFn(dctx, compressedBuffer, cSize - 1, callback, &out))) goto _output_error;
+        FL2_freeCCtx(cctx);
+        FL2_freeDCtx(dctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : XXH64 checksum : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        FL2_CStream* const cs = FL2_createCStreamMt(2);
+        FL2_DCtx* const dctx = FL2_createDCtx();
+        FL2_DStream* const ds = FL2_createDStream();
+        size_t r;
+        if (cctx == NULL || cs == NULL || dctx == NULL || ds == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 2);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        if (FL2_CCtx_setParameter(cctx, FL2_p_doXXHash, 2) != 2) goto _output_error;
+        if (!FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_doXXHash, 3))) goto _output_error;
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        if (FL2_isError(cSize) || (((BYTE*)compressedBuffer)[0] & 0xC0) != 0xC0) goto _output_error;
+        {   FL2_outBuffer out = { decodedBuffer, CNBuffSize, 0 };
+            FL2_inBuffer in = { compressedBuffer, cSize, 0 };
+            r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+            memset(decodedBuffer, 0, CNBuffSize);
+            r = FL2_decompressDCtx_toFn(dctx, compressedBuffer, cSize, callback, &out);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+            out.pos = 0;
+            CHECK(FL2_initDStream(ds));
+            if (FL2_decompressStream(ds, &out, &in) != 0 || out.pos != CNBuffSize) goto _output_error;
+            /* a damaged hash is detected */
+            ((BYTE*)compressedBuffer)[cSize - 1] ^= 1;
+            r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (FL2_getErrorCode(r) != FL2_error_checksum_wrong) goto _output_error;
+        }
+        {   /* streaming, with the hash set after init and updated during pipelined compression */
+            FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+            FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
+            CHECK(FL2_initCStream(cs, 2));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_doXXHash, 2));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_pipelineDepth, 1));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_dictionaryLog, 20));
+            CHECK(FL2_compressStream(cs, &out, &in));
+            if (in.pos != in.size) goto _output_error;
+            if (FL2_endStream(cs, &out) != 0) goto _output_error;
+            cSize = out.pos;
+            r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+        FL2_freeCStream(cs);
+        FL2_freeDCtx(dctx);
+        FL2_freeDStream(ds);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     /* streaming tests */
 
     DISPLAYLEVEL(4, "test%3i : compress stream in many chunks : ", testNb++);
@@ -440,6 +572,967 @@ static int basicUnitTests(U32 seed, double compressibility)
     }   }
     DISPLAYLEVEL(4, "OK \n");
 
+    /* blockSizeLog 0 produces no dictionary resets, so the stream decoder falls back to one thread */
+    for (int b = 0; b < 2; ++b) {
+        unsigned const blockLog = b ? 0 : 22;
+        DISPLAYLEVEL(4, "test%3i : compress with block size log %u : ", testNb++, blockLog);
+        {   FL2_CCtx* cctx = FL2_createCCtxMt(2);
+            if (cctx == NULL) goto _output_error;
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+            FL2_CCtx_setParameter(cctx, FL2_p_blockSizeLog, blockLog);
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+            FL2_freeCCtx(cctx);
+            if (FL2_isError(cSize)) goto _output_error;
+        }
+        DISPLAYLEVEL(4, "OK \n");
+
+        DISPLAYLEVEL(4, "test%3i : multithreaded decompress : ", testNb++);
+        {   size_t const r = FL2_decompressMt(decodedBuffer, CNBuffSize, compressedBuffer, cSize, 2);
+            if (r != CNBuffSize) goto _output_error;
+            if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+        }
+        DISPLAYLEVEL(4, "OK \n");
+
+        DISPLAYLEVEL(4, "test%3i : multithreaded decompress stream in many chunks : ", testNb++);
+        {   FL2_DStream* const dstreamMt = FL2_createDStreamMt(2);
+            FL2_inBuffer in = { compressedBuffer, 0, 0 };
+            FL2_outBuffer out = { decodedBuffer, 0, 0 };
+            BYTE *send = (BYTE*)compressedBuffer + cSize;
+            BYTE *oend = (BYTE*)decodedBuffer + CNBuffSize;
+            size_t r;
+            size_t total = 0;
+            if (dstreamMt == NULL) goto _output_error;
+            memset(decodedBuffer, 0, CNBuffSize);
+            CHECK(FL2_initDStream(dstreamMt));
+            do {
+                if (in.pos + LZMA_REQUIRED_INPUT_MAX >= in.size) {
+                    in.src = (BYTE*)in.src + in.pos;
+                    in.size = MIN(0x8101, send - (BYTE*)in.src);
+                    in.pos = 0;
+                }
+                out.dst = (BYTE*)out.dst + out.pos;
+                out.size = MIN(0x8101, oend - (BYTE*)out.dst);
+                out.pos = 0;
+                r = FL2_decompressStream(dstreamMt, &out, &in);
+                total += out.pos;
+                if (FL2_isError(r)) {
+                    FL2_freeDStream(dstreamMt);
+                    goto _output_error;
+                }
+            } while (r);
+            FL2_freeDStream(dstreamMt);
+            if (total != CNBuffSize) goto _output_error;
+            if (findDiff(CNBuffer, decodedBuffer, total) < CNBuffSize) goto _output_error;
+        }
+        DISPLAYLEVEL(4, "OK \n");
+    }
+
+    DISPLAYLEVEL(4, "test%3i : multithreaded decompress stream under a memory limit : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        /* 1 MB segments buffer up to 8 MB each, so 20 MB allows two and 2 MB decodes serially */
+        size_t const limits[2] = { 2 MB, 20 MB };
+        if (cctx == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_blockSizeLog, 20);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        FL2_freeCCtx(cctx);
+        if (FL2_isError(cSize)) goto _output_error;
+        for (int u = 0; u < 2; ++u) {
+            FL2_DStream* const dstreamMt = FL2_createDStreamMt(4);
+            FL2_inBuffer in = { compressedBuffer, cSize, 0 };
+            FL2_outBuffer out = { decodedBuffer, CNBuffSize, 0 };
+            size_t r;
+            if (dstreamMt == NULL) goto _output_error;
+            FL2_DStream_setMemoryLimit(dstreamMt, limits[u]);
+            memset(decodedBuffer, 0, CNBuffSize);
+            r = FL2_initDStream(dstreamMt);
+            if (!FL2_isError(r))
+                r = FL2_decompressStream(dstreamMt, &out, &in);
+            FL2_freeDStream(dstreamMt);
+            if (r != 0 || out.pos != CNBuffSize) goto _output_error;
+            if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+        }
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress with seek table : ", testNb++);
+    {   FL2_CCtx* cctx = FL2_createCCtxMt(2);
+        if (cctx == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_blockSizeLog, 22);
+        FL2_CCtx_setParameter(cctx, FL2_p_seekTable, 1);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        FL2_freeCCtx(cctx);
+        if (FL2_isError(cSize)) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress frame with seek table : ", testNb++);
+    {   size_t const r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress ranges : ", testNb++);
+    {   FL2_DCtx* const dctx = FL2_createDCtx();
+        size_t const offsets[4] = { 0, 4 MB - 5000, 1 MB + 17, CNBuffSize - 3000 };
+        if (dctx == NULL) goto _output_error;
+        for (int u = 0; u < 4; ++u) {
+            size_t const r = FL2_decompressRange(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize, offsets[u], 10000);
+            size_t const expected = MIN(10000, CNBuffSize - offsets[u]);
+            if (r != expected || memcmp((BYTE*)CNBuffer + offsets[u], decodedBuffer, expected)) {
+                FL2_freeDCtx(dctx);
+                goto _output_error;
+            }
+        }
+        FL2_freeDCtx(dctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with split seek table write : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStream();
+        FL2_outBuffer out = { compressedBuffer, 0, 0 };
+        FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
+        size_t r;
+        if (cs == NULL) goto _output_error;
+        CHECK(FL2_initCStream(cs, 1));
+        FL2_CStream_setParameter(cs, FL2_p_blockSizeLog, 22);
+        FL2_CStream_setParameter(cs, FL2_p_seekTable, 1);
+        out.size = compressedBufferSize;
+        CHECK(FL2_compressStream(cs, &out, &in));
+        r = FL2_flushStream(cs, &out);
+        if (r != 0) goto _output_error;
+        out.size = out.pos + 20;
+        r = FL2_endStream(cs, &out);
+        if (!r) goto _output_error;
+        out.size = compressedBufferSize;
+        r = FL2_endStream(cs, &out);
+        FL2_freeCStream(cs);
+        if (r != 0) goto _output_error;
+        cSize = out.pos;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress range from stream : ", testNb++);
+    {   FL2_DCtx* const dctx = FL2_createDCtx();
+        size_t r;
+        if (dctx == NULL) goto _output_error;
+        r = FL2_decompressRange(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize, 4 MB - 100, 1 MB);
+        FL2_freeDCtx(dctx);
+        if (r != 1 MB) goto _output_error;
+        if (memcmp((BYTE*)CNBuffer + 4 MB - 100, decodedBuffer, 1 MB)) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress range without seek table : ", testNb++);
+    {   FL2_DCtx* const dctx = FL2_createDCtx();
+        size_t r;
+        if (dctx == NULL) goto _output_error;
+        cSize = FL2_compress(compressedBuffer, compressedBufferSize, CNBuffer, 64 KB, 1);
+        if (FL2_isError(cSize)) goto _output_error;
+        r = FL2_decompressRange(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize, 0, 1000);
+        if (FL2_getErrorCode(r) != FL2_error_seekTable_missing) {
+            FL2_freeDCtx(dctx);
+            goto _output_error;
+        }
+        /* the end of the hash and data looks like a table of one entry, but its position is not the end marker */
+        memcpy((BYTE*)compressedBuffer + cSize - 24, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\1\0\0\0FL2S", 24);
+        r = FL2_decompressRange(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize, 0, 1000);
+        FL2_freeDCtx(dctx);
+        if (FL2_getErrorCode(r) != FL2_error_seekTable_missing) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : pipelined multithreaded compress stream with flush : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStreamMt(2);
+        FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+        size_t r;
+        if (cs == NULL) goto _output_error;
+        CHECK(FL2_initCStream(cs, 2));
+        CHECK(FL2_CStream_setParameter(cs, FL2_p_pipelineDepth, 1));
+        for (size_t pos = 0; pos < CNBuffSize; pos += 700 KB) {
+            FL2_inBuffer in = { (BYTE*)CNBuffer + pos, MIN(700 KB, CNBuffSize - pos), 0 };
+            r = FL2_compressStream(cs, &out, &in);
+            if (FL2_isError(r) || in.pos != in.size) {
+                FL2_freeCStream(cs);
+                goto _output_error;
+            }
+            if (pos == 2100 KB && FL2_flushStream(cs, &out) != 0) {
+                FL2_freeCStream(cs);
+                goto _output_error;
+            }
+        }
+        r = FL2_endStream(cs, &out);
+        FL2_freeCStream(cs);
+        if (r != 0) goto _output_error;
+        cSize = out.pos;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress pipelined stream : ", testNb++);
+    {   size_t const r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with windowed flushes : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStream();
+        FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+        size_t const srcSize = MIN(CNBuffSize, 600 KB);
+        if (cs == NULL) goto _output_error;
+        CHECK(FL2_initCStream(cs, 6));
+        if (!FL2_isError(FL2_CStream_setParameter(cs, FL2_p_flushWindowLog, FL2_FLUSH_WINDOW_LOG_MIN - 1))) goto _output_error;
+        if (FL2_CStream_setParameter(cs, FL2_p_flushWindowLog, 16) != 16) goto _output_error;
+        for (size_t pos = 0; pos < srcSize; pos += 3000) {
+            FL2_inBuffer in = { (BYTE*)CNBuffer + pos, MIN(3000, srcSize - pos), 0 };
+            CHECK(FL2_compressStream(cs, &out, &in));
+            if (in.pos != in.size) goto _output_error;
+            if (FL2_flushStream(cs, &out) != 0) goto _output_error;
+        }
+        if (FL2_endStream(cs, &out) != 0) goto _output_error;
+        FL2_freeCStream(cs);
+        cSize = out.pos;
+        if (FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize) != srcSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress to .xz blocks : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        size_t const srcSize = MIN(CNBuffSize, 3 MB + 1000);
+        BYTE* const lzma2 = (BYTE*)malloc(compressedBufferSize + 1);
+        if (cctx == NULL || lzma2 == NULL) goto _output_error;
+        CHECK(FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 4));
+        CHECK(FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20));
+        if (FL2_CCtx_setParameter(cctx, FL2_p_xzFormat, 2) != 2) goto _output_error;
+        if (!FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_xzFormat, FL2_XZ_FORMAT_MAX + 1))) goto _output_error;
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, FL2_XZ_COMPRESSBOUND(srcSize, 20), CNBuffer, srcSize, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        if (decodeXzBlocks((BYTE*)compressedBuffer, cSize, (BYTE*)CNBuffer, srcSize, lzma2, (BYTE*)decodedBuffer) != 4) goto _output_error;
+        /* a stream with the same parameters has the same blocks */
+        {   FL2_CStream* const cs = FL2_createCStreamMt(2);
+            BYTE* const cBuf2 = (BYTE*)malloc(compressedBufferSize);
+            FL2_outBuffer out = { cBuf2, 0, 0 };
+            size_t pos = 0;
+            size_t r = 1;
+            if (cs == NULL || cBuf2 == NULL) goto _output_error;
+            CHECK(FL2_initCStream(cs, 4));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_dictionaryLog, 20));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_xzFormat, 2));
+            while (pos < srcSize) {
+                FL2_inBuffer in = { (BYTE*)CNBuffer + pos, MIN(77777, srcSize - pos), 0 };
+                out.size = MIN(out.pos + 5000, compressedBufferSize);
+                CHECK(FL2_compressStream(cs, &out, &in));
+                pos += in.pos;
+            }
+            while (r != 0) {
+                out.size = MIN(out.pos + 7, compressedBufferSize);
+                r = FL2_endStream(cs, &out);
+                if (FL2_isError(r)) goto _output_error;
+            }
+            if (out.pos != cSize || memcmp(cBuf2, compressedBuffer, cSize)) goto _output_error;
+            FL2_freeCStream(cs);
+            free(cBuf2);
+        }
+        /* an empty stream has no blocks */
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, 0, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        if (decodeXzBlocks((BYTE*)compressedBuffer, cSize, (BYTE*)CNBuffer, 0, lzma2, (BYTE*)decodedBuffer) != 0) goto _output_error;
+        FL2_freeCCtx(cctx);
+        free(lzma2);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : content-defined blocks after different prefixes : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStreamMt(2);
+        size_t const bodySize = 3 MB;
+        size_t const prefixSize[2] = { 100 KB, 37 KB };
+        BYTE* const src = (BYTE*)malloc(prefixSize[0] + bodySize);
+        BYTE* const cBuf[2] = { (BYTE*)compressedBuffer, (BYTE*)malloc(compressedBufferSize) };
+        size_t cSizes[2] = { 0, 0 };
+        size_t common = 0;
+        if (cs == NULL || src == NULL || cBuf[1] == NULL) goto _output_error;
+        for (int n = 0; n < 2; ++n) {
+            FL2_outBuffer out = { cBuf[n], compressedBufferSize, 0 };
+            size_t const srcSize = prefixSize[n] + bodySize;
+            size_t r;
+            RDG_genBuffer(src, prefixSize[n], 0., 0., seed + n);
+            memcpy(src + prefixSize[n], CNBuffer, bodySize);
+            CHECK(FL2_initCStream(cs, 3));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_dictionaryLog, 20));
+            CHECK(FL2_CStream_setParameter(cs, FL2_p_doXXHash, 0));
+            if (FL2_CStream_setParameter(cs, FL2_p_contentBlockLog, 17) != 17) goto _output_error;
+            for (size_t pos = 0; pos < srcSize; pos += 333 KB) {
+                FL2_inBuffer in = { src + pos, MIN(333 KB, srcSize - pos), 0 };
+                CHECK(FL2_compressStream(cs, &out, &in));
+                if (in.pos != in.size) goto _output_error;
+            }
+            if (FL2_endStream(cs, &out) != 0) goto _output_error;
+            cSizes[n] = out.pos;
+            r = FL2_decompress(decodedBuffer, CNBuffSize, cBuf[n], cSizes[n]);
+            if (r != srcSize || findDiff(src, decodedBuffer, r) < r) goto _output_error;
+        }
+        /* the body compresses to the same data after the first cut in it */
+        while (common < MIN(cSizes[0], cSizes[1]) && cBuf[0][cSizes[0] - 1 - common] == cBuf[1][cSizes[1] - 1 - common])
+            ++common;
+        if (common < MIN(cSizes[0], cSizes[1]) / 2) goto _output_error;
+        FL2_freeCStream(cs);
+        free(src);
+        free(cBuf[1]);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : asynchronous compress stream : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStreamAsync(2);
+        FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+        FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
+        size_t r;
+        if (cs == NULL) goto _output_error;
+        CHECK(FL2_initCStream(cs, 2));
+        while (in.pos < in.size) {
+            r = FL2_compressStream(cs, &out, &in);
+            if (FL2_isError(r)) {
+                FL2_freeCStream(cs);
+                goto _output_error;
+            }
+            if (in.pos < in.size && FL2_isError(FL2_waitStream(cs, (unsigned)-1))) {
+                FL2_freeCStream(cs);
+                goto _output_error;
+            }
+        }
+        while ((r = FL2_endStream(cs, &out)) != 0 && !FL2_isError(r)) {
+            while ((r = FL2_waitStream(cs, 10)) == 1) {}
+            if (FL2_isError(r)) break;
+        }
+        FL2_freeCStream(cs);
+        if (r != 0) goto _output_error;
+        cSize = out.pos;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress asynchronous stream : ", testNb++);
+    {   size_t const r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream from referenced input : ", testNb++);
+    {   FL2_CStream* const cs = FL2_createCStream();
+        FL2_outBuffer out = { compressedBuffer, 0, 0 };
+        size_t r;
+        if (cs == NULL) goto _output_error;
+        CHECK(FL2_initCStream(cs, 2));
+        CHECK(FL2_compressStreamRef(cs, CNBuffer, CNBuffSize));
+        do {
+            out.size = MIN(out.pos + 64 KB, compressedBufferSize);
+            r = FL2_endStream(cs, &out);
+        } while (r != 0 && !FL2_isError(r) && out.size < compressedBufferSize);
+        FL2_freeCStream(cs);
+        if (r != 0) goto _output_error;
+        cSize = out.pos;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : referenced input matches FL2_compress() : ", testNb++);
+    {   size_t r = FL2_compress(decodedBuffer, CNBuffSize, CNBuffer, CNBuffSize, 2);
+        if (r != cSize || memcmp(decodedBuffer, compressedBuffer, cSize)) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : multithreaded direct output matches staged output : ", testNb++);
+    {   FL2_CCtx* cctx = FL2_createCCtxMt(2);
+        size_t r;
+        if (cctx == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 2);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        /* an exact-size destination is smaller than the slice bounds, so output is staged in the table */
+        r = FL2_compressCCtx(cctx, decodedBuffer, cSize, CNBuffer, CNBuffSize, 0);
+        FL2_freeCCtx(cctx);
+        if (FL2_isError(cSize) || r != cSize) goto _output_error;
+        if (memcmp(decodedBuffer, compressedBuffer, cSize)) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress with large page allocator : ", testNb++);
+    {   FL2_customMem const largeMem = { FL2_largePageAlloc, FL2_largePageFree, NULL };
+        FL2_CCtx* cctx = FL2_createCCtx_advanced(2, largeMem);
+        size_t r;
+        if (cctx == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 4);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        FL2_freeCCtx(cctx);
+        if (FL2_isError(cSize)) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with custom allocator : ", testNb++);
+    {   int allocs = 0;
+        FL2_customMem const countingMem = { countingAlloc, countingFree, &allocs };
+        FL2_CStream* cs = FL2_createCStream_advanced(1, countingMem);
+        FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+        FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
+        size_t r;
+        int live;
+        if (cs == NULL) goto _output_error;
+        r = FL2_initCStream(cs, 3);
+        if (!FL2_isError(r)) r = FL2_compressStream(cs, &out, &in);
+        if (!FL2_isError(r)) r = FL2_endStream(cs, &out);
+        live = allocs;
+        FL2_freeCStream(cs);
+        /* context, stream, match table, builders and input buffer */
+        if (r != 0 || live < 5 || allocs != 0) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, out.pos);
+        if (r != CNBuffSize) goto _output_error;
+        if (findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress small inputs : ", testNb++);
+    {   FL2_CCtx* cctx = FL2_createCCtxMt(2);
+        size_t const smallSize = FL2_SMALL_INPUT_MAX;
+        if (cctx == NULL) goto _output_error;
+        if (FL2_estimateCCtxSize_bySize(6, smallSize, 1) >= FL2_estimateCCtxSize_bySize(6, smallSize + 1, 1)) goto _output_error;
+        for (int level = 1; level <= FL2_maxCLevel(); level += 3) {
+            size_t r;
+            /* a large block first leaves a radix table, which a small block can reuse */
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, smallSize * 3, level);
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != smallSize * 3 || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+            cSize = FL2_compress(compressedBuffer, compressedBufferSize, (const BYTE*)CNBuffer + level, smallSize - level, level);
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != smallSize - level || findDiff((const BYTE*)CNBuffer + level, decodedBuffer, r) < r) goto _output_error;
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, smallSize, level);
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != smallSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress and decompress with context pools : ", testNb++);
+    {   FL2_CCtxPool* const cpool = FL2_createCCtxPool(2);
+        FL2_DCtxPool* const dpool = FL2_createDCtxPool(2);
+        FL2_CCtx* c1 = NULL;
+        FL2_CCtx* c2 = NULL;
+        FL2_DCtx* d1 = NULL;
+        size_t const smallSize = 64 KB;
+        size_t r = 0;
+        int reused = 0;
+        if (cpool == NULL || dpool == NULL) goto _pool_end;
+        c1 = FL2_CCtxPool_acquire(cpool, 4, CNBuffSize);
+        c2 = FL2_CCtxPool_acquire(cpool, 2, smallSize);
+        d1 = FL2_DCtxPool_acquire(dpool);
+        if (c1 == NULL || c2 == NULL || d1 == NULL || c1 == c2) goto _pool_end;
+        cSize = FL2_compressCCtx(c1, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        r = FL2_compressCCtx(c2, decodedBuffer, CNBuffSize, CNBuffer, smallSize, 0);
+        if (FL2_isError(cSize) || FL2_isError(r)) goto _pool_end;
+        r = FL2_decompressDCtx(d1, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, CNBuffSize) < CNBuffSize) goto _pool_end;
+        FL2_CCtxPool_release(cpool, c1);
+        FL2_CCtxPool_release(cpool, c2);
+        FL2_DCtxPool_release(dpool, d1);
+        /* the level 4 context has a table large enough for the whole buffer */
+        c1 = FL2_CCtxPool_acquire(cpool, 4, CNBuffSize / 2);
+        d1 = FL2_DCtxPool_acquire(dpool);
+        reused = (c1 != c2 && c1 != NULL && d1 != NULL);
+        r = FL2_compressCCtx(c1, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize / 2, 0);
+        if (!FL2_isError(r))
+            r = FL2_decompressDCtx(d1, decodedBuffer, CNBuffSize, compressedBuffer, r);
+        reused &= (r == CNBuffSize / 2) && findDiff(CNBuffer, decodedBuffer, r) >= r;
+        FL2_CCtxPool_release(cpool, c1);
+        FL2_DCtxPool_release(dpool, d1);
+    _pool_end:
+        FL2_freeCCtxPool(cpool);
+        FL2_freeDCtxPool(dpool);
+        if (!reused) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress and decompress with specialized and generic lc/lp/pb : ", testNb++);
+    {   static const unsigned props[3][3] = { { 3, 0, 2 }, { 0, 2, 2 }, { 1, 1, 0 } };
+        static const int levels[3] = { 1, 6, 10 };
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        if (cctx == NULL) goto _output_error;
+        for (size_t u = 0; u < 3; ++u) {
+            for (size_t v = 0; v < 3; ++v) {
+                FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, levels[v]);
+                FL2_CCtx_setParameter(cctx, FL2_p_literalCtxBits, props[u][0]);
+                FL2_CCtx_setParameter(cctx, FL2_p_literalPosBits, props[u][1]);
+                FL2_CCtx_setParameter(cctx, FL2_p_posBits, props[u][2]);
+                CHECK_V(r, FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, 512 KB, 0));
+                if (FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, r) != 512 KB) goto _output_error;
+                if (memcmp(decodedBuffer, CNBuffer, 512 KB) != 0) goto _output_error;
+            }
+        }
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : ultra strategy with the hash row and hash chain matchers : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        if (cctx == NULL) goto _output_error;
+        for (unsigned u = 0; u < 3; ++u) {
+            /* rows, then chain and rows again to reallocate in the same context */
+            FL2_CCtx_setParameter(cctx, FL2_p_highCompression, 1);
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 9);
+            CHECK(FL2_CCtx_setParameter(cctx, FL2_p_secondMatcher, (u & 1) ^ 1));
+            {   CHECK_V(r, FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, 1 MB, 0));
+                if (FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, r) != 1 MB) goto _output_error;
+                if (memcmp(decodedBuffer, CNBuffer, 1 MB) != 0) goto _output_error;
+            }
+        }
+        if (!FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_secondMatcher, FL2_SECOND_MATCHER_MAX + 1))) goto _output_error;
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress and decompress with a shared thread pool : ", testNb++);
+    {   FL2_threadPoolParams params;
+        FL2_threadPool* pool;
+        FL2_CCtx* const own = FL2_createCCtxMt(4);
+        FL2_CCtx* c1;
+        FL2_CCtx* c2;
+        FL2_DCtx* d1;
+        size_t ownSize, r;
+        params.affinityMask = 1;
+        params.priority = 5;
+        pool = FL2_createThreadPool_advanced(4, &params);
+        if (pool == NULL || own == NULL) goto _output_error;
+        c1 = FL2_createCCtxWithPool(pool);
+        c2 = FL2_createCCtxWithPool(pool);
+        d1 = FL2_createDCtxWithPool(pool);
+        if (c1 == NULL || c2 == NULL || d1 == NULL) goto _output_error;
+#ifndef FL2_SINGLETHREAD
+        if (FL2_CCtx_nbThreads(c1) != 4) goto _output_error;
+#endif
+        /* the output does not depend on where the threads come from */
+        ownSize = FL2_compressCCtx(own, decodedBuffer, CNBuffSize, CNBuffer, CNBuffSize, 3);
+        cSize = FL2_compressCCtx(c1, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 3);
+        if (FL2_isError(cSize) || cSize != ownSize) goto _output_error;
+        if (findDiff(compressedBuffer, decodedBuffer, cSize) < cSize) goto _output_error;
+        CHECK(FL2_compressCCtx(c2, decodedBuffer, CNBuffSize, CNBuffer, CNBuffSize / 3, 5));
+        r = FL2_decompressDCtx(d1, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        FL2_freeCCtx(c1);
+        FL2_freeCCtx(c2);
+        FL2_freeDCtx(d1);
+        FL2_freeCCtx(own);
+        FL2_freeThreadPool(pool);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress with a preset dictionary : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        FL2_DCtx* const dctx = FL2_createDCtxMt(2);
+        size_t const dictSize = 32 KB + 3;
+        const BYTE* const record = (const BYTE*)CNBuffer + 16 KB;
+        size_t const recordSize = 8 KB;
+        size_t plainSize, r;
+        if (cctx == NULL || dctx == NULL) goto _output_error;
+        plainSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, record, recordSize, 6);
+        CHECK(FL2_CCtx_loadDictionary(cctx, CNBuffer, dictSize));
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, record, recordSize, 6);
+        if (FL2_isError(cSize) || cSize >= plainSize) goto _output_error;
+        /* the dictionary is required */
+        if (!FL2_isError(FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize))) goto _output_error;
+        CHECK(FL2_DCtx_loadDictionary(dctx, CNBuffer, dictSize));
+        r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != recordSize || findDiff(record, decodedBuffer, r) < r) goto _output_error;
+        /* several blocks, the first beginning with the dictionary */
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_seekTable, 1);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        r = FL2_decompressRange(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize, 100, 3 MB);
+        if (r != 3 MB || findDiff((const BYTE*)CNBuffer + 100, decodedBuffer, r) < r) goto _output_error;
+        FL2_CCtx_loadDictionary(cctx, NULL, 0);
+        FL2_DCtx_loadDictionary(dctx, NULL, 0);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, record, recordSize, 0);
+        r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != recordSize || findDiff(record, decodedBuffer, r) < r) goto _output_error;
+        FL2_freeCCtx(cctx);
+        FL2_freeDCtx(dctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress with incremental prices : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        if (cctx == NULL) goto _output_error;
+        for (unsigned strategy = 1; strategy <= 2; ++strategy) { /* opt and ultra */
+            size_t r;
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 6);
+            FL2_CCtx_setParameter(cctx, FL2_p_strategy, strategy);
+            if (FL2_CCtx_setParameter(cctx, FL2_p_incrementalPrices, 1) != 1) goto _output_error;
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+            if (FL2_isError(cSize)) goto _output_error;
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress with adaptive strategy : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        unsigned const throughput[] = { 0, 40, 1000 };
+        if (cctx == NULL) goto _output_error;
+        for (size_t i = 0; i < sizeof(throughput) / sizeof(throughput[0]); ++i) {
+            size_t r;
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 5);
+            if (FL2_CCtx_setParameter(cctx, FL2_p_strategy, 3) != 3) goto _output_error;
+            FL2_CCtx_setParameter(cctx, FL2_p_adaptiveThroughput, throughput[i]);
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+            if (FL2_isError(cSize)) goto _output_error;
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress mixed data with random filter : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        BYTE* const mixed = (BYTE*)malloc(CNBuffSize);
+        size_t const slice = 192 KB;
+        unsigned const levels[] = { 2, 6 };
+        if (cctx == NULL || mixed == NULL) goto _output_error;
+        for (size_t pos = 0; pos < CNBuffSize; pos += slice) {
+            size_t const len = MIN(slice, CNBuffSize - pos);
+            if ((pos / slice) & 1)
+                RDG_genBuffer(mixed + pos, len, 0., 0., seed + (U32)pos);
+            else
+                memcpy(mixed + pos, (const BYTE*)CNBuffer + pos, len);
+        }
+        for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+            unsigned long long tested, randomBytes;
+            size_t r;
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, levels[i]);
+            if (FL2_CCtx_setParameter(cctx, FL2_p_randomFilter, 1) != 1) goto _output_error;
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, mixed, CNBuffSize, 0);
+            if (FL2_isError(cSize)) goto _output_error;
+            FL2_CCtx_getRandomFilterStats(cctx, &tested, &randomBytes);
+            if (tested != CNBuffSize || randomBytes == 0 || randomBytes > tested) goto _output_error;
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(mixed, decodedBuffer, r) < r) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+        free(mixed);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress and decompress with memory limits : ", testNb++);
+    {   FL2_CStream* const cstream = FL2_createCStreamMt(4);
+        FL2_DStream* const dstream = FL2_createDStream();
+        unsigned const limit = 96;
+        unsigned dictLogs[2];
+        if (cstream == NULL || dstream == NULL) goto _output_error;
+        for (unsigned priority = 0; priority < 2; ++priority) {
+            FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
+            FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
+            size_t r;
+            FL2_CStream_setParameter(cstream, FL2_p_memoryLimit, limit);
+            FL2_CStream_setParameter(cstream, FL2_p_memoryPriority, priority);
+            CHECK(FL2_initCStream(cstream, FL2_maxCLevel()));
+            if (FL2_estimateCStreamSize_usingCCtx(cstream) > ((size_t)limit << 20)) goto _output_error;
+            dictLogs[priority] = (unsigned)FL2_CStream_setParameter(cstream, FL2_p_dictionaryLog, 0);
+            CHECK(FL2_compressStream(cstream, &out, &in));
+            if (in.pos != CNBuffSize) goto _output_error;
+            if (FL2_endStream(cstream, &out) != 0) goto _output_error;
+            cSize = out.pos;
+            r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        }
+        /* speed priority reduces the dictionary before the thread count */
+        if (dictLogs[1] > dictLogs[0]) goto _output_error;
+        FL2_CStream_setParameter(cstream, FL2_p_memoryLimit, 1);
+        if (FL2_getErrorCode(FL2_initCStream(cstream, 0)) != FL2_error_memoryLimit_exceeded) goto _output_error;
+        {   FL2_inBuffer in = { compressedBuffer, cSize, 0 };
+            FL2_outBuffer out = { decodedBuffer, CNBuffSize, 0 };
+            FL2_DStream_setMemoryLimit(dstream, 1 MB);
+            FL2_initDStream(dstream);
+            if (FL2_getErrorCode(FL2_decompressStream(dstream, &out, &in)) != FL2_error_memoryLimit_exceeded) goto _output_error;
+            FL2_DStream_setMemoryLimit(dstream, 0);
+            in.pos = 0;
+            FL2_initDStream(dstream);
+            if (FL2_decompressStream(dstream, &out, &in) != 0 || out.pos != CNBuffSize) goto _output_error;
+        }
+        FL2_freeCStream(cstream);
+        FL2_freeDStream(dstream);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : reuse a stream dictionary across frames : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const dstream = FL2_createDStream();
+        /* Grown past the dictionary size and wrapped, then kept for a larger dictionary,
+         * then replaced for a smaller one */
+        static const unsigned dictLogs[3] = { 20, 27, 16 };
+        static const size_t srcSizes[3] = { 3 MB, 1000, 200000 };
+        if (cctx == NULL || dstream == NULL) goto _output_error;
+        for (unsigned n = 0; n < 3; ++n) {
+            FL2_inBuffer in = { compressedBuffer, 0, 0 };
+            size_t decoded = 0;
+            size_t r = 1;
+            FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 2);
+            FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, dictLogs[n]);
+            cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, srcSizes[n], 0);
+            if (FL2_isError(cSize)) goto _output_error;
+            in.size = cSize;
+            FL2_initDStream(dstream);
+            /* small output buffers keep data in the dictionary between calls */
+            while (r != 0) {
+                FL2_outBuffer out = { (BYTE*)decodedBuffer + decoded, MIN(CNBuffSize - decoded, 4099), 0 };
+                r = FL2_decompressStream(dstream, &out, &in);
+                if (FL2_isError(r)) goto _output_error;
+                if (out.pos == 0 && in.pos == in.size && r != 0) goto _output_error;
+                decoded += out.pos;
+            }
+            if (decoded != srcSizes[n] || findDiff(CNBuffer, decodedBuffer, decoded) < decoded) goto _output_error;
+        }
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(dstream);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : parameter sets and tuning : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        size_t const sampleSize = 64 KB;
+        FL2_compressionParameters params, current;
+        FL2_tuneResult results[4];
+        char text[FL2_PARAMETERS_STRING_MAX];
+        size_t refSize, count, r;
+        if (cctx == NULL) goto _output_error;
+        /* a level's set compresses the same as the level */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 6);
+        refSize = FL2_compressCCtx(cctx, decodedBuffer, CNBuffSize, CNBuffer, sampleSize, 0);
+        if (FL2_isError(refSize)) goto _output_error;
+        CHECK(FL2_getLevelParameters(6, 0, &params));
+        if (!FL2_isError(FL2_getLevelParameters(FL2_maxHighCLevel() + 1, 1, &current))) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        CHECK(FL2_CCtx_setParameters(cctx, &params));
+        FL2_CCtx_getParameters(cctx, &current);
+        if (memcmp(&current, &params, sizeof(params)) != 0) goto _output_error;
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, sampleSize, 0);
+        if (cSize != refSize || memcmp(compressedBuffer, decodedBuffer, cSize) != 0) goto _output_error;
+        /* text form */
+        if (FL2_parametersToString(text, sizeof(text), &params) != strlen(text)) goto _output_error;
+        CHECK(FL2_parametersFromString(&current, text));
+        if (memcmp(&current, &params, sizeof(params)) != 0) goto _output_error;
+        if (!FL2_isError(FL2_parametersFromString(&current, "24,2,9,0,42,48,1,8"))) goto _output_error;
+        if (!FL2_isError(FL2_parametersFromString(&current, "24,2,9,0,42,48,1,8,9"))) goto _output_error;
+        if (!FL2_isError(FL2_parametersToString(text, 4, &params))) goto _output_error;
+        {   /* out-of-bound values are rejected rather than written */
+            FL2_compressionParameters bad;
+            memset(&bad, 0xFF, sizeof(bad));
+            if (!FL2_isError(FL2_parametersToString(text, sizeof(text), &bad))) goto _output_error;
+            bad = params;
+            bad.searchDepth = FL2_SEARCH_DEPTH_MAX + 1;
+            if (!FL2_isError(FL2_parametersToString(text, sizeof(text), &bad))) goto _output_error;
+        }
+        /* the front is fastest first with each set compressing better, and the context is unchanged */
+        count = FL2_CCtx_tune(cctx, CNBuffer, sampleSize, results, 4);
+        if (FL2_isError(count) || count == 0) goto _output_error;
+        for (size_t n = 1; n < MIN(count, 4); ++n)
+            if (results[n].time < results[n - 1].time || results[n].cSize >= results[n - 1].cSize) goto _output_error;
+        FL2_CCtx_getParameters(cctx, &current);
+        if (memcmp(&current, &params, sizeof(params)) != 0) goto _output_error;
+        CHECK(FL2_CCtx_setParameters(cctx, &results[MIN(count, 4) - 1].params));
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, sampleSize, 0);
+        if (FL2_isError(cSize) || cSize != results[MIN(count, 4) - 1].cSize) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != sampleSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compact match table : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtx();
+        size_t bitpackSize, deepSize, r;
+        if (cctx == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 6);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 24);
+        FL2_CCtx_setParameter(cctx, FL2_p_searchDepth, 60);
+        bitpackSize = FL2_estimateCCtxSize_usingCCtx(cctx);
+        FL2_CCtx_setParameter(cctx, FL2_p_searchDepth, 200);
+        deepSize = FL2_estimateCCtxSize_usingCCtx(cctx);
+        /* lengths above 63 fit beside a 24-bit link, so the table stays at 4 bytes per position */
+        if (deepSize != bitpackSize) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(CNBuffer, decodedBuffer, r) < r) goto _output_error;
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : long-distance matcher : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        BYTE* const repeated = (BYTE*)malloc(CNBuffSize);
+        size_t const half = CNBuffSize / 2;
+        size_t plainSize, r;
+        if (cctx == NULL || repeated == NULL) goto _output_error;
+        /* the second half repeats the first at a distance beyond the 1 MiB dictionary */
+        RDG_genBuffer(repeated, half, 0., 0., seed);
+        memcpy(repeated + half, repeated, CNBuffSize - half);
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 6);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        plainSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, repeated, CNBuffSize, 0);
+        if (FL2_isError(plainSize)) goto _output_error;
+        if (!FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_longWindowLog, 19))) goto _output_error;
+        if (FL2_CCtx_setParameter(cctx, FL2_p_longWindowLog, 23) != 23) goto _output_error;
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, repeated, CNBuffSize, 0);
+        if (FL2_isError(cSize) || cSize > plainSize * 2 / 3) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(repeated, decodedBuffer, r) < r) goto _output_error;
+        free(repeated);
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : batch compress and decompress : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(4);
+        FL2_DCtx* const dctx = FL2_createDCtxMt(4);
+#define BATCH_COUNT 16
+        FL2_inBuffer srcs[BATCH_COUNT];
+        FL2_outBuffer dsts[BATCH_COUNT];
+        FL2_inBuffer frames[BATCH_COUNT];
+        FL2_outBuffer outs[BATCH_COUNT];
+        unsigned rseed = seed;
+        size_t cCap = 0;
+        size_t pos = 0;
+        size_t total;
+        BYTE* cBuf;
+        BYTE* dBuf;
+        if (cctx == NULL || dctx == NULL) goto _output_error;
+        /* the first buffer is large enough for all threads and has two dictionary resets */
+        srcs[0].src = CNBuffer;
+        srcs[0].size = CNBuffSize;
+        srcs[0].pos = 0;
+        for (unsigned n = 1; n < BATCH_COUNT; ++n) {
+            size_t const offset = (FUZ_rand(&rseed) % (CNBuffSize / 2));
+            srcs[n].src = (const BYTE*)CNBuffer + offset;
+            srcs[n].size = (n * 7919U) % 40000U;
+            srcs[n].pos = n & 1;
+        }
+        for (unsigned n = 0; n < BATCH_COUNT; ++n)
+            cCap += FL2_compressBound(srcs[n].size);
+        cBuf = (BYTE*)malloc(cCap);
+        dBuf = (BYTE*)malloc(CNBuffSize * 2);
+        if (cBuf == NULL || dBuf == NULL) goto _output_error;
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 2);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_blockSizeLog, 22);
+        for (unsigned n = 0; n < BATCH_COUNT; ++n) {
+            dsts[n].dst = cBuf + pos;
+            dsts[n].size = FL2_compressBound(srcs[n].size);
+            dsts[n].pos = 0;
+            pos += dsts[n].size;
+        }
+        total = FL2_compressBatch(cctx, srcs, dsts, BATCH_COUNT);
+        if (FL2_isError(total)) goto _output_error;
+        pos = 0;
+        for (unsigned n = 0; n < BATCH_COUNT; ++n) {
+            size_t const srcSize = srcs[n].size - srcs[n].pos;
+            size_t const r = FL2_decompress(dBuf, CNBuffSize, dsts[n].dst, dsts[n].pos);
+            if (r != srcSize || findDiff((const BYTE*)srcs[n].src + srcs[n].pos, dBuf, r) < r) goto _output_error;
+            frames[n].src = dsts[n].dst;
+            frames[n].size = dsts[n].pos;
+            frames[n].pos = 0;
+            outs[n].dst = dBuf + pos;
+            outs[n].size = srcSize;
+            outs[n].pos = 0;
+            pos += srcSize;
+            total -= dsts[n].pos;
+        }
+        if (total != 0) goto _output_error;
+        if (FL2_decompressBatch(dctx, frames, outs, BATCH_COUNT) != pos) goto _output_error;
+        for (unsigned n = 0; n < BATCH_COUNT; ++n) {
+            if (outs[n].pos != outs[n].size) goto _output_error;
+            if (findDiff((const BYTE*)srcs[n].src + srcs[n].pos, outs[n].dst, outs[n].pos) < outs[n].pos) goto _output_error;
+        }
+        /* a frame which fails does not stop the others */
+        for (unsigned n = 0; n < BATCH_COUNT; ++n)
+            outs[n].pos = 0;
+        --outs[3].size;
+        total = FL2_decompressBatch(dctx, frames, outs, BATCH_COUNT);
+        if (!FL2_isError(total) || outs[3].pos != 0 || outs[4].pos != outs[4].size) goto _output_error;
+        /* the memory limit is shared by the context and its workers, then restored */
+        for (unsigned n = 0; n < BATCH_COUNT; ++n)
+            dsts[n].pos = 0;
+        FL2_CCtx_setParameter(cctx, FL2_p_memoryLimit, 64);
+        CHECK(FL2_compressBatch(cctx, srcs, dsts, BATCH_COUNT));
+        if (FL2_CCtx_setParameter(cctx, FL2_p_memoryLimit, (unsigned)-1) != 64) goto _output_error;
+        for (unsigned n = 0; n < BATCH_COUNT; ++n) {
+            size_t const srcSize = srcs[n].size - srcs[n].pos;
+            size_t const r = FL2_decompress(dBuf, CNBuffSize, dsts[n].dst, dsts[n].pos);
+            if (r != srcSize || findDiff((const BYTE*)srcs[n].src + srcs[n].pos, dBuf, r) < r) goto _output_error;
+        }
+        free(cBuf);
+        free(dBuf);
+        FL2_freeDCtx(dctx);
+        FL2_freeCCtx(cctx);
+#undef BATCH_COUNT
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compression stats : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+        FL2_compressStats stats;
+        FL2_threadStats tStats;
+        unsigned nbThreads;
+        if (cctx == NULL) goto _output_error;
+        nbThreads = FL2_CCtx_nbThreads(cctx);
+        if (FL2_CCtx_setParameter(cctx, FL2_p_collectStats, 1) != 1) goto _output_error;
+        CHECK(FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize, 0));
+        FL2_CCtx_getStats(cctx, &stats);
+        if (stats.blocks == 0 || stats.bytesCompressed + stats.bytesStored != CNBuffSize) goto _output_error;
+        if (stats.matchCount == 0 || stats.matchBytes < stats.matchCount * 2) goto _output_error;
+        if (stats.buildTime + stats.encodeTime == 0) goto _output_error;
+        for (unsigned u = 0; u < nbThreads; ++u)
+            CHECK(FL2_CCtx_getThreadStats(cctx, u, &tStats));
+        if (!FL2_isError(FL2_CCtx_getThreadStats(cctx, nbThreads, &tStats))) goto _output_error;
+        /* counters restart with each frame */
+        CHECK(FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, CNBuffer, CNBuffSize / 2, 0));
+        FL2_CCtx_getStats(cctx, &stats);
+        if (stats.bytesCompressed + stats.bytesStored != CNBuffSize / 2) goto _output_error;
+        FL2_freeCCtx(cctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : multithreaded compress of unevenly compressible data : ", testNb++);
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(4);
+        BYTE* const skewed = (BYTE*)malloc(CNBuffSize);
+        size_t r;
+        if (cctx == NULL || skewed == NULL) goto _output_error;
+        /* random first half, so equal byte slices would give uneven encoding work */
+        RDG_genBuffer(skewed, CNBuffSize / 2, 0., 0., seed);
+        memcpy(skewed + CNBuffSize / 2, CNBuffer, CNBuffSize - CNBuffSize / 2);
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 4);
+        cSize = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, skewed, CNBuffSize, 0);
+        if (FL2_isError(cSize)) goto _output_error;
+        r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+        if (r != CNBuffSize || findDiff(skewed, decodedBuffer, r) < r) goto _output_error;
+        FL2_freeCCtx(cctx);
+        free(skewed);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : compress stream in one chunk : ", testNb++);
     {   FL2_outBuffer out = { compressedBuffer, compressedBufferSize, 0 };
         FL2_inBuffer in = { CNBuffer, CNBuffSize, 0 };
@@ -823,7 +1916,8 @@ static int fuzzerTests(unsigned nbThreads, U32 seed, U32 nbTests, unsigned start
             FL2_CCtx_setParameter(cctx, FL2_p_literalCtxBits, lc);
             FL2_CCtx_setParameter(cctx, FL2_p_literalPosBits, FUZ_rand(&lseed) % (5 - lc));
             FL2_CCtx_setParameter(cctx, FL2_p_posBits, FUZ_rand(&lseed) % 5);
-            FL2_CCtx_setParameter(cctx, FL2_p_doXXHash, FUZ_rand(&lseed) & 1);
+            FL2_CCtx_setParameter(cctx, FL2_p_doXXHash, FUZ_rand(&lseed) % 3);
+            FL2_CCtx_setParameter(cctx, FL2_p_secondMatcher, FUZ_rand(&lseed) & 1);
             cSize = FL2_compressCCtx(cctx, cBuffer, cBufferSize, sampleBuffer, sampleSize, 0);
             CHECK(FL2_isError(cSize), "FL2_compressCCtx failed : %s", FL2_getErrorName(cSize));
 